@@ -18,6 +18,7 @@
 #include "SS1BTPS.h"          /* Bluetopia API Prototypes/Constants.          */
 #include "HCIDRV.h"
 #include "HCITRANS.h"
+#include "HAL.h"
 
 #include "BTPSKRNL.h"
 #include "BTPSVEND.h"
@@ -34,6 +35,36 @@
 
    #include "Patch_PAN1316.h"
 
+#endif
+
+   /* The following MACROs are used to read a byte and a word of Patch  */
+   /* data from 20 bit memory.  The word address must be even.          */
+#ifdef __TI_COMPILER_VERSION__
+
+   #define READ_PATCH_BYTE(_x)   _data20_read_char(_x)
+   #define READ_PATCH_WORD(_x)   _data20_read_short(_x)
+
+#else
+
+#ifdef __IAR_SYSTEMS_ICC__
+
+   #define READ_PATCH_BYTE(_x)   (*((unsigned char BTPSVEND_PATCH_LOCATION *)(_x)))
+   #define READ_PATCH_WORD(_x)   (*((unsigned short BTPSVEND_PATCH_LOCATION *)(_x)))
+
+#endif
+
+#endif
+
+   /* The following constant represents the HCI baud rate that is used  */
+   /* while the Patch RAM is downloaded.  The controller is switched to */
+   /* this rate before the first patch command is sent and is switched  */
+   /* back to the rate that the HCI Driver was opened with when the     */
+   /* download has finished.  Defining this as zero downloads the Patch */
+   /* RAM at the HCI Driver baud rate.                                  */
+#ifndef VENDOR_PATCH_BAUD_RATE
+
+   #define VENDOR_PATCH_BAUD_RATE   921600L
+
 #endif
 
    /* Miscellaneous Type Declarations.                                  */
@@ -43,6 +74,11 @@
                                     /* any of the patch ram setup       */
                                     /* commands.                        */
 
+   /* The following constants represent the OGF and OCF of the vendor   */
+   /* specific Update UART HCI Baud Rate command.                       */
+#define VS_UPDATE_UART_HCI_BAUDRATE_OGF  (0x3F)
+#define VS_UPDATE_UART_HCI_BAUDRATE_OCF  (0x0336)
+
    /* The following variable is used to track whether or not the Vendor */
    /* Specific Commands (and Patch RAM commands) have already been      */
    /* issued to the device.  This is done so that we do not issue them  */
@@ -51,8 +87,14 @@
    /* are called for every HCI_Reset() that is issued.                  */
 static Boolean_t VendorCommandsIssued;
 
+   /* The following variable holds the baud rate that the HCI Driver was*/
+   /* opened with.  The controller is returned to this rate after the   */
+   /* Patch RAM has been downloaded at VENDOR_PATCH_BAUD_RATE.          */
+static unsigned long HCIBaudRate;
+
    /* Internal Function Prototypes.                                     */
 static void MovePatchBytes(unsigned char *Dest, unsigned long *Source, unsigned int Length);
+static Boolean_t ChangeBaudRate(unsigned int BluetoothStackID, unsigned long BaudRate, Byte_t *ReturnBuffer);
 static Boolean_t Download_Patch(unsigned int BluetoothStackID, unsigned int PatchLength, unsigned long PatchPointer, Byte_t *ReturnBuffer, Byte_t *TempBuffer);
 
    /* The following function is used to copy BTPSVEND_PATCH_LOCATION    */
@@ -63,29 +105,46 @@ static Boolean_t Download_Patch(unsigned int BluetoothStackID, unsigned int Patc
    /* (stored as an unsigned long) to the data to copy from 20 bit      */
    /* memory.  The last parameter is the number of bytes that are to be */
    /* moved.                                                            */
+   /* * NOTE * The data is read from 20 bit memory a word at a time.    */
+   /*          Only a leading byte at an odd address and a trailing odd */
+   /*          byte are read on their own.                              */
 static void MovePatchBytes(unsigned char *Dest, unsigned long *Source, unsigned int Length)
 {
+#ifdef READ_PATCH_WORD
+
+   unsigned short Word;
+
+#endif
+
    /* Check to make sure that the parameters passed in appear valid.    */
    if((Source) && (Dest) && (Length))
    {
 
-#ifdef __TI_COMPILER_VERSION__
+#ifdef READ_PATCH_WORD
 
-      /* Copy all of the requested data from Data 20 memory into Data 16*/
-      /* memory.                                                        */
-      while(Length--)
-         *Dest++ = _data20_read_char((*Source)++);
-
-#else
-
-#ifdef __IAR_SYSTEMS_ICC__
+      /* Bring the source up to a word boundary.                        */
+      if((*Source) & 1)
+      {
+         *Dest++ = READ_PATCH_BYTE((*Source)++);
+         Length--;
+      }
 
-      /* Copy all of the requested data from Data 20 memory into Data 16*/
-      /* memory.                                                        */
-      while(Length--)
-         *Dest++ = *((unsigned char BTPSVEND_PATCH_LOCATION *)(*Source)++);
+      /* Copy the requested data from Data 20 memory into Data 16 memory*/
+      /* a word at a time.  The destination may not be word aligned, so */
+      /* each word is stored a byte at a time (least significant byte   */
+      /* first, as the Patch data is laid out in memory).               */
+      while(Length >= 2)
+      {
+         Word       = READ_PATCH_WORD(*Source);
+         *Dest++    = (unsigned char)Word;
+         *Dest++    = (unsigned char)(Word >> 8);
+         (*Source) += 2;
+         Length    -= 2;
+      }
 
-#endif
+      /* Copy the last byte if an odd number of bytes remain.           */
+      if(Length)
+         *Dest = READ_PATCH_BYTE((*Source)++);
 
 #endif
 
@@ -97,6 +156,49 @@ static void MovePatchBytes(unsigned char *Dest, unsigned long *Source, unsigned
    }
 }
 
+   /* The following function is used to change the baud rate of the HCI */
+   /* UART.  The controller is sent the vendor specific Update UART HCI */
+   /* Baud Rate command (it responds at the current rate) and then the  */
+   /* HCI Driver is reconfigured to the new rate.  The function receives*/
+   /* as its second parameter the new baud rate and as its last         */
+   /* parameter a buffer (RETURN_BUFFER_SIZE bytes) to receive the      */
+   /* response.  This function returns TRUE if successful or FALSE if   */
+   /* there was an error (in which case the baud rate is not changed).  */
+static Boolean_t ChangeBaudRate(unsigned int BluetoothStackID, unsigned long BaudRate, Byte_t *ReturnBuffer)
+{
+   int                           Result;
+   Byte_t                        Status;
+   Byte_t                        Length;
+   Byte_t                        CommandBuffer[DWORD_SIZE];
+   Boolean_t                     ret_val;
+   HCI_Driver_Reconfigure_Data_t DriverReconfigureData;
+
+   /* The baud rate is sent as a little endian double word.             */
+   ASSIGN_HOST_DWORD_TO_LITTLE_ENDIAN_UNALIGNED_DWORD(CommandBuffer, BaudRate);
+
+   Length = RETURN_BUFFER_SIZE;
+   Result = HCI_Send_Raw_Command(BluetoothStackID, VS_UPDATE_UART_HCI_BAUDRATE_OGF, VS_UPDATE_UART_HCI_BAUDRATE_OCF, DWORD_SIZE, CommandBuffer, &Status, &Length, ReturnBuffer, TRUE);
+   if((!Result) && (!Status) && (Length) && (!ReturnBuffer[0]))
+   {
+      /* The controller has accepted the new rate, so change the rate   */
+      /* of the HCI Driver to match.                                    */
+      DriverReconfigureData.ReconfigureCommand = HCI_COMM_DRIVER_RECONFIGURE_DATA_COMMAND_CHANGE_PARAMETERS;
+      DriverReconfigureData.ReconfigureData    = (void *)&BaudRate;
+
+      HCI_Reconfigure_Driver(BluetoothStackID, FALSE, &DriverReconfigureData);
+
+      ret_val = TRUE;
+   }
+   else
+   {
+      DBG_MSG(DBG_ZONE_VENDOR, ("ChangeBaudRate(%lu) Result %d Status %d\r\n", BaudRate, Result, Status));
+
+      ret_val = FALSE;
+   }
+
+   return(ret_val);
+}
+
    /* The following function is provided to allow a mechanism to        */
    /* download the specified Patch Data to the CC25xx device.  This     */
    /* function does not disable the co-processor.  This function returns*/
@@ -192,6 +294,13 @@ Boolean_t BTPSAPI HCI_VS_InitializeBeforeHCIOpen(HCI_DriverInformation_t *HCI_Dr
    /* before the first reset.                                           */
    VendorCommandsIssued = FALSE;
 
+   /* Note the baud rate the HCI Driver is opened with so that the      */
+   /* controller can be returned to it after the Patch RAM download.    */
+   if((HCI_DriverInformation) && (HCI_DriverInformation->DriverType == hdtCOMM))
+      HCIBaudRate = HCI_DriverInformation->DriverInformation.COMMDriverInformation.BaudRate;
+   else
+      HCIBaudRate = 0;
+
    return(TRUE);
 }
 
@@ -257,17 +366,23 @@ Boolean_t BTPSAPI HCI_VS_InitializeBeforeHCIReset(unsigned int HCIDriverID, unsi
    /*          layer functions are able to be called at this time (hence*/
    /*          the HCI Driver ID and the Bluetooth Stack ID passed to   */
    /*          this function).                                          */
+   /* * NOTE * The Patch RAM is downloaded at VENDOR_PATCH_BAUD_RATE and*/
+   /*          each phase of the download is time stamped with          */
+   /*          HAL_BootStamp().                                         */
 Boolean_t BTPSAPI HCI_VS_InitializeAfterHCIReset(unsigned int HCIDriverID, unsigned int BluetoothStackID)
 {
    Byte_t    *TempBuf;
    Byte_t    *ReturnBuffer;
    Boolean_t  ret_val;
+   Boolean_t  BaudRateChanged;
 
    /* Verify that the parameters that were passed in appear valid.      */
    if((HCIDriverID) && (BluetoothStackID))
    {
       DBG_MSG(DBG_ZONE_VENDOR, ("HCI_VS_InitializeAfterHCIReset\r\n"));
 
+      HAL_BootStamp(HAL_BOOT_STAGE_PATCH_START);
+
       /* Allocate a buffer for the return result.                       */
       if((ReturnBuffer = (Byte_t *)BTPS_AllocateMemory(RETURN_BUFFER_SIZE)) != NULL)
       {
@@ -275,8 +390,23 @@ Boolean_t BTPSAPI HCI_VS_InitializeAfterHCIReset(unsigned int HCIDriverID, unsig
          /* Command Parameters into Data 16 memory.                     */
          if((TempBuf =(Byte_t *) BTPS_AllocateMemory(260)) != NULL)
          {
-            /* First download the Base Patch.                           */
-            if((ret_val = Download_Patch(BluetoothStackID, BasePatchLength, BasePatchPointer, ReturnBuffer, TempBuf)) == TRUE)
+            /* Raise the HCI baud rate for the download.  If the        */
+            /* controller does not accept the new rate the patches are  */
+            /* downloaded at the current rate.                          */
+            if((VENDOR_PATCH_BAUD_RATE) && (HCIBaudRate) && (HCIBaudRate < VENDOR_PATCH_BAUD_RATE))
+               BaudRateChanged = ChangeBaudRate(BluetoothStackID, VENDOR_PATCH_BAUD_RATE, ReturnBuffer);
+            else
+               BaudRateChanged = FALSE;
+
+            HAL_BootStamp(HAL_BOOT_STAGE_PATCH_BAUD_RATE);
+
+            /* First download the Base Patch.  Each stage is time stamped*/
+            /* whether or not it succeeded.                             */
+            ret_val = Download_Patch(BluetoothStackID, BasePatchLength, BasePatchPointer, ReturnBuffer, TempBuf);
+
+            HAL_BootStamp(HAL_BOOT_STAGE_BASE_PATCH);
+
+            if(ret_val)
             {
                /* Next if LE support is enabled go ahead and download   */
                /* the LE Patch.                                         */ 
@@ -294,6 +424,17 @@ Boolean_t BTPSAPI HCI_VS_InitializeAfterHCIReset(unsigned int HCIDriverID, unsig
 
             }
 
+            HAL_BootStamp(HAL_BOOT_STAGE_LE_PATCH);
+
+            /* Return the controller to the baud rate that the HCI      */
+            /* Driver was opened with.                                  */
+            if((BaudRateChanged) && (!ChangeBaudRate(BluetoothStackID, HCIBaudRate, ReturnBuffer)))
+               ret_val = FALSE;
+
+            HAL_BootStamp(HAL_BOOT_STAGE_PATCH_COMPLETE);
+
+            DBG_MSG(DBG_ZONE_VENDOR, ("Patch RAM: baud rate %lu ms, base %lu ms, LE %lu ms, restore %lu ms\r\n", HAL_GetBootStamp(HAL_BOOT_STAGE_PATCH_BAUD_RATE) - HAL_GetBootStamp(HAL_BOOT_STAGE_PATCH_START), HAL_GetBootStamp(HAL_BOOT_STAGE_BASE_PATCH) - HAL_GetBootStamp(HAL_BOOT_STAGE_PATCH_BAUD_RATE), HAL_GetBootStamp(HAL_BOOT_STAGE_LE_PATCH) - HAL_GetBootStamp(HAL_BOOT_STAGE_BASE_PATCH), HAL_GetBootStamp(HAL_BOOT_STAGE_PATCH_COMPLETE) - HAL_GetBootStamp(HAL_BOOT_STAGE_LE_PATCH)));
+
             /* Free the previously allocated tempory buffer.            */
             BTPS_FreeMemory(TempBuf);
          }
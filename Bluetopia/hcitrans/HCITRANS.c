@@ -113,6 +113,7 @@ static void SentHCILLCharacter(HCILL_Action_Request_t HCILLAction, Byte_t HCILL_
 static void DisableTransmitter(void);
 static void EnableTransmitter(void);
 static void LoadTransmitBuffer(unsigned int Length, unsigned char *Buffer);
+static void WaitControllerReady(unsigned long Timeout);
 
    /* The following function is used to unload all of the characters in */
    /* the receive FIFO.                                                 */
@@ -159,6 +160,11 @@ static void TxTransmit(void)
 
       /* The Tx Transmitter is no longer primed.                        */
       UartContext.Flags &= (~UART_CONTEXT_FLAG_TX_PRIMED);
+
+      /* Note when everything written has been sent for the latency     */
+      /* trace.                                                         */
+      if(UartContext.TxBytesFree == UartContext.TxBufferSize)
+         HAL_TraceStamp(HAL_TRACE_STAGE_HCI_TRANSMIT);
    }
 }
 
@@ -585,6 +591,31 @@ static void LoadTransmitBuffer(unsigned int Length, unsigned char *Buffer)
    }
 }
 
+   /* The following function is used to wait for the controller to be   */
+   /* ready once it has been released from reset.  The controller holds */
+   /* CTS high while it starts and lowers it when it is able to receive.*/
+   /* The wait ends when CTS has been seen high and then low, or after  */
+   /* the specified number of milliseconds.                             */
+static void WaitControllerReady(unsigned long Timeout)
+{
+   Boolean_t     Started;
+   unsigned long StartTick;
+
+   Started   = FALSE;
+   StartTick = BTPS_GetTickCount();
+
+   while((BTPS_GetTickCount() - StartTick) < Timeout)
+   {
+      if(BT_CTS_READ())
+         Started = TRUE;
+      else
+      {
+         if(Started)
+            break;
+      }
+   }
+}
+
    /* The following function is responsible for opening the HCI         */
    /* Transport layer that will be used by Bluetopia to send and receive*/
    /* COM (Serial) data.  This function must be successfully issued in  */
@@ -661,6 +692,8 @@ int BTPSAPI HCITR_COMOpen(HCI_COMMDriverInformation_t *COMMDriverInformation, HC
          BTPS_Delay(10);
          BT_DEVICE_UNRESET();
 
+         HAL_BootStamp(HAL_BOOT_STAGE_CONTROLLER_RESET);
+
          /* Bring CTS Line Low to Indicate that we are ready to receive.*/
          FLOW_ON();
 
@@ -704,9 +737,12 @@ int BTPSAPI HCITR_COMOpen(HCI_COMMDriverInformation_t *COMMDriverInformation, HC
 
          ENABLE_INTERRUPTS();
 
-         /* Check to see if we need to delay after opening the COM Port.*/
+         /* Wait for the controller to start, the initialization delay  */
+         /* is only the longest time to wait.                           */
          if(COMMDriverInformation->InitializationDelay)
-            BTPS_Delay(COMMDriverInformation->InitializationDelay);
+            WaitControllerReady(COMMDriverInformation->InitializationDelay);
+
+         HAL_BootStamp(HAL_BOOT_STAGE_CONTROLLER_READY);
 
          /* Flag that the HCI Transport is open.                        */
          HCITransportOpen = 1;
@@ -967,6 +1003,8 @@ int BTPSAPI HCITR_COMWrite(unsigned int HCITransportID, unsigned int Length, uns
       /* Load the Transmit Buffer with the selected characters.         */
       LoadTransmitBuffer(Length, Buffer);
 
+      HAL_TraceStamp(HAL_TRACE_STAGE_HCI_WRITE);
+
       /* Return success to the caller.                                  */
       ret_val = 0;
    }
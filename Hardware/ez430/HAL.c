@@ -46,6 +46,18 @@
 
 #endif
 
+   /* XON/XOFF flow control needs a transmit buffer so that the flow    */
+   /* control characters can be sent ahead of any queued data.          */
+#if (BT_DEBUG_UART_FLOW_CONTROL == BT_DEBUG_UART_FLOW_XON_XOFF) && (!BT_DEBUG_UART_TX_BUFFER_SIZE)
+
+   #error XON/XOFF flow control requires a Debug UART transmit buffer.
+
+#endif
+
+   /* The XON/XOFF flow control characters.                             */
+#define FLOW_CHARACTER_XON    0x11
+#define FLOW_CHARACTER_XOFF   0x13
+
    /* Auxilary clock frequency                                          */
 #define ACLK_FREQUENCY_HZ  ((unsigned int)32768)
 
@@ -58,6 +70,20 @@
    /* Instruction to start the Scheduler Tick ISR.                      */
 #define START_SCHEDULER()  (TA1CTL |= MC_1)
 
+   /* The latency trace stage that indicates that no sample is in       */
+   /* progress.                                                         */
+#define TRACE_STAGE_IDLE   0xFF
+
+   /* The following define how the FLL lock is detected once the system */
+   /* clock has been set: the DCO tap (UCSCTL0) is sampled at least once*/
+   /* per FLL reference period and the clock has settled when the tap   */
+   /* has stayed within one of the same value for CLOCK_SETTLE_WINDOW   */
+   /* samples.                                                          */
+#define CLOCK_SETTLE_SAMPLE_CYCLES   960
+#define CLOCK_SETTLE_WINDOW          96
+#define CLOCK_DCO_TAP_MASK           0x1F00
+#define CLOCK_DCO_TAP_STEP           0x0100
+
    /* The following structure represents the data that is stored to     */
    /* allow us to table drive the CPU setup for each of the Clock       */
    /* Frequencies that we allow.                                        */
@@ -93,6 +119,44 @@ static unsigned int  RxInIndex;
 static unsigned int  RxOutIndex;
 static unsigned int  RxBytesFree = BT_DEBUG_UART_RX_BUFFER_SIZE;
 
+                              /* The following are used to track the    */
+                              /* Receive flow control state.  The host  */
+                              /* is stopped when either the number of   */
+                              /* free bytes falls to the stop threshold */
+                              /* or the owner of the UART requests a    */
+                              /* hold.                                  */
+static unsigned int  RxFlowStopThreshold   = BT_DEBUG_UART_FLOW_STOP_THRESHOLD;
+static unsigned int  RxFlowResumeThreshold = BT_DEBUG_UART_FLOW_RESUME_THRESHOLD;
+static Boolean_t     RxFlowHold;
+static volatile Boolean_t RxFlowStopped;
+
+                              /* The following is used to count the     */
+                              /* characters that were discarded because */
+                              /* the Receive buffer was full.           */
+static volatile unsigned long RxBytesDropped;
+
+                              /* The following are used to hold the     */
+                              /* latency trace sample in progress.  The */
+                              /* stage is the next stage to time stamp  */
+                              /* (TRACE_STAGE_IDLE when no sample is in */
+                              /* progress).                             */
+static volatile unsigned char TraceStage = TRACE_STAGE_IDLE;
+static Word_t                 TraceTimestamps[HAL_TRACE_NUMBER_STAGES];
+
+                              /* The following holds the tick counts at */
+                              /* the time stamped events of the boot.   */
+static unsigned long BootStamps[HAL_BOOT_NUMBER_STAGES];
+
+                              /* The following holds the current Debug  */
+                              /* UART baud rate.                        */
+static unsigned long ConsoleBaudRate = BT_DEBUG_UART_BAUDRATE;
+
+                              /* The following holds the received       */
+                              /* character that marks the end of a block*/
+                              /* of data and causes the owner of the    */
+                              /* UART to be notified.                   */
+static unsigned char RxNotifyCharacter = 0xFF;
+
    /* If no buffer is specified, the this will result in a Blocking     */
    /* Write.                                                            */
 #if BT_DEBUG_UART_TX_BUFFER_SIZE > 0
@@ -107,7 +171,27 @@ static unsigned int TxInIndex;
 static unsigned int TxOutIndex;
 static unsigned int TxBytesFree = BT_DEBUG_UART_TX_BUFFER_SIZE;
 
+                              /* The following is used to hold a flow   */
+                              /* control character that must be sent    */
+                              /* ahead of any queued data.              */
+static volatile unsigned char PendingFlowCharacter;
+
 #endif
+
+                              /* The following is used to track whether */
+                              /* the host has asked us to stop sending  */
+                              /* (XON/XOFF only, the CTS line is read   */
+                              /* directly for RTS/CTS).                 */
+static volatile Boolean_t     TxFlowStopped;
+
+                              /* The following are used to notify the   */
+                              /* owner of the Debug UART when space is  */
+                              /* available in the Transmit buffer after */
+                              /* a short non-blocking write.            */
+static HAL_TxSpaceCallback_t TxSpaceCallback;
+static void                  *TxSpaceCallbackParameter;
+static unsigned int           TxSpaceThreshold;
+static volatile Boolean_t     TxSpaceCallbackArmed;
    
    /* The following represents the table that we use to table drive the */
    /* CPU Frequency setup.                                              */
@@ -138,6 +222,12 @@ static unsigned char DecrementVCORE(unsigned char Level);
 static void ConfigureVCore(unsigned char Level);
 static void StartCrystalOscillator(void);
 static void SetSystemClock(Cpu_Frequency_t CPU_Frequency);
+static unsigned int TxEnqueue(unsigned int Length, char *String);
+static Boolean_t TxFlowIsStopped(void);
+static void StartTransmit(void);
+static void SignalRxFlow(Boolean_t Enable);
+static void UpdateRxFlow(void);
+static Boolean_t FlashRangeValid(void *Address, unsigned int Length);
 
    /* The following function is responsible for determining if we are   */
    /* running on the MSP430F5438 or the MSP430F5438A processor.  This   */
@@ -509,6 +599,9 @@ static void SetSystemClock(Cpu_Frequency_t CPU_Frequency)
    unsigned int                    Ratio; 
    unsigned int                    DCODivBits;
    unsigned long                   SystemFrequency;
+   unsigned int                    Samples;
+   unsigned int                    Tap;
+   unsigned int                    CurrentTap;
    volatile unsigned int           Counter;
    BTPSCONST Frequency_Settings_t *CPU_Settings;
    
@@ -638,10 +731,27 @@ static void SetSystemClock(Cpu_Frequency_t CPU_Frequency)
        UCSCTL4 |= (SELM__DCOCLKDIV | SELS__DCOCLKDIV);
    }
 
-   /* Delay the appropriate amount of cycles for the clock to settle.   */
-   Counter = Ratio * 32;                           
-   while (Counter--)
-       __delay_cycles(30);
+   /* Wait for the clock to settle.  While the FLL is still moving the  */
+   /* DCO it changes the tap by one every 32 reference periods, so the  */
+   /* tap stays within one of the same value for the whole window only  */
+   /* once the FLL has locked.  The worst case settling time (n x 32 x  */
+   /* 32 x f_MCLK / f_FLL_reference cycles) is the longest wait.        */
+   Samples = 0;
+   Tap     = (UCSCTL0 & CLOCK_DCO_TAP_MASK);
+   Counter = Ratio;
+   while((Counter--) && (Samples < CLOCK_SETTLE_WINDOW))
+   {
+      __delay_cycles(CLOCK_SETTLE_SAMPLE_CYCLES);
+
+      CurrentTap = (UCSCTL0 & CLOCK_DCO_TAP_MASK);
+      if(((CurrentTap > Tap)?(CurrentTap - Tap):(Tap - CurrentTap)) <= CLOCK_DCO_TAP_STEP)
+         Samples++;
+      else
+      {
+         Tap     = CurrentTap;
+         Samples = 0;
+      }
+   }
 }
 
    /* The following function is provided to allow a mechanism of        */
@@ -660,9 +770,18 @@ void HAL_ConfigureHardware(void)
    SetSystemClock(BT_CPU_FREQ);
 
    /* Configure the UART-USB Port for its default configuration         */
-   HAL_CommConfigure(BT_DEBUG_UART_BASE, BT_DEBUG_UART_BAUDRATE, 0);
+   HAL_CommConfigure(BT_DEBUG_UART_BASE, ConsoleBaudRate, 0);
    GPIOPinTypeUART(BT_DEBUG_UART_PIN_BASE, BT_DEBUG_UART_PIN_TX_MASK, BT_DEBUG_UART_PIN_RX_MASK);
 
+#if BT_DEBUG_UART_FLOW_CONTROL == BT_DEBUG_UART_FLOW_RTS_CTS
+
+   /* Configure the Debug UART flow control pins and allow the host to  */
+   /* send.                                                             */
+   BT_DEBUG_CONFIG_FLOW_PINS();
+   BT_DEBUG_ENABLE_FLOW();
+
+#endif
+
    /* Enable Debug UART Receive Interrupt.                              */
    UARTIntEnableReceive(BT_DEBUG_UART_BASE);
 
@@ -810,6 +929,8 @@ int HAL_ConsoleRead(unsigned int Length, char *Buffer)
 
          RxBytesFree += CopyLength;
 
+         UpdateRxFlow();
+
          __enable_interrupt();
       }
 
@@ -821,89 +942,554 @@ int HAL_ConsoleRead(unsigned int Length, char *Buffer)
    return(Processed);
 }
 
-   /* This function writes a fixed size string to the UART port         */
-   /* specified by UartBase.                                            */
-void HAL_ConsoleWrite(unsigned int Length, char *String)
+   /* The following function is used to query the number of characters  */
+   /* that are waiting to be read from the UART input queue.            */
+unsigned int HAL_ConsoleReadLength(void)
+{
+   return(BT_DEBUG_UART_RX_BUFFER_SIZE - RxBytesFree);
+}
+
+   /* The following function is used to determine if the host has asked */
+   /* us to stop transmitting on the Debug UART.                        */
+static Boolean_t TxFlowIsStopped(void)
+{
+#if BT_DEBUG_UART_FLOW_CONTROL == BT_DEBUG_UART_FLOW_RTS_CTS
+
+   return((Boolean_t)(BT_DEBUG_CTS_READ()?TRUE:FALSE));
+
+#else
+
+   return(TxFlowStopped);
+
+#endif
+}
+
+   /* The following function is used to prime the Debug UART transmitter*/
+   /* if it is idle and there is data (or a flow control character)     */
+   /* waiting to be sent.                                               */
+   /* * NOTE * This function should be called with interrupts disabled. */
+static void StartTransmit(void)
 {
 #if BT_DEBUG_UART_TX_BUFFER_SIZE
 
-   unsigned int Count;
+   if(!UARTIntTransmitEnabled(BT_DEBUG_UART_BASE))
+   {
+      if(PendingFlowCharacter)
+      {
+         /* Flow control characters are sent even when we have been told*/
+         /* to stop.                                                    */
+         UARTTransmitBufferReg(BT_DEBUG_UART_BASE) = PendingFlowCharacter;
+         PendingFlowCharacter                      = 0;
+
+         UARTIntEnableTransmit(BT_DEBUG_UART_BASE);
+      }
+      else
+      {
+         if((TxBytesFree != BT_DEBUG_UART_TX_BUFFER_SIZE) && (!TxFlowIsStopped()))
+         {
+            /* Send the next character out.                             */
+            UARTTransmitBufferReg(BT_DEBUG_UART_BASE) = TransBuffer[TxOutIndex++];
+
+            /* Decrement the number of characters that are in the       */
+            /* transmit buffer and adjust the out index.                */
+            TxBytesFree++;
+            if(TxOutIndex == BT_DEBUG_UART_TX_BUFFER_SIZE)
+               TxOutIndex = 0;
+
+            UARTIntEnableTransmit(BT_DEBUG_UART_BASE);
+         }
+      }
+   }
+
+#endif
+}
+
+   /* The following function is used to tell the host that it may (or   */
+   /* may not) send data on the Debug UART.                             */
+   /* * NOTE * This function should be called with interrupts disabled. */
+static void SignalRxFlow(Boolean_t Enable)
+{
+#if BT_DEBUG_UART_FLOW_CONTROL == BT_DEBUG_UART_FLOW_RTS_CTS
+
+   if(Enable)
+      BT_DEBUG_ENABLE_FLOW();
+   else
+      BT_DEBUG_DISABLE_FLOW();
+
+#elif BT_DEBUG_UART_FLOW_CONTROL == BT_DEBUG_UART_FLOW_XON_XOFF
+
+   PendingFlowCharacter = (unsigned char)(Enable?FLOW_CHARACTER_XON:FLOW_CHARACTER_XOFF);
+
+   StartTransmit();
 
 #endif
+}
 
+   /* The following function is used to stop or resume the host based   */
+   /* on the amount of free space in the receive buffer and the current */
+   /* hold state.                                                       */
+   /* * NOTE * This function should be called with interrupts disabled. */
+static void UpdateRxFlow(void)
+{
+   if(!RxFlowStopped)
+   {
+      if((RxFlowHold) || (RxBytesFree <= RxFlowStopThreshold))
+      {
+         RxFlowStopped = TRUE;
+
+         SignalRxFlow(FALSE);
+
+         /* If the buffer is filling make sure that the owner of the    */
+         /* UART drains it, even if no end of block marker has been     */
+         /* received.                                                   */
+         if(!RxFlowHold)
+            DataSendCallback(NULL);
+      }
+   }
+   else
+   {
+      if((!RxFlowHold) && (RxBytesFree >= RxFlowResumeThreshold))
+      {
+         RxFlowStopped = FALSE;
+
+         SignalRxFlow(TRUE);
+      }
+   }
+}
+
+   /* The following function is used to place as much of the specified */
+   /* data as will currently fit into the Debug UART transmit buffer and */
+   /* to prime the transmitter if it is idle.  This function returns the */
+   /* number of bytes that were accepted.                               */
+static unsigned int TxEnqueue(unsigned int Length, char *String)
+{
+   unsigned int Processed = 0;
+
+#if BT_DEBUG_UART_TX_BUFFER_SIZE
+
+   unsigned int Count;
    volatile int Flags;
 
+   while((Length) && (TxBytesFree))
+   {
+      /* Get the number of bytes till we reach the end of the buffer.   */
+      Count = (BT_DEBUG_UART_TX_BUFFER_SIZE-TxInIndex);
+
+      /* Limit this by the number of Byte that are available.           */
+      if(Count > TxBytesFree)
+         Count = TxBytesFree;
+
+      if(Count > Length)
+         Count = Length;
+
+      /* Copy as much data as we can.                                   */
+      BTPS_MemCopy(&TransBuffer[TxInIndex], String, Count);
+
+      /* Adjust the Index and Counts.                                   */
+      TxInIndex += Count;
+      String    += Count;
+      Length    -= Count;
+      Processed += Count;
+      if(TxInIndex == BT_DEBUG_UART_TX_BUFFER_SIZE)
+         TxInIndex = 0;
+
+      /* Adjust the number of Free Bytes and prime the transmitter if   */
+      /* needed.                                                        */
+      Flags = (__get_interrupt_state() & GIE);
+      __disable_interrupt();
+
+      TxBytesFree -= Count;
+
+      StartTransmit();
+
+      if(Flags)
+         __enable_interrupt();
+   }
+
+#else
+
+   /* Without a transmit buffer we may only send a character when the   */
+   /* TXBUF is empty.                                                   */
+   while((Length) && (UARTTransmitBufferEmpty(BT_DEBUG_UART_BASE)) && (!TxFlowIsStopped()))
+   {
+      UARTTransmitBufferReg(BT_DEBUG_UART_BASE) = *String;
+
+      String++;
+      Length--;
+      Processed++;
+   }
+
+#endif
+
+   return(Processed);
+}
+
+   /* This function writes a fixed size string to the UART port         */
+   /* specified by UartBase.                                            */
+void HAL_ConsoleWrite(unsigned int Length, char *String)
+{
+   unsigned int Count;
+
    /* First make sure the parameters seem semi valid.                   */
    if((Length) && (String))
    {
       /* Loop and transmit all characters to the Debug UART.            */
       while(Length)
       {
-#if BT_DEBUG_UART_TX_BUFFER_SIZE
+         Count   = TxEnqueue(Length, String);
+         String += Count;
+         Length -= Count;
+      }
+   }
+}
 
-         if(TxBytesFree)
-         {
-            /* Get the number of bytes till we reach the end of the     */
-            /* buffer.                                                  */
-            Count = (BT_DEBUG_UART_TX_BUFFER_SIZE-TxInIndex);
+   /* The following function is used to send data to the UART output    */
+   /* queue without blocking.  The function returns the number of bytes */
+   /* that were accepted.                                               */
+int HAL_ConsoleWriteNonBlocking(unsigned int Length, char *Buffer)
+{
+   int Processed = 0;
 
-            /* Limit this by the number of Byte that are available.     */
-            if(Count > TxBytesFree)
-               Count = TxBytesFree;
+   /* First make sure the parameters seem semi valid.                   */
+   if((Length) && (Buffer))
+   {
+      Processed = (int)TxEnqueue(Length, Buffer);
 
-            if(Count > Length)
-               Count = Length;
+      /* If we could not accept all of the data, arm the transmit space */
+      /* callback so that the caller is told when it may try again.     */
+      if(((unsigned int)Processed < Length) && (TxSpaceCallback))
+         TxSpaceCallbackArmed = TRUE;
+   }
 
-            /* Copy as much data as we can.                             */
-            BTPS_MemCopy(&TransBuffer[TxInIndex], String, Count);
+   return(Processed);
+}
 
-            /* Adjust the number of Free Bytes.                         */
-            Flags = (__get_interrupt_state() & GIE);           
-            __disable_interrupt();
-            
-            TxBytesFree -= Count;
-
-            if(Flags)
-               __enable_interrupt();
-
-            /* Adjust the Index and Counts.                             */
-            TxInIndex += Count;
-            String    += Count;
-            Length    -= Count;
-            if(TxInIndex == BT_DEBUG_UART_TX_BUFFER_SIZE)
-               TxInIndex = 0;
-
-            /* Check to see if we need to prime the transmitter.        */
-            if(!UARTIntTransmitEnabled(BT_DEBUG_UART_BASE))
-            {
-               /* Send the next character out.                          */
-               UARTTransmitBufferReg(BT_DEBUG_UART_BASE) = TransBuffer[TxOutIndex++];
-
-               /* Decrement the number of characters that are in the    */
-               /* transmit buffer and adjust the out index.             */
-               TxBytesFree++;
-               if(TxOutIndex == BT_DEBUG_UART_TX_BUFFER_SIZE)
-                  TxOutIndex = 0;
-
-               UARTIntEnableTransmit(BT_DEBUG_UART_BASE);
-            }
-         }
+   /* The following function is used to query the number of bytes that  */
+   /* may currently be written to the UART output queue without         */
+   /* blocking.                                                         */
+unsigned int HAL_ConsoleWriteSpace(void)
+{
+#if BT_DEBUG_UART_TX_BUFFER_SIZE
+
+   return(TxBytesFree);
 
 #else
 
-         /* Loop until the TXBUF is empty.                              */
-         while(!UARTTransmitBufferEmpty(BT_DEBUG_UART_BASE));
+   return(UARTTransmitBufferEmpty(BT_DEBUG_UART_BASE)?1:0);
+
+#endif
+}
+
+   /* The following function is used to register a function that is    */
+   /* called once space is available in the UART output queue following */
+   /* a short write by HAL_ConsoleWriteNonBlocking().                   */
+void HAL_RegisterTxSpaceCallback(HAL_TxSpaceCallback_t Callback, void *CallbackParameter, unsigned int Threshold)
+{
+   volatile int Flags;
+
+   /* Clamp the threshold to the size of the transmit buffer.           */
+   if((!Threshold) || (Threshold > BT_DEBUG_UART_TX_BUFFER_SIZE))
+      Threshold = BT_DEBUG_UART_TX_BUFFER_SIZE;
+
+   /* The callback is referenced from the UART interrupt so we must     */
+   /* protect the update.                                               */
+   Flags = (__get_interrupt_state() & GIE);
+   __disable_interrupt();
+
+   TxSpaceCallback          = Callback;
+   TxSpaceCallbackParameter = CallbackParameter;
+   TxSpaceThreshold         = Threshold;
+   TxSpaceCallbackArmed     = FALSE;
 
-         /* Now that the TXBUF is empty send the character.             */
-         UARTTransmitBufferReg(BT_DEBUG_UART_BASE) = *String;
+   if(Flags)
+      __enable_interrupt();
+}
+
+   /* The following function is used to arm the transmit space callback */
+   /* without first making a short write.  If the threshold has already */
+   /* been reached the callback is dispatched immediately.              */
+void HAL_ConsoleArmTxSpaceCallback(void)
+{
+   volatile int Flags;
 
-         String++;
-         Length--;
+   Flags = (__get_interrupt_state() & GIE);
+   __disable_interrupt();
+
+   if(TxSpaceCallback)
+   {
+      if(HAL_ConsoleWriteSpace() >= TxSpaceThreshold)
+      {
+         TxSpaceCallbackArmed = FALSE;
+
+         (*TxSpaceCallback)(TxSpaceCallbackParameter);
+      }
+      else
+         TxSpaceCallbackArmed = TRUE;
+   }
+
+   if(Flags)
+      __enable_interrupt();
+}
+
+   /* The following function is used to change the received character   */
+   /* that causes DataSendCallback() to be called.                      */
+void HAL_ConsoleSetNotifyCharacter(unsigned char Character)
+{
+   RxNotifyCharacter = Character;
+}
+
+   /* The following function is used to change the receive flow control */
+   /* thresholds.                                                       */
+int HAL_ConsoleConfigureFlow(unsigned int StopThreshold, unsigned int ResumeThreshold)
+{
+   int          ret_val;
+   volatile int Flags;
+
+   /* Make sure the thresholds leave room for hysteresis.               */
+   if((StopThreshold < ResumeThreshold) && (ResumeThreshold <= BT_DEBUG_UART_RX_BUFFER_SIZE))
+   {
+      Flags = (__get_interrupt_state() & GIE);
+      __disable_interrupt();
+
+      RxFlowStopThreshold   = StopThreshold;
+      RxFlowResumeThreshold = ResumeThreshold;
+
+      UpdateRxFlow();
+
+      if(Flags)
+         __enable_interrupt();
+
+      ret_val = 0;
+   }
+   else
+      ret_val = -1;
+
+   return(ret_val);
+}
+
+   /* The following function is used to stop (or allow) the host from   */
+   /* sending regardless of the free space in the receive buffer.       */
+void HAL_ConsoleSetFlowHold(Boolean_t Hold)
+{
+   volatile int Flags;
+
+   Flags = (__get_interrupt_state() & GIE);
+   __disable_interrupt();
+
+   RxFlowHold = Hold;
+
+   UpdateRxFlow();
+
+   if(Flags)
+      __enable_interrupt();
+}
+
+   /* The following function returns TRUE if the host is currently being*/
+   /* told to stop sending.                                             */
+Boolean_t HAL_ConsoleRxFlowStopped(void)
+{
+   return(RxFlowStopped);
+}
+
+   /* The following function returns TRUE if the host has currently     */
+   /* told us to stop sending.                                          */
+Boolean_t HAL_ConsoleTxFlowStopped(void)
+{
+   return(TxFlowIsStopped());
+}
+
+   /* The following function returns the number of received characters  */
+   /* that have been discarded because the receive buffer was full.     */
+unsigned long HAL_ConsoleGetDroppedBytes(void)
+{
+   unsigned long ret_val;
+   volatile int  Flags;
+
+   /* The count is updated in the UART interrupt so we must protect the */
+   /* read.                                                             */
+   Flags = (__get_interrupt_state() & GIE);
+   __disable_interrupt();
+
+   ret_val = RxBytesDropped;
+
+   if(Flags)
+      __enable_interrupt();
+
+   return(ret_val);
+}
+
+   /* The following function is used to change the Debug UART baud rate.*/
+int HAL_ConsoleSetBaudRate(unsigned long BaudRate)
+{
+   int          ret_val;
+   volatile int Flags;
+
+   /* The clock source must not change since HAL_EnableSMCLK() and      */
+   /* HAL_DisableSMCLK() are built for BT_DEBUG_UART_BAUDRATE.          */
+   if((BaudRate) && ((BaudRate <= 9600) == (BT_DEBUG_UART_BAUDRATE <= 9600)))
+   {
+#if BT_DEBUG_UART_TX_BUFFER_SIZE
+
+      /* Let any queued output drain at the current baud rate (unless   */
+      /* the host has stopped us, in which case it is discarded).       */
+      while((TxBytesFree != BT_DEBUG_UART_TX_BUFFER_SIZE) && (!TxFlowIsStopped()))
+         ;
 
 #endif
 
+      /* Wait for the last character to leave the shift register.       */
+      while(HWREG8(BT_DEBUG_UART_BASE + MSP430_UART_STAT_OFFSET) & MSP430_UART_STAT_BUSY_mask)
+         ;
+
+      Flags = (__get_interrupt_state() & GIE);
+      __disable_interrupt();
+
+#if BT_DEBUG_UART_TX_BUFFER_SIZE
+
+      /* Discard anything that was not sent.                            */
+      TxInIndex   = 0;
+      TxOutIndex  = 0;
+      TxBytesFree = BT_DEBUG_UART_TX_BUFFER_SIZE;
+
+#endif
+
+      /* Reconfigure the UART, this resets the interrupt enables so the */
+      /* receive interrupt must be enabled again.                       */
+      HAL_CommConfigure(BT_DEBUG_UART_BASE, BaudRate, 0);
+      UARTIntEnableReceive(BT_DEBUG_UART_BASE);
+
+      ConsoleBaudRate = BaudRate;
+
+      if(Flags)
+         __enable_interrupt();
+
+      ret_val = 0;
+   }
+   else
+      ret_val = -1;
+
+   return(ret_val);
+}
+
+   /* The following function returns the current Debug UART baud rate.  */
+unsigned long HAL_ConsoleGetBaudRate(void)
+{
+   return(ConsoleBaudRate);
+}
+
+   /* The following function is a utility function that is used to      */
+   /* determine if the specified range lies entirely within one of the  */
+   /* Information Memory segments B through D or entirely within the    */
+   /* reserved Main Memory segments.                                    */
+static Boolean_t FlashRangeValid(void *Address, unsigned int Length)
+{
+   unsigned int Start;
+   unsigned int End;
+
+   Start = (unsigned int)Address;
+
+   /* The segments are aligned to their size, so the end of the segment */
+   /* that holds Start is found by rounding it up.                      */
+   if((Start >= (unsigned int)HAL_FLASH_INFO_SEGMENT_D) && (Start < ((unsigned int)HAL_FLASH_INFO_SEGMENT_B + HAL_FLASH_INFO_SEGMENT_SIZE)))
+      End = (Start & ~(HAL_FLASH_INFO_SEGMENT_SIZE - 1)) + HAL_FLASH_INFO_SEGMENT_SIZE;
+   else
+   {
+      if((Start >= (unsigned int)HAL_FLASH_MAIN_SEGMENT_1) && (Start < ((unsigned int)HAL_FLASH_MAIN_SEGMENT_2 + HAL_FLASH_MAIN_SEGMENT_SIZE)))
+         End = (Start & ~(HAL_FLASH_MAIN_SEGMENT_SIZE - 1)) + HAL_FLASH_MAIN_SEGMENT_SIZE;
+      else
+         End = Start;
+   }
+
+   return((Boolean_t)((End != Start) && (Length <= (End - Start))));
+}
+
+   /* The following function is used to erase the flash segment that    */
+   /* contains the specified address.                                   */
+int HAL_FlashEraseSegment(void *Segment)
+{
+   int          ret_val;
+   volatile int Flags;
+
+   if(FlashRangeValid(Segment, 1))
+   {
+      Flags = (__get_interrupt_state() & GIE);
+      __disable_interrupt();
+
+      /* Unlock the flash, select a segment erase and start it with a   */
+      /* dummy write to the segment.                                    */
+      FCTL3 = FWKEY;
+      FCTL1 = FWKEY | ERASE;
+
+      *((unsigned char *)Segment) = 0;
+
+      while(FCTL3 & BUSY)
+         ;
+
+      /* Lock the flash again.                                          */
+      FCTL1 = FWKEY;
+      FCTL3 = FWKEY | LOCK;
+
+      if(Flags)
+         __enable_interrupt();
+
+      ret_val = 0;
+   }
+   else
+      ret_val = -1;
+
+   return(ret_val);
+}
+
+   /* The following function is used to program data into a previously  */
+   /* erased flash segment.                                             */
+int HAL_FlashWrite(void *Address, unsigned int Length, void *Data)
+{
+   int            ret_val;
+   unsigned char *Destination;
+   unsigned char *Source;
+   volatile int   Flags;
+
+   if((Data) && (FlashRangeValid(Address, Length)))
+   {
+      Destination = (unsigned char *)Address;
+      Source      = (unsigned char *)Data;
+
+      Flags = (__get_interrupt_state() & GIE);
+      __disable_interrupt();
+
+      FCTL3 = FWKEY;
+      FCTL1 = FWKEY | WRT;
+
+      while(Length--)
+      {
+         *Destination++ = *Source++;
+
+         while(FCTL3 & BUSY)
+            ;
       }
+
+      FCTL1 = FWKEY;
+      FCTL3 = FWKEY | LOCK;
+
+      if(Flags)
+         __enable_interrupt();
+
+      ret_val = 0;
    }
+   else
+      ret_val = -1;
+
+   return(ret_val);
+}
+
+   /* The following function is used to reset the MSP430.               */
+void HAL_Reset(void)
+{
+   /* Trigger a software brown out reset.                               */
+   PMMCTL0 = PMMPW | PMMSWBOR;
+
+   while(1)
+      ;
 }
 
    /* The following function is used to return the configured system    */
@@ -931,6 +1517,106 @@ unsigned long HAL_GetTickCount(void)
    return(MSP430Ticks);
 }
 
+   /* The following function returns a free running 16 bit time stamp   */
+   /* in ACLK periods, made up of the system tick count and the current */
+   /* count of the system timer (TA1).                                  */
+Word_t HAL_GetTimestamp(void)
+{
+   Word_t        Count;
+   unsigned long Ticks;
+   volatile int  Flags;
+
+   Flags = (__get_interrupt_state() & GIE);
+   __disable_interrupt();
+
+   Count = TA1R;
+   Ticks = MSP430Ticks;
+
+   /* If the timer has wrapped but the tick has not been counted yet,   */
+   /* count it now.                                                     */
+   if((TA1CCTL0 & CCIFG) && (Count < (TA1CCR0 / 2)))
+      Ticks++;
+
+   if(Flags)
+      __enable_interrupt();
+
+   return((Word_t)((Ticks * (TA1CCR0 + 1)) + Count));
+}
+
+   /* The following function is used to start a latency trace sample.   */
+Boolean_t HAL_TraceArm(void)
+{
+   Boolean_t    ret_val;
+   volatile int Flags;
+
+   Flags = (__get_interrupt_state() & GIE);
+   __disable_interrupt();
+
+   /* A sample is only discarded if at least one stage was stamped.     */
+   ret_val    = (Boolean_t)((TraceStage != TRACE_STAGE_IDLE) && (TraceStage != HAL_TRACE_STAGE_UART_RECEIVE) && (TraceStage != HAL_TRACE_NUMBER_STAGES));
+   TraceStage = HAL_TRACE_STAGE_UART_RECEIVE;
+
+   if(Flags)
+      __enable_interrupt();
+
+   return(ret_val);
+}
+
+   /* The following function is used to time stamp the specified stage  */
+   /* of the current latency trace sample.                              */
+void HAL_TraceStamp(unsigned int Stage)
+{
+   volatile int Flags;
+
+   if(TraceStage == Stage)
+   {
+      Flags = (__get_interrupt_state() & GIE);
+      __disable_interrupt();
+
+      /* Check again now that the stage may not change under us.        */
+      if(TraceStage == Stage)
+      {
+         TraceTimestamps[Stage] = HAL_GetTimestamp();
+         TraceStage++;
+      }
+
+      if(Flags)
+         __enable_interrupt();
+   }
+}
+
+   /* The following function is used to collect a completed latency     */
+   /* trace sample.                                                     */
+Boolean_t HAL_TraceGetSample(Word_t *Timestamps)
+{
+   Boolean_t ret_val = FALSE;
+
+   if((Timestamps) && (TraceStage == HAL_TRACE_NUMBER_STAGES))
+   {
+      memcpy(Timestamps, TraceTimestamps, sizeof(TraceTimestamps));
+
+      TraceStage = TRACE_STAGE_IDLE;
+      ret_val    = TRUE;
+   }
+
+   return(ret_val);
+}
+
+   /* The following function is used to record the tick count at the    */
+   /* specified event of the boot.                                      */
+void HAL_BootStamp(unsigned int Stage)
+{
+   if(Stage < HAL_BOOT_NUMBER_STAGES)
+      BootStamps[Stage] = MSP430Ticks;
+}
+
+   /* The following function returns the tick count that was recorded   */
+   /* for the specified event of the boot.                              */
+unsigned long HAL_GetBootStamp(unsigned int Stage)
+{
+   return((Stage < HAL_BOOT_NUMBER_STAGES)?BootStamps[Stage]:0);
+}
+
    /* The following Toggles an LED at a passed in blink rate.           */
 void HAL_LedToggle(int LED_ID)
 {
@@ -1018,6 +1704,15 @@ __interrupt void TIMER_INTERRUPT(void)
 {
    ++MSP430Ticks;
 
+#if (BT_DEBUG_UART_FLOW_CONTROL == BT_DEBUG_UART_FLOW_RTS_CTS) && (BT_DEBUG_UART_TX_BUFFER_SIZE)
+
+   /* The CTS line is not interrupt capable so check each tick if a     */
+   /* stopped transmitter may be restarted.                             */
+   if((!UARTIntTransmitEnabled(BT_DEBUG_UART_BASE)) && (TxBytesFree != BT_DEBUG_UART_TX_BUFFER_SIZE))
+      StartTransmit();
+
+#endif
+
    /* Exit from LPM if necessary (this statement will have no effect if */
    /* we are not currently in low power mode).                          */
    LPM3_EXIT;
@@ -1034,9 +1729,26 @@ __interrupt void DEBUG_UART_INTERRUPT(void)
       /* Read the received character.                                   */
       ch = UARTReceiveBufferReg(BT_DEBUG_UART_BASE);
 
+#if BT_DEBUG_UART_FLOW_CONTROL == BT_DEBUG_UART_FLOW_XON_XOFF
+
+      /* Consume any flow control characters sent by the host.          */
+      if((ch == FLOW_CHARACTER_XON) || (ch == FLOW_CHARACTER_XOFF))
+      {
+         TxFlowStopped = (Boolean_t)(ch == FLOW_CHARACTER_XOFF);
+
+         if(!TxFlowStopped)
+            StartTransmit();
+      }
+      else
+
+#endif
+
       /* Place characters in receive buffer if there is any space.      */
       if(RxBytesFree)
       {
+         /* Time stamp the character if a trace sample was started.     */
+         HAL_TraceStamp(HAL_TRACE_STAGE_UART_RECEIVE);
+
          /* Save the character in the Receive Buffer.                   */
          RecvBuffer[RxInIndex++] = ch;
          RxBytesFree--;
@@ -1048,8 +1760,21 @@ __interrupt void DEBUG_UART_INTERRUPT(void)
          /* Grab the HCILL power lock so that we do not enter LPM3      */
          /* before we process the character we just received.           */
          HCILL_Power_Lock();
+
+         /* Stop the host if the buffer is nearly full.                 */
+         UpdateRxFlow();
+      }
+      else
+      {
+         /* There is no room for the character so count it as lost.     */
+         RxBytesDropped++;
       }
 
+      /* The notify character marks the end of a block of data to be    */
+      /* sent.                                                          */
+      if(ch == RxNotifyCharacter)
+         DataSendCallback(NULL);
+
       /* Exit from LPM if necessary (this statement will have no effect */
       /* if we are not currently in low power mode).                    */
       LPM3_EXIT;
@@ -1059,7 +1784,13 @@ __interrupt void DEBUG_UART_INTERRUPT(void)
 
    else
    {
-      if(TxBytesFree != BT_DEBUG_UART_TX_BUFFER_SIZE)
+      if(PendingFlowCharacter)
+      {
+         /* Flow control characters go ahead of any queued data.        */
+         UARTTransmitBufferReg(BT_DEBUG_UART_BASE) = PendingFlowCharacter;
+         PendingFlowCharacter                      = 0;
+      }
+      else if((TxBytesFree != BT_DEBUG_UART_TX_BUFFER_SIZE) && (!TxFlowIsStopped()))
       {
          /* Send the next character out.                                */
          UARTTransmitBufferReg(BT_DEBUG_UART_BASE) = TransBuffer[TxOutIndex++];
@@ -1072,17 +1803,25 @@ __interrupt void DEBUG_UART_INTERRUPT(void)
       }
       else
       {
-         /* There is no more data, so disable the TX Interrupt.         */
+         /* There is no more data (or the host has asked us to stop), so*/
+         /* disable the TX Interrupt.                                   */
          UARTIntDisableTransmit(BT_DEBUG_UART_BASE);
       }
-   }
 
-#endif
+      /* Notify the owner of the UART if it was waiting for space in the*/
+      /* transmit buffer.                                               */
+      if((TxSpaceCallbackArmed) && (TxBytesFree >= TxSpaceThreshold))
+      {
+         TxSpaceCallbackArmed = FALSE;
 
-   if (ch == 0xFF)
-   {
-	   DataSendCallback(NULL);
+         if(TxSpaceCallback)
+            (*TxSpaceCallback)(TxSpaceCallbackParameter);
+
+         LPM3_EXIT;
+      }
    }
+
+#endif
 }
 
    /* CTS Pin Interrupt. CtsInterrupt routine must change the polarity  */
@@ -15,12 +15,71 @@
 #ifndef __HAL_H__
 #define __HAL_H__
 #include <msp430.h>
+#include "BTTypes.h"            /* Bluetooth basic type definitions           */
 
    /* The following define the valid Peripheral values that may be      */
    /* passed into HAL_EnableSMCLK() and HAL_DisableSMCLK().             */
 #define HAL_PERIPHERAL_DEBUG_UART                        0x01
 #define HAL_PERIPHERAL_BLUETOOTH_UART                    0x02
 
+   /* The following define the Information Memory segments that may be  */
+   /* used to hold non-volatile data with HAL_FlashEraseSegment() and   */
+   /* HAL_FlashWrite().  Segment A is protected by LOCKA and is not     */
+   /* used.                                                             */
+#define HAL_FLASH_INFO_SEGMENT_SIZE                      128
+#define HAL_FLASH_INFO_SEGMENT_B                         ((void *)0x1900)
+#define HAL_FLASH_INFO_SEGMENT_C                         ((void *)0x1880)
+#define HAL_FLASH_INFO_SEGMENT_D                         ((void *)0x1800)
+
+   /* The following define the two Main Memory segments that are kept   */
+   /* out of the program by the linker command file (BONDSTORE) so that */
+   /* they may hold non-volatile data that outgrows the Information     */
+   /* Memory.  They are erased and written with the same functions.     */
+   /* * NOTE * Downloading the program erases these segments unless the */
+   /*          programmer is set to erase only the segments it writes.  */
+#define HAL_FLASH_MAIN_SEGMENT_SIZE                      512
+#define HAL_FLASH_MAIN_SEGMENT_1                         ((void *)0x5C00)
+#define HAL_FLASH_MAIN_SEGMENT_2                         ((void *)0x5E00)
+
+   /* The following define the stages of the data path that are time    */
+   /* stamped by the latency trace (see HAL_TraceStamp()), in the order */
+   /* that they are passed: a byte received on the Debug UART, the      */
+   /* application being told there is data to read, the data being      */
+   /* sent to SPP, SPP_Data_Write() returning, the data being written   */
+   /* to the Bluetooth UART and the Bluetooth UART transmit buffer      */
+   /* emptying.                                                         */
+#define HAL_TRACE_STAGE_UART_RECEIVE                     0
+#define HAL_TRACE_STAGE_MAILBOX_POST                     1
+#define HAL_TRACE_STAGE_SPP_SEND                         2
+#define HAL_TRACE_STAGE_SPP_WRITE                        3
+#define HAL_TRACE_STAGE_HCI_WRITE                        4
+#define HAL_TRACE_STAGE_HCI_TRANSMIT                     5
+#define HAL_TRACE_NUMBER_STAGES                          6
+
+   /* The following define the events of the boot that are time stamped */
+   /* with HAL_BootStamp(), in the order that they happen: the Bluetooth*/
+   /* controller being released from reset, the controller signalling   */
+   /* (by lowering CTS) that it is ready to receive, the start of the   */
+   /* Patch RAM download, the download baud rate set, the Base Patch and*/
+   /* the LE Patch downloaded and the HCI baud rate restored.           */
+#define HAL_BOOT_STAGE_CONTROLLER_RESET                  0
+#define HAL_BOOT_STAGE_CONTROLLER_READY                  1
+#define HAL_BOOT_STAGE_PATCH_START                       2
+#define HAL_BOOT_STAGE_PATCH_BAUD_RATE                   3
+#define HAL_BOOT_STAGE_BASE_PATCH                        4
+#define HAL_BOOT_STAGE_LE_PATCH                          5
+#define HAL_BOOT_STAGE_PATCH_COMPLETE                    6
+#define HAL_BOOT_NUMBER_STAGES                           7
+
+   /* The following type declaration represents the prototype of the    */
+   /* function that is called when space becomes available in the Debug */
+   /* UART transmit buffer after a call to HAL_ConsoleWriteNonBlocking()*/
+   /* was unable to accept all of the requested data.                   */
+   /* * NOTE * This function is called in the context of the Debug UART */
+   /*          interrupt, so it must not block and should do no more    */
+   /*          than signal the application (e.g. post to a mailbox).    */
+typedef void (*HAL_TxSpaceCallback_t)(void *CallbackParameter);
+
    /* The following function is used to place the hardware into a known */
    /* state.                                                            */
 void HAL_ConfigureHardware(void);
@@ -41,11 +100,108 @@ void HAL_CommConfigure(unsigned int UartBase, unsigned long BaudRate, unsigned c
    /* in Buffer.                                                        */
 int HAL_ConsoleRead(unsigned int Length, char *Buffer);
 
+   /* The following function is used to query the number of characters  */
+   /* that are waiting to be read from the UART input queue.            */
+unsigned int HAL_ConsoleReadLength(void);
+
    /* The following function is used to send data to the UART output    */
    /* queue.  The function receives a pointer to a buffer that will     */
    /* contains the data to send and the length of the data.             */
 void HAL_ConsoleWrite(unsigned int Length, char *Buffer);
 
+   /* The following function is used to send data to the UART output    */
+   /* queue without blocking.  The function receives a pointer to a     */
+   /* buffer that contains the data to send and the length of the data. */
+   /* The function returns the number of bytes that were accepted, which*/
+   /* may be less than Length (including zero) if the transmit buffer is*/
+   /* full.  If fewer bytes than requested were accepted, the registered*/
+   /* transmit space callback (if any) will be dispatched once space is */
+   /* available.                                                        */
+int HAL_ConsoleWriteNonBlocking(unsigned int Length, char *Buffer);
+
+   /* The following function is used to query the number of bytes that  */
+   /* may currently be written to the UART output queue without         */
+   /* blocking.                                                         */
+unsigned int HAL_ConsoleWriteSpace(void);
+
+   /* The following function is used to register a function that is    */
+   /* called once at least Threshold bytes are free in the UART output  */
+   /* queue following a short write by HAL_ConsoleWriteNonBlocking().  A*/
+   /* Threshold of zero (or one larger than the queue) is treated as the*/
+   /* size of the queue.  Passing a NULL Callback un-registers any      */
+   /* previously registered callback.                                   */
+void HAL_RegisterTxSpaceCallback(HAL_TxSpaceCallback_t Callback, void *CallbackParameter, unsigned int Threshold);
+
+   /* The following function is used to arm the transmit space callback */
+   /* when the caller needs more space than is currently free but has   */
+   /* not made a short write.  If the registered threshold has already  */
+   /* been reached the callback is dispatched before this function      */
+   /* returns.                                                          */
+void HAL_ConsoleArmTxSpaceCallback(void);
+
+   /* The following function is used to change the received character   */
+   /* that marks the end of a block of data.  Reception of this         */
+   /* character causes DataSendCallback() to be called.  The default is */
+   /* 0xFF.                                                             */
+void HAL_ConsoleSetNotifyCharacter(unsigned char Character);
+
+   /* The following function is used to change the receive flow control */
+   /* thresholds.  The host is told to stop sending when the number of  */
+   /* free bytes in the UART input queue falls to StopThreshold and is  */
+   /* told that it may resume once at least ResumeThreshold bytes are   */
+   /* free.  This function returns zero if successful or a negative     */
+   /* value if the thresholds are invalid.                              */
+int HAL_ConsoleConfigureFlow(unsigned int StopThreshold, unsigned int ResumeThreshold);
+
+   /* The following function is used to stop the host from sending (Hold*/
+   /* = TRUE) regardless of the free space in the UART input queue, for */
+   /* example while the Bluetooth link is unable to accept more data.   */
+   /* Passing FALSE returns to threshold based flow control.            */
+void HAL_ConsoleSetFlowHold(Boolean_t Hold);
+
+   /* The following function returns TRUE if the host is currently being*/
+   /* told to stop sending.                                             */
+Boolean_t HAL_ConsoleRxFlowStopped(void);
+
+   /* The following function returns TRUE if the host has currently     */
+   /* told us to stop sending.                                          */
+Boolean_t HAL_ConsoleTxFlowStopped(void);
+
+   /* The following function returns the number of received characters  */
+   /* that have been discarded because the UART input queue was full.   */
+unsigned long HAL_ConsoleGetDroppedBytes(void);
+
+   /* The following function is used to change the Debug UART baud rate.*/
+   /* Any queued output is sent at the current baud rate first.  Only   */
+   /* baud rates that use the same clock source as                      */
+   /* BT_DEBUG_UART_BAUDRATE (ACLK at or below 9600, otherwise SMCLK)   */
+   /* may be selected since the low power handling depends on it.  This */
+   /* function returns zero if successful or a negative value if the    */
+   /* baud rate is not supported.                                       */
+int HAL_ConsoleSetBaudRate(unsigned long BaudRate);
+
+   /* The following function returns the current Debug UART baud rate.  */
+unsigned long HAL_ConsoleGetBaudRate(void);
+
+   /* The following function is used to erase the flash segment that    */
+   /* contains the specified address.  This function returns zero if    */
+   /* successful or a negative value if the address is not in one of the*/
+   /* HAL_FLASH_INFO_SEGMENT_XXX or HAL_FLASH_MAIN_SEGMENT_XXX segments.*/
+   /* * NOTE * The CPU is held while the flash is erased (up to 32ms),  */
+   /*          so characters received on either UART during this time   */
+   /*          may be lost.                                             */
+int HAL_FlashEraseSegment(void *Segment);
+
+   /* The following function is used to program data into a previously  */
+   /* erased flash segment.  This function returns zero if successful or*/
+   /* a negative value if the data does not lie within one of the       */
+   /* HAL_FLASH_INFO_SEGMENT_XXX or HAL_FLASH_MAIN_SEGMENT_XXX segments.*/
+int HAL_FlashWrite(void *Address, unsigned int Length, void *Data);
+
+   /* The following function is used to reset the MSP430.  This function*/
+   /* does not return.                                                  */
+void HAL_Reset(void);
+
    /* The following function is used to return the configured system    */
    /* clock speed in MHz.                                               */
 unsigned long HAL_GetSystemSpeed(void);
@@ -53,6 +209,41 @@ unsigned long HAL_GetSystemSpeed(void);
    /* This function is called to get the system Tick Count.             */
 unsigned long HAL_GetTickCount(void);
 
+   /* The following function returns a free running 16 bit time stamp   */
+   /* in ACLK periods (1/32768 second).  The time stamp does not advance*/
+   /* while the system timer is stopped by HAL_LowPowerMode().          */
+Word_t HAL_GetTimestamp(void);
+
+   /* The following function is used to start a latency trace sample.   */
+   /* The next byte received on the Debug UART is time stamped and then */
+   /* each following HAL_TRACE_STAGE_XXX stage the first time it is     */
+   /* passed.  This function returns TRUE if a sample that was still in */
+   /* progress was discarded.                                           */
+Boolean_t HAL_TraceArm(void);
+
+   /* The following function is used to time stamp the specified stage  */
+   /* of the current latency trace sample.  The stage is only recorded  */
+   /* when it is the next stage of a sample in progress, so the cost    */
+   /* while no sample is in progress is a single compare.               */
+   /* * NOTE * This function may be called from interrupt context.      */
+void HAL_TraceStamp(unsigned int Stage);
+
+   /* The following function is used to collect a completed latency     */
+   /* trace sample.  If a sample has passed every stage its time stamps */
+   /* (HAL_TRACE_NUMBER_STAGES entries) are copied to Timestamps and    */
+   /* the function returns TRUE, otherwise it returns FALSE.            */
+Boolean_t HAL_TraceGetSample(Word_t *Timestamps);
+
+   /* The following function is used to record the tick count at the    */
+   /* specified HAL_BOOT_STAGE_XXX event of the boot.  The tick count   */
+   /* starts when HAL_ConfigureHardware() has set up the clocks.        */
+void HAL_BootStamp(unsigned int Stage);
+
+   /* The following function returns the tick count that was recorded   */
+   /* for the specified event of the boot, or zero if it has not        */
+   /* happened.                                                         */
+unsigned long HAL_GetBootStamp(unsigned int Stage);
+
    /* The following function is used to toggle the state of an LED.  The*/
    /* number of LEDs on a board is board specific.  If the LED_ID       */
    /* provided does not exist on the hardware platform then nothing is  */
@@ -70,6 +70,48 @@ typedef enum
    /* The DEBUG UART Baudrate, must be in range supported by chip.      */
 #define BT_DEBUG_UART_BAUDRATE         9600L
 
+   /* The following are the flow control methods that may be specified  */
+   /* in the BT_DEBUG_UART_FLOW_CONTROL macro.                          */
+#define BT_DEBUG_UART_FLOW_NONE        0
+#define BT_DEBUG_UART_FLOW_RTS_CTS     1
+#define BT_DEBUG_UART_FLOW_XON_XOFF    2
+
+   /* The flow control method used on the DEBUG UART.  This defaults to */
+   /* none as the RTS/CTS lines (P10.6 and P10.7) are not wired on every*/
+   /* board, RTS/CTS is selected by defining BT_DEBUG_UART_FLOW_CONTROL */
+   /* as BT_DEBUG_UART_FLOW_RTS_CTS in the build options.               */
+   /* * NOTE * XON/XOFF flow control requires a transmit buffer and is  */
+   /*          NOT safe for the SPP and LE bridge, which carries binary */
+   /*          data (any XON/XOFF byte in the data is taken as flow     */
+   /*          control).  It should only be used if the data sent over  */
+   /*          the DEBUG UART never contains the XON/XOFF characters.   */
+#ifndef BT_DEBUG_UART_FLOW_CONTROL
+   #define BT_DEBUG_UART_FLOW_CONTROL  (BT_DEBUG_UART_FLOW_NONE)
+#endif
+
+   /* The default number of free bytes in the DEBUG UART receive buffer */
+   /* at (or below) which the host is told to stop sending.  This must  */
+   /* be large enough to absorb the characters the host sends before it */
+   /* reacts.                                                           */
+#define BT_DEBUG_UART_FLOW_STOP_THRESHOLD   64
+
+   /* The default number of free bytes in the DEBUG UART receive buffer */
+   /* at (or above) which the host is told that it may resume sending.  */
+#define BT_DEBUG_UART_FLOW_RESUME_THRESHOLD 256
+
+   /* The DEBUG UART Flow Control I/O Pin Base.  Should be set to the   */
+   /* address of the Input register of the I/O Port where the RTS/CTS   */
+   /* pins are located.                                                 */
+#define BT_DEBUG_UART_FLOW_PIN_BASE    ((unsigned int)&P10IN)
+
+   /* The DEBUG UART RTS Output Pin Mask (driven high to stop the host).*/
+#define BT_DEBUG_UART_RTS_PIN          (BIT6)
+
+   /* The DEBUG UART CTS Input Pin Mask (high when the host is unable to*/
+   /* receive).  The pin is pulled down so that an unconnected CTS line */
+   /* does not stop the transmitter.                                    */
+#define BT_DEBUG_UART_CTS_PIN          (BIT7)
+
 /******************************************************************************/
 /** The following defines control the Bluetooth Slow Clock Line.             **/
 /******************************************************************************/
@@ -220,4 +262,28 @@ typedef enum
    /* for use by the module.  (Rather than GPIO).                       */
 #define BT_CONFIG_UART_PINS()          GPIOPinTypeUART(BT_UART_PIN_PORT_BASE, BT_UART_PIN_TX,BT_UART_PIN_RX)
 
+   /* The following macro is used to configure the DEBUG UART RTS/CTS   */
+   /* Flow Control Pins.  The DEBUG UART pins are not on an interrupt   */
+   /* capable port, so the CTS line is polled.                          */
+#define BT_DEBUG_CONFIG_FLOW_PINS()                                                                                              \
+{                                                                                                                                \
+   HWREG8((BT_DEBUG_UART_FLOW_PIN_BASE) + MSP430F5438_GPIO_PSEL_OFFSET)   &= (~(BT_DEBUG_UART_RTS_PIN | BT_DEBUG_UART_CTS_PIN)); \
+   HWREG8((BT_DEBUG_UART_FLOW_PIN_BASE) + MSP430F5438_GPIO_OUTPUT_OFFSET) &= (~(BT_DEBUG_UART_RTS_PIN | BT_DEBUG_UART_CTS_PIN)); \
+   HWREG8((BT_DEBUG_UART_FLOW_PIN_BASE) + MSP430F5438_GPIO_DIR_OFFSET)    |= (BT_DEBUG_UART_RTS_PIN);                            \
+   HWREG8((BT_DEBUG_UART_FLOW_PIN_BASE) + MSP430F5438_GPIO_DIR_OFFSET)    &= (~(BT_DEBUG_UART_CTS_PIN));                         \
+   HWREG8((BT_DEBUG_UART_FLOW_PIN_BASE) + MSP430F5438_GPIO_RESEN_OFFSET)  |= (BT_DEBUG_UART_CTS_PIN);                            \
+}
+
+   /* The following is used to tell the host to stop sending on the     */
+   /* DEBUG UART.                                                       */
+#define BT_DEBUG_DISABLE_FLOW()        HWREG8((BT_DEBUG_UART_FLOW_PIN_BASE) + MSP430F5438_GPIO_OUTPUT_OFFSET) |= (BT_DEBUG_UART_RTS_PIN)
+
+   /* The following is used to tell the host that it may send on the    */
+   /* DEBUG UART.                                                       */
+#define BT_DEBUG_ENABLE_FLOW()         HWREG8((BT_DEBUG_UART_FLOW_PIN_BASE) + MSP430F5438_GPIO_OUTPUT_OFFSET) &= (~(BT_DEBUG_UART_RTS_PIN))
+
+   /* The following macro returns Non-Zero if the host is currently     */
+   /* unable to receive on the DEBUG UART.                              */
+#define BT_DEBUG_CTS_READ()            (GPIORead(BT_DEBUG_UART_FLOW_PIN_BASE) & (BT_DEBUG_UART_CTS_PIN))
+
 #endif
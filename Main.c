@@ -14,11 +14,12 @@
 #include "EHCILL.h"
 #include "HRDWCFG.h"
 
-#define HCILL_MODE_INACTIVITY_TIMEOUT              (500)
-#define HCILL_MODE_RETRANSMIT_TIMEOUT              (100)
-
+/* Debug output is written without blocking so that a full console   */
+/* transmit buffer never stalls the Bluetooth stack; characters that */
+/* do not fit are dropped.  When the UART is framed the output is    */
+/* carried on the log channel.                                       */
 static void DisplayCallback(char Character) {
-	HAL_ConsoleWrite(1, &Character);
+	DisplayCharacter(Character);
 }
 
 static unsigned long GetTickCallback(void) {
@@ -28,10 +29,14 @@ static unsigned long GetTickCallback(void) {
 static void MainThread(void) {
 	unsigned int BluetoothStackID;
 	int Result;
+	Word_t InactivityTimeout;
+	Word_t RetransmitTimeout;
 	BTPS_Initialization_t BTPS_Initialization;
 	HCI_DriverInformation_t HCI_DriverInformation;
 
-	/* Configure the UART Parameters.                                    */
+	/* Configure the UART Parameters.  The controller is used as soon as */
+	/* it signals that it is ready, the initialization delay is only the */
+	/* longest time to wait for it.                                      */
 	HCI_DRIVER_SET_COMM_INFORMATION(&HCI_DriverInformation, 1, 115200, cpUART);
 	HCI_DriverInformation.DriverInformation.COMMDriverInformation.InitializationDelay =
 			100;
@@ -46,10 +51,12 @@ static void MainThread(void) {
 		/* Save the Bluetooth Stack ID.                                   */
 		BluetoothStackID = (unsigned int) Result;
 
-		/* Go ahead an enable HCILL Mode.                                 */
+		/* Go ahead an enable HCILL Mode (with the configured timeouts).  */
+		GetHCILLTimeouts(&InactivityTimeout, &RetransmitTimeout);
+
 		HCILL_Init();
-		HCILL_Configure(BluetoothStackID, HCILL_MODE_INACTIVITY_TIMEOUT,
-				HCILL_MODE_RETRANSMIT_TIMEOUT, TRUE);
+		HCILL_Configure(BluetoothStackID, InactivityTimeout, RetransmitTimeout,
+				TRUE);
 
 		/* Call the main application state machine.                       */
 		while (1) {
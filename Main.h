@@ -22,6 +22,10 @@
 #define APPLICATION_ERROR_INVALID_PARAMETERS             (-1000)
 #define APPLICATION_ERROR_UNABLE_TO_OPEN_STACK           (-1001)
 
+   /* The following define the default HCILL timeouts (in milliseconds).*/
+#define HCILL_MODE_INACTIVITY_TIMEOUT                    (500)
+#define HCILL_MODE_RETRANSMIT_TIMEOUT                    (100)
+
    /* The following function is used to initialize the application      */
    /* instance.  This function should open the stack and prepare to     */
    /* execute commands based on user input.  The first parameter passed */
@@ -40,5 +44,17 @@ void ApplicationMain(void);
    /* must be sent.                                                     */
 void DataSendCallback(void *param);
 
+   /* The following function is used to retrieve the HCILL timeouts (in */
+   /* milliseconds) that should be used when HCILL is configured.  These*/
+   /* may differ from the defaults if they were changed at runtime and  */
+   /* saved.                                                            */
+void GetHCILLTimeouts(Word_t *InactivityTimeout, Word_t *RetransmitTimeout);
+
+   /* The following function is used to write a character of the debug  */
+   /* output, the stack's message output callback passes each character */
+   /* to it.  The character is sent on the log channel when the UART is */
+   /* framed.  This function never blocks.                              */
+void DisplayCharacter(char Character);
+
 #endif
 
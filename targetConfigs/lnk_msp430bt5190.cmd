@@ -28,7 +28,8 @@ MEMORY
     INFOB                   : origin = 0x1900, length = 0x0080
     INFOC                   : origin = 0x1880, length = 0x0080
     INFOD                   : origin = 0x1800, length = 0x0080
-    FLASH                   : origin = 0x5C00, length = 0xA380
+    BONDSTORE               : origin = 0x5C00, length = 0x0400
+    FLASH                   : origin = 0x6000, length = 0x9F80
     FLASH2                  : origin = 0x10000,length = 0x35C00
     INT00                   : origin = 0xFF80, length = 0x0002
     INT01                   : origin = 0xFF82, length = 0x0002
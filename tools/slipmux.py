@@ -0,0 +1,419 @@
+#!/usr/bin/env python3
+"""Reference host client for the framed UART of trunks (AT+FRAMING=1).
+
+When framing is enabled every transfer on the UART is a SLIP (RFC 1055)
+frame of the form END | Header | Payload | END.  The low nibble of the
+header is the channel and the high nibble the frame type (data or
+credit).  This client demultiplexes the channels of the board:
+
+    SPP, LE, SPP port N  - each is given a pty (raw mode) so that any
+                           program (minicom, socat, spptest.py, ...)
+                           can use the bridged data stream.
+    CONTROL              - commands are read from stdin, one per line,
+                           and the responses are written to stdout.
+    LOG                  - the debug output is written to stderr.
+
+Each side starts with INITIAL_CREDITS credits per channel and may only
+send a data frame on a channel for which it holds a credit.  The client
+returns the credit of a frame from the board only once the frame has
+been written to its pty, so a channel whose pty is not read stops on
+its own without blocking the others.  Data is only read from a pty while
+the board has granted a credit on its channel.  Control responses are
+sent by the board without credits.
+
+Usage:
+
+    slipmux.py /dev/ttyACM0 --baud 9600 --enable --links /tmp/trunks
+
+--enable switches a board that is in (raw) data mode to framing with the
++++ escape and AT+FRAMING=1.  A board that already starts framed (the
+setting was saved with AT&W) must be used right after its reset (or with
+--reset) so that both sides start with the initial credits.
+"""
+
+import argparse
+import os
+import select
+import signal
+import sys
+import termios
+import time
+import tty
+
+SLIP_END = 0xC0
+SLIP_ESC = 0xDB
+SLIP_ESC_END = 0xDC
+SLIP_ESC_ESC = 0xDD
+
+CHANNEL_SPP = 0x00
+CHANNEL_LE = 0x01
+CHANNEL_CONTROL = 0x02
+CHANNEL_LOG = 0x03
+CHANNEL_SPP_PORT = 0x04
+SPP_MAXIMUM_ADDITIONAL_PORTS = 2
+NUMBER_CHANNELS = 4 + SPP_MAXIMUM_ADDITIONAL_PORTS
+
+CHANNEL_MASK = 0x0F
+TYPE_MASK = 0xF0
+TYPE_DATA = 0x00
+TYPE_CREDIT = 0x10
+
+MAXIMUM_PAYLOAD = 64
+INITIAL_CREDITS = 2
+
+ESCAPE_SEQUENCE = b"+++"
+ESCAPE_GUARD_TIME = 1.0
+
+# The board checks the escape guard time once a second, so allow for
+# that on top of the guard time.
+ESCAPE_WAIT = ESCAPE_GUARD_TIME + 1.5
+
+
+def channel_name(channel):
+    if channel == CHANNEL_SPP:
+        return "spp"
+    if channel == CHANNEL_LE:
+        return "le"
+    if channel == CHANNEL_CONTROL:
+        return "control"
+    if channel == CHANNEL_LOG:
+        return "log"
+    return "port%d" % (channel - CHANNEL_SPP_PORT)
+
+
+def slip_encode(header, payload=b""):
+    """Return the SLIP encoding of a frame with the given header."""
+    frame = bytearray([SLIP_END])
+    for byte in bytes([header]) + bytes(payload):
+        if byte == SLIP_END:
+            frame += bytes([SLIP_ESC, SLIP_ESC_END])
+        elif byte == SLIP_ESC:
+            frame += bytes([SLIP_ESC, SLIP_ESC_ESC])
+        else:
+            frame.append(byte)
+    frame.append(SLIP_END)
+    return bytes(frame)
+
+
+class SlipDecoder:
+    """Collects the frames received on the UART.
+
+    Frames that are too long or hold an invalid escape are dropped, the
+    same as on the board.
+    """
+
+    def __init__(self):
+        self.frame = bytearray()
+        self.escape = False
+        self.error = False
+        self.dropped = 0
+
+    def feed(self, data):
+        frames = []
+        for byte in data:
+            if byte == SLIP_END:
+                if self.error or self.escape:
+                    self.dropped += 1
+                elif self.frame:
+                    frames.append(bytes(self.frame))
+                self.frame = bytearray()
+                self.escape = False
+                self.error = False
+            elif byte == SLIP_ESC:
+                self.escape = True
+            else:
+                if self.escape:
+                    if byte == SLIP_ESC_END:
+                        byte = SLIP_END
+                    elif byte == SLIP_ESC_ESC:
+                        byte = SLIP_ESC
+                    else:
+                        self.error = True
+                    self.escape = False
+                if len(self.frame) < MAXIMUM_PAYLOAD + 1:
+                    self.frame.append(byte)
+                else:
+                    self.error = True
+        return frames
+
+
+class DataChannel:
+    """A data channel bridged to a pty."""
+
+    def __init__(self, channel, link_prefix):
+        self.channel = channel
+        self.master, self.slave = os.openpty()
+        # Keep the slave open so the master does not report EIO while no
+        # program has the pty open, and make it a raw byte stream.
+        tty.setraw(self.slave)
+        os.set_blocking(self.master, False)
+        self.path = os.ttyname(self.slave)
+        self.link = None
+        if link_prefix:
+            self.link = "%s-%s" % (link_prefix, channel_name(channel))
+            if os.path.islink(self.link):
+                os.unlink(self.link)
+            os.symlink(self.path, self.link)
+
+        # Frames from the board waiting to be written to the pty.
+        self.pending = []
+
+    def close(self):
+        if self.link and os.path.islink(self.link):
+            os.unlink(self.link)
+        os.close(self.master)
+        os.close(self.slave)
+
+
+class Mux:
+    def __init__(self, uart, link_prefix, window):
+        self.uart = uart
+        self.decoder = SlipDecoder()
+        self.window = window
+        self.tx_credits = [INITIAL_CREDITS] * NUMBER_CHANNELS
+        self.rx_credits = [INITIAL_CREDITS] * NUMBER_CHANNELS
+        self.returned = [0] * NUMBER_CHANNELS
+        self.control_queue = []
+        self.stdin_buffer = b""
+        self.frames_sent = 0
+        self.frames_received = 0
+        self.frames_dropped = 0
+        self.channels = {}
+        for channel in [CHANNEL_SPP, CHANNEL_LE] + [
+                CHANNEL_SPP_PORT + index
+                for index in range(SPP_MAXIMUM_ADDITIONAL_PORTS)]:
+            self.channels[channel] = DataChannel(channel, link_prefix)
+
+    def close(self):
+        for data_channel in self.channels.values():
+            data_channel.close()
+
+    def send_frame(self, header, payload=b""):
+        data = slip_encode(header, payload)
+        while data:
+            select.select([], [self.uart], [])
+            data = data[os.write(self.uart, data):]
+        self.frames_sent += 1
+
+    def grant_credits(self, channel, credits):
+        while credits:
+            count = min(credits, 0xFF - self.rx_credits[channel])
+            if not count:
+                break
+            self.send_frame(TYPE_CREDIT | channel, bytes([count]))
+            self.rx_credits[channel] += count
+            credits -= count
+
+    def open_window(self):
+        """Grant the board more than the initial credits on the channels
+        that carry data to the host."""
+        for channel in list(self.channels) + [CHANNEL_LOG]:
+            if self.window > INITIAL_CREDITS:
+                self.grant_credits(channel, self.window - INITIAL_CREDITS)
+
+    def handle_frame(self, frame):
+        self.frames_received += 1
+        header = frame[0]
+        channel = header & CHANNEL_MASK
+        payload = frame[1:]
+
+        if channel >= NUMBER_CHANNELS:
+            self.frames_dropped += 1
+        elif (header & TYPE_MASK) == TYPE_CREDIT:
+            if len(payload) == 1:
+                self.tx_credits[channel] += payload[0]
+            else:
+                self.frames_dropped += 1
+        elif (header & TYPE_MASK) == TYPE_DATA:
+            if channel == CHANNEL_CONTROL:
+                # Responses are sent without credits.
+                sys.stdout.write(payload.decode("latin-1"))
+                sys.stdout.flush()
+            else:
+                self.rx_credits[channel] -= 1
+                if channel == CHANNEL_LOG:
+                    sys.stderr.write(payload.decode("latin-1"))
+                    sys.stderr.flush()
+                    self.returned[channel] += 1
+                else:
+                    self.channels[channel].pending.append(bytearray(payload))
+        else:
+            self.frames_dropped += 1
+
+    def write_ptys(self):
+        for data_channel in self.channels.values():
+            while data_channel.pending:
+                data = data_channel.pending[0]
+                try:
+                    count = os.write(data_channel.master, data)
+                except BlockingIOError:
+                    break
+                del data[:count]
+                if data:
+                    break
+                data_channel.pending.pop(0)
+                self.returned[data_channel.channel] += 1
+
+        # Return the credits of the frames that have been consumed.
+        for channel in range(NUMBER_CHANNELS):
+            if self.returned[channel]:
+                credits = self.returned[channel]
+                self.returned[channel] = 0
+                self.grant_credits(channel, credits)
+
+    def read_pty(self, data_channel):
+        try:
+            data = os.read(data_channel.master, MAXIMUM_PAYLOAD)
+        except (BlockingIOError, OSError):
+            return
+        if data:
+            self.send_frame(TYPE_DATA | data_channel.channel, data)
+            self.tx_credits[data_channel.channel] -= 1
+
+    def read_stdin(self):
+        data = os.read(sys.stdin.fileno(), 256)
+        if not data:
+            return False
+        self.stdin_buffer += data
+        while b"\n" in self.stdin_buffer:
+            line, self.stdin_buffer = self.stdin_buffer.split(b"\n", 1)
+            line = line.rstrip(b"\r")
+            if line:
+                self.control_queue.append(line + b"\r")
+        return True
+
+    def send_control(self):
+        while self.control_queue and self.tx_credits[CHANNEL_CONTROL]:
+            self.send_frame(TYPE_DATA | CHANNEL_CONTROL,
+                            self.control_queue.pop(0))
+            self.tx_credits[CHANNEL_CONTROL] -= 1
+
+    def run(self):
+        stdin_open = True
+        self.open_window()
+        while True:
+            readers = [self.uart]
+            if stdin_open:
+                readers.append(sys.stdin.fileno())
+            writers = []
+            for data_channel in self.channels.values():
+                # Only take data from a pty that may be sent.
+                if self.tx_credits[data_channel.channel]:
+                    readers.append(data_channel.master)
+                if data_channel.pending:
+                    writers.append(data_channel.master)
+
+            readable, _, _ = select.select(readers, writers, [], 1.0)
+
+            if self.uart in readable:
+                for frame in self.decoder.feed(os.read(self.uart, 1024)):
+                    self.handle_frame(frame)
+
+            if stdin_open and sys.stdin.fileno() in readable:
+                stdin_open = self.read_stdin()
+
+            for data_channel in self.channels.values():
+                if ((data_channel.master in readable)
+                        and self.tx_credits[data_channel.channel]):
+                    self.read_pty(data_channel)
+
+            self.send_control()
+            self.write_ptys()
+
+
+def open_uart(path, baud):
+    uart = os.open(path, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+    tty.setraw(uart)
+    attributes = termios.tcgetattr(uart)
+    speed = getattr(termios, "B%d" % baud)
+    attributes[4] = speed
+    attributes[5] = speed
+    attributes[2] |= termios.CLOCAL | termios.CREAD
+    termios.tcsetattr(uart, termios.TCSANOW, attributes)
+    termios.tcflush(uart, termios.TCIOFLUSH)
+    return uart
+
+
+def read_until(uart, token, timeout):
+    data = b""
+    end = time.monotonic() + timeout
+    while token not in data:
+        remaining = end - time.monotonic()
+        if remaining <= 0:
+            break
+        if select.select([uart], [], [], remaining)[0]:
+            data += os.read(uart, 256)
+    return data
+
+
+def enable_framing(uart):
+    """Switch a board in raw data mode to framing, returns True on
+    success."""
+    time.sleep(ESCAPE_GUARD_TIME + 0.2)
+    os.write(uart, ESCAPE_SEQUENCE + b"\xff")
+    time.sleep(ESCAPE_WAIT)
+    termios.tcflush(uart, termios.TCIFLUSH)
+    os.write(uart, b"AT+FRAMING=1\r")
+    response = read_until(uart, b"OK\r\n", 2.0)
+    termios.tcflush(uart, termios.TCIFLUSH)
+    return b"OK\r\n" in response
+
+
+def reset_board(uart, wait):
+    """Reset a framed board so that both sides start with the initial
+    credits."""
+    os.write(uart, slip_encode(TYPE_DATA | CHANNEL_CONTROL, b"ATZ\r"))
+    time.sleep(wait)
+    termios.tcflush(uart, termios.TCIFLUSH)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Demultiplex the framed UART of trunks onto ptys.")
+    parser.add_argument("uart", help="serial device of the board")
+    parser.add_argument("--baud", type=int, default=9600,
+                        help="UART baud rate (default 9600)")
+    parser.add_argument("--enable", action="store_true",
+                        help="switch the board from data mode to framing")
+    parser.add_argument("--reset", action="store_true",
+                        help="reset a framed board before starting")
+    parser.add_argument("--reset-wait", type=float, default=5.0,
+                        help="seconds to wait for the board to restart")
+    parser.add_argument("--links", metavar="PREFIX",
+                        help="create PREFIX-spp, PREFIX-le, ... symlinks "
+                        "to the ptys")
+    parser.add_argument("--window", type=int, default=4,
+                        help="frames the board may send ahead on each "
+                        "channel (default 4)")
+    args = parser.parse_args()
+
+    uart = open_uart(args.uart, args.baud)
+
+    if args.enable and not enable_framing(uart):
+        sys.exit("The board did not accept AT+FRAMING=1.")
+
+    if args.reset:
+        reset_board(uart, args.reset_wait)
+
+    mux = Mux(uart, args.links, max(args.window, INITIAL_CREDITS))
+    for data_channel in mux.channels.values():
+        print("%-7s %s" % (channel_name(data_channel.channel),
+                           data_channel.link or data_channel.path),
+              file=sys.stderr)
+
+    signal.signal(signal.SIGTERM, lambda signum, frame: sys.exit(0))
+
+    try:
+        mux.run()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        print("Frames sent %d, received %d, dropped %d." %
+              (mux.frames_sent, mux.frames_received,
+               mux.frames_dropped + mux.decoder.dropped), file=sys.stderr)
+        mux.close()
+        os.close(uart)
+
+
+if __name__ == "__main__":
+    main()
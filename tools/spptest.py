@@ -0,0 +1,286 @@
+#!/usr/bin/env python3
+"""Linux peer for the SPP test modes of trunks (AT+SPPTEST).
+
+The board is put in a test mode with AT+SPPTEST=<mode> and this script
+plays the other end of the SPP link:
+
+    GENERATE  - the board sends the pattern, the script reads and checks
+                it.
+    SINK      - the script sends the pattern, the board checks it.
+    LOOPBACK  - the script sends the pattern and checks the echo.
+
+The pattern is a byte stream in which each byte is one more (modulo
+256) than the previous one.  The checks resynchronize on an error in
+the same way as the board.  The bytes per second sent, received and
+good (pattern correct or echoed correctly) are reported every second,
+followed by the number of pattern errors.  Compare them with the
++SPPTEST lines of the board.
+
+The link is an RFCOMM socket (--rfcomm), a tty such as /dev/rfcommN
+or a pty of slipmux.py (--tty), or a simulated board that runs in this
+script (--simulate), which is useful to check the script itself.
+
+Usage:
+
+    spptest.py loopback --rfcomm 00:11:22:33:44:55 --channel 1
+    spptest.py generate --tty /dev/rfcomm0 --duration 30
+    spptest.py sink --simulate --rate 20000
+"""
+
+import argparse
+import os
+import select
+import socket
+import sys
+import threading
+import time
+import tty
+
+MODES = ("generate", "sink", "loopback")
+
+BLOCK_SIZE = 512
+REPORT_PERIOD = 1.0
+
+
+def pattern(start, length):
+    """Return length bytes of the pattern starting with start."""
+    return bytes((start + index) & 0xFF for index in range(length))
+
+
+class PatternChecker:
+    """Checks a received pattern, resynchronizing on every byte."""
+
+    def __init__(self):
+        self.expected = 0
+        self.good = 0
+        self.errors = 0
+
+    def check(self, data):
+        for byte in data:
+            if byte == self.expected:
+                self.good += 1
+            else:
+                self.errors += 1
+            self.expected = (byte + 1) & 0xFF
+
+
+class EchoChecker:
+    """Compares the echo with the bytes that were sent."""
+
+    def __init__(self):
+        self.sent = bytearray()
+        self.good = 0
+        self.errors = 0
+
+    def add_sent(self, data):
+        self.sent += data
+
+    def check(self, data):
+        for byte in data:
+            if self.sent and byte == self.sent[0]:
+                self.good += 1
+            else:
+                self.errors += 1
+            if self.sent:
+                del self.sent[0]
+
+
+def simulate_board(link, mode, rate):
+    """Runs a stand-in for the board in the given test mode on one end of
+    a socket pair, limited to rate bytes per second (0 for no limit)."""
+    transmit = 0
+    checker = PatternChecker()
+    echo = bytearray()
+    allowance = float(BLOCK_SIZE)
+    last = time.monotonic()
+
+    link.setblocking(False)
+    while True:
+        now = time.monotonic()
+        if rate:
+            allowance = min(allowance + (now - last) * rate, rate)
+        else:
+            allowance = float(BLOCK_SIZE)
+        last = now
+        budget = max(int(min(allowance, BLOCK_SIZE)), 0)
+
+        want_write = (mode == "generate") or (mode == "loopback" and echo)
+        readable, writable, _ = select.select(
+            [link] if budget else [],
+            [link] if (want_write and budget) else [], [], 0.01)
+
+        if link in readable:
+            try:
+                data = link.recv(budget)
+            except BlockingIOError:
+                data = None
+            except OSError:
+                return
+            if data == b"":
+                return
+            if data:
+                if rate:
+                    allowance -= len(data)
+                if mode == "sink":
+                    checker.check(data)
+                elif mode == "loopback":
+                    echo += data
+
+        if link in writable:
+            if mode == "generate":
+                data = pattern(transmit, budget)
+            else:
+                data = bytes(echo[:budget])
+            try:
+                count = link.send(data)
+            except BlockingIOError:
+                count = 0
+            except OSError:
+                return
+            if rate:
+                allowance -= count
+            if mode == "generate":
+                transmit = (transmit + count) & 0xFF
+            else:
+                del echo[:count]
+
+
+def open_link(args):
+    """Returns the file descriptor of the link to the board (and the
+    object that must be kept open with it)."""
+    if args.rfcomm:
+        link = socket.socket(socket.AF_BLUETOOTH, socket.SOCK_STREAM,
+                             socket.BTPROTO_RFCOMM)
+        link.connect((args.rfcomm, args.channel))
+        link.setblocking(False)
+        return link.fileno(), link
+
+    if args.tty:
+        descriptor = os.open(args.tty, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(descriptor)
+        os.set_blocking(descriptor, False)
+        return descriptor, None
+
+    local, remote = socket.socketpair()
+    threading.Thread(target=simulate_board,
+                     args=(remote, args.mode, args.rate),
+                     daemon=True).start()
+    local.setblocking(False)
+    return local.fileno(), local
+
+
+def run(descriptor, mode, duration):
+    transmit = 0
+    totals = {"sent": 0, "received": 0}
+    period = {"sent": 0, "received": 0, "good": 0}
+    checker = EchoChecker() if mode == "loopback" else PatternChecker()
+    send = mode in ("sink", "loopback")
+
+    start = time.monotonic()
+    report = start + REPORT_PERIOD
+    last_good = 0
+
+    print("seconds  sent B/s  received B/s  good B/s  errors")
+
+    try:
+        while (not duration) or (time.monotonic() - start < duration):
+            timeout = max(report - time.monotonic(), 0)
+            readable, writable, _ = select.select(
+                [descriptor], [descriptor] if send else [], [], timeout)
+
+            if descriptor in readable:
+                try:
+                    data = os.read(descriptor, BLOCK_SIZE)
+                except BlockingIOError:
+                    data = None
+                if data == b"":
+                    print("The link was closed.", file=sys.stderr)
+                    break
+                if data:
+                    if mode != "sink":
+                        checker.check(data)
+                    period["received"] += len(data)
+
+            if descriptor in writable:
+                data = pattern(transmit, BLOCK_SIZE)
+                try:
+                    count = os.write(descriptor, data)
+                except BlockingIOError:
+                    count = 0
+                if count:
+                    if mode == "loopback":
+                        checker.add_sent(data[:count])
+                    transmit = (transmit + count) & 0xFF
+                    period["sent"] += count
+
+            now = time.monotonic()
+            if now >= report:
+                elapsed = now - report + REPORT_PERIOD
+                if mode == "sink":
+                    # The board checks the pattern and reports the errors.
+                    period["good"] = period["sent"]
+                else:
+                    period["good"] = checker.good - last_good
+                    last_good = checker.good
+                print("%7.0f  %8.0f  %12.0f  %8.0f  %6d" %
+                      (now - start, period["sent"] / elapsed,
+                       period["received"] / elapsed,
+                       period["good"] / elapsed,
+                       0 if mode == "sink" else checker.errors))
+                sys.stdout.flush()
+                for key in totals:
+                    totals[key] += period[key]
+                period = {"sent": 0, "received": 0, "good": 0}
+                report = now + REPORT_PERIOD
+    except KeyboardInterrupt:
+        pass
+
+    for key in totals:
+        totals[key] += period[key]
+
+    elapsed = time.monotonic() - start
+    print("Total: sent %d, received %d in %.1f s (%.0f B/s sent, %.0f B/s "
+          "received)." % (totals["sent"], totals["received"], elapsed,
+                          totals["sent"] / elapsed,
+                          totals["received"] / elapsed))
+    if mode != "sink":
+        print("Pattern errors: %d." % checker.errors)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Peer for the SPP test modes of trunks.")
+    parser.add_argument("mode", choices=MODES,
+                        help="test mode of the board (AT+SPPTEST)")
+    link = parser.add_mutually_exclusive_group(required=True)
+    link.add_argument("--rfcomm", metavar="BD_ADDR",
+                      help="connect an RFCOMM socket to the board")
+    link.add_argument("--tty", metavar="PATH",
+                      help="use a tty (/dev/rfcommN or a slipmux.py pty)")
+    link.add_argument("--simulate", action="store_true",
+                      help="run against a simulated board")
+    parser.add_argument("--channel", type=int, default=1,
+                        help="RFCOMM channel of the board (default 1)")
+    parser.add_argument("--rate", type=int, default=0,
+                        help="bytes per second of the simulated board "
+                        "(default no limit)")
+    parser.add_argument("--duration", type=float, default=0,
+                        help="seconds to run (default until interrupted)")
+    args = parser.parse_args()
+
+    descriptor, keep = open_link(args)
+    if not args.simulate:
+        print("Start the test on the board with AT+SPPTEST=%s." %
+              args.mode.upper(), file=sys.stderr)
+
+    try:
+        run(descriptor, args.mode, args.duration)
+    finally:
+        if keep is not None:
+            keep.close()
+        elif args.tty:
+            os.close(descriptor)
+
+
+if __name__ == "__main__":
+    main()
@@ -21,9 +21,15 @@
 #include "HCITRANS.h"            /* HCI Transport Layer Header.               */
 #include "HRDWCFG.h"             /* Hardware Configuration.                   */
 
-#define MAX_SUPPORTED_LINK_KEYS                    (1)   /* Max supported Link*/
+#define MAX_SUPPORTED_LINK_KEYS                    (4)   /* Max supported Link*/
 /* keys.             */
 
+#define MAX_SUPPORTED_LE_BONDS                     (4)   /* Max supported LE  */
+/* bonds.            */
+
+#define MAX_SUPPORTED_DEVICES                      (4)   /* Max number of LE  */
+/* devices tracked.  */
+
 #define FUNCTION_ERROR                             (-4)  /* Denotes that an   */
 /* error occurred in */
 /* execution of the  */
@@ -62,21 +68,560 @@
 /* controls the SPP  */
 /* Buffer Size.      */
 
-/* Determine the Name we will use for this compilation.              */
+#define SPP_RECEIVE_BUFFER_SIZE                   64     /* The following     */
+/* controls the size */
+/* of the buffer used*/
+/* to move SPP data  */
+/* to the UART.      */
+
+#define SPP_HONOR_REMOTE_FLOW_CONTROL             1      /* Stop sending SPP  */
+/* data while the    */
+/* remote has cleared*/
+/* its RTS/CTS status*/
+/* bit.              */
+
+/* The following define the additional SPP server ports.  Up to      */
+/* SPP_MAXIMUM_ADDITIONAL_PORTS ports (AT+SPPPORTS) are opened on the*/
+/* RFCOMM channels following the bridge port.  As they share the     */
+/* wired port with the bridge port their data is only carried while  */
+/* the UART is framed, each port on its own channel starting at      */
+/* UART_FRAMING_CHANNEL_SPP_PORT.  Each port has a transmit ring for */
+/* the data from the host (at least UART_FRAMING_INITIAL_CREDITS     */
+/* frames) and a receive buffer for the data to the host.            */
+#define SPP_MAXIMUM_ADDITIONAL_PORTS               2
+#define SPP_DEFAULT_ADDITIONAL_PORTS               0
+#define SPP_PORT_TRANSMIT_BUFFER_SIZE              128
+#define SPP_PORT_RECEIVE_BUFFER_SIZE               64
+
+/* The following define the optional framing used on the UART.  When */
+/* framing is enabled every transfer on the UART is a SLIP (RFC 1055)*/
+/* frame of the form:                                                */
+/*                                                                   */
+/*    END | Header | Payload ... | END                               */
+/*                                                                   */
+/* The low nibble of the Header is the channel and the high nibble is*/
+/* the frame type.  Data frames carry up to                          */
+/* UART_FRAMING_MAXIMUM_PAYLOAD bytes of channel data.  Credit frames*/
+/* carry a single byte that grants the receiver that many more data  */
+/* frames on the channel.  Each side starts with                     */
+/* UART_FRAMING_INITIAL_CREDITS credits per channel and must not send*/
+/* a data frame on a channel for which it holds no credit, so that a */
+/* stalled channel never blocks the others.  Log frames are dropped  */
+/* rather than waiting for credits.  Control responses are sent      */
+/* without credits, the host must read the whole response to a      */
+/* command (the control channel credits only govern the commands).   */
+#define UART_FRAMING_SLIP_END                      0xC0
+#define UART_FRAMING_SLIP_ESC                      0xDB
+#define UART_FRAMING_SLIP_ESC_END                  0xDC
+#define UART_FRAMING_SLIP_ESC_ESC                  0xDD
+
+#define UART_FRAMING_CHANNEL_SPP                   0x00
+#define UART_FRAMING_CHANNEL_LE                    0x01
+#define UART_FRAMING_CHANNEL_CONTROL               0x02
+#define UART_FRAMING_CHANNEL_LOG                   0x03
+#define UART_FRAMING_CHANNEL_SPP_PORT              0x04
+#define UART_FRAMING_NUMBER_CHANNELS               (4 + SPP_MAXIMUM_ADDITIONAL_PORTS)
+
+#define UART_FRAMING_CHANNEL_MASK                  0x0F
+#define UART_FRAMING_TYPE_MASK                     0xF0
+#define UART_FRAMING_TYPE_DATA                     0x00
+#define UART_FRAMING_TYPE_CREDIT                   0x10
+
+#define UART_FRAMING_MAXIMUM_PAYLOAD               64
+#define UART_FRAMING_INITIAL_CREDITS               2
+#define UART_FRAMING_LOG_BUFFER_SIZE               32
+
+/* The following MACRO returns the worst case number of UART bytes    */
+/* needed to send a frame with the specified payload length.         */
+#define UART_FRAMING_ENCODED_SIZE(_x)              ((2 * ((_x) + 1)) + 2)
+
+#define UART_FRAMING_DEFAULT_ENABLED               FALSE  /* Framing mode*/
+/* at boot.          */
+
+/* The following define the GATT serial service that carries bridge  */
+/* data over LE.  The central enables notifications on the TX        */
+/* characteristic to receive UART data and writes (with or without   */
+/* response) to the RX characteristic to send data to the UART.  The */
+/* UUIDs are those of the widely used Nordic UART Service so that    */
+/* existing central applications may be used (stored little endian). */
+#define SERIAL_SERVICE_UUID_CONSTANT               { 0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, 0x93, 0xF3, 0xA3, 0xB5, 0x01, 0x00, 0x40, 0x6E }
+#define SERIAL_SERVICE_RX_UUID_CONSTANT            { 0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, 0x93, 0xF3, 0xA3, 0xB5, 0x02, 0x00, 0x40, 0x6E }
+#define SERIAL_SERVICE_TX_UUID_CONSTANT            { 0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, 0x93, 0xF3, 0xA3, 0xB5, 0x03, 0x00, 0x40, 0x6E }
+
+/* The following define the offsets of the attributes in the serial  */
+/* service table (see SerialServiceTable).                           */
+#define SERIAL_SERVICE_TX_VALUE_ATTRIBUTE_OFFSET   2
+#define SERIAL_SERVICE_TX_CCCD_ATTRIBUTE_OFFSET    3
+#define SERIAL_SERVICE_RX_VALUE_ATTRIBUTE_OFFSET   5
+
+#define SERIAL_SERVICE_CCCD_LENGTH                 2
+#define SERIAL_SERVICE_NOTIFICATION_HEADER_SIZE    3
+
+#define SERIAL_SERVICE_BUFFER_SIZE                 128    /* Size of the */
+/* buffer holding    */
+/* UART data waiting */
+/* to be notified.   */
+
+#define SERIAL_SERVICE_MAXIMUM_PACKETS             2      /* Maximum     */
+/* notifications     */
+/* outstanding in    */
+/* the controller.   */
+
+/* The following define the LE connection parameter profiles (see    */
+/* LEConnectionProfiles).  While the profile is selected             */
+/* automatically the serial service traffic is measured every        */
+/* APPLICATION_TIMER_PERIOD.  The throughput profile is requested as */
+/* soon as a period carries LE_PROFILE_THROUGHPUT_THRESHOLD bytes,   */
+/* the latency profile while there is less traffic and the power     */
+/* profile once the link has been idle for LE_PROFILE_IDLE_PERIODS.  */
+#define LE_PROFILE_THROUGHPUT                      0
+#define LE_PROFILE_LATENCY                         1
+#define LE_PROFILE_POWER                           2
+#define LE_PROFILE_AUTOMATIC                       0xFE
+#define LE_PROFILE_NONE                            0xFF
+
+#define LE_PROFILE_THROUGHPUT_THRESHOLD            128
+#define LE_PROFILE_IDLE_PERIODS                    5
+
+/* The following control the connection parameter update requests.   */
+/* A request is not made until LE_PROFILE_RETRY_PERIODS after the    */
+/* connection is made or a request is rejected.  Each retry widens   */
+/* the requested interval, after LE_PROFILE_MAXIMUM_RETRIES the      */
+/* profile is not requested again until another profile is wanted.   */
+#define LE_PROFILE_RETRY_PERIODS                   5
+#define LE_PROFILE_RESPONSE_PERIODS                30
+#define LE_PROFILE_MAXIMUM_RETRIES                 3
+
+/* The following define the SPP buffer profiles (see                 */
+/* SPPBufferProfiles).  The SPP buffers of each connection are sized */
+/* from the selected profile when the port is opened, a profile is   */
+/* only used when the heap has room for its buffers plus             */
+/* SPP_PROFILE_HEAP_RESERVE bytes, otherwise the next smaller        */
+/* profile is used.                                                  */
+#define SPP_PROFILE_DEFAULT                        0
+#define SPP_PROFILE_BALANCED                       1
+#define SPP_PROFILE_THROUGHPUT                     2
+
+#define SPP_PROFILE_HEAP_RESERVE                   384
+
+/* The following define the SPP test modes (AT+SPPTEST).  While a    */
+/* test runs the SPP port is not bridged to the UART, instead the    */
+/* device generates a known pattern (GENERATE), checks and discards  */
+/* the pattern (SINK) or echoes whatever it receives (LOOPBACK).     */
+/* The pattern is a byte stream in which each byte is one more       */
+/* (modulo 256) than the previous byte.  tools/spptest.py runs the   */
+/* peer on a Linux host over an RFCOMM socket or /dev/rfcommN, it    */
+/* checks the pattern for GENERATE, writes the pattern for SINK and  */
+/* compares the echo for LOOPBACK.  The rates of the last second are */
+/* reported as unsolicited +SPPTEST lines.                           */
+#define SPP_TEST_MODE_OFF                          0
+#define SPP_TEST_MODE_GENERATE                     1
+#define SPP_TEST_MODE_SINK                         2
+#define SPP_TEST_MODE_LOOPBACK                     3
+
+/* The following define the latency trace.  A trace sample follows a */
+/* byte from the UART to the Bluetooth UART (HAL_TRACE_STAGE_XXX)    */
+/* and is started every configured number of seconds (AT+TRACE, zero */
+/* turns tracing off).  The time between each pair of stages is      */
+/* counted in a histogram in which bucket N holds the times from     */
+/* 2^(N-1) up to 2^N ACLK periods (bucket zero holds zero and the    */
+/* last bucket holds everything longer).                             */
+#define TRACE_HISTOGRAM_BUCKETS                    12
+#define TRACE_DEFAULT_PERIOD                       0
+
+/* The following define the real-time mode, in which data from the   */
+/* UART that has waited longer than the deadline (in milliseconds,   */
+/* zero turns the mode off) is dropped instead of being sent late.   */
+/* The age of the SPP Buffer is tracked in up to REALTIME_SEGMENTS   */
+/* segments of data queued at the same time.  The automatic flush    */
+/* timeout of the ACL link is set to half the deadline, which limits */
+/* the deadline to twice the largest flush timeout (0x07FF slots).   */
+#define REALTIME_DEFAULT_DEADLINE                  0
+#define REALTIME_DEADLINE_LIMIT                    2500
+#define REALTIME_SEGMENTS                          4
+
+/* The following define the bridge policies (AT+BRIDGE), which select*/
+/* the transports that carry the raw UART data while both a BR/EDR   */
+/* and an LE device are connected.  SPP (or LE) sends the data to    */
+/* that transport and only uses the other one as a backup while it is*/
+/* not connected, DUPLICATE sends the data to both (as fast as the   */
+/* slower one allows) and merges the data received from both.        */
+/* CHANNEL is the framed UART, on which each transport has its own   */
+/* channel.                                                          */
+#define BRIDGE_POLICY_SPP_PRIMARY                  0
+#define BRIDGE_POLICY_LE_PRIMARY                   1
+#define BRIDGE_POLICY_DUPLICATE                    2
+#define BRIDGE_POLICY_CHANNEL                      3
+
+#define BRIDGE_TRANSPORT_SPP                       0x01
+#define BRIDGE_TRANSPORT_LE                        0x02
+
+/* The following define the sniff mode used on the BR/EDR link.  The */
+/* link is put into sniff after it has been idle for the configured  */
+/* number of seconds (SNIFF_DEFAULT_IDLE_TIME, zero disables sniff). */
+/* The sniff interval (in baseband slots of 0.625 ms) is chosen from */
+/* the recent activity of the link, a link that has carried traffic  */
+/* in most recent periods uses SNIFF_SHORT_INTERVAL so that it wakes */
+/* quickly, a link that is rarely used uses SNIFF_LONG_INTERVAL.     */
+#define SNIFF_DEFAULT_IDLE_TIME                    3
+#define SNIFF_SHORT_INTERVAL                       80
+#define SNIFF_MEDIUM_INTERVAL                      320
+#define SNIFF_LONG_INTERVAL                        800
+#define SNIFF_ATTEMPT                              4
+#define SNIFF_TIMEOUT                              1
+
+/* The following define the activity score (an average of the        */
+/* periods that carried traffic, out of SNIFF_ACTIVITY_MAXIMUM) at   */
+/* or above which the short and medium sniff intervals are used.     */
+#define SNIFF_ACTIVITY_MAXIMUM                     256
+#define SNIFF_ACTIVITY_SHORT                       128
+#define SNIFF_ACTIVITY_MEDIUM                      32
+
+/* The following define the levels of packet types used on the BR/EDR*/
+/* link (see LinkPacketTypes).  The link starts with the EDR packets */
+/* (2-DH5/3-DH5) and the link quality is checked every               */
+/* LINK_QUALITY_PERIOD seconds.  A check that finds failed contacts  */
+/* or an RSSI below LINK_QUALITY_RSSI_LOW moves to the next, more    */
+/* robust, level.  After LINK_QUALITY_GOOD_CHECKS checks in a row    */
+/* that find no failed contacts and an RSSI of at least              */
+/* LINK_QUALITY_RSSI_GOOD the previous level is tried again.  The    */
+/* RSSI is in dB from the golden receive power range.                */
+#define LINK_PACKETS_EDR                           0
+#define LINK_PACKETS_BASIC_RATE                    1
+#define LINK_PACKETS_ROBUST                        2
+#define NUMBER_LINK_PACKET_LEVELS                  3
+
+#define LINK_QUALITY_PERIOD                        2
+#define LINK_QUALITY_GOOD_CHECKS                   5
+#define LINK_QUALITY_RSSI_LOW                      (-10)
+#define LINK_QUALITY_RSSI_GOOD                     (-4)
+
+#define LINK_PACKET_TYPES_NO_EDR                   (HCI_PACKET_ACL_TYPE_2_DH1_MAY_NOT_BE_USED | HCI_PACKET_ACL_TYPE_3_DH1_MAY_NOT_BE_USED | HCI_PACKET_ACL_TYPE_2_DH3_MAY_NOT_BE_USED | HCI_PACKET_ACL_TYPE_3_DH3_MAY_NOT_BE_USED | HCI_PACKET_ACL_TYPE_2_DH5_MAY_NOT_BE_USED | HCI_PACKET_ACL_TYPE_3_DH5_MAY_NOT_BE_USED)
+#define LINK_PACKET_TYPES_DM                       (HCI_PACKET_ACL_TYPE_DM1 | HCI_PACKET_ACL_TYPE_DM3 | HCI_PACKET_ACL_TYPE_DM5)
+#define LINK_PACKET_TYPES_DH                       (HCI_PACKET_ACL_TYPE_DH1 | HCI_PACKET_ACL_TYPE_DH3 | HCI_PACKET_ACL_TYPE_DH5)
+
+/* The following is the period (in milliseconds) of the application  */
+/* timer.                                                            */
+#define APPLICATION_TIMER_PERIOD                   1000
+
+/* Determine the default Name we will use for this compilation (the  */
+/* same name is used for LE and BR/EDR).                             */
 #define LE_DEMO_DEVICE_NAME                        "Trunks"
-#define CB_DEMO_DEVICE_NAME                        "Trunks"
+
+/* The following define the default advertising interval (in        */
+/* milliseconds, as GAP takes it) and the range that may be          */
+/* configured at runtime.                                            */
+#define ADVERTISING_INTERVAL_MINIMUM_DEFAULT       50
+#define ADVERTISING_INTERVAL_MAXIMUM_DEFAULT       100
+#define ADVERTISING_INTERVAL_LOWER_LIMIT           MINIMUM_ADVERTISING_INTERVAL
+#define ADVERTISING_INTERVAL_UPPER_LIMIT           MAXIMUM_ADVERTISING_INTERVAL
+
+/* The following define the advertising schedule.  The intervals     */
+/* above are used for the first ADVERTISING_FAST_TIME_DEFAULT        */
+/* seconds after power up or a disconnect, after which the slow      */
+/* intervals are used until a device connects (a fast time of zero   */
+/* never changes to the slow intervals).  The fast time is limited by*/
+/* the scheduler, which takes a 16 bit period in milliseconds.       */
+#define ADVERTISING_FAST_TIME_DEFAULT              30
+#define ADVERTISING_FAST_TIME_LIMIT                65
+#define ADVERTISING_SLOW_INTERVAL_MINIMUM_DEFAULT  1600
+#define ADVERTISING_SLOW_INTERVAL_MAXIMUM_DEFAULT  1700
+
+#define ADVERTISING_CONFIG_FAST                    0
+#define ADVERTISING_CONFIG_SLOW                    1
+#define NUMBER_ADVERTISING_CONFIGS                 2
+
+/* The following is the charge (in nC) used by the controller for    */
+/* each advertising event (on all three channels).  It is only used  */
+/* to estimate the average current of each advertising configuration */
+/* and should be measured for the board.                             */
+#define ADVERTISING_EVENT_CHARGE                   30000
+
+/* The following define the phases of advertising after a disconnect */
+/* (or at power up).  If the last device was bonded it is first      */
+/* reconnected with high duty cycle directed advertising, which the  */
+/* controller stops after 1.28s.  Advertising then only accepts      */
+/* connections from the bonded devices (the white list) for          */
+/* RECONNECT_WHITE_LIST_TIME seconds, before any device is accepted. */
+/* The CC256x (Bluetooth 4.0) can not resolve private addresses, so  */
+/* a bonded device that uses them is directed to, and put in the     */
+/* white list with, the resolvable private address it last used      */
+/* (from the RPA cache, which is only held in RAM).  If that address */
+/* is not known, as after power up, the device is not directed to    */
+/* and the white list phase is skipped, so the device reconnects     */
+/* through undirected advertising, where the host resolves its       */
+/* address.  The time from the start of advertising to the           */
+/* connection is recorded for the phase in which the connection was  */
+/* made.                                                             */
+#define RECONNECT_PHASE_DIRECTED                   0
+#define RECONNECT_PHASE_WHITE_LIST                 1
+#define RECONNECT_PHASE_NORMAL                     2
+#define RECONNECT_PHASE_NONE                       0xFF
+#define NUMBER_RECONNECT_PHASES                    3
+
+#define RECONNECT_DIRECTED_TIME                    3
+#define RECONNECT_WHITE_LIST_TIME                  10
+
+/* The following define the runtime control interface.  Commands are  */
+/* AT style text lines, for example:                                 */
+/*                                                                   */
+/*    AT                 - OK                                        */
+/*    ATO                - Return to data mode (raw UART only).      */
+/*    ATZ                - Reset (applies all saved settings).       */
+/*    AT&W               - Save the current settings to flash.       */
+/*    AT&F               - Restore the default settings.             */
+/*    AT+PORT?/=<n>      - SPP server port (applied while the SPP    */
+/*                         port is not connected).                   */
+/*    AT+NAME?/=<s>      - Device name (applied immediately).        */
+/*    AT+ADV?/=<min>,<max> - Advertising interval in ms, 20 to 10240 */
+/*                         (applied the next time advertising is     */
+/*                         started).                                 */
+/*    AT+HCILL?/=<inactivity>,<retransmit> - HCILL timeouts in ms    */
+/*                         (applied immediately).                    */
+/*    AT+BAUD?/=<rate>   - UART baud rate (applied after the OK).    */
+/*    AT+FRAMING?/=<0|1> - UART framing (applied after the OK).      */
+/*    AT+STAT?           - Statistics counters, in the order: UART   */
+/*                         bytes dropped, frames received, frames    */
+/*                         sent, frames dropped and log bytes        */
+/*                         dropped.                                  */
+/*                                                                   */
+/* Query responses are of the form +NAME:value followed by OK or     */
+/* ERROR.  When the UART is framed each control channel data frame   */
+/* holds a single command and the responses are sent on the control  */
+/* channel.  Otherwise command mode is entered from data mode by     */
+/* sending the CONTROL_ESCAPE_SEQUENCE (followed by the 0xFF end of  */
+/* block marker) with at least CONTROL_ESCAPE_GUARD_TIME ms without  */
+/* any other UART data before and after it.  The sequence is held    */
+/* until the guard time after it has passed (checked every           */
+/* APPLICATION_TIMER_PERIOD), and is sent as data if anything        */
+/* follows it sooner.  Commands are then terminated by a carriage    */
+/* return.  SPP data received while in command mode is left queued   */
+/* in SPP.  A response that the UART does not take within            */
+/* CONTROL_RESPONSE_TIMEOUT ms (the host is not reading) is dropped, */
+/* and later responses are only written as far as they fit until a   */
+/* response is written in full again.                                */
+#define CONTROL_ESCAPE_SEQUENCE                    "+++"
+#define CONTROL_ESCAPE_SEQUENCE_LENGTH             3
+#define CONTROL_ESCAPE_GUARD_TIME                  1000
+#define CONTROL_COMMAND_BUFFER_SIZE                48
+#define CONTROL_RESPONSE_BUFFER_SIZE               96
+#define CONTROL_RESET_DELAY                        50
+#define CONTROL_RESPONSE_TIMEOUT                   250
+
+/* The following bit mask flags are used to record the actions that  */
+/* must be taken once the response to a command has been sent.       */
+#define CONTROL_PENDING_BAUD_RATE                  0x01
+#define CONTROL_PENDING_FRAMING                    0x02
+#define CONTROL_PENDING_RESET                      0x04
+
+/* The following define the location and format of the settings saved*/
+/* in flash.  The signature must be changed whenever the format of   */
+/* ApplicationSettings_t changes.                                    */
+#define APPLICATION_SETTINGS_SEGMENT               HAL_FLASH_INFO_SEGMENT_D
+#define APPLICATION_SETTINGS_SIGNATURE             0x540A
+
+/* The following define the bond store, which keeps the classic link */
+/* keys and the LE bonding information in two reserved Main Memory   */
+/* segments.  The active segment starts with a header holding a      */
+/* signature and a sequence number, followed by a log of records.    */
+/* Each record is a type byte followed by a copy of the entry (or    */
+/* only the BD_ADDR of a deleted entry).  The type byte is written   */
+/* last, so a record interrupted by a reset is never used.  When the */
+/* active segment is full the valid entries are written to the other */
+/* segment with the next sequence number, so each segment is only    */
+/* erased on every other switch.  All entries (see                   */
+/* MAX_SUPPORTED_LINK_KEYS and MAX_SUPPORTED_LE_BONDS) must fit in   */
+/* one segment with room left to append every entry once more, so    */
+/* that a full table is not compacted on every change (this is       */
+/* checked at compile time).  Changes are written in batches once no */
+/* device has been connected for BOND_STORE_FLUSH_DELAY seconds.     */
+#define BOND_STORE_SEGMENT_1                       HAL_FLASH_MAIN_SEGMENT_1
+#define BOND_STORE_SEGMENT_2                       HAL_FLASH_MAIN_SEGMENT_2
+#define BOND_STORE_SEGMENT_SIZE                    HAL_FLASH_MAIN_SEGMENT_SIZE
+#define BOND_STORE_SIGNATURE                       0x4B42
+#define BOND_STORE_FLUSH_DELAY                     2
+
+#define BOND_RECORD_TYPE_ENTRY                     0x10
+#define BOND_RECORD_TYPE_DELETE                    0x20
+#define BOND_RECORD_TYPE_TABLE_MASK                0x0F
+#define BOND_RECORD_TYPE_ERASED                    0xFF
+
+/* The following define the bond store tables.                       */
+#define BOND_TABLE_LINK_KEY                        0
+#define BOND_TABLE_LE                              1
+
+/* The following define the LTK cache, which holds the most recently */
+/* used LTKs keyed by their EDIV and Rand so that a Long Term Key    */
+/* Request is answered without regenerating the key (the cache is    */
+/* only held in RAM).  The time from the request to the encryption   */
+/* change is measured separately for keys taken from the cache and   */
+/* keys that were regenerated (LTK_SOURCE_XXX).                      */
+#define LTK_CACHE_SIZE                             4
+
+#define LTK_SOURCE_CACHE                           0
+#define LTK_SOURCE_REGENERATED                     1
+#define NUMBER_LTK_SOURCES                         2
+#define LTK_SOURCE_NONE                            0xFF
+
+/* The following define the RPA cache, which maps the resolvable     */
+/* private addresses recently used by bonded devices to the address  */
+/* of their bond, so that the IRKs of the bonds are only tried when a*/
+/* device has changed its address.  The cache is direct mapped by the*/
+/* hash of the address (and is only held in RAM).                    */
+#define RPA_CACHE_SIZE                             4
+
+/* The following define the opening of the stack.  The steps that    */
+/* follow the stack initialization are run in the order of           */
+/* OpenStackSteps.  The time taken by each step is kept (in          */
+/* milliseconds) with the time from the start of the initialization  */
+/* to the first advertising.                                         */
+#define NUMBER_OPEN_STACK_STEPS                    5
+
+#define MAXIMUM_DEVICE_NAME_LENGTH                 20
 
 /* The following is used as a printf replacement.                    */
 #define Display(_x)                                do { BTPS_OutputMessage _x; } while(0)
 
+/* The following MACRO is used to check a condition that the         */
+/* preprocessor can not evaluate (for example one that uses sizeof)  */
+/* at compile time.  A false condition declares an array of negative */
+/* size, which fails to compile.                                     */
+#define COMPILE_TIME_ASSERT(_Name, _Condition)     typedef char _Name[(_Condition) ? 1 : -1]
+
 /* The following type definition represents the container type which */
 /* holds the mapping between Bluetooth devices (based on the BD_ADDR)*/
 /* and the Link Key (BD_ADDR <-> Link Key Mapping).                  */
 typedef struct _tagLinkKeyInfo_t {
+	Byte_t Flags;
 	BD_ADDR_t BD_ADDR;
 	Link_Key_t LinkKey;
 } LinkKeyInfo_t;
 
+/* The following type definition represents the container type which */
+/* holds the bonding information of an LE device.  The LTK is not    */
+/* kept as it is regenerated from the EDIV and Rand.                 */
+typedef struct _tagLEBondInfo_t {
+	Byte_t Flags;
+	BD_ADDR_t BD_ADDR;
+	Byte_t AddressType;
+	Word_t EDIV;
+	Byte_t EncryptionKeySize;
+	Random_Number_t Rand;
+	Encryption_Key_t IRK;
+} LEBondInfo_t;
+
+/* The following structure is the start of every entry in the bond   */
+/* store tables, and is used to search the tables.                   */
+typedef struct _tagBondEntryHeader_t {
+	Byte_t Flags;
+	BD_ADDR_t BD_ADDR;
+} BondEntryHeader_t;
+
+/* Defines the bit mask flags that may be set in the bond store      */
+/* entries.  A deleted entry keeps the DELETED flag so that searches */
+/* continue past it.                                                 */
+#define BOND_ENTRY_FLAGS_VALID                           0x01
+#define BOND_ENTRY_FLAGS_DELETED                         0x02
+#define BOND_ENTRY_FLAGS_PENDING                         0x04
+#define BOND_ENTRY_FLAGS_IRK_VALID                       0x08
+
+/* The following structure describes one of the bond store tables.   */
+typedef struct _tagBondTable_t {
+	void *Entries;
+	unsigned int EntrySize;
+	unsigned int NumberEntries;
+} BondTable_t;
+
+/* The following structure is the header at the start of a bond      */
+/* store segment.                                                    */
+typedef struct _tagBondStoreHeader_t {
+	Word_t Signature;
+	Word_t Sequence;
+} BondStoreHeader_t;
+
+/* The following MACRO returns the number of bytes needed to write   */
+/* every entry of the bond store tables (each record is a type byte  */
+/* followed by the entry).                                           */
+#define BOND_STORE_TABLES_SIZE                     ((MAX_SUPPORTED_LINK_KEYS * (1 + sizeof(LinkKeyInfo_t))) + (MAX_SUPPORTED_LE_BONDS * (1 + sizeof(LEBondInfo_t))))
+
+/* A compacted segment holding every entry must leave room to append */
+/* every entry once more.                                            */
+COMPILE_TIME_ASSERT(BondStoreSizeCheck_t,
+		(sizeof(BondStoreHeader_t) + (2 * BOND_STORE_TABLES_SIZE))
+				<= BOND_STORE_SEGMENT_SIZE);
+
+/* The following structure is used to hold the state of the bond     */
+/* store.  Used is the number of bytes used in the active segment.   */
+typedef struct _tagBondStoreInfo_t {
+	Byte_t *Segment;
+	Word_t Sequence;
+	unsigned int Used;
+	Boolean_t Pending;
+	Boolean_t Compact;
+	Byte_t IdlePeriods;
+	DWord_t RecordsWritten;
+	DWord_t SegmentErases;
+	DWord_t WriteErrors;
+} BondStoreInfo_t;
+
+/* The following structure is an entry in the LTK cache.             */
+typedef struct _tagLTKCacheEntry_t {
+	Word_t EDIV;
+	Random_Number_t Rand;
+	Long_Term_Key_t LTK;
+} LTKCacheEntry_t;
+
+/* The following structure is used to hold the LTK cache, most       */
+/* recently used entry first, and the encryption setup times (in     */
+/* milliseconds) of each source of the LTK.                          */
+typedef struct _tagLTKCacheInfo_t {
+	unsigned int NumberEntries;
+	LTKCacheEntry_t Entries[LTK_CACHE_SIZE];
+	Byte_t RequestSource;
+	unsigned long RequestTick;
+	DWord_t Requests[NUMBER_LTK_SOURCES];
+	DWord_t SetupTime[NUMBER_LTK_SOURCES];
+	DWord_t SetupCount[NUMBER_LTK_SOURCES];
+} LTKCacheInfo_t;
+
+/* The following structure is used to hold an entry of the RPA cache,*/
+/* an unused entry holds a NULL RPA.                                 */
+typedef struct _tagRPACacheEntry_t {
+	BD_ADDR_t RPA;
+	BD_ADDR_t BD_ADDR;
+} RPACacheEntry_t;
+
+/* The following structure is used to hold the RPA cache and the     */
+/* number of addresses that were found in the cache, resolved with   */
+/* the IRKs, not resolved and that replaced a previous address of    */
+/* the same device.                                                  */
+typedef struct _tagRPACacheInfo_t {
+	RPACacheEntry_t Entries[RPA_CACHE_SIZE];
+	DWord_t Hits;
+	DWord_t Resolved;
+	DWord_t Unresolved;
+	DWord_t Rotations;
+} RPACacheInfo_t;
+
+/* The following type definition represents a step of opening the    */
+/* stack.  The function returns zero if successful, any other value  */
+/* means that the stack can not be used.                             */
+typedef int (*OpenStackStepFunction_t)(unsigned int BluetoothStackID);
+
+typedef struct _tagOpenStackStep_t {
+	char *Name;
+	OpenStackStepFunction_t Function;
+} OpenStackStep_t;
+
+/* The following structure is used to hold the times (in             */
+/* milliseconds) taken by the last opening of the stack.             */
+typedef struct _tagBootInfo_t {
+	unsigned long StartTick;
+	unsigned long InitializeTime;
+	unsigned long StepTime[NUMBER_OPEN_STACK_STEPS];
+	unsigned long AdvertisingTime;
+} BootInfo_t;
+
 /* Structure used to hold all of the GAP LE Parameters.              */
 typedef struct _tagGAPLE_Parameters_t {
 	GAP_LE_IO_Capability_t IOCapability;
@@ -100,6 +645,7 @@ typedef struct _tagApplicationStateInfo_t {
 	Byte_t Flags;
 	Mailbox_t Mailbox;
 	unsigned int GAPSInstanceID;
+	unsigned int SerialServiceID;
 	unsigned int HCIEventCallbackHandle;
 	ConnectionInfo_t LEConnectionInfo;
 	ConnectionInfo_t CBConnectionInfo;
@@ -107,6 +653,13 @@ typedef struct _tagApplicationStateInfo_t {
 	DWord_t SPPServerSDPHandle;
 	unsigned int SPPBufferLength;
 	Byte_t SPPBuffer[SPP_BUFFER_SIZE];
+	unsigned int SPPReceiveBufferStart;
+	unsigned int SPPReceiveBufferLength;
+	Byte_t SPPReceiveBuffer[SPP_RECEIVE_BUFFER_SIZE];
+	unsigned int SPPLocalPortStatus;
+	Byte_t SPPBufferProfile;
+	unsigned int SPPDefaultMaximumDataPackets;
+	unsigned int SPPDefaultQueuedDataPacketsThreshold;
 	Byte_t AccelEnableCount;
 } ApplicationStateInfo_t;
 
@@ -114,6 +667,10 @@ typedef struct _tagApplicationStateInfo_t {
 #define APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED        0x02
 #define APPLICATION_STATE_INFO_FLAGS_SPP_BUFFER_FULL     0x04
 #define APPLICATION_STATE_INFO_SNIFF_MODE_ACTIVE         0x08
+#define APPLICATION_STATE_INFO_FLAGS_REMOTE_FLOW_STOPPED 0x10
+#define APPLICATION_STATE_INFO_FLAGS_SPP_DATA_PENDING    0x20
+#define APPLICATION_STATE_INFO_FLAGS_SPP_QUEUING_CHANGED 0x40
+#define APPLICATION_STATE_INFO_FLAGS_SPP_QUEUING_PENDING 0x80
 
 /* The following defines are used with the application mailbox.      */
 #define APPLICATION_MAILBOX_DEPTH                        8
@@ -125,10 +682,341 @@ typedef struct _tagApplicationStateInfo_t {
 #define APPLICATION_MAILBOX_MESSAGE_ID_CB_CONNECTED      0x04
 #define APPLICATION_MAILBOX_MESSAGE_ID_SPP_BUFFER_EMPTY  0x05
 #define APPLICATION_MAILBOX_MESSAGE_ID_UART_READ         0x06
-
-/* The following structure for a Master is used to hold a list of    */
-/* information on all paired devices. For slave we will not use this */
-/* structure.                                                        */
+#define APPLICATION_MAILBOX_MESSAGE_ID_SPP_DATA          0x07
+#define APPLICATION_MAILBOX_MESSAGE_ID_UART_WRITE_READY  0x08
+#define APPLICATION_MAILBOX_MESSAGE_ID_LE_WRITE_READY    0x09
+#define APPLICATION_MAILBOX_MESSAGE_ID_DIRECTED_TIMEOUT  0x0A
+#define APPLICATION_MAILBOX_MESSAGE_ID_ADVERTISING_TIMER 0x0B
+#define APPLICATION_MAILBOX_MESSAGE_ID_SPP_PORT_EVENT    0x0C
+
+/* The following structure is used to hold the state of an additional*/
+/* SPP server port (see SPP_MAXIMUM_ADDITIONAL_PORTS).  The transmit */
+/* ring holds the data from the host waiting for SPP_Data_Write and  */
+/* the receive buffer the SPP data waiting for the UART.             */
+typedef struct _tagSPPPortInfo_t {
+	unsigned int ServerPortID;
+	DWord_t SDPHandle;
+	Byte_t Flags;
+	BD_ADDR_t BD_ADDR;
+	unsigned int TransmitStart;
+	unsigned int TransmitLength;
+	Byte_t TransmitBuffer[SPP_PORT_TRANSMIT_BUFFER_SIZE];
+	unsigned int ReceiveStart;
+	unsigned int ReceiveLength;
+	Byte_t ReceiveBuffer[SPP_PORT_RECEIVE_BUFFER_SIZE];
+	DWord_t BytesSent;
+	DWord_t BytesReceived;
+} SPPPortInfo_t;
+
+#define SPP_PORT_INFO_FLAGS_CONNECTED              0x01
+#define SPP_PORT_INFO_FLAGS_BUFFER_FULL            0x02
+#define SPP_PORT_INFO_FLAGS_DATA_PENDING           0x04
+
+/* The following structure is used to hold the additional SPP ports. */
+/* The next port is the port that is served first on the next pass.  */
+typedef struct _tagSPPPortsInfo_t {
+	Byte_t NextPort;
+	SPPPortInfo_t Ports[SPP_MAXIMUM_ADDITIONAL_PORTS];
+} SPPPortsInfo_t;
+
+/* The following MACRO returns the RAM (in bytes) used by the SPP    */
+/* buffers with the specified number of additional ports, including  */
+/* the buffers of the bridge port.  The RFCOMM buffers of each       */
+/* connection are allocated from the BTPS heap.                      */
+#define SPP_PORTS_RAM_SIZE(_x)                     (SPP_BUFFER_SIZE + SPP_RECEIVE_BUFFER_SIZE + ((_x) * sizeof(SPPPortInfo_t)))
+
+/* The following structure is used to hold the state of the UART     */
+/* framing (see UART_FRAMING_SLIP_END).                              */
+typedef struct _tagUARTFramingInfo_t {
+	Boolean_t Enabled;
+	Byte_t TxCredits[UART_FRAMING_NUMBER_CHANNELS];
+	Byte_t RxCredits[UART_FRAMING_NUMBER_CHANNELS];
+	Boolean_t RxEscape;
+	Boolean_t RxOverflow;
+	unsigned int RxFrameLength;
+	Byte_t RxFrame[UART_FRAMING_MAXIMUM_PAYLOAD + 1];
+	unsigned int LogLength;
+	Byte_t LogBuffer[UART_FRAMING_LOG_BUFFER_SIZE];
+	DWord_t FramesReceived;
+	DWord_t FramesSent;
+	DWord_t FramesDropped;
+	DWord_t LogBytesDropped;
+} UARTFramingInfo_t;
+
+/* The following structure is used to hold the state of the GATT     */
+/* serial service for the current LE connection.                     */
+typedef struct _tagSerialServiceInfo_t {
+	Boolean_t NotificationsEnabled;
+	Word_t ConnectionHandle;
+	Word_t PayloadSize;
+	Byte_t PacketsOutstanding;
+	Boolean_t WriteReadyPending;
+	unsigned int BufferLength;
+	Byte_t Buffer[SERIAL_SERVICE_BUFFER_SIZE];
+	DWord_t NotificationsSent;
+	DWord_t BytesReceived;
+	DWord_t BytesDropped;
+} SerialServiceInfo_t;
+
+/* The following structure represents an LE connection parameter     */
+/* profile.  The intervals and timeout are in milliseconds.          */
+typedef struct _tagLEConnectionProfile_t {
+	char *Name;
+	Word_t IntervalMin;
+	Word_t IntervalMax;
+	Word_t SlaveLatency;
+	Word_t SupervisionTimeout;
+} LEConnectionProfile_t;
+
+/* The following structure is used to hold the state of the LE       */
+/* connection parameter profile selection for the current LE         */
+/* connection.                                                       */
+typedef struct _tagLEProfileInfo_t {
+	Byte_t Profile;
+	Byte_t TargetProfile;
+	Byte_t PendingProfile;
+	Byte_t RejectedProfile;
+	Byte_t Retries;
+	Byte_t RetryPeriods;
+	Byte_t PendingPeriods;
+	Byte_t IdlePeriods;
+	unsigned int TrafficBytes;
+	GAP_LE_Current_Connection_Parameters_t CurrentParameters;
+	DWord_t UpdatesRequested;
+	DWord_t UpdatesRejected;
+} LEProfileInfo_t;
+
+/* The following structure is used to hold the state of the          */
+/* reconnection to a bonded LE device.  The times are in             */
+/* milliseconds.                                                     */
+typedef struct _tagReconnectInfo_t {
+	Byte_t Phase;
+	Byte_t Periods;
+	GAP_LE_Address_Type_t AddressType;
+	BD_ADDR_t BD_ADDR;
+	DWord_t StartTick;
+	Byte_t LastPhase;
+	DWord_t LastTime;
+	DWord_t Connections[NUMBER_RECONNECT_PHASES];
+} ReconnectInfo_t;
+
+/* The following structure is used to hold the statistics of one     */
+/* advertising configuration.  The times are in milliseconds.        */
+typedef struct _tagAdvertisingStatistics_t {
+	DWord_t AdvertisingTime;
+	DWord_t ConnectTime;
+	DWord_t Connections;
+} AdvertisingStatistics_t;
+
+/* The following structure is used to hold the state of the          */
+/* advertising schedule.                                             */
+typedef struct _tagAdvertisingInfo_t {
+	Boolean_t Active;
+	Byte_t Config;
+	DWord_t ConfigStartTick;
+	AdvertisingStatistics_t Statistics[NUMBER_ADVERTISING_CONFIGS];
+} AdvertisingInfo_t;
+
+/* The following structure holds the advertising data that was last  */
+/* built from the device name.  The flags are those that were last   */
+/* written to the controller with the data (zero if the data has not */
+/* been written).                                                    */
+typedef struct _tagAdvertisingDataInfo_t {
+	Byte_t Flags;
+	Byte_t Length;
+	Advertising_Data_t AdvertisingData;
+} AdvertisingDataInfo_t;
+
+/* The following structure represents the scan response data, which  */
+/* only holds the serial service UUID and so is a constant.          */
+typedef struct _tagScanResponseData_t {
+	Byte_t ServiceUUIDLength;
+	Byte_t ServiceUUIDType;
+	Byte_t ServiceUUID[UUID_128_SIZE];
+	Byte_t Unused[SCAN_RESPONSE_DATA_MAXIMUM_SIZE - UUID_128_SIZE - 2];
+} ScanResponseData_t;
+
+/* The following structure represents an SPP buffer profile.  The    */
+/* buffer sizes are in bytes (zero leaves the stack default) and the */
+/* queuing parameters are the number of RFCOMM data packets that may */
+/* be queued to L2CAP and the threshold at which more are accepted   */
+/* (zero leaves the stack's own queuing parameters).                 */
+typedef struct _tagSPPBufferProfile_t {
+	char *Name;
+	unsigned int ReceiveBufferSize;
+	unsigned int TransmitBufferSize;
+	unsigned int MaximumDataPackets;
+	unsigned int QueuedDataPacketsThreshold;
+} SPPBufferProfile_t;
+
+/* The following structure is used to hold the state of the SPP test */
+/* mode and the SPP transmit counters.  The period counters cover    */
+/* the time since the last test report.                              */
+typedef struct _tagSPPTestInfo_t {
+	Byte_t Mode;
+	Byte_t TransmitPattern;
+	Byte_t ReceivePattern;
+	unsigned long ReportTick;
+	DWord_t PeriodTransmitBytes;
+	DWord_t PeriodReceiveBytes;
+	DWord_t PeriodGoodBytes;
+	DWord_t PeriodPartialWrites;
+	DWord_t PeriodBufferFullStalls;
+	DWord_t PatternErrors;
+	DWord_t PartialWrites;
+	DWord_t BufferFullStalls;
+} SPPTestInfo_t;
+
+/* The following structure is used to hold the latency trace         */
+/* histograms, one per pair of consecutive trace stages.             */
+typedef struct _tagTraceInfo_t {
+	Byte_t Periods;
+	DWord_t Samples;
+	DWord_t SamplesDiscarded;
+	Word_t Histogram[HAL_TRACE_NUMBER_STAGES - 1][TRACE_HISTOGRAM_BUCKETS];
+} TraceInfo_t;
+
+/* The following structure is used to hold the state of the sniff    */
+/* mode of the BR/EDR link.  The active and sniff times are in       */
+/* milliseconds and cover the current (or last) link.                */
+typedef struct _tagSniffInfo_t {
+	Word_t ConnectionHandle;
+	Boolean_t RequestPending;
+	Byte_t IdlePeriods;
+	Word_t ActivityScore;
+	Word_t Interval;
+	unsigned int TrafficBytes;
+	unsigned long ModeStartTick;
+	DWord_t ActiveTime;
+	DWord_t SniffTime;
+	DWord_t SniffEntries;
+} SniffInfo_t;
+
+/* The following structure represents a level of packet types used   */
+/* on the BR/EDR link.                                               */
+typedef struct _tagLinkPacketType_t {
+	char *Name;
+	Word_t PacketType;
+} LinkPacketType_t;
+
+/* The following structure is used to hold the state of the packet   */
+/* type selection of the BR/EDR link.  The packet type is the one    */
+/* reported by the controller.  The time spent (in milliseconds) and */
+/* the bytes sent at each level cover the current (or last) link.    */
+typedef struct _tagLinkInfo_t {
+	Byte_t Level;
+	Byte_t Periods;
+	Byte_t GoodChecks;
+	SByte_t RSSI;
+	Word_t PacketType;
+	unsigned long LevelStartTick;
+	DWord_t FailedContacts;
+	DWord_t Downgrades;
+	DWord_t Upgrades;
+	DWord_t LevelTime[NUMBER_LINK_PACKET_LEVELS];
+	DWord_t TransmitBytes[NUMBER_LINK_PACKET_LEVELS];
+} LinkInfo_t;
+
+/* The following structure represents data that was queued in the    */
+/* SPP Buffer at the same time.                                      */
+typedef struct _tagRealTimeSegment_t {
+	unsigned int Length;
+	unsigned long Tick;
+} RealTimeSegment_t;
+
+/* The following structure is used to hold the age of the data in the*/
+/* SPP Buffer while in real-time mode, oldest segment first.  The    */
+/* queued length is the sum of the segment lengths.                  */
+typedef struct _tagRealTimeInfo_t {
+	unsigned int NumberSegments;
+	unsigned int QueuedLength;
+	RealTimeSegment_t Segments[REALTIME_SEGMENTS];
+	DWord_t BytesDropped;
+	DWord_t Drops;
+} RealTimeInfo_t;
+
+/* The following structure is used to hold the statistics of one of  */
+/* the transports that carry bridge data.  The queue depth is the    */
+/* number of bytes waiting to be sent.                               */
+typedef struct _tagBridgeStatistics_t {
+	DWord_t TransmitBytes;
+	DWord_t ReceiveBytes;
+	Word_t MaximumQueueDepth;
+} BridgeStatistics_t;
+
+/* The following structure is used to hold the statistics of the     */
+/* bridge transports since the policy was last set.                  */
+typedef struct _tagBridgeInfo_t {
+	unsigned long StartTick;
+	BridgeStatistics_t SPP;
+	BridgeStatistics_t LE;
+} BridgeInfo_t;
+
+/* The following structure holds the settings that may be changed at */
+/* runtime and saved to flash.                                       */
+typedef struct _tagApplicationSettings_t {
+	Word_t Signature;
+	Word_t AdvertisingIntervalMin;
+	Word_t AdvertisingIntervalMax;
+	Word_t SlowAdvertisingIntervalMin;
+	Word_t SlowAdvertisingIntervalMax;
+	Word_t HCILLInactivityTimeout;
+	Word_t HCILLRetransmitTimeout;
+	Word_t RealTimeDeadline;
+	DWord_t ConsoleBaudRate;
+	Byte_t SPPPortNumber;
+	Byte_t SPPAdditionalPorts;
+	Byte_t UARTFraming;
+	Byte_t BridgePolicy;
+	Byte_t LEProfile;
+	Byte_t SniffIdleTime;
+	Byte_t SPPProfile;
+	Byte_t TracePeriod;
+	Byte_t FastAdvertisingTime;
+	char DeviceName[MAXIMUM_DEVICE_NAME_LENGTH + 1];
+	Encryption_Key_t IdentityRoot;
+	Encryption_Key_t IRK;
+	Encryption_Key_t DHK;
+	Word_t Checksum;
+} ApplicationSettings_t;
+
+#define APPLICATION_SETTINGS_SIZE                        (sizeof(ApplicationSettings_t))
+
+/* The settings must fit in the information segment that holds them. */
+COMPILE_TIME_ASSERT(ApplicationSettingsSizeCheck_t,
+		APPLICATION_SETTINGS_SIZE <= HAL_FLASH_INFO_SEGMENT_SIZE);
+
+/* The following structure is used to hold the state of the runtime  */
+/* control interface.                                                */
+typedef struct _tagControlInfo_t {
+	Boolean_t CommandMode;
+	Byte_t PendingActions;
+	unsigned long LastConsoleDataTick;
+	unsigned int EscapeLength;
+	Byte_t EscapeBuffer[CONTROL_ESCAPE_SEQUENCE_LENGTH + 1];
+	unsigned int CommandLength;
+	char CommandBuffer[CONTROL_COMMAND_BUFFER_SIZE];
+	unsigned int ResponseLength;
+	char ResponseBuffer[CONTROL_RESPONSE_BUFFER_SIZE];
+	Boolean_t ResponseStalled;
+} ControlInfo_t;
+
+/* The following type definition represents the prototype of a       */
+/* control command.  The Parameter points to the character following */
+/* the command name ('?' for a query, '=' for a set or the NULL      */
+/* terminator).  The function returns zero if successful or a        */
+/* negative value to report an error.                                */
+typedef int (*ControlCommandFunction_t)(char *Parameter);
+
+typedef struct _tagControlCommand_t {
+	char *Name;
+	ControlCommandFunction_t Function;
+} ControlCommand_t;
+
+/* The following structure is used to hold information on the LE     */
+/* devices that are (or were) connected.  The entries are held in a  */
+/* table of MAX_SUPPORTED_DEVICES entries that is searched from the  */
+/* entry given by the hash of the BD_ADDR (open addressing).         */
 typedef struct _tagDeviceInfo_t {
 	Byte_t Flags;
 	Byte_t EncryptionKeySize;
@@ -137,7 +1025,6 @@ typedef struct _tagDeviceInfo_t {
 	Long_Term_Key_t LTK;
 	Random_Number_t Rand;
 	Word_t EDIV;
-	struct _tagDeviceInfoInfo_t *NextDeviceInfoInfoPtr;
 } DeviceInfo_t;
 
 #define DEVICE_INFO_DATA_SIZE                            (sizeof(DeviceInfo_t))
@@ -145,6 +1032,7 @@ typedef struct _tagDeviceInfo_t {
 /* Defines the bit mask flags that may be set in the DeviceInfo_t    */
 /* structure.                                                        */
 #define DEVICE_INFO_FLAGS_LTK_VALID                      0x01
+#define DEVICE_INFO_FLAGS_IN_USE                         0x02
 
 /* User to represent a structure to hold a BD_ADDR return from       */
 /* BD_ADDRToStr.                                                     */
@@ -175,17 +1063,77 @@ static Encryption_Key_t IRK;
 static ApplicationStateInfo_t ApplicationStateInfo; /* Container for all of the        */
 /* Application State Information.  */
 
+static UARTFramingInfo_t UARTFramingInfo; /* Holds the state of the UART     */
+/* framing.                        */
+
+static SPPPortsInfo_t SPPPortsInfo; /* Holds the state of the         */
+/* additional SPP ports.           */
+
+static SerialServiceInfo_t SerialServiceInfo; /* Holds the state of the GATT    */
+/* serial service.                 */
+
+static LEProfileInfo_t LEProfileInfo; /* Holds the state of the LE      */
+/* connection parameter profiles.  */
+
+static ReconnectInfo_t ReconnectInfo; /* Holds the state of the         */
+/* reconnection to bonded devices. */
+
+static AdvertisingInfo_t AdvertisingInfo; /* Holds the state of the         */
+/* advertising schedule.           */
+
+static AdvertisingDataInfo_t AdvertisingDataInfo; /* Holds the last advertising     */
+/* data.                           */
+
+static SniffInfo_t SniffInfo; /* Holds the state of the sniff    */
+/* mode of the BR/EDR link.        */
+
+static LinkInfo_t LinkInfo; /* Holds the state of the packet   */
+/* types of the BR/EDR link.       */
+
+static RealTimeInfo_t RealTimeInfo; /* Holds the age of the data in    */
+/* the SPP Buffer.                 */
+
+static BridgeInfo_t BridgeInfo; /* Holds the statistics of the     */
+/* bridge transports.              */
+
+static ApplicationSettings_t ApplicationSettings; /* Holds the current runtime       */
+/* settings.                       */
+
+static TraceInfo_t TraceInfo; /* Holds the latency trace         */
+/* histograms.                     */
+
+static SPPTestInfo_t SPPTestInfo; /* Holds the state of the SPP test */
+/* mode.                           */
+
+static ControlInfo_t ControlInfo; /* Holds the state of the control  */
+/* interface.                      */
+
 static GAPLE_Parameters_t LE_Parameters; /* Holds GAP Parameters like       */
 /* Discoverability, Connectability */
 /* Modes.                          */
 
-static DeviceInfo_t *DeviceInfoList; /* Holds the list head for the     */
-/* device info list.               */
+static DeviceInfo_t DeviceInfoTable[MAX_SUPPORTED_DEVICES]; /* Holds the    */
+/* device info table.              */
 
 static LinkKeyInfo_t LinkKeyInfo[MAX_SUPPORTED_LINK_KEYS]; /* Variable holds     */
 /* BD_ADDR <-> Link Keys for       */
 /* pairing.                        */
 
+static LEBondInfo_t LEBondInfo[MAX_SUPPORTED_LE_BONDS]; /* Variable holds the  */
+/* bonding information of LE       */
+/* devices.                        */
+
+static BondStoreInfo_t BondStoreInfo; /* Holds the state of the bond     */
+/* store.                          */
+
+static LTKCacheInfo_t LTKCacheInfo; /* Holds the recently used LTKs.   */
+
+static RPACacheInfo_t RPACacheInfo; /* Holds the recently resolved     */
+/* private addresses.              */
+
+static BootInfo_t BootInfo; /* Holds the times taken by the     */
+/* opening of the stack.           */
+
 static GAP_IO_Capability_t IOCapability; /* Variable which holds the        */
 /* current I/O Capabilities that   */
 /* are to be used for Secure Simple*/
@@ -214,16 +1162,140 @@ static BTPSCONST char *IOCapabilitiesStrings[] =
 		{ "Display Only", "Display Yes/No", "Keyboard Only", "No Input/Output",
 				"Keyboard/Display" };
 
+/* The following define the attributes of the GATT serial service.   */
+/* The characteristic values and the Client Characteristic           */
+/* Configuration Descriptor have no storage so that every access is  */
+/* passed to GATT_Server_Event_Callback().                           */
+static BTPSCONST GATT_Primary_Service_128_Entry_t SerialServiceUUID = {
+		SERIAL_SERVICE_UUID_CONSTANT };
+
+static BTPSCONST GATT_Characteristic_Declaration_128_Entry_t SerialServiceTxDeclaration =
+		{ GATT_CHARACTERISTIC_PROPERTIES_NOTIFY,
+				SERIAL_SERVICE_TX_UUID_CONSTANT };
+
+static BTPSCONST GATT_Characteristic_Value_128_Entry_t SerialServiceTxValue = {
+		SERIAL_SERVICE_TX_UUID_CONSTANT, 0, NULL };
+
+static BTPSCONST GATT_Characteristic_Descriptor_16_Entry_t SerialServiceTxConfiguration =
+		{ GATT_CLIENT_CHARACTERISTIC_CONFIGURATION_UUID_CONSTANT,
+				SERIAL_SERVICE_CCCD_LENGTH, NULL };
+
+static BTPSCONST GATT_Characteristic_Declaration_128_Entry_t SerialServiceRxDeclaration =
+		{ (GATT_CHARACTERISTIC_PROPERTIES_WRITE_WITHOUT_RESPONSE
+				| GATT_CHARACTERISTIC_PROPERTIES_WRITE),
+				SERIAL_SERVICE_RX_UUID_CONSTANT };
+
+static BTPSCONST GATT_Characteristic_Value_128_Entry_t SerialServiceRxValue = {
+		SERIAL_SERVICE_RX_UUID_CONSTANT, 0, NULL };
+
+static BTPSCONST GATT_Service_Attribute_Entry_t SerialServiceTable[] = {
+		{ GATT_ATTRIBUTE_FLAGS_READABLE, aetPrimaryService128,
+				(void *) &SerialServiceUUID },
+		{ GATT_ATTRIBUTE_FLAGS_READABLE, aetCharacteristicDeclaration128,
+				(void *) &SerialServiceTxDeclaration },
+		{ 0, aetCharacteristicValue128, (void *) &SerialServiceTxValue },
+		{ GATT_ATTRIBUTE_FLAGS_READABLE_WRITABLE,
+				aetCharacteristicDescriptor16,
+				(void *) &SerialServiceTxConfiguration },
+		{ GATT_ATTRIBUTE_FLAGS_READABLE, aetCharacteristicDeclaration128,
+				(void *) &SerialServiceRxDeclaration },
+		{ GATT_ATTRIBUTE_FLAGS_WRITABLE, aetCharacteristicValue128,
+				(void *) &SerialServiceRxValue } };
+
+#define SERIAL_SERVICE_NUMBER_ATTRIBUTES  (sizeof(SerialServiceTable)/sizeof(GATT_Service_Attribute_Entry_t))
+
+/* The following table holds the LE connection parameter profiles,   */
+/* indexed by LE_PROFILE_xxx.  The throughput profile uses the       */
+/* shortest interval the central is likely to accept, the latency    */
+/* profile a short interval without slave latency and the power      */
+/* profile a long interval with slave latency.                       */
+static BTPSCONST LEConnectionProfile_t LEConnectionProfiles[] = {
+		{ "THROUGHPUT", 8, 15, 0, 2000 },
+		{ "LATENCY", 15, 30, 0, 2000 },
+		{ "POWER", 100, 200, 4, 6000 } };
+
+#define NUMBER_LE_CONNECTION_PROFILES  (sizeof(LEConnectionProfiles)/sizeof(LEConnectionProfile_t))
+
+/* The following table holds the SPP buffer profiles, indexed by     */
+/* SPP_PROFILE_xxx.  The RFCOMM frame size is fixed by the stack     */
+/* configuration (L2CAP MTU), so throughput is gained by letting     */
+/* more frames be outstanding: the buffers must hold several frames  */
+/* and RFCOMM must be allowed to queue them to L2CAP.                */
+static BTPSCONST SPPBufferProfile_t SPPBufferProfiles[] = {
+		{ "DEFAULT", SPP_BUFFER_SIZE_CURRENT, SPP_BUFFER_SIZE_CURRENT, 0, 0 },
+		{ "BALANCED", 128, 128, 3, 1 },
+		{ "THROUGHPUT", 256, 384, 6, 2 } };
+
+#define NUMBER_SPP_BUFFER_PROFILES  (sizeof(SPPBufferProfiles)/sizeof(SPPBufferProfile_t))
+
+/* The following table holds the packet types used on the BR/EDR     */
+/* link, indexed by LINK_PACKETS_XXX.  EDR allows every packet type  */
+/* so that the controller can use 3-DH5, basic rate stops the EDR    */
+/* packets and robust only allows the FEC protected DM packets.      */
+static BTPSCONST LinkPacketType_t LinkPacketTypes[] = {
+		{ "EDR", LINK_PACKET_TYPES_DM | LINK_PACKET_TYPES_DH },
+		{ "BASIC", LINK_PACKET_TYPES_DM | LINK_PACKET_TYPES_DH
+				| LINK_PACKET_TYPES_NO_EDR },
+		{ "ROBUST", LINK_PACKET_TYPES_DM | LINK_PACKET_TYPES_NO_EDR } };
+
+/* The following table holds the names of the SPP test modes,        */
+/* indexed by SPP_TEST_MODE_xxx.                                     */
+static BTPSCONST char *SPPTestModeNames[] = {
+		"OFF", "GENERATE", "SINK", "LOOPBACK" };
+
+#define NUMBER_SPP_TEST_MODES  (sizeof(SPPTestModeNames)/sizeof(char *))
+
+/* The following table holds the names of the bridge policies,       */
+/* indexed by BRIDGE_POLICY_xxx.                                     */
+static BTPSCONST char *BridgePolicyNames[] = {
+		"SPP", "LE", "DUPLICATE", "CHANNEL" };
+
+#define NUMBER_BRIDGE_POLICIES  (sizeof(BridgePolicyNames)/sizeof(char *))
+
+/* The following hold the parts of the EIR and advertising data that */
+/* do not depend on the device name.  The EIR lists the SDP server   */
+/* (0x1000) and SPP (0x1101) UUIDs in little endian order, followed  */
+/* by two unassigned entries.  The transmit power and the            */
+/* advertising flags are filled in when the data is written.         */
+static BTPSCONST Byte_t EIRDataHeader[] = {
+		2, HCI_EXTENDED_INQUIRY_RESPONSE_DATA_TYPE_TX_POWER_LEVEL, 0,
+		1 + (UUID_16_SIZE << 2),
+		HCI_EXTENDED_INQUIRY_RESPONSE_DATA_TYPE_16_BIT_SERVICE_CLASS_UUID_COMPLETE,
+		0x00, 0x10, 0x01, 0x11, 0x00, 0x00, 0x00, 0x00 };
+
+#define EIR_DATA_TX_POWER_OFFSET  2
+
+static BTPSCONST Byte_t AdvertisingDataHeader[] = {
+		2, HCI_LE_ADVERTISING_REPORT_DATA_TYPE_FLAGS, 0,
+		1 + (UUID_16_SIZE << 1),
+		HCI_LE_ADVERTISING_REPORT_DATA_TYPE_16_BIT_SERVICE_UUID_COMPLETE,
+		0x00, 0x00, 0x00, 0x00 };
+
+#define ADVERTISING_DATA_FLAGS_OFFSET  2
+
+static BTPSCONST ScanResponseData_t ScanResponseData = {
+		1 + UUID_128_SIZE,
+		HCI_LE_ADVERTISING_REPORT_DATA_TYPE_128_BIT_SERVICE_UUID_COMPLETE,
+		SERIAL_SERVICE_UUID_CONSTANT, { 0 } };
+
+/* The following table describes the bond store tables, indexed by   */
+/* BOND_TABLE_XXX.                                                   */
+static BTPSCONST BondTable_t BondTables[] = {
+		{ LinkKeyInfo, sizeof(LinkKeyInfo_t), MAX_SUPPORTED_LINK_KEYS },
+		{ LEBondInfo, sizeof(LEBondInfo_t), MAX_SUPPORTED_LE_BONDS } };
+
+#define NUMBER_BOND_TABLES  (sizeof(BondTables)/sizeof(BondTable_t))
+
+#define BOND_TABLE_ENTRY(_x, _y)  ((BondEntryHeader_t *)(((Byte_t *)BondTables[(_x)].Entries) + ((_y) * BondTables[(_x)].EntrySize)))
+
 /* Internal function prototypes.                                     */
-static Boolean_t CreateNewDeviceInfoEntry(DeviceInfo_t **ListHead,
+static unsigned int HashBD_ADDR(BD_ADDR_t *BD_ADDR);
+static Boolean_t CreateNewDeviceInfoEntry(
 		GAP_LE_Address_Type_t *ConnectionAddressType,
 		BD_ADDR_t *ConnectionBD_ADDR);
-static DeviceInfo_t *SearchDeviceInfoEntryByBD_ADDR(DeviceInfo_t **ListHead,
-		BD_ADDR_t *BD_ADDR);
-static DeviceInfo_t *DeleteDeviceInfoEntry(DeviceInfo_t **ListHead,
-		BD_ADDR_t *BD_ADDR);
-static void FreeDeviceInfoEntryMemory(DeviceInfo_t *EntryToFree);
-static void FreeDeviceInfoList(DeviceInfo_t **ListHead);
+static DeviceInfo_t *SearchDeviceInfoEntryByBD_ADDR(BD_ADDR_t *BD_ADDR);
+static void DeleteDeviceInfoEntry(BD_ADDR_t *BD_ADDR);
+static void ClearDeviceInfoTable(void);
 
 static void BD_ADDRToStr(BD_ADDR_t *Board_Address, BoardStr_t BoardStr);
 
@@ -232,8 +1304,21 @@ static void DisplayPairingInformation(
 static void DisplayFunctionError(char *Function, int Status);
 static void DisplayFunctionSuccess(char *Function);
 
+static Boolean_t SPPBufferProfileFits(Byte_t Profile);
+static void ApplySPPQueuingParameters(void);
+static Boolean_t SPPConnectionsOpen(void);
+static void UpdateSPPQueuingParameters(void);
+static void ApplySPPBufferProfile(unsigned int SerialPortID);
 static int SPPOpenServer(unsigned int BluetoothStackID);
-
+static void SPPOpenPorts(unsigned int BluetoothStackID);
+static void SPPClosePorts(void);
+
+static int ConfigureController(unsigned int BluetoothStackID);
+static int InitializeGATTServices(unsigned int BluetoothStackID);
+static int GenerateLocalKeys(unsigned int BluetoothStackID);
+static int InitializeAdvertisingData(unsigned int BluetoothStackID);
+static unsigned long GetBootStageTime(unsigned int FromStage,
+		unsigned int ToStage);
 static int OpenStack(HCI_DriverInformation_t *HCI_DriverInformation,
 		BTPS_Initialization_t *BTPS_Initialization);
 static int CloseStack(void);
@@ -241,6 +1326,7 @@ static int CloseStack(void);
 static int SetPairable(void);
 
 static void PostApplicationMailbox(Byte_t MessageID);
+static void PostLEWriteReady(void);
 
 static void ConfigureCapabilities(GAP_LE_Pairing_Capabilities_t *Capabilities);
 static int SlavePairingRequestResponse(unsigned int BluetoothStackID,
@@ -250,17 +1336,143 @@ static int EncryptionInformationRequestResponse(unsigned int BluetoothStackID,
 		GAP_LE_Authentication_Response_Information_t *GAP_LE_Authentication_Response_Information);
 static int DeleteLinkKey(unsigned int BluetoothStackID, BD_ADDR_t *BD_ADDR);
 
+static void *SearchBondEntry(unsigned int Table, BD_ADDR_t *BD_ADDR,
+		Boolean_t Insert);
+static void StoreBondEntry(void *Entry);
+static void DeleteBondEntry(unsigned int Table, BD_ADDR_t *BD_ADDR);
+static unsigned int BondRecordLength(Byte_t Type);
+static void LoadBondStore(void);
+static Boolean_t WriteBondRecord(Byte_t *Address, Byte_t Type,
+		unsigned int Length, void *Data);
+static Boolean_t CompactBondStore(void);
+static void FlushBondStore(void);
+static void UpdateBondStore(void);
+
+static Boolean_t SearchLTKCache(Word_t EDIV, Random_Number_t *Rand,
+		Long_Term_Key_t *LTK);
+static void AddLTKCacheEntry(Word_t EDIV, Random_Number_t *Rand,
+		Long_Term_Key_t *LTK);
+static void UpdateLTKSetupTime(Byte_t Status);
+
+static void InvalidateRPACache(BD_ADDR_t *BD_ADDR);
+static void AddRPACacheEntry(BD_ADDR_t *RPA, BD_ADDR_t *BD_ADDR);
+static LEBondInfo_t *ResolveLEBondEntry(BD_ADDR_t *BD_ADDR);
+static LEBondInfo_t *SearchLEBondEntry(GAP_LE_Address_Type_t AddressType,
+		BD_ADDR_t *BD_ADDR, Boolean_t Insert);
+static LEBondInfo_t *MoveLEBondEntry(LEBondInfo_t *LEBond,
+		GAP_LE_Address_Type_t AddressType, BD_ADDR_t *BD_ADDR);
+static GAP_LE_Address_Type_t GetConnectionAddressType(BD_ADDR_t *BD_ADDR);
+
 static void FormatEIRData(unsigned int BluetoothStackID);
+static Boolean_t BuildAdvertisingData(void);
 static void FormatAdvertisingData(unsigned int BluetoothStackID,
 		Boolean_t SupportBR_EDR);
 
-static int StartAdvertising(unsigned int BluetoothStackID);
+static int StartAdvertising(unsigned int BluetoothStackID, Byte_t Phase);
+static Boolean_t GetLEBondAddress(LEBondInfo_t *LEBond,
+		GAP_LE_Address_Type_t *AddressType, BD_ADDR_t *BD_ADDR);
+static unsigned int LoadWhiteList(void);
+static void StartReconnectPhase(void);
+static void StartReconnect(BD_ADDR_t *BD_ADDR);
+static void NextReconnectPhase(void);
+static void UpdateReconnect(void);
+static void BTPSAPI AdvertisingTimerCallback(void *ScheduleParameter);
+static void StartAdvertisingSchedule(void);
+static void StartSlowAdvertising(void);
+static void StopAdvertisingSchedule(void);
 
 static void IdleFunction(unsigned int BluetoothStackID);
 
 static unsigned int FormatSPPDataPacket(unsigned int PacketBufferLength,
 		Byte_t *PacketBuffer);
+static void UpdateControlEscape(void);
+static void TrackSPPBufferAge(void);
+static void DropSPPData(unsigned int Length);
+static void UpdateRealTimeQueue(void);
+static void ApplyRealTimeMode(void);
+static unsigned int GetSPPBufferSpace(void);
 static void ProcessSendSPPData(Boolean_t PacketizeCurrentData);
+static void ProcessReceiveSPPData(void);
+static void UpdateSPPConnectability(void);
+static Boolean_t QueueSPPPortData(unsigned int Index, unsigned int Length,
+		Byte_t *Data);
+static void ProcessSPPPorts(void);
+static void UpdateWiredFlowHold(void);
+static void UpdateLocalPortStatus(void);
+static unsigned int ProcessSPPTestData(unsigned int Length, Byte_t *Data);
+static void ReportSPPTest(void);
+
+static void SetSerialServiceMTU(Word_t MTU);
+static void ProcessSendLEData(Boolean_t PacketizeCurrentData);
+static void ProcessReceiveLEData(unsigned int Length, Byte_t *Data);
+static Byte_t GetBridgeTransports(void);
+static void ProcessBridgeData(void);
+
+static void StartLEConnectionProfile(
+		GAP_LE_Current_Connection_Parameters_t *CurrentParameters);
+static void RequestLEConnectionProfile(Byte_t Profile);
+static void RejectLEConnectionProfile(void);
+static void UpdateLEConnectionProfile(void);
+static void UpdateSniffTime(void);
+static void StartSniffMode(void);
+static void ExitSniffMode(void);
+static void UpdateSniffMode(void);
+static void SetLinkPacketLevel(Byte_t Level);
+static void StartLinkPacketSelection(void);
+static void UpdateLinkQuality(void);
+static void AddTraceSample(Word_t *Timestamps);
+static void UpdateLatencyTrace(void);
+static void BTPSAPI ApplicationTimerCallback(void *ScheduleParameter);
+
+static void UARTWriteReadyCallback(void *CallbackParameter);
+
+static void SetUARTFraming(Boolean_t Enable);
+static void WriteFramedBytes(unsigned int Length, Byte_t *Data);
+static void WriteUARTFrame(Byte_t Header, unsigned int Length, Byte_t *Data);
+static unsigned int SendUARTFrameData(Byte_t Channel, unsigned int Length,
+		Byte_t *Data);
+static Boolean_t SendUARTFrameCredits(Byte_t Channel, Byte_t Credits);
+static void UpdateUARTFrameCredits(void);
+static void ProcessUARTFrame(void);
+static void ProcessUARTFrames(void);
+static void FlushFramedLog(void);
+
+static Word_t CalculateSettingsChecksum(ApplicationSettings_t *Settings);
+static void LoadDefaultSettings(void);
+static void LoadSettings(void);
+static int SaveSettings(void);
+static void ApplyDeviceName(void);
+static int ReopenSPPServer(void);
+
+static void SetCommandMode(Boolean_t Enable);
+static Boolean_t ParseControlValues(char *Parameter, unsigned int NumberValues,
+		unsigned long *Values);
+static void AddControlResponse(char *Response);
+static void WriteControlResponse(void);
+static void ExecuteControlCommand(void);
+static void ProcessControlInput(void);
+
+static int ControlDataMode(char *Parameter);
+static int ControlReset(char *Parameter);
+static int ControlSaveSettings(char *Parameter);
+static int ControlFactoryDefaults(char *Parameter);
+static int ControlPort(char *Parameter);
+static int ControlName(char *Parameter);
+static int ControlAdvertising(char *Parameter);
+static int ControlSlowAdvertising(char *Parameter);
+static int ControlHCILL(char *Parameter);
+static int ControlBaudRate(char *Parameter);
+static int ControlFraming(char *Parameter);
+static int ControlStatistics(char *Parameter);
+static int ControlLEProfile(char *Parameter);
+static int ControlSniff(char *Parameter);
+static int ControlSPPProfile(char *Parameter);
+static int ControlSPPTest(char *Parameter);
+static int ControlTrace(char *Parameter);
+static int ControlBonds(char *Parameter);
+static int ControlRealTime(char *Parameter);
+static int ControlSPPPorts(char *Parameter);
+static int ControlBridge(char *Parameter);
 
 /* BTPS Callback function prototypes.                                */
 static void BTPSAPI GAP_LE_Event_Callback(unsigned int BluetoothStackID,
@@ -273,86 +1485,178 @@ static void BTPSAPI GAP_Event_Callback(unsigned int BluetoothStackID,
 		GAP_Event_Data_t *GAP_Event_Data, unsigned long CallbackParameter);
 static void BTPSAPI SPP_Event_Callback(unsigned int BluetoothStackID,
 		SPP_Event_Data_t *SPP_Event_Data, unsigned long CallbackParameter);
+static void BTPSAPI SPP_Port_Event_Callback(unsigned int BluetoothStackID,
+		SPP_Event_Data_t *SPP_Event_Data, unsigned long CallbackParameter);
+static void BTPSAPI GATT_Server_Event_Callback(unsigned int BluetoothStackID,
+		GATT_Server_Event_Data_t *GATT_Server_Event_Data,
+		unsigned long CallbackParameter);
+static void BTPSAPI GATT_Client_Event_Callback(unsigned int BluetoothStackID,
+		GATT_Client_Event_Data_t *GATT_Client_Event_Data,
+		unsigned long CallbackParameter);
+static void BTPSAPI HCI_Event_Callback(unsigned int BluetoothStackID,
+		HCI_Event_Data_t *HCI_Event_Data, unsigned long CallbackParameter);
+
+/* The following table maps the control command names (following the */
+/* AT prefix) to the functions that implement them.                  */
+static BTPSCONST ControlCommand_t ControlCommandTable[] = {
+		{ "O", ControlDataMode },
+		{ "Z", ControlReset },
+		{ "&W", ControlSaveSettings },
+		{ "&F", ControlFactoryDefaults },
+		{ "+PORT", ControlPort },
+		{ "+NAME", ControlName },
+		{ "+ADV", ControlAdvertising },
+		{ "+ADVSLOW", ControlSlowAdvertising },
+		{ "+HCILL", ControlHCILL },
+		{ "+BAUD", ControlBaudRate },
+		{ "+FRAMING", ControlFraming },
+		{ "+STAT", ControlStatistics },
+		{ "+LEPROFILE", ControlLEProfile },
+		{ "+SNIFF", ControlSniff },
+		{ "+SPPPROFILE", ControlSPPProfile },
+		{ "+SPPTEST", ControlSPPTest },
+		{ "+TRACE", ControlTrace },
+		{ "+BONDS", ControlBonds },
+		{ "+REALTIME", ControlRealTime },
+		{ "+SPPPORTS", ControlSPPPorts },
+		{ "+BRIDGE", ControlBridge } };
+
+#define NUMBER_CONTROL_COMMANDS  (sizeof(ControlCommandTable)/sizeof(ControlCommand_t))
+
+/* The following table holds the steps of opening the stack that     */
+/* follow the stack initialization, in the order they are run.       */
+static BTPSCONST OpenStackStep_t OpenStackSteps[NUMBER_OPEN_STACK_STEPS] = {
+		{ "Configure", ConfigureController },
+		{ "SPPOpenServer", SPPOpenServer },
+		{ "GATT", InitializeGATTServices },
+		{ "Keys", GenerateLocalKeys },
+		{ "Advertising", InitializeAdvertisingData } };
+
+/* The following function is a utility function which is used to     */
+/* hash a BD_ADDR to the first entry searched in one of the tables   */
+/* that are indexed by BD_ADDR.                                      */
+static unsigned int HashBD_ADDR(BD_ADDR_t *BD_ADDR) {
+	return ((unsigned int) (BD_ADDR->BD_ADDR0 ^ BD_ADDR->BD_ADDR1
+			^ BD_ADDR->BD_ADDR2 ^ BD_ADDR->BD_ADDR3 ^ BD_ADDR->BD_ADDR4
+			^ BD_ADDR->BD_ADDR5));
+}
 
-/* The following function adds the specified Entry to the specified  */
-/* List.  This function allocates and adds an entry to the list that */
-/* has the same attributes as parameters to this function.  This     */
-/* function will return FALSE if NO Entry was added.  This can occur */
-/* if the element passed in was deemed invalid or the actual List    */
-/* Head was invalid.                                                 */
+/* The following function adds an entry with the specified attributes*/
+/* to the device info table.  This function will return FALSE if NO  */
+/* Entry was added.  This can occur if the BD_ADDR passed in was     */
+/* deemed invalid or the table is full.                              */
 /* ** NOTE ** This function does not insert duplicate entries into   */
-/*            the list.  An element is considered a duplicate if the */
-/*            Connection BD_ADDR.  When this occurs, this function   */
-/*            returns NULL.                                          */
-static Boolean_t CreateNewDeviceInfoEntry(DeviceInfo_t **ListHead,
+/*            the table.  An element is considered a duplicate if the*/
+/*            Connection BD_ADDR is already in the table.  When this */
+/*            occurs, this function returns FALSE.                   */
+static Boolean_t CreateNewDeviceInfoEntry(
 		GAP_LE_Address_Type_t *ConnectionAddressType,
 		BD_ADDR_t *ConnectionBD_ADDR) {
 	Boolean_t ret_val = FALSE;
-	DeviceInfo_t *DeviceInfoPtr;
+	unsigned int Index;
+	unsigned int Count;
 
 	/* Verify that the passed in parameters seem semi-valid.             */
-	if ((ListHead) && (!COMPARE_NULL_BD_ADDR(*ConnectionBD_ADDR))) {
-		/* Allocate the memory for the entry.                             */
-		if ((DeviceInfoPtr = BTPS_AllocateMemory(sizeof(DeviceInfo_t))) != NULL) {
-			/* Initialize the entry.                                       */
-			BTPS_MemInitialize(DeviceInfoPtr, 0, sizeof(DeviceInfo_t));
-			DeviceInfoPtr->ConnectionAddressType = *ConnectionAddressType;
-			DeviceInfoPtr->ConnectionBD_ADDR = *ConnectionBD_ADDR;
-
-			ret_val = BSC_AddGenericListEntry_Actual(ekBD_ADDR_t,
-					BTPS_STRUCTURE_OFFSET(DeviceInfo_t, ConnectionBD_ADDR),
-					BTPS_STRUCTURE_OFFSET(DeviceInfo_t, NextDeviceInfoInfoPtr),
-					(void **) (ListHead), (void *) (DeviceInfoPtr));
-			if (!ret_val) {
-				/* Failed to add to list so we should free the memory that  */
-				/* we allocated for the entry.                              */
-				BTPS_FreeMemory(DeviceInfoPtr);
+	if (!COMPARE_NULL_BD_ADDR(*ConnectionBD_ADDR)) {
+		Index = HashBD_ADDR(ConnectionBD_ADDR) % MAX_SUPPORTED_DEVICES;
+
+		/* Search for the first free entry, stopping at a duplicate.      */
+		for (Count = 0; Count < MAX_SUPPORTED_DEVICES; Count++) {
+			if (!(DeviceInfoTable[Index].Flags & DEVICE_INFO_FLAGS_IN_USE)) {
+				/* Initialize the entry.                                    */
+				BTPS_MemInitialize(&(DeviceInfoTable[Index]), 0,
+						sizeof(DeviceInfo_t));
+				DeviceInfoTable[Index].Flags = DEVICE_INFO_FLAGS_IN_USE;
+				DeviceInfoTable[Index].ConnectionAddressType =
+						*ConnectionAddressType;
+				DeviceInfoTable[Index].ConnectionBD_ADDR = *ConnectionBD_ADDR;
+
+				ret_val = TRUE;
+				break;
 			}
+
+			if (COMPARE_BD_ADDR(DeviceInfoTable[Index].ConnectionBD_ADDR, *ConnectionBD_ADDR))
+				break;
+
+			if (++Index == MAX_SUPPORTED_DEVICES)
+				Index = 0;
 		}
 	}
 
 	return (ret_val);
 }
 
-/* The following function searches the specified List for the        */
-/* specified Connection BD_ADDR.  This function returns NULL if      */
-/* either the List Head is invalid, the BD_ADDR is invalid, or the   */
+/* The following function searches the device info table for the     */
+/* specified Connection BD_ADDR.  This function returns NULL if the  */
 /* Connection BD_ADDR was NOT found.                                 */
-static DeviceInfo_t *SearchDeviceInfoEntryByBD_ADDR(DeviceInfo_t **ListHead,
-		BD_ADDR_t *BD_ADDR) {
-	return (BSC_SearchGenericListEntry(ekBD_ADDR_t, (void *) (BD_ADDR),
-			BTPS_STRUCTURE_OFFSET(DeviceInfo_t, ConnectionBD_ADDR),
-			BTPS_STRUCTURE_OFFSET(DeviceInfo_t, NextDeviceInfoInfoPtr),
-			(void **) (ListHead)));
-}
-
-/* The following function searches the specified Key Info List for   */
-/* the specified BD_ADDR and removes it from the List.  This function*/
-/* returns NULL if either the List Head is invalid, the BD_ADDR is   */
-/* invalid, or the specified Entry was NOT present in the list.  The */
-/* entry returned will have the Next Entry field set to NULL, and    */
-/* the caller is responsible for deleting the memory associated with */
-/* this entry by calling the FreeKeyEntryMemory() function.          */
-static DeviceInfo_t *DeleteDeviceInfoEntry(DeviceInfo_t **ListHead,
-		BD_ADDR_t *BD_ADDR) {
-	return (BSC_DeleteGenericListEntry(ekBD_ADDR_t, (void *) (BD_ADDR),
-			BTPS_STRUCTURE_OFFSET(DeviceInfo_t, ConnectionBD_ADDR),
-			BTPS_STRUCTURE_OFFSET(DeviceInfo_t, NextDeviceInfoInfoPtr),
-			(void **) (ListHead)));
+static DeviceInfo_t *SearchDeviceInfoEntryByBD_ADDR(BD_ADDR_t *BD_ADDR) {
+	unsigned int Index;
+	unsigned int Count;
+	DeviceInfo_t *ret_val = NULL;
+
+	Index = HashBD_ADDR(BD_ADDR) % MAX_SUPPORTED_DEVICES;
+
+	/* The entries of a device are never separated from their hashed     */
+	/* entry by a free entry, so the search ends at the first one.       */
+	for (Count = 0; (Count < MAX_SUPPORTED_DEVICES)
+			&& (DeviceInfoTable[Index].Flags & DEVICE_INFO_FLAGS_IN_USE);
+			Count++) {
+		if (COMPARE_BD_ADDR(DeviceInfoTable[Index].ConnectionBD_ADDR, *BD_ADDR)) {
+			ret_val = &(DeviceInfoTable[Index]);
+			break;
+		}
+
+		if (++Index == MAX_SUPPORTED_DEVICES)
+			Index = 0;
+	}
+
+	return (ret_val);
 }
 
-/* This function frees the specified Key Info Information member     */
-/* memory.                                                           */
-static void FreeDeviceInfoEntryMemory(DeviceInfo_t *EntryToFree) {
-	BSC_FreeGenericListEntryMemory((void *) (EntryToFree));
+/* The following function removes the entry of the specified BD_ADDR */
+/* from the device info table.  The entries that follow it are moved */
+/* back so that no entry is separated from its hashed entry by a free*/
+/* entry.                                                            */
+static void DeleteDeviceInfoEntry(BD_ADDR_t *BD_ADDR) {
+	unsigned int Free;
+	unsigned int Index;
+	unsigned int Hash;
+	DeviceInfo_t *DeviceInfo;
+
+	if ((DeviceInfo = SearchDeviceInfoEntryByBD_ADDR(BD_ADDR)) != NULL) {
+		Free = (unsigned int) (DeviceInfo - DeviceInfoTable);
+		Index = Free;
+
+		while (TRUE) {
+			if (++Index == MAX_SUPPORTED_DEVICES)
+				Index = 0;
+
+			if ((Index == Free)
+					|| (!(DeviceInfoTable[Index].Flags & DEVICE_INFO_FLAGS_IN_USE)))
+				break;
+
+			/* Move the entry back if its hashed entry does not lie     */
+			/* (cyclically) between the free entry and the entry.       */
+			Hash = HashBD_ADDR(&(DeviceInfoTable[Index].ConnectionBD_ADDR))
+					% MAX_SUPPORTED_DEVICES;
+
+			if ((Free < Index) ?
+					((Hash <= Free) || (Hash > Index)) :
+					((Hash <= Free) && (Hash > Index))) {
+				DeviceInfoTable[Free] = DeviceInfoTable[Index];
+
+				Free = Index;
+			}
+		}
+
+		BTPS_MemInitialize(&(DeviceInfoTable[Free]), 0, sizeof(DeviceInfo_t));
+	}
 }
 
-/* The following function deletes (and free's all memory) every      */
-/* element of the specified Key Info List. Upon return of this       */
-/* function, the Head Pointer is set to NULL.                        */
-static void FreeDeviceInfoList(DeviceInfo_t **ListHead) {
-	BSC_FreeGenericListEntryList((void **) (ListHead),
-			BTPS_STRUCTURE_OFFSET(DeviceInfo_t, NextDeviceInfoInfoPtr) );
+/* The following function removes every entry from the device info   */
+/* table.                                                            */
+static void ClearDeviceInfoTable(void) {
+	BTPS_MemInitialize(DeviceInfoTable, 0, sizeof(DeviceInfoTable));
 }
 
 /* The following function is responsible for converting data of type */
@@ -424,6 +1728,151 @@ static void DisplayFunctionSuccess(char *Function) {
 	Display(("%s success.\r\n",Function));
 }
 
+/* The following function is a utility function which is used to     */
+/* check whether the heap has room for the buffers of the specified  */
+/* SPP buffer profile.  The default sized buffers that are released  */
+/* when the buffers are changed are counted as free.                 */
+static Boolean_t SPPBufferProfileFits(Byte_t Profile) {
+	unsigned int Used;
+	unsigned int Free;
+	unsigned int MaxFree;
+	unsigned int Required;
+	BTPSCONST SPPBufferProfile_t *BufferProfile;
+
+	BufferProfile = &(SPPBufferProfiles[Profile]);
+
+	if ((BufferProfile->ReceiveBufferSize == SPP_BUFFER_SIZE_CURRENT)
+			&& (BufferProfile->TransmitBufferSize == SPP_BUFFER_SIZE_CURRENT))
+		return (TRUE);
+
+	BTPS_QueryMemoryUsage(&Used, &Free, &MaxFree);
+
+	Required = BufferProfile->ReceiveBufferSize
+			+ BufferProfile->TransmitBufferSize + SPP_PROFILE_HEAP_RESERVE;
+
+	return ((Boolean_t) (((Free + SPP_BUFFER_SIZE_DEFAULT_RECEIVE
+			+ SPP_BUFFER_SIZE_DEFAULT_TRANSMIT) >= Required)
+			&& (MaxFree >= BufferProfile->TransmitBufferSize)));
+}
+
+/* The following function is a utility function which is used to set */
+/* the RFCOMM queuing parameters of the selected SPP buffer profile. */
+/* RFCOMM only accepts these while no RFCOMM connection is open, so  */
+/* this is done when the server is opened and after a disconnection. */
+/* Zero parameters would disable the queuing limit, so the DEFAULT   */
+/* profile instead restores the parameters the stack had before a    */
+/* profile first changed them (and leaves them alone until then).    */
+static void ApplySPPQueuingParameters(void) {
+	int Result;
+	unsigned int MaximumDataPackets;
+	unsigned int QueuedDataPacketsThreshold;
+	BTPSCONST SPPBufferProfile_t *BufferProfile;
+
+	BufferProfile = &(SPPBufferProfiles[ApplicationSettings.SPPProfile]);
+
+	Result = 0;
+	if (BufferProfile->MaximumDataPackets) {
+		MaximumDataPackets = BufferProfile->MaximumDataPackets;
+		QueuedDataPacketsThreshold = BufferProfile->QueuedDataPacketsThreshold;
+
+		if (!(ApplicationStateInfo.Flags
+				& APPLICATION_STATE_INFO_FLAGS_SPP_QUEUING_CHANGED)) {
+			Result = RFCOMM_Get_Data_Queuing_Parameters(
+					ApplicationStateInfo.BluetoothStackID,
+					&(ApplicationStateInfo.SPPDefaultMaximumDataPackets),
+					&(ApplicationStateInfo.SPPDefaultQueuedDataPacketsThreshold));
+			if (Result)
+				DisplayFunctionError("RFCOMM_Get_Data_Queuing_Parameters",
+						Result);
+		}
+	} else {
+		MaximumDataPackets = ApplicationStateInfo.SPPDefaultMaximumDataPackets;
+		QueuedDataPacketsThreshold =
+				ApplicationStateInfo.SPPDefaultQueuedDataPacketsThreshold;
+	}
+
+	if ((!Result)
+			&& ((BufferProfile->MaximumDataPackets)
+					|| (ApplicationStateInfo.Flags
+							& APPLICATION_STATE_INFO_FLAGS_SPP_QUEUING_CHANGED))) {
+		Result = RFCOMM_Set_Data_Queuing_Parameters(
+				ApplicationStateInfo.BluetoothStackID, MaximumDataPackets,
+				QueuedDataPacketsThreshold);
+		if (Result)
+			DisplayFunctionError("RFCOMM_Set_Data_Queuing_Parameters", Result);
+		else {
+			if (BufferProfile->MaximumDataPackets)
+				ApplicationStateInfo.Flags |=
+						APPLICATION_STATE_INFO_FLAGS_SPP_QUEUING_CHANGED;
+			else
+				ApplicationStateInfo.Flags &=
+						~APPLICATION_STATE_INFO_FLAGS_SPP_QUEUING_CHANGED;
+		}
+	}
+}
+
+/* The following function is a utility function which is used to     */
+/* check whether an SPP port (the bridge port or an additional port) */
+/* is connected.                                                     */
+static Boolean_t SPPConnectionsOpen(void) {
+	unsigned int Index;
+	Boolean_t ret_val;
+
+	ret_val = (Boolean_t) ((ApplicationStateInfo.Flags
+			& APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED) != 0);
+
+	for (Index = 0; (!ret_val) && (Index < SPP_MAXIMUM_ADDITIONAL_PORTS);
+			Index++) {
+		if (SPPPortsInfo.Ports[Index].Flags & SPP_PORT_INFO_FLAGS_CONNECTED)
+			ret_val = TRUE;
+	}
+
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to     */
+/* apply a pending change of the RFCOMM queuing parameters.  The     */
+/* change is deferred until no SPP port is connected.                */
+static void UpdateSPPQueuingParameters(void) {
+	if ((ApplicationStateInfo.Flags
+			& APPLICATION_STATE_INFO_FLAGS_SPP_QUEUING_PENDING)
+			&& (!SPPConnectionsOpen())) {
+		ApplicationStateInfo.Flags &=
+				~APPLICATION_STATE_INFO_FLAGS_SPP_QUEUING_PENDING;
+
+		ApplySPPQueuingParameters();
+	}
+}
+
+/* The following function is a utility function which is used to     */
+/* size the SPP buffers of a newly opened port from the selected SPP */
+/* buffer profile.  If the heap does not have room for the profile   */
+/* the next smaller profile that fits is used instead.               */
+static void ApplySPPBufferProfile(unsigned int SerialPortID) {
+	int Result;
+	Byte_t Profile;
+
+	Profile = ApplicationSettings.SPPProfile;
+	while ((Profile != SPP_PROFILE_DEFAULT) && (!SPPBufferProfileFits(Profile)))
+		Profile--;
+
+	if (Profile != ApplicationSettings.SPPProfile)
+		Display(
+				("SPP %s profile does not fit, using %s.\r\n", SPPBufferProfiles[ApplicationSettings.SPPProfile].Name, SPPBufferProfiles[Profile].Name));
+
+	/* The buffers are empty at this point so nothing is lost.           */
+	Result = SPP_Change_Buffer_Size(ApplicationStateInfo.BluetoothStackID,
+			SerialPortID, SPPBufferProfiles[Profile].ReceiveBufferSize,
+			SPPBufferProfiles[Profile].TransmitBufferSize);
+	if (Result) {
+		DisplayFunctionError("SPP_Change_Buffer_Size", Result);
+
+		Profile = SPP_PROFILE_DEFAULT;
+	}
+
+	ApplicationStateInfo.SPPBufferProfile = Profile;
+}
+
 /* The following function is responsible for opening a Serial Port   */
 /* Server on the Local Device.  This function opens the Serial Port  */
 /* Server on the specified RFCOMM Channel.  This function returns    */
@@ -435,9 +1884,13 @@ static int SPPOpenServer(unsigned int BluetoothStackID) {
 
 	/* First check to see if a valid Bluetooth Stack ID exists.          */
 	if (BluetoothStackID) {
+		/* Let RFCOMM queue as many frames as the buffer profile wants.   */
+		ApplySPPQueuingParameters();
+
 		/* Simply attempt to open an Serial Server, on RFCOMM Server Port */
 		/* 1.                                                             */
-		ret_val = SPP_Open_Server_Port(BluetoothStackID, SPP_PORT_NUMBER,
+		ret_val = SPP_Open_Server_Port(BluetoothStackID,
+				ApplicationSettings.SPPPortNumber,
 				SPP_Event_Callback, (unsigned long) 0);
 
 		/* If the Open was successful, then note the Serial Port Server   */
@@ -453,7 +1906,7 @@ static int SPPOpenServer(unsigned int BluetoothStackID) {
 				/* Record indicating that an Serial Port Server exists.  Do */
 				/* this by first creating a Service Name.                   */
 				BTPS_SprintF(ServiceName, "Serial Port Server Port %d",
-						SPP_PORT_NUMBER);
+						ApplicationSettings.SPPPortNumber);
 
 				/* Now that a Service Name has been created try to Register */
 				/* the SDP Record.                                          */
@@ -479,7 +1932,8 @@ static int SPPOpenServer(unsigned int BluetoothStackID) {
 				} else {
 					/* Simply flag to the user that everything initialized   */
 					/* correctly.                                            */
-					Display(("Server Opened: %d.\r\n", SPP_PORT_NUMBER));
+					Display(
+							("Server Opened: %d.\r\n", ApplicationSettings.SPPPortNumber));
 
 					/* Flag success to the caller.                           */
 					ret_val = 0;
@@ -493,10 +1947,14 @@ static int SPPOpenServer(unsigned int BluetoothStackID) {
 			}
 		} else {
 			Display(
-					("Unable to Open Server on: %d, Error = %d.\r\n", SPP_PORT_NUMBER, ret_val));
+					("Unable to Open Server on: %d, Error = %d.\r\n", ApplicationSettings.SPPPortNumber, ret_val));
 
 			ret_val = FUNCTION_ERROR;
 		}
+
+		/* Open the additional ports once the bridge port is open.        */
+		if (!ret_val)
+			SPPOpenPorts(BluetoothStackID);
 	} else {
 		/* No valid Bluetooth Stack ID exists.                            */
 		ret_val = INVALID_STACK_ID_ERROR;
@@ -505,6 +1963,281 @@ static int SPPOpenServer(unsigned int BluetoothStackID) {
 	return (ret_val);
 }
 
+/* The following function is responsible for opening the configured  */
+/* number of additional SPP server ports on the RFCOMM channels      */
+/* following the bridge port.  A port that cannot be opened is       */
+/* reported and skipped.                                             */
+static void SPPOpenPorts(unsigned int BluetoothStackID) {
+	int Result;
+	unsigned int Index;
+	unsigned int PortNumber;
+	char ServiceName[32];
+	SPPPortInfo_t *Port;
+
+	for (Index = 0; Index < ApplicationSettings.SPPAdditionalPorts; Index++) {
+		Port = &(SPPPortsInfo.Ports[Index]);
+		PortNumber = ApplicationSettings.SPPPortNumber + Index + 1;
+
+		if (PortNumber > SPP_PORT_NUMBER_MAXIMUM)
+			break;
+
+		/* The index of the port is passed to the callback.               */
+		Result = SPP_Open_Server_Port(BluetoothStackID, PortNumber,
+				SPP_Port_Event_Callback, (unsigned long) Index);
+		if (Result > 0) {
+			Port->ServerPortID = (unsigned int) Result;
+
+			BTPS_SprintF(ServiceName, "Serial Port Server Port %u", PortNumber);
+
+			if (SPP_Register_SDP_Record(BluetoothStackID, Port->ServerPortID,
+					NULL, ServiceName, &(Port->SDPHandle)) < 0) {
+				SPP_Close_Server_Port(BluetoothStackID, Port->ServerPortID);
+
+				Port->ServerPortID = 0;
+			}
+		}
+
+		if (Port->ServerPortID)
+			Display(("Server Opened: %u.\r\n", PortNumber));
+		else
+			Display(("Unable to Open Server on: %u.\r\n", PortNumber));
+	}
+}
+
+/* The following function is responsible for closing the additional  */
+/* SPP server ports.  Any connection to them is dropped with them.   */
+static void SPPClosePorts(void) {
+	unsigned int Index;
+	SPPPortInfo_t *Port;
+
+	for (Index = 0; Index < SPP_MAXIMUM_ADDITIONAL_PORTS; Index++) {
+		Port = &(SPPPortsInfo.Ports[Index]);
+
+		if (Port->ServerPortID) {
+			SPP_Un_Register_SDP_Record(ApplicationStateInfo.BluetoothStackID,
+					Port->ServerPortID, Port->SDPHandle);
+
+			SPP_Close_Server_Port(ApplicationStateInfo.BluetoothStackID,
+					Port->ServerPortID);
+		}
+	}
+
+	BTPS_MemInitialize(&SPPPortsInfo, 0, sizeof(SPPPortsInfo));
+}
+
+/* The following function is the first step of opening the stack.  It*/
+/* configures the host and the controller.  The controller commands  */
+/* are sent one at a time, each waiting for its completion, as the   */
+/* controller only accepts one command at a time.  A failed command  */
+/* is reported, but does not stop the opening of the stack.  This    */
+/* function always returns zero.                                     */
+static int ConfigureController(unsigned int BluetoothStackID) {
+	int Result;
+	Byte_t Status;
+	Word_t NumberKeysDeleted;
+	BD_ADDR_t BD_ADDR;
+	L2CA_Link_Connect_Params_t L2CA_Link_Connect_Params;
+
+	/* Go ahead and allow Master/Slave Role Switch.                      */
+	L2CA_Link_Connect_Params.L2CA_Link_Connect_Request_Config =
+			cqAllowRoleSwitch;
+	L2CA_Link_Connect_Params.L2CA_Link_Connect_Response_Config =
+			csMaintainCurrentRole;
+
+	L2CA_Set_Link_Connection_Configuration(BluetoothStackID,
+			&L2CA_Link_Connect_Params);
+
+	if (HCI_Command_Supported(BluetoothStackID,
+			HCI_SUPPORTED_COMMAND_WRITE_DEFAULT_LINK_POLICY_BIT_NUMBER) > 0) {
+		Result = HCI_Write_Default_Link_Policy_Settings(BluetoothStackID,
+				(HCI_LINK_POLICY_SETTINGS_ENABLE_MASTER_SLAVE_SWITCH
+						| HCI_LINK_POLICY_SETTINGS_ENABLE_SNIFF_MODE), &Status);
+		if ((Result) || (Status != HCI_ERROR_CODE_NO_ERROR))
+			Display(
+					("HCI_Write_Default_Link_Policy_Settings failed: %d, Status 0x%02X.\r\n", Result, Status));
+	}
+
+	/* Write the Inquiry/Page Scan Modes that we will be using           */
+	/* (Interlaced scanning).                                            */
+	Result = HCI_Write_Inquiry_Scan_Type(BluetoothStackID,
+			HCI_INQUIRY_SCAN_TYPE_OPTIONAL_INTERLACED_SCAN, &Status);
+	if ((Result) || (Status != HCI_ERROR_CODE_NO_ERROR))
+		Display(
+				("HCI_Write_Inquiry_Scan_Type failed: %d, Status 0x%02X.\r\n", Result, Status));
+
+	Result = HCI_Write_Page_Scan_Type(BluetoothStackID,
+			HCI_PAGE_SCAN_TYPE_OPTIONAL_INTERLACED_SCAN, &Status);
+	if ((Result) || (Status != HCI_ERROR_CODE_NO_ERROR))
+		Display(
+				("HCI_Write_Page_Scan_Type failed: %d, Status 0x%02X.\r\n", Result, Status));
+
+	/* Delete all Link Keys stored in the controller, the Link Keys are  */
+	/* supplied from the bond store when they are requested (so the bond */
+	/* store itself is left as it is).                                   */
+	ASSIGN_BD_ADDR(BD_ADDR, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
+
+	Result = HCI_Delete_Stored_Link_Key(BluetoothStackID, BD_ADDR, TRUE,
+			&Status, &NumberKeysDeleted);
+	if ((Result) || (Status != HCI_ERROR_CODE_NO_ERROR))
+		Display(
+				("HCI_Delete_Stored_Link_Key failed: %d, Status 0x%02X.\r\n", Result, Status));
+
+	return (0);
+}
+
+/* The following function is the step of opening the stack that      */
+/* initializes GATT, the GAP Service and the serial service.  None of*/
+/* them wait on the controller.  This function returns zero on       */
+/* success and a negative value on all errors.                       */
+static int InitializeGATTServices(unsigned int BluetoothStackID) {
+	int Result;
+	int ret_val;
+	unsigned int ServiceID;
+	GATT_Attribute_Handle_Group_t ServiceHandleGroup;
+	GAP_Preferred_Connection_Parameters_t PreferredParameters;
+
+	/* Initialize the GATT Service.                                      */
+	if (!(Result = GATT_Initialize(BluetoothStackID,
+			GATT_INITIALIZATION_FLAGS_SUPPORT_LE, GATT_Connection_Event_Callback,
+			0))) {
+		/* Initialize the GAPS Service.                                   */
+		Result = GAPS_Initialize_Service(BluetoothStackID, &ServiceID);
+		if (Result > 0) {
+			/* Save the Instance ID of the GAP Service.                    */
+			ApplicationStateInfo.GAPSInstanceID = (unsigned int) Result;
+
+			/* Set the GAP Device Name and Device Appearance.              */
+			GAPS_Set_Device_Name(BluetoothStackID,
+					ApplicationStateInfo.GAPSInstanceID,
+					ApplicationSettings.DeviceName);
+			GAPS_Set_Device_Appearance(BluetoothStackID,
+					ApplicationStateInfo.GAPSInstanceID,
+					GAP_DEVICE_APPEARENCE_VALUE_GENERIC_COMPUTER);
+
+			/* Tell the central which parameters to use at the start of the*/
+			/* connection.                                                 */
+			PreferredParameters.Minimum_Connection_Interval =
+					LEConnectionProfiles[LE_PROFILE_LATENCY].IntervalMin;
+			PreferredParameters.Maximum_Connection_Interval =
+					LEConnectionProfiles[LE_PROFILE_LATENCY].IntervalMax;
+			PreferredParameters.Slave_Latency =
+					LEConnectionProfiles[LE_PROFILE_LATENCY].SlaveLatency;
+			PreferredParameters.Supervision_Timeout =
+					LEConnectionProfiles[LE_PROFILE_LATENCY].SupervisionTimeout;
+
+			GAPS_Set_Preferred_Connection_Parameters(BluetoothStackID,
+					ApplicationStateInfo.GAPSInstanceID, &PreferredParameters);
+
+			/* Register the GATT serial service.                           */
+			Result = GATT_Register_Service(BluetoothStackID,
+					GATT_SERVICE_FLAGS_LE_SERVICE,
+					SERIAL_SERVICE_NUMBER_ATTRIBUTES,
+					(GATT_Service_Attribute_Entry_t *) SerialServiceTable,
+					&ServiceHandleGroup, GATT_Server_Event_Callback, 0);
+			if (Result > 0)
+				ApplicationStateInfo.SerialServiceID = (unsigned int) Result;
+			else
+				DisplayFunctionError("GATT_Register_Service", Result);
+
+			/* Register for HCI events so that the serial service          */
+			/* notifications may be paced by the controller's completed    */
+			/* packets.                                                    */
+			Result = HCI_Register_Event_Callback(BluetoothStackID,
+					HCI_Event_Callback, 0);
+			if (Result > 0)
+				ApplicationStateInfo.HCIEventCallbackHandle =
+						(unsigned int) Result;
+			else
+				DisplayFunctionError("HCI_Register_Event_Callback", Result);
+
+			ret_val = 0;
+		} else {
+			DisplayFunctionError("GAPS_Initialize_Service", Result);
+
+			ret_val = UNABLE_TO_INITIALIZE_STACK;
+		}
+	} else {
+		DisplayFunctionError("GATT_Initialize", Result);
+
+		ret_val = UNABLE_TO_INITIALIZE_STACK;
+	}
+
+	return (ret_val);
+}
+
+/* The following function is the step of opening the stack that sets */
+/* the IRK and DHK, which are derived from the constant Identity Root*/
+/* Key.  The keys saved with the settings are used if they were      */
+/* derived from the same Identity Root Key, otherwise they are       */
+/* derived again (which waits on the controller) and saved for the   */
+/* next boot.  This function always returns zero.                    */
+static int GenerateLocalKeys(unsigned int BluetoothStackID) {
+	if (!BTPS_MemCompare(&(ApplicationSettings.IdentityRoot),
+			(Encryption_Key_t *) (&IR), sizeof(Encryption_Key_t))) {
+		IRK = ApplicationSettings.IRK;
+		DHK = ApplicationSettings.DHK;
+	} else {
+		if ((!GAP_LE_Diversify_Function(BluetoothStackID,
+				(Encryption_Key_t *) (&IR), 1, 0, &IRK))
+				&& (!GAP_LE_Diversify_Function(BluetoothStackID,
+						(Encryption_Key_t *) (&IR), 3, 0, &DHK))) {
+			ApplicationSettings.IdentityRoot = IR;
+			ApplicationSettings.IRK = IRK;
+			ApplicationSettings.DHK = DHK;
+
+			if (SaveSettings())
+				Display(("Unable to save the derived keys.\r\n"));
+		}
+	}
+
+	return (0);
+}
+
+/* The following function is the last step of opening the stack, it  */
+/* formats the EIR, advertising and scan response data (the          */
+/* controller has none after the reset).  This function always       */
+/* returns zero.                                                     */
+static int InitializeAdvertisingData(unsigned int BluetoothStackID) {
+	int Result;
+	Scan_Response_Data_t ScanResponse;
+
+	FormatEIRData(BluetoothStackID);
+
+	BuildAdvertisingData();
+
+	AdvertisingDataInfo.Flags = 0;
+
+	FormatAdvertisingData(BluetoothStackID, TRUE);
+
+	/* The scan response data never changes.  It is copied into a stack  */
+	/* buffer because the API does not take a constant pointer.          */
+	BTPS_MemInitialize(&ScanResponse, 0, sizeof(ScanResponse));
+	BTPS_MemCopy(&ScanResponse, &ScanResponseData, sizeof(ScanResponseData));
+
+	Result = GAP_LE_Set_Scan_Response_Data(BluetoothStackID,
+			sizeof(ScanResponseData) - sizeof(ScanResponseData.Unused),
+			&ScanResponse);
+	if (Result)
+		DisplayFunctionError("GAP_LE_Set_Scan_Response_Data", Result);
+
+	return (0);
+}
+
+/* The following function is a utility function which is used to get */
+/* the time (in milliseconds) between two HAL_BOOT_STAGE_XXX events.  */
+/* Zero is returned if either event has not been time stamped (for   */
+/* example because an earlier stage failed).                         */
+static unsigned long GetBootStageTime(unsigned int FromStage,
+		unsigned int ToStage) {
+	unsigned long From;
+	unsigned long To;
+
+	From = HAL_GetBootStamp(FromStage);
+	To = HAL_GetBootStamp(ToStage);
+
+	return (((From) && (To >= From)) ? (To - From) : 0);
+}
+
 /* The following function is responsible for opening the SS1         */
 /* Bluetooth Protocol Stack.  This function accepts a pre-populated  */
 /* HCI Driver Information structure that contains the HCI Driver     */
@@ -515,11 +2248,10 @@ static int OpenStack(HCI_DriverInformation_t *HCI_DriverInformation,
 	int Result;
 	int ret_val = 0;
 	char BluetoothAddress[16];
-	Byte_t Status;
+	unsigned int Step;
+	unsigned long StepTick;
 	BD_ADDR_t BD_ADDR;
-	unsigned int ServiceID;
 	HCI_Version_t HCIVersion;
-	L2CA_Link_Connect_Params_t L2CA_Link_Connect_Params;
 
 	/* Next, makes sure that the Driver Information passed appears to be */
 	/* semi-valid.                                                       */
@@ -535,9 +2267,15 @@ static int OpenStack(HCI_DriverInformation_t *HCI_DriverInformation,
 		BTPS_MemInitialize(&ApplicationStateInfo, 0,
 				sizeof(ApplicationStateInfo));
 
+		BTPS_MemInitialize(&BootInfo, 0, sizeof(BootInfo));
+
+		BootInfo.StartTick = BTPS_GetTickCount();
+
 		/* Initialize the Stack                                           */
 		Result = BSC_Initialize(HCI_DriverInformation, 0);
 
+		BootInfo.InitializeTime = BTPS_GetTickCount() - BootInfo.StartTick;
+
 		/* Next, check the return value of the initialization to see if it*/
 		/* was successful.                                                */
 		if (Result > 0) {
@@ -547,6 +2285,11 @@ static int OpenStack(HCI_DriverInformation_t *HCI_DriverInformation,
 			ApplicationStateInfo.BluetoothStackID = Result;
 			Display(
 					("Bluetooth Stack ID: %d.\r\n", ApplicationStateInfo.BluetoothStackID));
+			Display(("BSC_Initialize: %lu ms.\r\n", BootInfo.InitializeTime));
+			Display(
+					("Controller ready after %lu ms.\r\n", GetBootStageTime(HAL_BOOT_STAGE_CONTROLLER_RESET, HAL_BOOT_STAGE_CONTROLLER_READY)));
+			Display(
+					("Patch RAM: %lu ms.\r\n", GetBootStageTime(HAL_BOOT_STAGE_PATCH_START, HAL_BOOT_STAGE_PATCH_COMPLETE)));
 
 			/* Initialize the Default Pairing Parameters.                  */
 			LE_Parameters.IOCapability = licNoInputNoOutput;
@@ -572,118 +2315,31 @@ static int OpenStack(HCI_DriverInformation_t *HCI_DriverInformation,
 				Display(("BD_ADDR: %s\r\n", BluetoothAddress));
 			}
 
-			/* Go ahead and allow Master/Slave Role Switch.                */
-			L2CA_Link_Connect_Params.L2CA_Link_Connect_Request_Config =
-					cqAllowRoleSwitch;
-			L2CA_Link_Connect_Params.L2CA_Link_Connect_Response_Config =
-					csMaintainCurrentRole;
-
-			L2CA_Set_Link_Connection_Configuration(
-					ApplicationStateInfo.BluetoothStackID,
-					&L2CA_Link_Connect_Params);
-
-			if (HCI_Command_Supported(ApplicationStateInfo.BluetoothStackID,
-					HCI_SUPPORTED_COMMAND_WRITE_DEFAULT_LINK_POLICY_BIT_NUMBER)
-					> 0)
-				HCI_Write_Default_Link_Policy_Settings(
-						ApplicationStateInfo.BluetoothStackID,
-						(HCI_LINK_POLICY_SETTINGS_ENABLE_MASTER_SLAVE_SWITCH
-								| HCI_LINK_POLICY_SETTINGS_ENABLE_SNIFF_MODE),
-						&Status);
-
-			/* Write the Inquiry/Page Scan Modes that we will be using     */
-			/* (Interlaced scanning).                                      */
-			HCI_Write_Inquiry_Scan_Type(ApplicationStateInfo.BluetoothStackID,
-					HCI_INQUIRY_SCAN_TYPE_OPTIONAL_INTERLACED_SCAN, &Status);
-			HCI_Write_Page_Scan_Type(ApplicationStateInfo.BluetoothStackID,
-					HCI_PAGE_SCAN_TYPE_OPTIONAL_INTERLACED_SCAN, &Status);
-
-			/* Delete all Stored Link Keys.                                */
-			ASSIGN_BD_ADDR(BD_ADDR, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
-
-			DeleteLinkKey(ApplicationStateInfo.BluetoothStackID, &BD_ADDR);
-
-			/* Regenerate IRK and DHK from the constant Identity Root Key. */
-			GAP_LE_Diversify_Function(ApplicationStateInfo.BluetoothStackID,
-					(Encryption_Key_t *) (&IR), 1, 0, &IRK);
-			GAP_LE_Diversify_Function(ApplicationStateInfo.BluetoothStackID,
-					(Encryption_Key_t *) (&IR), 3, 0, &DHK);
-
 			/* Flag that we have no Key Information in the Key List.       */
-			DeviceInfoList = NULL;
-
-			/* Attempt to open an SPP Server.                              */
-			if (!(Result = SPPOpenServer(ApplicationStateInfo.BluetoothStackID))) {
-				/* Initialize the GATT Service.                             */
-				if (!(Result = GATT_Initialize(
-						ApplicationStateInfo.BluetoothStackID,
-						GATT_INITIALIZATION_FLAGS_SUPPORT_LE,
-						GATT_Connection_Event_Callback, 0))) {
-					/* Initialize the GAPS Service.                          */
-					Result = GAPS_Initialize_Service(
-							ApplicationStateInfo.BluetoothStackID, &ServiceID);
-					if (Result > 0) {
-						/* Save the Instance ID of the GAP Service.           */
-						ApplicationStateInfo.GAPSInstanceID =
-								(unsigned int) Result;
-
-						/* Set the GAP Device Name and Device Appearance.     */
-						GAPS_Set_Device_Name(
-								ApplicationStateInfo.BluetoothStackID,
-								ApplicationStateInfo.GAPSInstanceID,
-								LE_DEMO_DEVICE_NAME);
-						GAPS_Set_Device_Appearance(
-								ApplicationStateInfo.BluetoothStackID,
-								ApplicationStateInfo.GAPSInstanceID,
-								GAP_DEVICE_APPEARENCE_VALUE_GENERIC_COMPUTER);
-
-						/* Save the callback handle.                    */
-						ApplicationStateInfo.HCIEventCallbackHandle =
-								(unsigned int) ret_val;
-
-						/* Format the EIR Data.                         */
-						FormatEIRData(ApplicationStateInfo.BluetoothStackID);
-
-						/* Format the Advertising Data.                 */
-						FormatAdvertisingData(
-								ApplicationStateInfo.BluetoothStackID, TRUE);
-
-						/* Return success to the caller.                */
-						ret_val = 0;
-					} else {
-						/* The Stack was NOT initialized successfully, inform */
-						/* the user and set the return value of the           */
-						/* initialization function to an error.               */
-						DisplayFunctionError("GAPS_Initialize_Service", Result);
-
-						ret_val = UNABLE_TO_INITIALIZE_STACK;
-					}
+			ClearDeviceInfoTable();
 
-					/* Shutdown the stack if an error occurred.              */
-					if (ret_val < 0)
-						CloseStack();
-				} else {
-					/* The Stack was NOT initialized successfully, inform the*/
-					/* user and set the return value of the initialization   */
-					/* function to an error.                                 */
-					DisplayFunctionError("GATT_Initialize", Result);
+			/* Run the remaining steps, stopping at the first that fails.  */
+			for (Step = 0; (!ret_val) && (Step < NUMBER_OPEN_STACK_STEPS);
+					Step++) {
+				StepTick = BTPS_GetTickCount();
 
-					/* Shutdown the stack.                                   */
-					CloseStack();
+				Result = (*OpenStackSteps[Step].Function)(
+						ApplicationStateInfo.BluetoothStackID);
+				if (Result) {
+					DisplayFunctionError(OpenStackSteps[Step].Name, Result);
 
 					ret_val = UNABLE_TO_INITIALIZE_STACK;
 				}
-			} else {
-				/* The Stack was NOT initialized successfully, inform the   */
-				/* user and set the return value of the initialization      */
-				/* function to an error.                                    */
-				DisplayFunctionError("OpenServer", Result);
 
-				/* Shutdown the stack.                                      */
-				CloseStack();
+				BootInfo.StepTime[Step] = BTPS_GetTickCount() - StepTick;
 
-				ret_val = UNABLE_TO_INITIALIZE_STACK;
+				Display(
+						("%s: %lu ms.\r\n", OpenStackSteps[Step].Name, BootInfo.StepTime[Step]));
 			}
+
+			/* Shutdown the stack if an error occurred.                    */
+			if (ret_val < 0)
+				CloseStack();
 		} else {
 			/* The Stack was NOT initialized successfully, inform the user */
 			/* and set the return value of the initialization function to  */
@@ -717,6 +2373,13 @@ static int CloseStack(void) {
 			GAPS_Cleanup_Service(ApplicationStateInfo.BluetoothStackID,
 					ApplicationStateInfo.GAPSInstanceID);
 
+		/* Un-register the GATT serial service.                           */
+		if (ApplicationStateInfo.SerialServiceID)
+			GATT_Un_Register_Service(ApplicationStateInfo.BluetoothStackID,
+					ApplicationStateInfo.SerialServiceID);
+
+		SPPClosePorts();
+
 		if (ApplicationStateInfo.SPPServerPortID) {
 			SPP_Un_Register_SDP_Record( ApplicationStateInfo.BluetoothStackID,
 					ApplicationStateInfo.SPPServerPortID,
@@ -741,8 +2404,8 @@ static int CloseStack(void) {
 
 		Display(("Stack Shutdown.\r\n"));
 
-		/* Free the Key List.                                             */
-		FreeDeviceInfoList(&DeviceInfoList);
+		/* Clear the Key List.                                            */
+		ClearDeviceInfoTable();
 
 		/* Flag that the Stack is no longer initialized.                  */
 		BTPS_MemInitialize(&ApplicationStateInfo, 0,
@@ -849,6 +2512,20 @@ static void PostApplicationMailbox(Byte_t MessageID) {
 	BTPS_AddMailbox(ApplicationStateInfo.Mailbox, (void *) &MessageID);
 }
 
+/* The following function is used to post that the LE device can     */
+/* take more data.  Only one such message is left in the mailbox at a*/
+/* time, so a burst of completed packets can not fill the mailbox.   */
+static void PostLEWriteReady(void) {
+	Byte_t MessageID;
+
+	if (!SerialServiceInfo.WriteReadyPending) {
+		MessageID = APPLICATION_MAILBOX_MESSAGE_ID_LE_WRITE_READY;
+
+		SerialServiceInfo.WriteReadyPending = BTPS_AddMailbox(
+				ApplicationStateInfo.Mailbox, (void *) &MessageID);
+	}
+}
+
 /* The following function provides a mechanism to configure a        */
 /* Pairing Capabilities structure with the application's pairing     */
 /* parameters.                                                       */
@@ -881,9 +2558,11 @@ static void ConfigureCapabilities(GAP_LE_Pairing_Capabilities_t *Capabilities) {
 
 		/* This application only demostrates using Long Term Key's (LTK)  */
 		/* for encryption of a LE Link, however we could request and send */
-		/* all possible keys here if we wanted to.                        */
+		/* all possible keys here if we wanted to.  The Identity          */
+		/* Resolving Key (IRK) of the master is requested so that it can  */
+		/* be kept in the bond store.                                     */
 		Capabilities->Receiving_Keys.Encryption_Key = FALSE;
-		Capabilities->Receiving_Keys.Identification_Key = FALSE;
+		Capabilities->Receiving_Keys.Identification_Key = TRUE;
 		Capabilities->Receiving_Keys.Signing_Key = FALSE;
 
 		Capabilities->Sending_Keys.Encryption_Key = TRUE;
@@ -951,6 +2630,10 @@ static int EncryptionInformationRequestResponse(unsigned int BluetoothStackID,
 		{
 			Display(("   Encryption Information Request Response.\r\n"));
 
+			/* Keep the new LTK so that the first encryption request    */
+			/* does not have to regenerate it.                          */
+			AddLTKCacheEntry(GAP_LE_Authentication_Response_Information->Authentication_Data.Encryption_Information.EDIV, &(GAP_LE_Authentication_Response_Information->Authentication_Data.Encryption_Information.Rand), &(GAP_LE_Authentication_Response_Information->Authentication_Data.Encryption_Information.LTK));
+
 			/* Response to the request with the LTK, EDIV and Rand      */
 			/* values.                                                  */
 			GAP_LE_Authentication_Response_Information->GAP_LE_Authentication_Type = larEncryptionInformation;
@@ -997,121 +2680,632 @@ static int DeleteLinkKey(unsigned int BluetoothStackID, BD_ADDR_t *BD_ADDR) {
 	int Result;
 	Byte_t Status_Result;
 	Word_t Num_Keys_Deleted = 0;
-	BD_ADDR_t NULL_BD_ADDR;
 
 	Result = HCI_Delete_Stored_Link_Key(BluetoothStackID, *BD_ADDR, TRUE,
 			&Status_Result, &Num_Keys_Deleted);
 
 	/* Any stored link keys for the specified address (or all) have been */
-	/* deleted from the chip.  Now, let's make sure that our stored Link */
-	/* Key Array is in sync with these changes.                          */
+	/* deleted from the chip.  Now, let's make sure that the bond store  */
+	/* is in sync with these changes.                                    */
+	if (COMPARE_NULL_BD_ADDR(*BD_ADDR))
+		DeleteBondEntry(BOND_TABLE_LINK_KEY, NULL);
+	else
+		DeleteBondEntry(BOND_TABLE_LINK_KEY, BD_ADDR);
 
-	/* First check to see all Link Keys were deleted.                    */
-	ASSIGN_BD_ADDR(NULL_BD_ADDR, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
+	return (Result);
+}
 
-	if (COMPARE_BD_ADDR(*BD_ADDR, NULL_BD_ADDR))
-		BTPS_MemInitialize(LinkKeyInfo, 0, sizeof(LinkKeyInfo));
-	else {
-		/* Individual Link Key.  Go ahead and see if know about the entry */
-		/* in the list.                                                   */
-		for (Result = 0; (Result < sizeof(LinkKeyInfo) / sizeof(LinkKeyInfo_t));
-				Result++) {
-			if (COMPARE_BD_ADDR(*BD_ADDR, LinkKeyInfo[Result].BD_ADDR)) {
-				LinkKeyInfo[Result].BD_ADDR = NULL_BD_ADDR;
+/* The following function is a utility function which is used to     */
+/* search one of the bond store tables (BOND_TABLE_XXX) for the entry*/
+/* of the specified device.  The table is searched from the hashed   */
+/* entry onwards until the device or an entry that was never used is */
+/* found.  If Insert is TRUE and the device is not in the table, a   */
+/* free entry is cleared and returned with the BD_ADDR set.  This    */
+/* function returns NULL if no entry was found.                      */
+/* * NOTE * A deleted entry is only reused for another device once   */
+/*          the deletion has been written to flash, so the deletion  */
+/*          is not lost.                                             */
+static void *SearchBondEntry(unsigned int Table, BD_ADDR_t *BD_ADDR,
+		Boolean_t Insert) {
+	unsigned int Index;
+	unsigned int Count;
+	BondEntryHeader_t *Entry;
+	BondEntryHeader_t *FreeEntry;
+	BondEntryHeader_t *ret_val;
+
+	ret_val = NULL;
+	FreeEntry = NULL;
+	Index = HashBD_ADDR(BD_ADDR) % BondTables[Table].NumberEntries;
+
+	for (Count = 0; (!ret_val) && (Count < BondTables[Table].NumberEntries);
+			Count++) {
+		Entry = BOND_TABLE_ENTRY(Table, Index);
+
+		if (Entry->Flags & BOND_ENTRY_FLAGS_VALID) {
+			if (COMPARE_BD_ADDR(Entry->BD_ADDR, *BD_ADDR))
+				ret_val = Entry;
+		} else {
+			/* The deleted entry of the same device is preferred.          */
+			if (COMPARE_BD_ADDR(Entry->BD_ADDR, *BD_ADDR))
+				FreeEntry = Entry;
+			else {
+				if ((!FreeEntry)
+						&& (!(Entry->Flags & BOND_ENTRY_FLAGS_PENDING)))
+					FreeEntry = Entry;
+			}
 
+			if (!(Entry->Flags & BOND_ENTRY_FLAGS_DELETED))
 				break;
-			}
 		}
+
+		if (++Index == BondTables[Table].NumberEntries)
+			Index = 0;
 	}
 
-	return (Result);
-}
+	if ((!ret_val) && (Insert) && (FreeEntry)) {
+		BTPS_MemInitialize(FreeEntry, 0, BondTables[Table].EntrySize);
 
-/* The following function is a utility function which exists to      */
-/* format the EIR Data that is used by this application.             */
-static void FormatEIRData(unsigned int BluetoothStackID) {
-	Byte_t *TempPtr;
-	Byte_t Status;
-	SByte_t TxPower;
-	unsigned int Length;
-	unsigned int StringLength;
-	Extended_Inquiry_Response_Data_t EIRData;
+		FreeEntry->BD_ADDR = *BD_ADDR;
 
-	/* First, check that valid Bluetooth Stack ID exists.                */
-	if (BluetoothStackID) {
-		/* Begin formatting the EIR Data.                                 */
-		Length = 0;
-		TempPtr = EIRData.Extended_Inquiry_Response_Data;
+		ret_val = FreeEntry;
+	}
 
-		BTPS_MemInitialize(TempPtr, 0, EXTENDED_INQUIRY_RESPONSE_DATA_SIZE);
+	return (ret_val);
+}
 
-		/* Format the Inquiry Response Transmit Power Level.              */
-		*TempPtr++ = 2;
-		*TempPtr++ = HCI_EXTENDED_INQUIRY_RESPONSE_DATA_TYPE_TX_POWER_LEVEL;
+/* The following function is a utility function which is used to flag*/
+/* that an entry of the bond store has been added or changed.  The   */
+/* entry is written to flash with the next batch of changes.         */
+static void StoreBondEntry(void *Entry) {
+	((BondEntryHeader_t *) Entry)->Flags &= ~BOND_ENTRY_FLAGS_DELETED;
+	((BondEntryHeader_t *) Entry)->Flags |= (BOND_ENTRY_FLAGS_VALID
+			| BOND_ENTRY_FLAGS_PENDING);
 
-		if ((HCI_Read_Inquiry_Response_Transmit_Power_Level(BluetoothStackID,
-				&Status, &TxPower)) || (Status))
-			*TempPtr++ = 0;
-		else
-			*TempPtr++ = (Byte_t) TxPower;
+	BondStoreInfo.Pending = TRUE;
+	BondStoreInfo.IdlePeriods = 0;
+}
+
+/* The following function is a utility function which is used to     */
+/* delete the entry of the specified device from one of the bond     */
+/* store tables.  If BD_ADDR is NULL all entries of the table are    */
+/* deleted.                                                          */
+static void DeleteBondEntry(unsigned int Table, BD_ADDR_t *BD_ADDR) {
+	unsigned int Index;
+	BondEntryHeader_t *Entry;
+
+	for (Index = 0; Index < BondTables[Table].NumberEntries; Index++) {
+		Entry = BOND_TABLE_ENTRY(Table, Index);
+
+		if ((Entry->Flags & BOND_ENTRY_FLAGS_VALID)
+				&& ((!BD_ADDR) || (COMPARE_BD_ADDR(Entry->BD_ADDR, *BD_ADDR)))) {
+			Entry->Flags = (BOND_ENTRY_FLAGS_DELETED | BOND_ENTRY_FLAGS_PENDING);
+
+			BondStoreInfo.Pending = TRUE;
+			BondStoreInfo.IdlePeriods = 0;
+		}
+	}
+
+	if (Table == BOND_TABLE_LE)
+		InvalidateRPACache(BD_ADDR);
+}
+
+/* The following function is a utility function which is used to     */
+/* determine the length of a bond store record (not counting the type*/
+/* byte).  This function returns zero if the type is not valid.      */
+static unsigned int BondRecordLength(Byte_t Type) {
+	unsigned int ret_val;
+
+	ret_val = 0;
+
+	if ((Type & BOND_RECORD_TYPE_TABLE_MASK) < NUMBER_BOND_TABLES) {
+		if ((Type & ~BOND_RECORD_TYPE_TABLE_MASK) == BOND_RECORD_TYPE_ENTRY)
+			ret_val = BondTables[Type & BOND_RECORD_TYPE_TABLE_MASK].EntrySize;
+		else {
+			if ((Type & ~BOND_RECORD_TYPE_TABLE_MASK) == BOND_RECORD_TYPE_DELETE)
+				ret_val = BD_ADDR_SIZE;
+		}
+	}
+
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to load*/
+/* the bond store from flash.  The newest segment with a valid header*/
+/* is used and its records are applied in order.  If the segment     */
+/* holds anything after the last record (for example a record that   */
+/* was interrupted by a reset), the segments are switched with the   */
+/* next batch of changes.                                            */
+static void LoadBondStore(void) {
+	Byte_t *Record;
+	unsigned int Index;
+	unsigned int Length;
+	BondStoreHeader_t *Header1;
+	BondStoreHeader_t *Header2;
+	BondEntryHeader_t *Entry;
+
+	BTPS_MemInitialize(LinkKeyInfo, 0, sizeof(LinkKeyInfo));
+	BTPS_MemInitialize(LEBondInfo, 0, sizeof(LEBondInfo));
+	BTPS_MemInitialize(&BondStoreInfo, 0, sizeof(BondStoreInfo));
+
+	Header1 = (BondStoreHeader_t *) BOND_STORE_SEGMENT_1;
+	Header2 = (BondStoreHeader_t *) BOND_STORE_SEGMENT_2;
+
+	/* Use the segment with the newer sequence number if both are        */
+	/* valid.                                                            */
+	if ((Header1->Signature == BOND_STORE_SIGNATURE)
+			&& ((Header2->Signature != BOND_STORE_SIGNATURE)
+					|| ((Word_t) (Header1->Sequence - Header2->Sequence)
+							< 0x8000)))
+		BondStoreInfo.Segment = (Byte_t *) Header1;
+	else {
+		if (Header2->Signature == BOND_STORE_SIGNATURE)
+			BondStoreInfo.Segment = (Byte_t *) Header2;
+	}
+
+	if (BondStoreInfo.Segment) {
+		BondStoreInfo.Sequence =
+				((BondStoreHeader_t *) BondStoreInfo.Segment)->Sequence;
+		BondStoreInfo.Used = sizeof(BondStoreHeader_t);
+
+		while (BondStoreInfo.Used < BOND_STORE_SEGMENT_SIZE) {
+			Record = &(BondStoreInfo.Segment[BondStoreInfo.Used]);
+			if (*Record == BOND_RECORD_TYPE_ERASED)
+				break;
+
+			Length = BondRecordLength(*Record);
+			if ((!Length)
+					|| ((BondStoreInfo.Used + 1 + Length)
+							> BOND_STORE_SEGMENT_SIZE))
+				break;
+
+			Index = (*Record & BOND_RECORD_TYPE_TABLE_MASK);
+
+			if ((*Record & ~BOND_RECORD_TYPE_TABLE_MASK)
+					== BOND_RECORD_TYPE_ENTRY) {
+				/* The record is a copy of the entry.                       */
+				if ((Entry = SearchBondEntry(Index, (BD_ADDR_t *) &(Record[2]),
+						TRUE)) != NULL) {
+					BTPS_MemCopy(Entry, &(Record[1]), Length);
 
-		Length += 3;
+					Entry->Flags &= BOND_ENTRY_FLAGS_IRK_VALID;
+					Entry->Flags |= BOND_ENTRY_FLAGS_VALID;
+				}
+			} else {
+				if ((Entry = SearchBondEntry(Index, (BD_ADDR_t *) &(Record[1]),
+						FALSE)) != NULL)
+					Entry->Flags = BOND_ENTRY_FLAGS_DELETED;
+			}
 
-		/* Format the Service Class List.                                 */
-		*TempPtr++ = 1 + (UUID_16_SIZE<<2);
-		*TempPtr++ =
-				HCI_EXTENDED_INQUIRY_RESPONSE_DATA_TYPE_16_BIT_SERVICE_CLASS_UUID_COMPLETE;
+			BondStoreInfo.Used += (1 + Length);
+		}
 
-		/* Assign the SDP Server UUID.                                    */
-		SDP_ASSIGN_SDP_SERVER_UUID_16(*((UUID_16_t *)TempPtr));
+		/* Anything after the last record means the segment can no        */
+		/* longer be appended to.                                         */
+		for (Index = BondStoreInfo.Used; Index < BOND_STORE_SEGMENT_SIZE;
+				Index++) {
+			if (BondStoreInfo.Segment[Index] != BOND_RECORD_TYPE_ERASED)
+				BondStoreInfo.Compact = TRUE;
+		}
+	} else {
+		/* Nothing has been stored, the first batch of changes is         */
+		/* written to segment 1.                                          */
+		BondStoreInfo.Segment = (Byte_t *) BOND_STORE_SEGMENT_2;
+		BondStoreInfo.Compact = TRUE;
+	}
+}
 
-		/* Swap the Endian-ness (above macro assigns in big endian        */
-		/* format).                                                       */
-		Status = TempPtr[1];
-		TempPtr[1] = TempPtr[0];
-		TempPtr[0] = Status;
+/* The following function is a utility function which is used to     */
+/* write a bond store record at the specified address.  The type byte*/
+/* is written after the rest of the record.  This function returns   */
+/* TRUE if the record was written correctly.                         */
+static Boolean_t WriteBondRecord(Byte_t *Address, Byte_t Type,
+		unsigned int Length, void *Data) {
+	Boolean_t ret_val;
+
+	ret_val = (Boolean_t) ((!HAL_FlashWrite(&(Address[1]), Length, Data))
+			&& (!HAL_FlashWrite(Address, 1, &Type))
+			&& (!BTPS_MemCompare(&(Address[1]), Data, Length))
+			&& (Address[0] == Type));
+
+	if (ret_val)
+		BondStoreInfo.RecordsWritten++;
+	else
+		BondStoreInfo.WriteErrors++;
 
-		TempPtr += UUID_16_SIZE;
+	return (ret_val);
+}
 
-		/* Assign the SPP UUID.                                           */
-		SDP_ASSIGN_SERIAL_PORT_PROFILE_UUID_16(*((UUID_16_t *)TempPtr));
+/* The following function is a utility function which is used to     */
+/* write all valid entries of the bond store to the segment that is  */
+/* not active, which then becomes the active segment.  The header is */
+/* written last, so the previous segment stays in use if this is     */
+/* interrupted.  This function returns TRUE if successful.           */
+static Boolean_t CompactBondStore(void) {
+	Boolean_t ret_val;
+	Byte_t *Segment;
+	unsigned int Used;
+	unsigned int Table;
+	unsigned int Index;
+	BondEntryHeader_t *Entry;
+	BondStoreHeader_t Header;
+
+	if (BondStoreInfo.Segment == (Byte_t *) BOND_STORE_SEGMENT_1)
+		Segment = (Byte_t *) BOND_STORE_SEGMENT_2;
+	else
+		Segment = (Byte_t *) BOND_STORE_SEGMENT_1;
 
-		/* Swap the Endian-ness (above macro assigns in big endian        */
-		/* format).                                                       */
-		Status = TempPtr[1];
-		TempPtr[1] = TempPtr[0];
-		TempPtr[0] = Status;
+	BondStoreInfo.SegmentErases++;
 
-		TempPtr += UUID_16_SIZE;
+	ret_val = (Boolean_t) (!HAL_FlashEraseSegment(Segment));
+	Used = sizeof(BondStoreHeader_t);
 
-		/* Assign the Key Fob UUID.                                       */
-		//TI_KFS_ASSIGN_KFS_SERVICE_UUID_16(*((UUID_16_t *)TempPtr)); FIXME
-		TempPtr += UUID_16_SIZE;
+	for (Table = 0; (ret_val) && (Table < NUMBER_BOND_TABLES); Table++) {
+		for (Index = 0;
+				(ret_val) && (Index < BondTables[Table].NumberEntries);
+				Index++) {
+			Entry = BOND_TABLE_ENTRY(Table, Index);
 
-		/* Assign the Accelerometer UUID.                                 */
-		//TI_ACC_ASSIGN_ACC_SERVICE_UUID_16(*((UUID_16_t *) TempPtr)); FIXME
-		TempPtr += UUID_16_SIZE;
+			if (Entry->Flags & BOND_ENTRY_FLAGS_VALID) {
+				ret_val = WriteBondRecord(&(Segment[Used]),
+						(Byte_t) (BOND_RECORD_TYPE_ENTRY | Table),
+						BondTables[Table].EntrySize, Entry);
 
-		Length += 2 + (UUID_16_SIZE<<2);
+				Used += (1 + BondTables[Table].EntrySize);
+			}
+		}
+	}
 
-		/* Format the local device name.                                  */
-		StringLength = BTPS_StringLength(CB_DEMO_DEVICE_NAME);
-		if (StringLength
-				<= (EXTENDED_INQUIRY_RESPONSE_DATA_MAXIMUM_SIZE - Length - 2)) {
-			*TempPtr++ = StringLength + 1;
-			*TempPtr++ =
-					HCI_EXTENDED_INQUIRY_RESPONSE_DATA_TYPE_LOCAL_NAME_COMPLETE;
+	if (ret_val) {
+		Header.Signature = BOND_STORE_SIGNATURE;
+		Header.Sequence = (Word_t) (BondStoreInfo.Sequence + 1);
+
+		if ((!HAL_FlashWrite(Segment, sizeof(Header), &Header))
+				&& (!BTPS_MemCompare(Segment, &Header, sizeof(Header)))) {
+			BondStoreInfo.Segment = Segment;
+			BondStoreInfo.Sequence = Header.Sequence;
+			BondStoreInfo.Used = Used;
+			BondStoreInfo.Compact = FALSE;
+
+			/* Every change is now held in the active segment.             */
+			for (Table = 0; Table < NUMBER_BOND_TABLES; Table++) {
+				for (Index = 0; Index < BondTables[Table].NumberEntries;
+						Index++)
+					BOND_TABLE_ENTRY(Table, Index)->Flags &=
+							~BOND_ENTRY_FLAGS_PENDING;
+			}
 		} else {
-			StringLength = 64;
-			*TempPtr++ = StringLength + 1;
-			*TempPtr++ =
-					HCI_EXTENDED_INQUIRY_RESPONSE_DATA_TYPE_LOCAL_NAME_SHORTENED;
+			BondStoreInfo.WriteErrors++;
+
+			ret_val = FALSE;
+		}
+	}
+
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to     */
+/* write the changed entries of the bond store to flash.  The changes*/
+/* are appended to the active segment if they fit, otherwise the     */
+/* segments are switched.                                            */
+/* * NOTE * The CPU is held while the flash is written, so this      */
+/*          function is only called while there are no Bluetooth     */
+/*          connections.                                             */
+static void FlushBondStore(void) {
+	unsigned int Table;
+	unsigned int Index;
+	unsigned int Length;
+	BondEntryHeader_t *Entry;
+
+	/* Work out the space needed by the changes.                         */
+	for (Table = 0, Length = 0; Table < NUMBER_BOND_TABLES; Table++) {
+		for (Index = 0; Index < BondTables[Table].NumberEntries; Index++) {
+			Entry = BOND_TABLE_ENTRY(Table, Index);
+
+			if (Entry->Flags & BOND_ENTRY_FLAGS_PENDING)
+				Length += (1
+						+ ((Entry->Flags & BOND_ENTRY_FLAGS_VALID) ?
+								BondTables[Table].EntrySize : BD_ADDR_SIZE));
+		}
+	}
+
+	if ((BondStoreInfo.Used + Length) > BOND_STORE_SEGMENT_SIZE)
+		BondStoreInfo.Compact = TRUE;
+
+	for (Table = 0; (!BondStoreInfo.Compact) && (Table < NUMBER_BOND_TABLES);
+			Table++) {
+		for (Index = 0;
+				(!BondStoreInfo.Compact)
+						&& (Index < BondTables[Table].NumberEntries); Index++) {
+			Entry = BOND_TABLE_ENTRY(Table, Index);
+
+			if (Entry->Flags & BOND_ENTRY_FLAGS_PENDING) {
+				if (Entry->Flags & BOND_ENTRY_FLAGS_VALID) {
+					Length = BondTables[Table].EntrySize;
+
+					if (!WriteBondRecord(
+							&(BondStoreInfo.Segment[BondStoreInfo.Used]),
+							(Byte_t) (BOND_RECORD_TYPE_ENTRY | Table), Length,
+							Entry))
+						BondStoreInfo.Compact = TRUE;
+				} else {
+					Length = BD_ADDR_SIZE;
+
+					if (!WriteBondRecord(
+							&(BondStoreInfo.Segment[BondStoreInfo.Used]),
+							(Byte_t) (BOND_RECORD_TYPE_DELETE | Table), Length,
+							&(Entry->BD_ADDR)))
+						BondStoreInfo.Compact = TRUE;
+				}
+
+				Entry->Flags &= ~BOND_ENTRY_FLAGS_PENDING;
+
+				BondStoreInfo.Used += (1 + Length);
+			}
+		}
+	}
+
+	/* If the changes could not be appended, all entries are written to  */
+	/* the other segment.  A failure is retried with the next change.    */
+	if (BondStoreInfo.Compact)
+		CompactBondStore();
+
+	BondStoreInfo.Pending = FALSE;
+}
+
+/* The following function is called every APPLICATION_TIMER_PERIOD   */
+/* while the bond store has changes that have not been written.  The */
+/* changes are written once no device has been connected for         */
+/* BOND_STORE_FLUSH_DELAY periods, so that the links are not held up */
+/* while the flash is written and the changes made during a          */
+/* connection are written together.                                  */
+static void UpdateBondStore(void) {
+	if (ApplicationStateInfo.Flags
+			& (APPLICATION_STATE_INFO_FLAGS_LE_CONNECTED
+					| APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED))
+		BondStoreInfo.IdlePeriods = 0;
+	else {
+		if (++BondStoreInfo.IdlePeriods >= BOND_STORE_FLUSH_DELAY)
+			FlushBondStore();
+	}
+}
+
+/* The following function is a utility function which is used to     */
+/* search the LTK cache for the LTK with the specified EDIV and Rand.*/
+/* The entry found is moved to the front of the cache so that the    */
+/* least recently used entry is the one replaced.  This function     */
+/* returns TRUE if the LTK was found.                                */
+static Boolean_t SearchLTKCache(Word_t EDIV, Random_Number_t *Rand,
+		Long_Term_Key_t *LTK) {
+	Boolean_t ret_val;
+	unsigned int Index;
+	LTKCacheEntry_t Entry;
+
+	ret_val = FALSE;
+
+	for (Index = 0; Index < LTKCacheInfo.NumberEntries; Index++) {
+		if ((LTKCacheInfo.Entries[Index].EDIV == EDIV)
+				&& (!BTPS_MemCompare(&(LTKCacheInfo.Entries[Index].Rand), Rand,
+						sizeof(Random_Number_t)))) {
+			Entry = LTKCacheInfo.Entries[Index];
+
+			BTPS_MemMove(&(LTKCacheInfo.Entries[1]), LTKCacheInfo.Entries,
+					Index * sizeof(LTKCacheEntry_t));
+
+			LTKCacheInfo.Entries[0] = Entry;
+
+			*LTK = Entry.LTK;
+
+			ret_val = TRUE;
+			break;
+		}
+	}
+
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to add */
+/* an LTK to the front of the LTK cache, the least recently used     */
+/* entry is dropped when the cache is full.                          */
+static void AddLTKCacheEntry(Word_t EDIV, Random_Number_t *Rand,
+		Long_Term_Key_t *LTK) {
+	if (LTKCacheInfo.NumberEntries < LTK_CACHE_SIZE)
+		LTKCacheInfo.NumberEntries++;
+
+	BTPS_MemMove(&(LTKCacheInfo.Entries[1]), LTKCacheInfo.Entries,
+			(LTKCacheInfo.NumberEntries - 1) * sizeof(LTKCacheEntry_t));
+
+	LTKCacheInfo.Entries[0].EDIV = EDIV;
+	LTKCacheInfo.Entries[0].Rand = *Rand;
+	LTKCacheInfo.Entries[0].LTK = *LTK;
+}
+
+/* The following function is a utility function which is used to add */
+/* the time since the last Long Term Key Request to the setup time of*/
+/* the source of its LTK once the encryption has changed.            */
+static void UpdateLTKSetupTime(Byte_t Status) {
+	if (LTKCacheInfo.RequestSource != LTK_SOURCE_NONE) {
+		if (Status == HCI_ERROR_CODE_NO_ERROR) {
+			LTKCacheInfo.SetupTime[LTKCacheInfo.RequestSource] +=
+					BTPS_GetTickCount() - LTKCacheInfo.RequestTick;
+			LTKCacheInfo.SetupCount[LTKCacheInfo.RequestSource]++;
+		}
+
+		LTKCacheInfo.RequestSource = LTK_SOURCE_NONE;
+	}
+}
+
+/* The following function is a utility function which is used to     */
+/* remove the entries of the RPA cache that map to the bond of the   */
+/* specified device (all entries if BD_ADDR is NULL).                */
+static void InvalidateRPACache(BD_ADDR_t *BD_ADDR) {
+	unsigned int Index;
+
+	for (Index = 0; Index < RPA_CACHE_SIZE; Index++) {
+		if ((!BD_ADDR)
+				|| (COMPARE_BD_ADDR(RPACacheInfo.Entries[Index].BD_ADDR, *BD_ADDR)))
+			BTPS_MemInitialize(&(RPACacheInfo.Entries[Index]), 0,
+					sizeof(RPACacheEntry_t));
+	}
+}
+
+/* The following function is a utility function which is used to map */
+/* a resolvable private address to the identity address of its bond  */
+/* in the RPA cache.  The previous addresses of the device (and their */
+/* device info) will not be used again and are removed.              */
+static void AddRPACacheEntry(BD_ADDR_t *RPA, BD_ADDR_t *BD_ADDR) {
+	unsigned int Index;
+	RPACacheEntry_t *Entry;
+
+	for (Index = 0; Index < RPA_CACHE_SIZE; Index++) {
+		if ((COMPARE_BD_ADDR(RPACacheInfo.Entries[Index].BD_ADDR, *BD_ADDR))
+				&& (!COMPARE_BD_ADDR(RPACacheInfo.Entries[Index].RPA, *RPA))) {
+			DeleteDeviceInfoEntry(&(RPACacheInfo.Entries[Index].RPA));
+
+			RPACacheInfo.Rotations++;
+		}
+	}
+
+	InvalidateRPACache(BD_ADDR);
+
+	Entry = &(RPACacheInfo.Entries[HashBD_ADDR(RPA) % RPA_CACHE_SIZE]);
+
+	Entry->RPA = *RPA;
+	Entry->BD_ADDR = *BD_ADDR;
+}
+
+/* The following function is a utility function which is used to     */
+/* resolve a resolvable private address with the IRKs of the LE      */
+/* bonds.  This function returns the bond of the device that owns the*/
+/* address, or NULL if no IRK resolves it.                           */
+static LEBondInfo_t *ResolveLEBondEntry(BD_ADDR_t *BD_ADDR) {
+	unsigned int Index;
+	LEBondInfo_t *ret_val;
+
+	ret_val = NULL;
+
+	for (Index = 0; (!ret_val) && (Index < MAX_SUPPORTED_LE_BONDS); Index++) {
+		if (((LEBondInfo[Index].Flags
+				& (BOND_ENTRY_FLAGS_VALID | BOND_ENTRY_FLAGS_IRK_VALID))
+				== (BOND_ENTRY_FLAGS_VALID | BOND_ENTRY_FLAGS_IRK_VALID))
+				&& (GAP_LE_Resolve_Address(ApplicationStateInfo.BluetoothStackID,
+						&(LEBondInfo[Index].IRK), *BD_ADDR)))
+			ret_val = &(LEBondInfo[Index]);
+	}
+
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to     */
+/* search the LE bond of the specified device.  A random resolvable  */
+/* private address that is not the address of a bond is looked up in */
+/* the RPA cache, and is only resolved with the IRKs of the bonds    */
+/* when it is not found.  If Insert is TRUE a new entry is added for */
+/* a device that is not bonded.  This function returns the bond of   */
+/* the device, or NULL if there is none.                             */
+static LEBondInfo_t *SearchLEBondEntry(GAP_LE_Address_Type_t AddressType,
+		BD_ADDR_t *BD_ADDR, Boolean_t Insert) {
+	RPACacheEntry_t *Entry;
+	LEBondInfo_t *ret_val;
+
+	ret_val = SearchBondEntry(BOND_TABLE_LE, BD_ADDR, FALSE);
+
+	if ((!ret_val) && (AddressType == latRandom)
+			&& (GAP_LE_TEST_RESOLVABLE_ADDRESS_BITS(*BD_ADDR))) {
+		Entry = &(RPACacheInfo.Entries[HashBD_ADDR(BD_ADDR) % RPA_CACHE_SIZE]);
+
+		if ((COMPARE_BD_ADDR(Entry->RPA, *BD_ADDR))
+				&& ((ret_val = SearchBondEntry(BOND_TABLE_LE, &(Entry->BD_ADDR),
+						FALSE)) != NULL))
+			RPACacheInfo.Hits++;
+		else {
+			if ((ret_val = ResolveLEBondEntry(BD_ADDR)) != NULL) {
+				AddRPACacheEntry(BD_ADDR, &(ret_val->BD_ADDR));
+
+				RPACacheInfo.Resolved++;
+			} else
+				RPACacheInfo.Unresolved++;
 		}
+	}
+
+	if ((!ret_val) && (Insert))
+		ret_val = SearchBondEntry(BOND_TABLE_LE, BD_ADDR, TRUE);
 
-		BTPS_MemCopy(TempPtr, CB_DEMO_DEVICE_NAME, StringLength);
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to key */
+/* an LE bond by the identity address of the device once it has been */
+/* distributed.  Any older bond of the identity address is replaced  */
+/* and the entry of the address used while pairing is deleted.  This */
+/* function returns the bond, which is left at the pairing address if*/
+/* the table has no free entry for the identity address.             */
+static LEBondInfo_t *MoveLEBondEntry(LEBondInfo_t *LEBond,
+		GAP_LE_Address_Type_t AddressType, BD_ADDR_t *BD_ADDR) {
+	LEBondInfo_t *Entry;
+	LEBondInfo_t *ret_val;
+
+	ret_val = LEBond;
+
+	if ((!COMPARE_BD_ADDR(LEBond->BD_ADDR, *BD_ADDR))
+			&& ((Entry = SearchBondEntry(BOND_TABLE_LE, BD_ADDR, TRUE)) != NULL)) {
+		*Entry = *LEBond;
+		Entry->BD_ADDR = *BD_ADDR;
+
+		DeleteBondEntry(BOND_TABLE_LE, &(LEBond->BD_ADDR));
+
+		ret_val = Entry;
+	}
+
+	if (COMPARE_BD_ADDR(ret_val->BD_ADDR, *BD_ADDR))
+		ret_val->AddressType = (Byte_t) AddressType;
+
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to get */
+/* the address type of the specified connected LE device.  Public is */
+/* returned for a device that has no device info.                    */
+static GAP_LE_Address_Type_t GetConnectionAddressType(BD_ADDR_t *BD_ADDR) {
+	DeviceInfo_t *DeviceInfo;
+
+	return (((DeviceInfo = SearchDeviceInfoEntryByBD_ADDR(BD_ADDR)) != NULL) ?
+			DeviceInfo->ConnectionAddressType : latPublic);
+}
+
+/* The following function is a utility function which exists to      */
+/* format the EIR Data that is used by this application.  Only the   */
+/* transmit power and the device name are added to the constant      */
+/* header.                                                           */
+static void FormatEIRData(unsigned int BluetoothStackID) {
+	Byte_t Status;
+	SByte_t TxPower;
+	unsigned int Length;
+	unsigned int StringLength;
+	Extended_Inquiry_Response_Data_t EIRData;
+
+	/* First, check that valid Bluetooth Stack ID exists.                */
+	if (BluetoothStackID) {
+		BTPS_MemInitialize(&EIRData, 0, sizeof(EIRData));
+		BTPS_MemCopy(EIRData.Extended_Inquiry_Response_Data, EIRDataHeader,
+				sizeof(EIRDataHeader));
+
+		Length = sizeof(EIRDataHeader);
+
+		/* Format the Inquiry Response Transmit Power Level.              */
+		if ((!HCI_Read_Inquiry_Response_Transmit_Power_Level(BluetoothStackID,
+				&Status, &TxPower)) && (!Status))
+			EIRData.Extended_Inquiry_Response_Data[EIR_DATA_TX_POWER_OFFSET] =
+					(Byte_t) TxPower;
+
+		/* Format the local device name (the name always fits).           */
+		StringLength = BTPS_StringLength(ApplicationSettings.DeviceName);
+
+		EIRData.Extended_Inquiry_Response_Data[Length++] = StringLength + 1;
+		EIRData.Extended_Inquiry_Response_Data[Length++] =
+				HCI_EXTENDED_INQUIRY_RESPONSE_DATA_TYPE_LOCAL_NAME_COMPLETE;
 
-		TempPtr += StringLength;
-		Length += StringLength + 2;
+		BTPS_MemCopy(&(EIRData.Extended_Inquiry_Response_Data[Length]),
+				ApplicationSettings.DeviceName, StringLength);
 
 		/* Write the Extended Inquiry Response Data.                      */
 		if (!GAP_Write_Extended_Inquiry_Information(BluetoothStackID,
@@ -1120,119 +3314,164 @@ static void FormatEIRData(unsigned int BluetoothStackID) {
 	}
 }
 
-/* The following function is a utility function that formats the     */
-/* advertising data.                                                 */
+/* The following function is a utility function which is used to     */
+/* build the advertising data from the constant header and the device*/
+/* name.  This function returns TRUE if the data has changed, in     */
+/* which case it will be written to the controller by the next call  */
+/* to FormatAdvertisingData().                                       */
+static Boolean_t BuildAdvertisingData(void) {
+	Boolean_t ret_val;
+	unsigned int Length;
+	unsigned int StringLength;
+	Advertising_Data_t AdvertisingData;
+
+	BTPS_MemInitialize(&AdvertisingData, 0, sizeof(AdvertisingData));
+	BTPS_MemCopy(AdvertisingData.Advertising_Data, AdvertisingDataHeader,
+			sizeof(AdvertisingDataHeader));
+
+	Length = sizeof(AdvertisingDataHeader);
+
+	/* Set the Device Name String.                                       */
+	StringLength = BTPS_StringLength(ApplicationSettings.DeviceName);
+	if (StringLength <= (ADVERTISING_DATA_MAXIMUM_SIZE - Length - 2))
+		AdvertisingData.Advertising_Data[Length + 1] =
+				HCI_LE_ADVERTISING_REPORT_DATA_TYPE_LOCAL_NAME_COMPLETE;
+	else {
+		AdvertisingData.Advertising_Data[Length + 1] =
+				HCI_LE_ADVERTISING_REPORT_DATA_TYPE_LOCAL_NAME_SHORTENED;
+		StringLength = (ADVERTISING_DATA_MAXIMUM_SIZE - Length - 2);
+	}
+
+	AdvertisingData.Advertising_Data[Length] = StringLength + 1;
+
+	BTPS_MemCopy(&(AdvertisingData.Advertising_Data[Length + 2]),
+			ApplicationSettings.DeviceName, StringLength);
+
+	Length += StringLength + 2;
+
+	/* The flags are not part of the comparison as they are set when the */
+	/* data is written.                                                  */
+	AdvertisingData.Advertising_Data[ADVERTISING_DATA_FLAGS_OFFSET] =
+			AdvertisingDataInfo.AdvertisingData.Advertising_Data[ADVERTISING_DATA_FLAGS_OFFSET];
+
+	if ((Length != AdvertisingDataInfo.Length)
+			|| (BTPS_MemCompare(&AdvertisingData,
+					&(AdvertisingDataInfo.AdvertisingData),
+					sizeof(AdvertisingData)))) {
+		AdvertisingDataInfo.AdvertisingData = AdvertisingData;
+		AdvertisingDataInfo.Length = (Byte_t) Length;
+		AdvertisingDataInfo.Flags = 0;
+
+		ret_val = TRUE;
+	} else
+		ret_val = FALSE;
+
+	return (ret_val);
+}
+
+/* The following function is a utility function that writes the      */
+/* advertising data, with the flags saying whether BR/EDR is         */
+/* supported.  Nothing is written if the controller already has the  */
+/* same data.                                                        */
 static void FormatAdvertisingData(unsigned int BluetoothStackID,
 		Boolean_t SupportBR_EDR) {
 	int Result;
-	unsigned int Length;
-	unsigned int StringLength;
-	union {
-		Advertising_Data_t AdvertisingData;
-		Scan_Response_Data_t ScanResponseData;
-	} Advertisement_Data_Buffer;
+	Byte_t Flags;
 
 	/* First, check that valid Bluetooth Stack ID exists.                */
 	if (BluetoothStackID) {
-		BTPS_MemInitialize(&(Advertisement_Data_Buffer.AdvertisingData), 0,
-				sizeof(Advertising_Data_t));
-
-		Length = 0;
-
-		/* Set the Flags A/D Field (1 byte type and 1 byte Flags.         */
-		Advertisement_Data_Buffer.AdvertisingData.Advertising_Data[0] = 2;
-		Advertisement_Data_Buffer.AdvertisingData.Advertising_Data[1] =
-				HCI_LE_ADVERTISING_REPORT_DATA_TYPE_FLAGS;
-		Advertisement_Data_Buffer.AdvertisingData.Advertising_Data[2] =
-				HCI_LE_ADVERTISING_FLAGS_GENERAL_DISCOVERABLE_MODE_FLAGS_BIT_MASK;
+		Flags = HCI_LE_ADVERTISING_FLAGS_GENERAL_DISCOVERABLE_MODE_FLAGS_BIT_MASK;
 
 		/* Determine if we are going to say that we support BR/EDR.       */
 		if (!SupportBR_EDR)
-			Advertisement_Data_Buffer.AdvertisingData.Advertising_Data[2] |=
-					HCI_LE_ADVERTISING_FLAGS_BR_EDR_NOT_SUPPORTED_FLAGS_BIT_MASK;
-
-		Length += Advertisement_Data_Buffer.AdvertisingData.Advertising_Data[0]
-				+ 1;
-
-		/* Configure the services that we say we support.                 */
-		Advertisement_Data_Buffer.AdvertisingData.Advertising_Data[Length] = 1
-				+ (UUID_16_SIZE<<1);
-		Advertisement_Data_Buffer.AdvertisingData.Advertising_Data[Length + 1] =
-				HCI_LE_ADVERTISING_REPORT_DATA_TYPE_16_BIT_SERVICE_UUID_COMPLETE;
-
-		Length +=
-				Advertisement_Data_Buffer.AdvertisingData.Advertising_Data[Length]
-						+ 1;
-
-		/* Set the Device Name String.                                    */
-		StringLength = BTPS_StringLength(LE_DEMO_DEVICE_NAME);
-		if (StringLength < (ADVERTISING_DATA_MAXIMUM_SIZE - Length - 2))
-			Advertisement_Data_Buffer.AdvertisingData.Advertising_Data[Length
-					+ 1] =
-					HCI_LE_ADVERTISING_REPORT_DATA_TYPE_LOCAL_NAME_COMPLETE;
-		else {
-			Advertisement_Data_Buffer.AdvertisingData.Advertising_Data[Length
-					+ 1] =
-					HCI_LE_ADVERTISING_REPORT_DATA_TYPE_LOCAL_NAME_SHORTENED;
-			StringLength = (ADVERTISING_DATA_MAXIMUM_SIZE - Length - 2);
-		}
+			Flags |= HCI_LE_ADVERTISING_FLAGS_BR_EDR_NOT_SUPPORTED_FLAGS_BIT_MASK;
 
-		Advertisement_Data_Buffer.AdvertisingData.Advertising_Data[Length] =
-				StringLength + 1;
+		if (Flags != AdvertisingDataInfo.Flags) {
+			AdvertisingDataInfo.AdvertisingData.Advertising_Data[ADVERTISING_DATA_FLAGS_OFFSET] =
+					Flags;
 
-		BTPS_MemCopy(
-				&(Advertisement_Data_Buffer.AdvertisingData.Advertising_Data[Length
-						+ 2]), LE_DEMO_DEVICE_NAME, StringLength);
-
-		Length +=
-				Advertisement_Data_Buffer.AdvertisingData.Advertising_Data[Length]
-						+ 1;
+			/* Write thee advertising data to the chip.                    */
+			Result = GAP_LE_Set_Advertising_Data(BluetoothStackID,
+					AdvertisingDataInfo.Length,
+					&(AdvertisingDataInfo.AdvertisingData));
+			if (!Result) {
+				AdvertisingDataInfo.Flags = Flags;
 
-		/* Write thee advertising data to the chip.                       */
-		Result = GAP_LE_Set_Advertising_Data(BluetoothStackID, Length,
-				&(Advertisement_Data_Buffer.AdvertisingData));
-		if (!Result)
-			Display(("Advertising Data Configured Successfully.\r\n"));
-		else
-			Display(
-					("GAP_LE_Set_Advertising_Data(dtAdvertising) returned %d.\r\n", Result));
+				Display(("Advertising Data Configured Successfully.\r\n"));
+			} else
+				Display(
+						("GAP_LE_Set_Advertising_Data(dtAdvertising) returned %d.\r\n", Result));
+		}
 	}
 }
 
 /* The following function is a utility function that starts an       */
-/* advertising process.                                              */
-static int StartAdvertising(unsigned int BluetoothStackID) {
+/* advertising process for the specified reconnect phase             */
+/* (RECONNECT_PHASE_XXX).                                            */
+static int StartAdvertising(unsigned int BluetoothStackID, Byte_t Phase) {
 	int ret_val;
 	GAP_LE_Advertising_Parameters_t AdvertisingParameters;
 	GAP_LE_Connectability_Parameters_t ConnectabilityParameters;
 
 	/* First, check that valid Bluetooth Stack ID exists.                */
 	if (BluetoothStackID) {
-		/* Set up the advertising parameters.                             */
+		/* Set up the advertising parameters.  In the white list phase    */
+		/* only the bonded devices may connect, the intervals depend on   */
+		/* the advertising schedule.                                      */
 		AdvertisingParameters.Advertising_Channel_Map =
 				HCI_LE_ADVERTISING_CHANNEL_MAP_DEFAULT;
 		AdvertisingParameters.Scan_Request_Filter = fpNoFilter;
-		AdvertisingParameters.Connect_Request_Filter = fpNoFilter;
-		AdvertisingParameters.Advertising_Interval_Min = 50;
-		AdvertisingParameters.Advertising_Interval_Max = 100;
+		AdvertisingParameters.Connect_Request_Filter =
+				(Phase == RECONNECT_PHASE_WHITE_LIST) ? fpWhiteList : fpNoFilter;
+
+		if (AdvertisingInfo.Config == ADVERTISING_CONFIG_SLOW) {
+			AdvertisingParameters.Advertising_Interval_Min =
+					ApplicationSettings.SlowAdvertisingIntervalMin;
+			AdvertisingParameters.Advertising_Interval_Max =
+					ApplicationSettings.SlowAdvertisingIntervalMax;
+		} else {
+			AdvertisingParameters.Advertising_Interval_Min =
+					ApplicationSettings.AdvertisingIntervalMin;
+			AdvertisingParameters.Advertising_Interval_Max =
+					ApplicationSettings.AdvertisingIntervalMax;
+		}
 
 		/* Configure the Connectability Parameters.                       */
-		/* * NOTE * Since we do not ever put ourselves to be direct       */
-		/*          connectable then we will set the DirectAddress to all */
-		/*          0s.                                                   */
-		ConnectabilityParameters.Connectability_Mode = lcmConnectable;
+		/* * NOTE * We are only direct connectable (to the last bonded    */
+		/*          device) in the directed phase, otherwise we will set  */
+		/*          the DirectAddress to all 0s.                          */
 		ConnectabilityParameters.Own_Address_Type = latPublic;
-		ConnectabilityParameters.Direct_Address_Type = latPublic;
-		ASSIGN_BD_ADDR(ConnectabilityParameters.Direct_Address, 0, 0, 0, 0, 0,
-				0);
+
+		if (Phase == RECONNECT_PHASE_DIRECTED) {
+			ConnectabilityParameters.Connectability_Mode =
+					lcmDirectConnectable;
+			ConnectabilityParameters.Direct_Address_Type =
+					ReconnectInfo.AddressType;
+			ConnectabilityParameters.Direct_Address = ReconnectInfo.BD_ADDR;
+		} else {
+			ConnectabilityParameters.Connectability_Mode = lcmConnectable;
+			ConnectabilityParameters.Direct_Address_Type = latPublic;
+			ASSIGN_BD_ADDR(ConnectabilityParameters.Direct_Address, 0, 0, 0,
+					0, 0, 0);
+		}
 
 		/* Now enable advertising.                                        */
 		ret_val = GAP_LE_Advertising_Enable(BluetoothStackID, TRUE,
 				&AdvertisingParameters, &ConnectabilityParameters,
 				GAP_LE_Event_Callback, 0);
-		if (!ret_val)
+		if (!ret_val) {
 			Display(("GAP_LE_Advertising_Enable success.\r\n"));
-		else {
+
+			/* Note the time from the start of opening the stack to the    */
+			/* first advertising.                                          */
+			if (!BootInfo.AdvertisingTime) {
+				BootInfo.AdvertisingTime = BTPS_GetTickCount()
+						- BootInfo.StartTick;
+
+				Display(
+						("First advertising after %lu ms.\r\n", BootInfo.AdvertisingTime));
+			}
+		} else {
 			Display( ("GAP_LE_Advertising_Enable returned %d.\r\n", ret_val));
 
 			ret_val = FUNCTION_ERROR;
@@ -1245,82 +3484,3152 @@ static int StartAdvertising(unsigned int BluetoothStackID) {
 	return (ret_val);
 }
 
-/* The following function is responsible for checking the idle state */
-/* and possibly entering LPM3 mode.                                  */
-static void IdleFunction(unsigned int BluetoothStackID) {
-	HCILL_State_t HCILL_State;
+/* The following function is a utility function which is used to get */
+/* the address that the device of the specified LE bond is using.    */
+/* The CC256x does not resolve private addresses in the controller,  */
+/* so a device that has given its IRK is only matched by the         */
+/* resolvable private address it last used, taken from the RPA       */
+/* cache.  This function returns FALSE if that address is not known. */
+static Boolean_t GetLEBondAddress(LEBondInfo_t *LEBond,
+		GAP_LE_Address_Type_t *AddressType, BD_ADDR_t *BD_ADDR) {
+	unsigned int Index;
+	Boolean_t ret_val;
+
+	if (LEBond->Flags & BOND_ENTRY_FLAGS_IRK_VALID) {
+		for (Index = 0, ret_val = FALSE; (!ret_val) && (Index < RPA_CACHE_SIZE);
+				Index++) {
+			if ((!COMPARE_NULL_BD_ADDR(RPACacheInfo.Entries[Index].RPA))
+					&& (COMPARE_BD_ADDR(RPACacheInfo.Entries[Index].BD_ADDR,
+							LEBond->BD_ADDR))) {
+				*AddressType = latRandom;
+				*BD_ADDR = RPACacheInfo.Entries[Index].RPA;
+
+				ret_val = TRUE;
+			}
+		}
+	} else {
+		*AddressType = (GAP_LE_Address_Type_t) LEBond->AddressType;
+		*BD_ADDR = LEBond->BD_ADDR;
 
-	/* Determine the HCILL State.                                        */
-	HCILL_State = HCILL_GetState();
+		ret_val = TRUE;
+	}
 
-	/* If the stack is Idle and we are in HCILL Sleep, then we may enter */
-	/* LPM3 mode (with Timer Interrupts disabled).                       */
-	if ((BSC_QueryStackIdle(BluetoothStackID)) && (HCILL_State == hsSleep)
-			&& (!HCILL_Get_Power_Lock_Count())) {
-		/* Enter MSP430 LPM3.                                             */
-		LPM3;
-	} else {
-		/* Enter Low Power Mode 0 if no HCI UART data is ready to be      */
-		/* process.                                                       */
-		if (!HCITR_RxBytesReady(0))
-			LPM0;
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to     */
+/* fill the white list with the addresses that the bonded LE devices */
+/* are using (see GetLEBondAddress()).  The white list is left empty */
+/* if the address of any bonded device is not known, so that the     */
+/* device is not locked out by the filter.  This function returns    */
+/* the number of devices in the white list.                          */
+/* * NOTE * The white list can only be changed while advertising is  */
+/*          not using it.                                            */
+static unsigned int LoadWhiteList(void) {
+	unsigned int Index;
+	unsigned int Count;
+	Boolean_t Unknown;
+	GAP_LE_White_List_Entry_t WhiteListEntries[MAX_SUPPORTED_LE_BONDS];
+
+	GAP_LE_Remove_Device_From_White_List(ApplicationStateInfo.BluetoothStackID,
+			0, NULL, &Count);
+
+	for (Index = 0, Count = 0, Unknown = FALSE; Index < MAX_SUPPORTED_LE_BONDS;
+			Index++) {
+		if (LEBondInfo[Index].Flags & BOND_ENTRY_FLAGS_VALID) {
+			if (GetLEBondAddress(&(LEBondInfo[Index]),
+					&(WhiteListEntries[Count].Address_Type),
+					&(WhiteListEntries[Count].Address)))
+				Count++;
+			else
+				Unknown = TRUE;
+		}
+	}
+
+	if ((!Count) || (Unknown)
+			|| (GAP_LE_Add_Device_To_White_List(
+					ApplicationStateInfo.BluetoothStackID, Count,
+					WhiteListEntries, &Count)))
+		Count = 0;
+
+	return (Count);
+}
+
+/* The following function is a utility function which is used to     */
+/* start advertising for the current reconnect phase.  The white list*/
+/* phase is skipped if there are no bonded devices, and normal       */
+/* advertising is used if a phase can not be started.                */
+static void StartReconnectPhase(void) {
+	ReconnectInfo.Periods = 0;
+
+	if ((ReconnectInfo.Phase == RECONNECT_PHASE_WHITE_LIST)
+			&& (!LoadWhiteList()))
+		ReconnectInfo.Phase = RECONNECT_PHASE_NORMAL;
+
+	if ((StartAdvertising(ApplicationStateInfo.BluetoothStackID,
+			ReconnectInfo.Phase))
+			&& (ReconnectInfo.Phase != RECONNECT_PHASE_NORMAL)) {
+		ReconnectInfo.Phase = RECONNECT_PHASE_NORMAL;
+
+		StartAdvertising(ApplicationStateInfo.BluetoothStackID,
+				ReconnectInfo.Phase);
+	}
+}
+
+/* The following function is called when an LE device has            */
+/* disconnected (or at power up) to start advertising.  The specified*/
+/* device is the one that was connected, if it is bonded it is       */
+/* reconnected with directed advertising.                            */
+static void StartReconnect(BD_ADDR_t *BD_ADDR) {
+	LEBondInfo_t *LEBond;
+
+	ReconnectInfo.StartTick = BTPS_GetTickCount();
+
+	StartAdvertisingSchedule();
+
+	if ((!COMPARE_NULL_BD_ADDR(*BD_ADDR))
+			&& ((LEBond = SearchLEBondEntry(GetConnectionAddressType(BD_ADDR),
+					BD_ADDR, FALSE)) != NULL)
+			&& (GetLEBondAddress(LEBond, &(ReconnectInfo.AddressType),
+					&(ReconnectInfo.BD_ADDR))))
+		ReconnectInfo.Phase = RECONNECT_PHASE_DIRECTED;
+	else
+		ReconnectInfo.Phase = RECONNECT_PHASE_WHITE_LIST;
+
+	StartReconnectPhase();
+}
+
+/* The following function is used to move on to the next reconnect   */
+/* phase when the current one has timed out.                         */
+static void NextReconnectPhase(void) {
+	if (ReconnectInfo.Phase < RECONNECT_PHASE_NORMAL) {
+		GAP_LE_Advertising_Disable(ApplicationStateInfo.BluetoothStackID);
+
+		ReconnectInfo.Phase++;
+
+		StartReconnectPhase();
+	}
+}
+
+/* The following function is called every APPLICATION_TIMER_PERIOD   */
+/* while a reconnect phase other than normal advertising is running. */
+/* The directed phase normally ends with the directed advertising    */
+/* timeout from the controller, the timer is only a backup.          */
+static void UpdateReconnect(void) {
+	ReconnectInfo.Periods++;
+
+	if (((ReconnectInfo.Phase == RECONNECT_PHASE_DIRECTED)
+			&& (ReconnectInfo.Periods >= RECONNECT_DIRECTED_TIME))
+			|| ((ReconnectInfo.Phase == RECONNECT_PHASE_WHITE_LIST)
+					&& (ReconnectInfo.Periods >= RECONNECT_WHITE_LIST_TIME)))
+		NextReconnectPhase();
+}
+
+/* The following function is run by the scheduler when the fast      */
+/* advertising time has passed.  The change to the slow intervals is */
+/* made from the mailbox, as a scheduled function must not remove    */
+/* itself from the scheduler.                                        */
+static void BTPSAPI AdvertisingTimerCallback(void *ScheduleParameter) {
+	PostApplicationMailbox(APPLICATION_MAILBOX_MESSAGE_ID_ADVERTISING_TIMER);
+}
+
+/* The following function is used to start the advertising schedule  */
+/* with the fast intervals, the scheduler is asked to call           */
+/* AdvertisingTimerCallback() when it is time to use the slow        */
+/* intervals.                                                        */
+static void StartAdvertisingSchedule(void) {
+	BTPS_DeleteFunctionFromScheduler(AdvertisingTimerCallback, NULL);
+
+	AdvertisingInfo.Active = TRUE;
+	AdvertisingInfo.Config = ADVERTISING_CONFIG_FAST;
+	AdvertisingInfo.ConfigStartTick = ReconnectInfo.StartTick;
+
+	if ((ApplicationSettings.FastAdvertisingTime)
+			&& (!BTPS_AddFunctionToScheduler(AdvertisingTimerCallback, NULL,
+					(unsigned int) ApplicationSettings.FastAdvertisingTime
+							* 1000)))
+		Display(("Failed to start the advertising timer.\r\n"));
+}
+
+/* The following function is called (from the mailbox) when the fast */
+/* advertising time has passed to change to the slow intervals.  If  */
+/* the directed phase is running the slow intervals are used by the  */
+/* following phases.                                                 */
+static void StartSlowAdvertising(void) {
+	DWord_t CurrentTick;
+
+	BTPS_DeleteFunctionFromScheduler(AdvertisingTimerCallback, NULL);
+
+	if ((AdvertisingInfo.Active)
+			&& (AdvertisingInfo.Config == ADVERTISING_CONFIG_FAST)) {
+		CurrentTick = BTPS_GetTickCount();
+
+		AdvertisingInfo.Statistics[ADVERTISING_CONFIG_FAST].AdvertisingTime +=
+				CurrentTick - AdvertisingInfo.ConfigStartTick;
+		AdvertisingInfo.Config = ADVERTISING_CONFIG_SLOW;
+		AdvertisingInfo.ConfigStartTick = CurrentTick;
+
+		if ((ReconnectInfo.Phase == RECONNECT_PHASE_WHITE_LIST)
+				|| (ReconnectInfo.Phase == RECONNECT_PHASE_NORMAL)) {
+			GAP_LE_Advertising_Disable(ApplicationStateInfo.BluetoothStackID);
+
+			StartAdvertising(ApplicationStateInfo.BluetoothStackID,
+					ReconnectInfo.Phase);
+		}
+	}
+}
+
+/* The following function is called when a device has connected to   */
+/* stop the advertising schedule and record the time taken to        */
+/* connect with the advertising configuration in use.                */
+/* * NOTE * This function is called from the GAP LE callback, the    */
+/*          advertising timer is removed from the scheduler by the   */
+/*          mailbox.                                                 */
+static void StopAdvertisingSchedule(void) {
+	AdvertisingStatistics_t *Statistics;
+
+	if (AdvertisingInfo.Active) {
+		Statistics = &(AdvertisingInfo.Statistics[AdvertisingInfo.Config]);
+
+		Statistics->AdvertisingTime += BTPS_GetTickCount()
+				- AdvertisingInfo.ConfigStartTick;
+		Statistics->ConnectTime += ReconnectInfo.LastTime;
+		Statistics->Connections++;
+
+		AdvertisingInfo.Active = FALSE;
+	}
+}
+
+/* The following function is responsible for checking the idle state */
+/* and possibly entering LPM3 mode.                                  */
+static void IdleFunction(unsigned int BluetoothStackID) {
+	HCILL_State_t HCILL_State;
+
+	/* Determine the HCILL State.                                        */
+	HCILL_State = HCILL_GetState();
+
+	/* If the stack is Idle and we are in HCILL Sleep, then we may enter */
+	/* LPM3 mode (with Timer Interrupts disabled).                       */
+	if ((BSC_QueryStackIdle(BluetoothStackID)) && (HCILL_State == hsSleep)
+			&& (!HCILL_Get_Power_Lock_Count())) {
+		/* Enter MSP430 LPM3.                                             */
+		LPM3;
+	} else {
+		/* Enter Low Power Mode 0 if no HCI UART data is ready to be      */
+		/* process.                                                       */
+		if (!HCITR_RxBytesReady(0))
+			LPM0;
+	}
+}
+
+/* The following function is a utility function that is used to      */
+/* format a SPP Data Packet.  This function returns the number of    */
+/* bytes formatted into PacketBuffer.                                */
+/* * NOTE * The control escape sequence is held here (see            */
+/*          UpdateControlEscape()).                                  */
+static unsigned int FormatSPPDataPacket(unsigned int PacketBufferLength,
+		Byte_t *PacketBuffer) {
+	unsigned int ret_val;
+	unsigned int Offset;
+	unsigned long CurrentTick;
+
+	/* A held escape sequence is put in front of any new data.           */
+	Offset = ControlInfo.EscapeLength;
+
+	if (PacketBufferLength > Offset)
+		ret_val = (unsigned int) HAL_ConsoleRead(PacketBufferLength - Offset,
+				(char *) &(PacketBuffer[Offset]));
+	else
+		ret_val = 0;
+
+	if (ret_val) {
+		CurrentTick = BTPS_GetTickCount();
+
+		if (Offset) {
+			if ((Offset == CONTROL_ESCAPE_SEQUENCE_LENGTH) && (ret_val == 1)
+					&& (PacketBuffer[Offset] == 0xFF)) {
+				/* The end of block marker completes the escape sequence.   */
+				ControlInfo.EscapeBuffer[ControlInfo.EscapeLength++] = 0xFF;
+
+				ret_val = 0;
+			} else {
+				/* Data followed the escape sequence within the guard time, */
+				/* so the sequence was data.                                */
+				BTPS_MemCopy(PacketBuffer, ControlInfo.EscapeBuffer, Offset);
+				ControlInfo.EscapeLength = 0;
+
+				ret_val += Offset;
+			}
+		} else {
+			/* Hold the escape sequence (and optionally the end of block   */
+			/* marker) if it was received on its own after the guard time. */
+			if ((ret_val >= CONTROL_ESCAPE_SEQUENCE_LENGTH)
+					&& (ret_val <= (CONTROL_ESCAPE_SEQUENCE_LENGTH + 1))
+					&& (!BTPS_MemCompare(PacketBuffer, CONTROL_ESCAPE_SEQUENCE,
+							CONTROL_ESCAPE_SEQUENCE_LENGTH))
+					&& ((ret_val == CONTROL_ESCAPE_SEQUENCE_LENGTH)
+							|| (PacketBuffer[CONTROL_ESCAPE_SEQUENCE_LENGTH] == 0xFF))
+					&& ((CurrentTick - ControlInfo.LastConsoleDataTick)
+							>= CONTROL_ESCAPE_GUARD_TIME)) {
+				BTPS_MemCopy(ControlInfo.EscapeBuffer, PacketBuffer, ret_val);
+				ControlInfo.EscapeLength = ret_val;
+
+				ret_val = 0;
+			}
+		}
+
+		ControlInfo.LastConsoleDataTick = CurrentTick;
+	}
+
+	return (ret_val);
+}
+
+/* The following function is called every APPLICATION_TIMER_PERIOD   */
+/* while an escape sequence is held.  Command mode is entered once   */
+/* nothing has followed the sequence for the guard time.             */
+static void UpdateControlEscape(void) {
+	if ((!HAL_ConsoleReadLength())
+			&& ((BTPS_GetTickCount() - ControlInfo.LastConsoleDataTick)
+					>= CONTROL_ESCAPE_GUARD_TIME))
+		SetCommandMode(TRUE);
+}
+
+/* The following function is a utility function which is used to add */
+/* the data queued in the SPP Buffer since the last call as a new    */
+/* segment.  When all segments are in use the data is added to the   */
+/* newest one.                                                       */
+static void TrackSPPBufferAge(void) {
+	unsigned int Length;
+
+	/* The SPP Buffer is discarded on a disconnect.                      */
+	if (ApplicationStateInfo.SPPBufferLength < RealTimeInfo.QueuedLength) {
+		RealTimeInfo.NumberSegments = 0;
+		RealTimeInfo.QueuedLength = 0;
+	}
+
+	Length = ApplicationStateInfo.SPPBufferLength - RealTimeInfo.QueuedLength;
+	if (Length) {
+		if (RealTimeInfo.NumberSegments < REALTIME_SEGMENTS) {
+			RealTimeInfo.Segments[RealTimeInfo.NumberSegments].Length = Length;
+			RealTimeInfo.Segments[RealTimeInfo.NumberSegments].Tick =
+					BTPS_GetTickCount();
+			RealTimeInfo.NumberSegments++;
+		} else
+			RealTimeInfo.Segments[REALTIME_SEGMENTS - 1].Length += Length;
+
+		RealTimeInfo.QueuedLength += Length;
+	}
+}
+
+/* The following function is a utility function which is used to     */
+/* remove the specified number of bytes, which have been sent or     */
+/* dropped, from the front of the segments.                          */
+static void DropSPPData(unsigned int Length) {
+	unsigned int Index;
+
+	if (Length > RealTimeInfo.QueuedLength)
+		Length = RealTimeInfo.QueuedLength;
+
+	RealTimeInfo.QueuedLength -= Length;
+
+	for (Index = 0; (Length) && (Index < RealTimeInfo.NumberSegments);) {
+		if (Length >= RealTimeInfo.Segments[Index].Length) {
+			Length -= RealTimeInfo.Segments[Index].Length;
+			Index++;
+		} else {
+			RealTimeInfo.Segments[Index].Length -= Length;
+			Length = 0;
+		}
+	}
+
+	if (Index) {
+		RealTimeInfo.NumberSegments -= Index;
+
+		BTPS_MemMove(RealTimeInfo.Segments, &(RealTimeInfo.Segments[Index]),
+				RealTimeInfo.NumberSegments * sizeof(RealTimeSegment_t));
+	}
+}
+
+/* The following function is called in real-time mode before data is */
+/* queued or sent to drop the segments of the SPP Buffer that are    */
+/* older than the deadline.  If the SPP Buffer is full the oldest    */
+/* segment is dropped as well so that newer data from the UART can be*/
+/* queued.                                                           */
+static void UpdateRealTimeQueue(void) {
+	unsigned int Index;
+	unsigned int Length;
+	unsigned long CurrentTick;
+
+	TrackSPPBufferAge();
+
+	CurrentTick = BTPS_GetTickCount();
+
+	for (Index = 0, Length = 0; (Index < RealTimeInfo.NumberSegments)
+			&& ((CurrentTick - RealTimeInfo.Segments[Index].Tick)
+					> ApplicationSettings.RealTimeDeadline); Index++)
+		Length += RealTimeInfo.Segments[Index].Length;
+
+	if ((!Length) && (RealTimeInfo.NumberSegments)
+			&& (ApplicationStateInfo.SPPBufferLength == SPP_BUFFER_SIZE))
+		Length = RealTimeInfo.Segments[0].Length;
+
+	if (Length) {
+		DropSPPData(Length);
+
+		BTPS_MemMove(ApplicationStateInfo.SPPBuffer,
+				&(ApplicationStateInfo.SPPBuffer[Length]),
+				(ApplicationStateInfo.SPPBufferLength - Length));
+
+		ApplicationStateInfo.SPPBufferLength -= Length;
+
+		RealTimeInfo.BytesDropped += Length;
+		RealTimeInfo.Drops++;
+	}
+}
+
+/* The following function is a utility function which is used to set */
+/* the automatic flush timeout of the BR/EDR link from the real-time */
+/* deadline (zero, no flush, when the mode is off).                  */
+static void ApplyRealTimeMode(void) {
+	Byte_t Status;
+	Word_t ConnectionHandle;
+	unsigned long FlushTimeout;
+
+	/* Half the deadline, in baseband slots of 0.625ms.                  */
+	FlushTimeout = ((unsigned long) ApplicationSettings.RealTimeDeadline * 4)
+			/ 5;
+	if (FlushTimeout > 0x07FF)
+		FlushTimeout = 0x07FF;
+
+	if ((ApplicationStateInfo.Flags & APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED)
+			&& ((HCI_Write_Automatic_Flush_Timeout(
+					ApplicationStateInfo.BluetoothStackID,
+					SniffInfo.ConnectionHandle, (Word_t) FlushTimeout, &Status,
+					&ConnectionHandle)) || (Status)))
+		Display(("Failed to set the flush timeout.\r\n"));
+}
+
+/* The following function is a utility function which is used to     */
+/* determine how much UART data may be read into the SPP Buffer.     */
+/* While no device is connected only enough is read to see the       */
+/* control escape sequence, and only while the SPP Buffer is empty,  */
+/* so that the rest is left in the UART and flow control holds the   */
+/* host until a device connects.                                     */
+static unsigned int GetSPPBufferSpace(void) {
+	unsigned int ret_val;
+
+	if (ApplicationStateInfo.Flags & APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED)
+		ret_val = SPP_BUFFER_SIZE - ApplicationStateInfo.SPPBufferLength;
+	else {
+		if (!ApplicationStateInfo.SPPBufferLength)
+			ret_val = CONTROL_ESCAPE_SEQUENCE_LENGTH + 1;
+		else
+			ret_val = 0;
+	}
+
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to     */
+/* packetize and send SPP Data to a connected device.                */
+static void ProcessSendSPPData(Boolean_t PacketizeCurrentData) {
+	int Result;
+
+	/* In real-time mode drop the data that has waited too long, and make*/
+	/* room for the newest data.                                         */
+	if (ApplicationSettings.RealTimeDeadline)
+		UpdateRealTimeQueue();
+
+	/* If requested packetize the current UART data.  While no device is */
+	/* connected only enough is read to see the control escape sequence  */
+	/* (see GetSPPBufferSpace()).                                        */
+	/* In real-time mode the UART is read even though SPP can not accept */
+	/* more data so that the data waiting in the UART does not age.      */
+	if (SPPTestInfo.Mode == SPP_TEST_MODE_GENERATE) {
+		/* Fill the rest of the SPP Buffer with the test pattern.         */
+		while ((ApplicationStateInfo.Flags
+				& APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED)
+				&& (ApplicationStateInfo.SPPBufferLength < SPP_BUFFER_SIZE))
+			ApplicationStateInfo.SPPBuffer[ApplicationStateInfo.SPPBufferLength++] =
+					SPPTestInfo.TransmitPattern++;
+	} else if ((PacketizeCurrentData) && (!ControlInfo.CommandMode)
+			&& (!SPPTestInfo.Mode)
+			&& ((ApplicationSettings.RealTimeDeadline)
+					|| (!(ApplicationStateInfo.Flags
+							& (APPLICATION_STATE_INFO_FLAGS_SPP_BUFFER_FULL
+									| APPLICATION_STATE_INFO_FLAGS_REMOTE_FLOW_STOPPED))))) {
+		/* Packetize the current data to the end of the SPP Buffer and    */
+		/* increment the length of the SPP Buffer.                        */
+		ApplicationStateInfo.SPPBufferLength += FormatSPPDataPacket(
+				GetSPPBufferSpace(),
+				&(ApplicationStateInfo.SPPBuffer[ApplicationStateInfo.SPPBufferLength]));
+	}
+
+	/* Note the time at which the new data was queued.                   */
+	if (ApplicationSettings.RealTimeDeadline)
+		TrackSPPBufferAge();
+
+	if (ApplicationStateInfo.SPPBufferLength > BridgeInfo.SPP.MaximumQueueDepth)
+		BridgeInfo.SPP.MaximumQueueDepth =
+				(Word_t) ApplicationStateInfo.SPPBufferLength;
+
+	/* Only continue if we are current connected to a BR/EDR Device AND  */
+	/* the SPP Buffer is not Empty.                                      */
+	if ((ApplicationStateInfo.Flags
+			& (APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED
+					| APPLICATION_STATE_INFO_FLAGS_SPP_BUFFER_FULL
+					| APPLICATION_STATE_INFO_FLAGS_REMOTE_FLOW_STOPPED))
+			== APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED) {
+		/* Wake the link so that the data is not held until the next      */
+		/* sniff anchor point.                                            */
+		if (ApplicationStateInfo.SPPBufferLength) {
+			ExitSniffMode();
+
+			HAL_TraceStamp(HAL_TRACE_STAGE_SPP_SEND);
+		}
+
+		/* Send the packetized SPP data to the remote device.             */
+		Result = SPP_Data_Write(ApplicationStateInfo.BluetoothStackID,
+				ApplicationStateInfo.SPPServerPortID,
+				ApplicationStateInfo.SPPBufferLength,
+				(unsigned char *) ApplicationStateInfo.SPPBuffer);
+
+		HAL_TraceStamp(HAL_TRACE_STAGE_SPP_WRITE);
+
+		if (Result >= 0) {
+			/* If we wrote less than the requested number of bytes move the*/
+			/* data forward in the buffer and flag that the SPP Buffer is  */
+			/* FULL.                                                       */
+			if ((unsigned int) Result < ApplicationStateInfo.SPPBufferLength) {
+				/* Count writes that made no progress separately.           */
+				if (Result) {
+					SPPTestInfo.PartialWrites++;
+					SPPTestInfo.PeriodPartialWrites++;
+				} else {
+					SPPTestInfo.BufferFullStalls++;
+					SPPTestInfo.PeriodBufferFullStalls++;
+				}
+
+				BTPS_MemMove(ApplicationStateInfo.SPPBuffer,
+						&(ApplicationStateInfo.SPPBuffer[(unsigned int) Result]),
+						(ApplicationStateInfo.SPPBufferLength - Result));
+
+				ApplicationStateInfo.Flags |=
+						APPLICATION_STATE_INFO_FLAGS_SPP_BUFFER_FULL;
+
+				/* Stop the wired host until SPP can accept more data.      */
+				UpdateWiredFlowHold();
+			}
+
+			ApplicationStateInfo.SPPBufferLength -= (unsigned int) Result;
+			if (ApplicationSettings.RealTimeDeadline)
+				DropSPPData((unsigned int) Result);
+
+			SniffInfo.TrafficBytes += (unsigned int) Result;
+			LinkInfo.TransmitBytes[LinkInfo.Level] += (unsigned int) Result;
+			SPPTestInfo.PeriodTransmitBytes += (unsigned int) Result;
+			BridgeInfo.SPP.TransmitBytes += (unsigned int) Result;
+
+			/* Keep the generator running while SPP accepts all of the  */
+			/* data.                                                    */
+			if ((SPPTestInfo.Mode == SPP_TEST_MODE_GENERATE)
+					&& (!(ApplicationStateInfo.Flags
+							& APPLICATION_STATE_INFO_FLAGS_SPP_BUFFER_FULL)))
+				PostApplicationMailbox(
+						APPLICATION_MAILBOX_MESSAGE_ID_SPP_BUFFER_EMPTY);
+		} else
+			Display(("Error - SPP_Data_Write returned %d.\r\n", Result));
+	}
+}
+
+/* The following function is a utility function which is used to     */
+/* move data received over SPP to the UART.  Data is only read from  */
+/* SPP as fast as the UART can accept it, the remainder is left      */
+/* queued in SPP so that RFCOMM flow control throttles the remote.   */
+static void ProcessReceiveSPPData(void) {
+	int Result;
+	unsigned int Count;
+
+	/* SPP data is left queued while the UART is in command mode, unless */
+	/* a test is consuming it, and while the raw UART is bridged to LE   */
+	/* only.                                                             */
+	while ((ApplicationStateInfo.Flags
+			& APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED)
+			&& ((!ControlInfo.CommandMode) || (SPPTestInfo.Mode))
+			&& ((UARTFramingInfo.Enabled) || (SPPTestInfo.Mode)
+					|| (GetBridgeTransports() & BRIDGE_TRANSPORT_SPP))) {
+		/* Refill the receive buffer if it is empty.                      */
+		if (!ApplicationStateInfo.SPPReceiveBufferLength) {
+			if (!(ApplicationStateInfo.Flags
+					& APPLICATION_STATE_INFO_FLAGS_SPP_DATA_PENDING))
+				break;
+
+			Result = SPP_Data_Read(ApplicationStateInfo.BluetoothStackID,
+					ApplicationStateInfo.SPPServerPortID,
+					SPP_RECEIVE_BUFFER_SIZE,
+					ApplicationStateInfo.SPPReceiveBuffer);
+
+			/* A short read means that SPP has no more data queued.     */
+			if (Result < SPP_RECEIVE_BUFFER_SIZE)
+				ApplicationStateInfo.Flags &=
+						~APPLICATION_STATE_INFO_FLAGS_SPP_DATA_PENDING;
+
+			if (Result <= 0)
+				break;
+
+			/* The remote is sending, wake the link for the rest of the */
+			/* data.                                                    */
+			SniffInfo.TrafficBytes += (unsigned int) Result;
+			BridgeInfo.SPP.ReceiveBytes += (unsigned int) Result;
+			ExitSniffMode();
+
+			ApplicationStateInfo.SPPReceiveBufferStart = 0;
+			ApplicationStateInfo.SPPReceiveBufferLength = (unsigned int) Result;
+		}
+
+		/* Write as much of the buffer as the UART (or the test) will     */
+		/* accept.                                                        */
+		if (SPPTestInfo.Mode)
+			Count = ProcessSPPTestData(
+					ApplicationStateInfo.SPPReceiveBufferLength,
+					&(ApplicationStateInfo.SPPReceiveBuffer[ApplicationStateInfo.SPPReceiveBufferStart]));
+		else if (UARTFramingInfo.Enabled)
+			Count = SendUARTFrameData(UART_FRAMING_CHANNEL_SPP,
+					ApplicationStateInfo.SPPReceiveBufferLength,
+					&(ApplicationStateInfo.SPPReceiveBuffer[ApplicationStateInfo.SPPReceiveBufferStart]));
+		else
+			Count = (unsigned int) HAL_ConsoleWriteNonBlocking(
+					ApplicationStateInfo.SPPReceiveBufferLength,
+					(char *) &(ApplicationStateInfo.SPPReceiveBuffer[ApplicationStateInfo.SPPReceiveBufferStart]));
+
+		ApplicationStateInfo.SPPReceiveBufferStart += Count;
+		ApplicationStateInfo.SPPReceiveBufferLength -= Count;
+
+		/* If the UART is full (or the host has not granted a credit) we  */
+		/* will be called back when it drains.                            */
+		if (ApplicationStateInfo.SPPReceiveBufferLength)
+			break;
+	}
+
+	/* Let the remote know whether we can accept more data.              */
+	UpdateLocalPortStatus();
+}
+
+/* The following function is a utility function which is used to set */
+/* the BR/EDR discoverability and connectability.  The device stays  */
+/* discoverable and connectable while any SPP server port is free.   */
+static void UpdateSPPConnectability(void) {
+	unsigned int Index;
+	Boolean_t PortFree;
+
+	PortFree = (Boolean_t) (!(ApplicationStateInfo.Flags
+			& APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED));
+
+	for (Index = 0; (!PortFree) && (Index < SPP_MAXIMUM_ADDITIONAL_PORTS);
+			Index++) {
+		if ((SPPPortsInfo.Ports[Index].ServerPortID)
+				&& (!(SPPPortsInfo.Ports[Index].Flags
+						& SPP_PORT_INFO_FLAGS_CONNECTED)))
+			PortFree = TRUE;
+	}
+
+	GAP_Set_Discoverability_Mode(ApplicationStateInfo.BluetoothStackID,
+			(PortFree) ? dmGeneralDiscoverableMode : dmNonDiscoverableMode, 0);
+	GAP_Set_Connectability_Mode(ApplicationStateInfo.BluetoothStackID,
+			(PortFree) ? cmConnectableMode : cmNonConnectableMode);
+}
+
+/* The following function is a utility function which is used to     */
+/* queue data from the host in the transmit ring of an additional SPP*/
+/* port.  This function returns FALSE if the port is not connected or*/
+/* the data does not fit.                                            */
+static Boolean_t QueueSPPPortData(unsigned int Index, unsigned int Length,
+		Byte_t *Data) {
+	Boolean_t ret_val;
+	unsigned int End;
+	unsigned int Count;
+	SPPPortInfo_t *Port;
+
+	Port = &(SPPPortsInfo.Ports[Index]);
+
+	if ((Port->Flags & SPP_PORT_INFO_FLAGS_CONNECTED)
+			&& (Length <= (SPP_PORT_TRANSMIT_BUFFER_SIZE - Port->TransmitLength))) {
+		/* Copy up to the end of the ring and wrap the rest.              */
+		End = (Port->TransmitStart + Port->TransmitLength)
+				% SPP_PORT_TRANSMIT_BUFFER_SIZE;
+		Count = SPP_PORT_TRANSMIT_BUFFER_SIZE - End;
+		if (Count > Length)
+			Count = Length;
+
+		BTPS_MemCopy(&(Port->TransmitBuffer[End]), Data, Count);
+		BTPS_MemCopy(Port->TransmitBuffer, &(Data[Count]), Length - Count);
+
+		Port->TransmitLength += Length;
+
+		ret_val = TRUE;
+	} else
+		ret_val = FALSE;
+
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to move*/
+/* the data of the additional SPP ports.  Each pass makes at most one*/
+/* SPP_Data_Write and sends at most one UART frame per port, and each*/
+/* call starts with the port after the one that started the last, so */
+/* that a busy port cannot starve the others.  Passes are made until */
+/* no port makes progress.                                           */
+static void ProcessSPPPorts(void) {
+	int Result;
+	Boolean_t Progress;
+	unsigned int Count;
+	unsigned int Index;
+	unsigned int Length;
+	SPPPortInfo_t *Port;
+
+	do {
+		Progress = FALSE;
+
+		for (Count = 0; Count < SPP_MAXIMUM_ADDITIONAL_PORTS; Count++) {
+			Index = (SPPPortsInfo.NextPort + Count)
+					% SPP_MAXIMUM_ADDITIONAL_PORTS;
+			Port = &(SPPPortsInfo.Ports[Index]);
+
+			if (!(Port->Flags & SPP_PORT_INFO_FLAGS_CONNECTED))
+				continue;
+
+			/* Write the data up to the end of the transmit ring, the rest */
+			/* is written on the next pass.                                */
+			if ((Port->TransmitLength)
+					&& (!(Port->Flags & SPP_PORT_INFO_FLAGS_BUFFER_FULL))) {
+				Length = SPP_PORT_TRANSMIT_BUFFER_SIZE - Port->TransmitStart;
+				if (Length > Port->TransmitLength)
+					Length = Port->TransmitLength;
+
+				Result = SPP_Data_Write(ApplicationStateInfo.BluetoothStackID,
+						Port->ServerPortID, (Word_t) Length,
+						&(Port->TransmitBuffer[Port->TransmitStart]));
+				if (Result >= 0) {
+					/* SPP will tell us when it has room for the rest.       */
+					if ((unsigned int) Result < Length)
+						Port->Flags |= SPP_PORT_INFO_FLAGS_BUFFER_FULL;
+
+					if (Result) {
+						Port->TransmitStart = (Port->TransmitStart
+								+ (unsigned int) Result)
+								% SPP_PORT_TRANSMIT_BUFFER_SIZE;
+						Port->TransmitLength -= (unsigned int) Result;
+						Port->BytesSent += (unsigned int) Result;
+
+						Progress = TRUE;
+					}
+				} else
+					Display(("Error - SPP_Data_Write returned %d.\r\n", Result));
+			}
+
+			/* The data is left queued in SPP (so that RFCOMM flow control */
+			/* throttles the remote) until the UART can take it.           */
+			if ((!UARTFramingInfo.Enabled)
+					|| (!UARTFramingInfo.TxCredits[UART_FRAMING_CHANNEL_SPP_PORT
+							+ Index]))
+				continue;
+
+			/* Refill the receive buffer if it is empty.                   */
+			if ((!Port->ReceiveLength)
+					&& (Port->Flags & SPP_PORT_INFO_FLAGS_DATA_PENDING)) {
+				Result = SPP_Data_Read(ApplicationStateInfo.BluetoothStackID,
+						Port->ServerPortID, SPP_PORT_RECEIVE_BUFFER_SIZE,
+						Port->ReceiveBuffer);
+
+				/* A short read means that SPP has no more data queued.     */
+				if (Result < SPP_PORT_RECEIVE_BUFFER_SIZE)
+					Port->Flags &= ~SPP_PORT_INFO_FLAGS_DATA_PENDING;
+
+				if (Result > 0) {
+					Port->ReceiveStart = 0;
+					Port->ReceiveLength = (unsigned int) Result;
+					Port->BytesReceived += (unsigned int) Result;
+				}
+			}
+
+			if (Port->ReceiveLength) {
+				Length = SendUARTFrameData(
+						(Byte_t) (UART_FRAMING_CHANNEL_SPP_PORT + Index),
+						Port->ReceiveLength,
+						&(Port->ReceiveBuffer[Port->ReceiveStart]));
+				if (Length) {
+					Port->ReceiveStart += Length;
+					Port->ReceiveLength -= Length;
+
+					Progress = TRUE;
+				}
+			}
+		}
+	} while (Progress);
+
+	SPPPortsInfo.NextPort = (Byte_t) ((SPPPortsInfo.NextPort + 1)
+			% SPP_MAXIMUM_ADDITIONAL_PORTS);
+
+	/* Grant the host credits for the space that is now free.            */
+	UpdateUARTFrameCredits();
+}
+
+/* The following function is a utility function which is used to     */
+/* consume SPP data while a test is running.  The pattern is checked */
+/* (resynchronizing on errors) by the sink and the data is queued to */
+/* be sent back as SPP Buffer space allows by the loopback, anything */
+/* received by the generator is discarded.  The function returns the */
+/* number of bytes consumed.                                         */
+static unsigned int ProcessSPPTestData(unsigned int Length, Byte_t *Data) {
+	unsigned int Index;
+
+	if (SPPTestInfo.Mode == SPP_TEST_MODE_LOOPBACK) {
+		if (Length > (SPP_BUFFER_SIZE - ApplicationStateInfo.SPPBufferLength))
+			Length = SPP_BUFFER_SIZE - ApplicationStateInfo.SPPBufferLength;
+
+		if (Length) {
+			BTPS_MemCopy(
+					&(ApplicationStateInfo.SPPBuffer[ApplicationStateInfo.SPPBufferLength]),
+					Data, Length);
+			ApplicationStateInfo.SPPBufferLength += Length;
+
+			SPPTestInfo.PeriodGoodBytes += Length;
+
+			ProcessSendSPPData(FALSE);
+		}
+	} else if (SPPTestInfo.Mode == SPP_TEST_MODE_SINK) {
+		for (Index = 0; Index < Length; Index++) {
+			if (Data[Index] == SPPTestInfo.ReceivePattern)
+				SPPTestInfo.PeriodGoodBytes++;
+			else
+				SPPTestInfo.PatternErrors++;
+
+			SPPTestInfo.ReceivePattern = (Byte_t) (Data[Index] + 1);
+		}
+	}
+
+	SPPTestInfo.PeriodReceiveBytes += Length;
+
+	return (Length);
+}
+
+/* The following function is a utility function which is used to     */
+/* report the rates of the SPP test since the last report.  The      */
+/* report holds the transmit, receive and good (pattern correct or   */
+/* looped back) bytes per second followed by the number of partial   */
+/* writes and buffer full stalls in the period.                      */
+static void ReportSPPTest(void) {
+	unsigned long CurrentTick;
+	unsigned long Elapsed;
+	char Response[CONTROL_RESPONSE_BUFFER_SIZE - 8];
+
+	CurrentTick = BTPS_GetTickCount();
+	Elapsed = CurrentTick - SPPTestInfo.ReportTick;
+
+	if (Elapsed) {
+		BTPS_SprintF(Response, "+SPPTEST:%lu,%lu,%lu,%lu,%lu\r\n",
+				(SPPTestInfo.PeriodTransmitBytes * 1000) / Elapsed,
+				(SPPTestInfo.PeriodReceiveBytes * 1000) / Elapsed,
+				(SPPTestInfo.PeriodGoodBytes * 1000) / Elapsed,
+				SPPTestInfo.PeriodPartialWrites,
+				SPPTestInfo.PeriodBufferFullStalls);
+		AddControlResponse(Response);
+		WriteControlResponse();
+	}
+
+	SPPTestInfo.ReportTick = CurrentTick;
+	SPPTestInfo.PeriodTransmitBytes = 0;
+	SPPTestInfo.PeriodReceiveBytes = 0;
+	SPPTestInfo.PeriodGoodBytes = 0;
+	SPPTestInfo.PeriodPartialWrites = 0;
+	SPPTestInfo.PeriodBufferFullStalls = 0;
+}
+
+/* The following function is a utility function which is used to stop*/
+/* the wired host while SPP is unable to accept more data, either    */
+/* because the SPP transmit buffer is full or because the remote has */
+/* asked us to stop.                                                 */
+/* * NOTE * When the UART is framed the per channel credits are used */
+/*          instead so that the other channels are not stopped.      */
+/*          The host is never held in command mode or in real-time   */
+/*          mode, in which old data is dropped instead.              */
+static void UpdateWiredFlowHold(void) {
+	HAL_ConsoleSetFlowHold(
+			(Boolean_t) (((!UARTFramingInfo.Enabled)
+					&& (!ControlInfo.CommandMode)
+					&& (!ApplicationSettings.RealTimeDeadline)
+					&& (ApplicationStateInfo.Flags
+							& (APPLICATION_STATE_INFO_FLAGS_SPP_BUFFER_FULL
+									| APPLICATION_STATE_INFO_FLAGS_REMOTE_FLOW_STOPPED))) ?
+					TRUE : FALSE));
+}
+
+/* The following function is a utility function which is used to     */
+/* mirror the state of the wired port to the remote SPP device.  The */
+/* RTS/CTS bit is cleared while SPP data can not be delivered to the */
+/* wired host so that the remote stops before our buffers overflow.  */
+static void UpdateLocalPortStatus(void) {
+	unsigned int PortStatus;
+	int Result;
+
+	if (ApplicationStateInfo.Flags & APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED) {
+		PortStatus = SPP_PORT_STATUS_DTR_DSR_BIT;
+
+		if ((!ApplicationStateInfo.SPPReceiveBufferLength)
+				&& (!HAL_ConsoleTxFlowStopped()))
+			PortStatus |= SPP_PORT_STATUS_RTS_CTS_BIT;
+
+		/* Only send the status when it actually changes.                 */
+		if (PortStatus != ApplicationStateInfo.SPPLocalPortStatus) {
+			Result = SPP_Port_Status(ApplicationStateInfo.BluetoothStackID,
+					ApplicationStateInfo.SPPServerPortID, PortStatus);
+			if (!Result)
+				ApplicationStateInfo.SPPLocalPortStatus = PortStatus;
+			else
+				DisplayFunctionError("SPP_Port_Status", Result);
+		}
+	}
+}
+
+/* The following function is a utility function which is used to set */
+/* the serial service notification payload from the negotiated ATT   */
+/* MTU.                                                              */
+static void SetSerialServiceMTU(Word_t MTU) {
+	if (MTU > GATT_MAXIMUM_SUPPORTED_STACK_MTU)
+		MTU = GATT_MAXIMUM_SUPPORTED_STACK_MTU;
+
+	if (MTU < ATT_PROTOCOL_MTU_MINIMUM_LE)
+		MTU = ATT_PROTOCOL_MTU_MINIMUM_LE;
+
+	SerialServiceInfo.PayloadSize = (Word_t) (MTU
+			- SERIAL_SERVICE_NOTIFICATION_HEADER_SIZE);
+}
+
+/* The following function is a utility function which is used to send*/
+/* the buffered UART data to the LE device as serial service         */
+/* notifications.  Each notification is filled up to the negotiated  */
+/* payload size and no more than SERIAL_SERVICE_MAXIMUM_PACKETS are  */
+/* left outstanding in the controller, so data that arrives while the*/
+/* link is busy is packed into the next notification.                */
+/* * NOTE * Raw UART data is only sent over LE when the bridge policy*/
+/*          selects LE alone (see ProcessBridgeData).                */
+static void ProcessSendLEData(Boolean_t PacketizeCurrentData) {
+	int Result;
+	unsigned int Length;
+
+	if (!SerialServiceInfo.NotificationsEnabled)
+		return;
+
+	/* If requested packetize the current UART data to the end of the    */
+	/* serial service buffer.                                            */
+	if ((PacketizeCurrentData) && (!UARTFramingInfo.Enabled)
+			&& (!ControlInfo.CommandMode)
+			&& (GetBridgeTransports() == BRIDGE_TRANSPORT_LE)) {
+		SerialServiceInfo.BufferLength += FormatSPPDataPacket(
+				SERIAL_SERVICE_BUFFER_SIZE - SerialServiceInfo.BufferLength,
+				&(SerialServiceInfo.Buffer[SerialServiceInfo.BufferLength]));
+	}
+
+	if (SerialServiceInfo.BufferLength > BridgeInfo.LE.MaximumQueueDepth)
+		BridgeInfo.LE.MaximumQueueDepth = (Word_t) SerialServiceInfo.BufferLength;
+
+	while ((SerialServiceInfo.BufferLength)
+			&& (SerialServiceInfo.PacketsOutstanding
+					< SERIAL_SERVICE_MAXIMUM_PACKETS)) {
+		Length = SerialServiceInfo.BufferLength;
+		if (Length > SerialServiceInfo.PayloadSize)
+			Length = SerialServiceInfo.PayloadSize;
+
+		Result = GATT_Handle_Value_Notification(
+				ApplicationStateInfo.BluetoothStackID,
+				ApplicationStateInfo.SerialServiceID,
+				ApplicationStateInfo.LEConnectionInfo.ConnectionIndex,
+				SERIAL_SERVICE_TX_VALUE_ATTRIBUTE_OFFSET, (Word_t) Length,
+				SerialServiceInfo.Buffer);
+
+		/* If the stack has no buffer available the data is kept and sent */
+		/* when the controller reports completed packets.                 */
+		if (Result <= 0) {
+			if (Result != BTGATT_ERROR_INSUFFICIENT_RESOURCES)
+				DisplayFunctionError("GATT_Handle_Value_Notification", Result);
+			break;
+		}
+
+		if ((unsigned int) Result < SerialServiceInfo.BufferLength)
+			BTPS_MemMove(SerialServiceInfo.Buffer,
+					&(SerialServiceInfo.Buffer[(unsigned int) Result]),
+					(SerialServiceInfo.BufferLength - Result));
+
+		SerialServiceInfo.BufferLength -= (unsigned int) Result;
+
+		SerialServiceInfo.PacketsOutstanding++;
+		SerialServiceInfo.NotificationsSent++;
+		BridgeInfo.LE.TransmitBytes += (unsigned int) Result;
+
+		LEProfileInfo.TrafficBytes += (unsigned int) Result;
+	}
+}
+
+/* The following function is a utility function which is used to move*/
+/* data written by the LE device to the UART.  Writes can not be held*/
+/* off so any data that the UART can not accept is dropped.          */
+/* * NOTE * Raw LE data is only written to the UART while the bridge */
+/*          policy selects LE (see GetBridgeTransports).             */
+static void ProcessReceiveLEData(unsigned int Length, Byte_t *Data) {
+	unsigned int Count;
+	unsigned int Index;
+
+	SerialServiceInfo.BytesReceived += Length;
+	LEProfileInfo.TrafficBytes += Length;
+	BridgeInfo.LE.ReceiveBytes += Length;
+
+	Index = 0;
+	if (!ControlInfo.CommandMode) {
+		if (UARTFramingInfo.Enabled) {
+			while ((Index < Length)
+					&& ((Count = SendUARTFrameData(UART_FRAMING_CHANNEL_LE,
+							Length - Index, &(Data[Index]))) != 0))
+				Index += Count;
+		} else {
+			if (GetBridgeTransports() & BRIDGE_TRANSPORT_LE)
+				Index = (unsigned int) HAL_ConsoleWriteNonBlocking(Length,
+						(char *) Data);
+		}
+	}
+
+	SerialServiceInfo.BytesDropped += (Length - Index);
+}
+
+/* The following function is a utility function which is used to     */
+/* select the transports (BRIDGE_TRANSPORT_XXX) that carry the raw   */
+/* UART data under the bridge policy.  While neither transport is    */
+/* connected the data is held for SPP.                               */
+static Byte_t GetBridgeTransports(void) {
+	Byte_t ret_val;
+	Boolean_t SPPActive;
+	Boolean_t LEActive;
+
+	SPPActive = (Boolean_t) ((ApplicationStateInfo.Flags
+			& APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED) != 0);
+	LEActive = SerialServiceInfo.NotificationsEnabled;
+
+	switch (ApplicationSettings.BridgePolicy) {
+	case BRIDGE_POLICY_LE_PRIMARY:
+		ret_val = (LEActive) ? BRIDGE_TRANSPORT_LE : BRIDGE_TRANSPORT_SPP;
+		break;
+	case BRIDGE_POLICY_DUPLICATE:
+		ret_val = 0;
+		if (SPPActive)
+			ret_val |= BRIDGE_TRANSPORT_SPP;
+		if (LEActive)
+			ret_val |= BRIDGE_TRANSPORT_LE;
+		if (!ret_val)
+			ret_val = BRIDGE_TRANSPORT_SPP;
+		break;
+	default:
+		ret_val = ((LEActive) && (!SPPActive)) ?
+				BRIDGE_TRANSPORT_LE : BRIDGE_TRANSPORT_SPP;
+		break;
+	}
+
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to send*/
+/* the raw UART data to the transports selected by the bridge policy.*/
+/* When both are selected only as much data is read as fits in both  */
+/* the SPP Buffer and the serial service buffer, so the slower       */
+/* transport paces the UART.                                         */
+static void ProcessBridgeData(void) {
+	Byte_t Transports;
+	unsigned int Length;
+
+	Transports = GetBridgeTransports();
+
+	if (Transports == (BRIDGE_TRANSPORT_SPP | BRIDGE_TRANSPORT_LE)) {
+		if ((!ControlInfo.CommandMode) && (!SPPTestInfo.Mode)) {
+			Length = GetSPPBufferSpace();
+			if (Length
+					> (SERIAL_SERVICE_BUFFER_SIZE - SerialServiceInfo.BufferLength))
+				Length = SERIAL_SERVICE_BUFFER_SIZE
+						- SerialServiceInfo.BufferLength;
+
+			Length = FormatSPPDataPacket(Length,
+					&(SerialServiceInfo.Buffer[SerialServiceInfo.BufferLength]));
+
+			BTPS_MemCopy(
+					&(ApplicationStateInfo.SPPBuffer[ApplicationStateInfo.SPPBufferLength]),
+					&(SerialServiceInfo.Buffer[SerialServiceInfo.BufferLength]),
+					Length);
+
+			ApplicationStateInfo.SPPBufferLength += Length;
+			SerialServiceInfo.BufferLength += Length;
+		}
+
+		ProcessSendSPPData(FALSE);
+		ProcessSendLEData(FALSE);
+	} else if (Transports == BRIDGE_TRANSPORT_LE)
+		ProcessSendLEData(TRUE);
+	else
+		ProcessSendSPPData(TRUE);
+}
+
+/* The following function is a utility function which is used to     */
+/* reset the LE connection parameter profile selection when an LE    */
+/* connection is made.  The counters are kept.                       */
+static void StartLEConnectionProfile(
+		GAP_LE_Current_Connection_Parameters_t *CurrentParameters) {
+	LEProfileInfo.Profile = LE_PROFILE_NONE;
+	LEProfileInfo.TargetProfile = LE_PROFILE_LATENCY;
+	LEProfileInfo.PendingProfile = LE_PROFILE_NONE;
+	LEProfileInfo.RejectedProfile = LE_PROFILE_NONE;
+	LEProfileInfo.Retries = 0;
+	LEProfileInfo.RetryPeriods = LE_PROFILE_RETRY_PERIODS;
+	LEProfileInfo.PendingPeriods = 0;
+	LEProfileInfo.IdlePeriods = 0;
+	LEProfileInfo.TrafficBytes = 0;
+	LEProfileInfo.CurrentParameters = *CurrentParameters;
+}
+
+/* The following function is a utility function which is used to ask */
+/* the central to use the specified profile.  Each retry doubles the */
+/* maximum interval (and stretches the supervision timeout to match) */
+/* to give the central more room to accept.                          */
+static void RequestLEConnectionProfile(Byte_t Profile) {
+	int Result;
+	unsigned long IntervalMax;
+	unsigned long SupervisionTimeout;
+	BTPSCONST LEConnectionProfile_t *ConnectionProfile;
+
+	ConnectionProfile = &(LEConnectionProfiles[Profile]);
+
+	IntervalMax = (unsigned long) ConnectionProfile->IntervalMax
+			<< LEProfileInfo.Retries;
+	if (IntervalMax > MAXIMUM_MAXIMUM_CONNECTION_INTERVAL)
+		IntervalMax = MAXIMUM_MAXIMUM_CONNECTION_INTERVAL;
+
+	/* The supervision timeout must cover several missed events.         */
+	SupervisionTimeout = (ConnectionProfile->SlaveLatency + 1) * IntervalMax
+			* 3;
+	if (SupervisionTimeout < ConnectionProfile->SupervisionTimeout)
+		SupervisionTimeout = ConnectionProfile->SupervisionTimeout;
+	if (SupervisionTimeout > MAXIMUM_LINK_SUPERVISION_TIMEOUT)
+		SupervisionTimeout = MAXIMUM_LINK_SUPERVISION_TIMEOUT;
+
+	Result = GAP_LE_Connection_Parameter_Update_Request(
+			ApplicationStateInfo.BluetoothStackID,
+			ApplicationStateInfo.LEConnectionInfo.BD_ADDR,
+			ConnectionProfile->IntervalMin, (Word_t) IntervalMax,
+			ConnectionProfile->SlaveLatency, (Word_t) SupervisionTimeout);
+	if (!Result) {
+		Display(
+				("Requesting LE %s profile (%u-%lu ms).\r\n", ConnectionProfile->Name, ConnectionProfile->IntervalMin, IntervalMax));
+
+		LEProfileInfo.PendingProfile = Profile;
+		LEProfileInfo.PendingPeriods = 0;
+		LEProfileInfo.UpdatesRequested++;
+	} else {
+		DisplayFunctionError("GAP_LE_Connection_Parameter_Update_Request",
+				Result);
+
+		LEProfileInfo.RetryPeriods = LE_PROFILE_RETRY_PERIODS;
+	}
+}
+
+/* The following function is a utility function which is used to     */
+/* note that the pending profile request was rejected or was never   */
+/* answered.  The request is retried (with a wider interval) after a */
+/* pause, and the profile is given up on after too many retries.     */
+static void RejectLEConnectionProfile(void) {
+	LEProfileInfo.UpdatesRejected++;
+
+	if (++LEProfileInfo.Retries > LE_PROFILE_MAXIMUM_RETRIES)
+		LEProfileInfo.RejectedProfile = LEProfileInfo.PendingProfile;
+
+	LEProfileInfo.PendingProfile = LE_PROFILE_NONE;
+	LEProfileInfo.RetryPeriods = LE_PROFILE_RETRY_PERIODS;
+}
+
+/* The following function is called every APPLICATION_TIMER_PERIOD   */
+/* while an LE device is connected to measure the traffic, select    */
+/* the profile that should be used and request it when needed.       */
+static void UpdateLEConnectionProfile(void) {
+	Byte_t TargetProfile;
+
+	/* Select the profile based on the traffic seen in the last period.  */
+	if (ApplicationSettings.LEProfile == LE_PROFILE_AUTOMATIC) {
+		TargetProfile = LEProfileInfo.TargetProfile;
+
+		if ((LEProfileInfo.TrafficBytes >= LE_PROFILE_THROUGHPUT_THRESHOLD)
+				|| (SerialServiceInfo.BufferLength)) {
+			TargetProfile = LE_PROFILE_THROUGHPUT;
+			LEProfileInfo.IdlePeriods = 0;
+		} else if (LEProfileInfo.TrafficBytes) {
+			TargetProfile = LE_PROFILE_LATENCY;
+			LEProfileInfo.IdlePeriods = 0;
+		} else if (LEProfileInfo.IdlePeriods < LE_PROFILE_IDLE_PERIODS) {
+			/* Drop to the latency profile at once when data stops.        */
+			if (TargetProfile == LE_PROFILE_THROUGHPUT)
+				TargetProfile = LE_PROFILE_LATENCY;
+
+			if (++LEProfileInfo.IdlePeriods == LE_PROFILE_IDLE_PERIODS)
+				TargetProfile = LE_PROFILE_POWER;
+		}
+	} else
+		TargetProfile = ApplicationSettings.LEProfile;
+
+	LEProfileInfo.TrafficBytes = 0;
+
+	/* A profile that was given up on may be tried again once another    */
+	/* profile has been wanted.                                          */
+	if (TargetProfile != LEProfileInfo.TargetProfile) {
+		LEProfileInfo.TargetProfile = TargetProfile;
+		LEProfileInfo.RejectedProfile = LE_PROFILE_NONE;
+		LEProfileInfo.Retries = 0;
+	}
+
+	if (LEProfileInfo.PendingProfile != LE_PROFILE_NONE) {
+		/* Treat a request that is never answered as rejected.            */
+		if (++LEProfileInfo.PendingPeriods >= LE_PROFILE_RESPONSE_PERIODS)
+			RejectLEConnectionProfile();
+	} else if (LEProfileInfo.RetryPeriods)
+		LEProfileInfo.RetryPeriods--;
+	else if ((TargetProfile != LEProfileInfo.Profile)
+			&& (TargetProfile != LEProfileInfo.RejectedProfile))
+		RequestLEConnectionProfile(TargetProfile);
+}
+
+/* The following function is a utility function which is used to add */
+/* the time spent in the current mode of the BR/EDR link to the      */
+/* active or sniff time.                                             */
+static void UpdateSniffTime(void) {
+	unsigned long CurrentTick;
+
+	CurrentTick = BTPS_GetTickCount();
+
+	if (ApplicationStateInfo.Flags & APPLICATION_STATE_INFO_SNIFF_MODE_ACTIVE)
+		SniffInfo.SniffTime += CurrentTick - SniffInfo.ModeStartTick;
+	else
+		SniffInfo.ActiveTime += CurrentTick - SniffInfo.ModeStartTick;
+
+	SniffInfo.ModeStartTick = CurrentTick;
+}
+
+/* The following function is a utility function which is used to put */
+/* the BR/EDR link into sniff mode.  The interval is chosen from the */
+/* activity score of the link.                                       */
+static void StartSniffMode(void) {
+	int Result;
+	Byte_t StatusResult;
+
+	if (SniffInfo.ActivityScore >= SNIFF_ACTIVITY_SHORT)
+		SniffInfo.Interval = SNIFF_SHORT_INTERVAL;
+	else if (SniffInfo.ActivityScore >= SNIFF_ACTIVITY_MEDIUM)
+		SniffInfo.Interval = SNIFF_MEDIUM_INTERVAL;
+	else
+		SniffInfo.Interval = SNIFF_LONG_INTERVAL;
+
+	Result = HCI_Sniff_Mode(ApplicationStateInfo.BluetoothStackID,
+			SniffInfo.ConnectionHandle, SniffInfo.Interval,
+			(Word_t) (SniffInfo.Interval / 2), SNIFF_ATTEMPT, SNIFF_TIMEOUT,
+			&StatusResult);
+	if ((!Result) && (StatusResult == HCI_ERROR_CODE_NO_ERROR))
+		SniffInfo.RequestPending = TRUE;
+	else
+		Display(
+				("HCI_Sniff_Mode failed: %d, Status 0x%02X.\r\n", Result, StatusResult));
+}
+
+/* The following function is a utility function which is used to     */
+/* take the BR/EDR link out of sniff mode when there is data to send.*/
+static void ExitSniffMode(void) {
+	int Result;
+	Byte_t StatusResult;
+
+	SniffInfo.IdlePeriods = 0;
+
+	if ((ApplicationStateInfo.Flags & APPLICATION_STATE_INFO_SNIFF_MODE_ACTIVE)
+			&& (!SniffInfo.RequestPending)) {
+		Result = HCI_Exit_Sniff_Mode(ApplicationStateInfo.BluetoothStackID,
+				SniffInfo.ConnectionHandle, &StatusResult);
+		if ((!Result) && (StatusResult == HCI_ERROR_CODE_NO_ERROR))
+			SniffInfo.RequestPending = TRUE;
+	}
+}
+
+/* The following function is called every APPLICATION_TIMER_PERIOD   */
+/* while a BR/EDR device is connected to update the activity score   */
+/* and to put the link into sniff mode once it has been idle.        */
+static void UpdateSniffMode(void) {
+	Boolean_t Idle;
+
+	/* Data that is still queued in either direction also counts as      */
+	/* traffic.                                                          */
+	Idle = (Boolean_t) ((!SniffInfo.TrafficBytes)
+			&& (!ApplicationStateInfo.SPPBufferLength)
+			&& (!ApplicationStateInfo.SPPReceiveBufferLength)
+			&& (!(ApplicationStateInfo.Flags
+					& APPLICATION_STATE_INFO_FLAGS_SPP_DATA_PENDING)));
+
+	SniffInfo.TrafficBytes = 0;
+
+	/* The activity score is a moving average of the periods that        */
+	/* carried traffic.                                                  */
+	SniffInfo.ActivityScore = (Word_t) (((SniffInfo.ActivityScore * 3)
+			+ ((Idle) ? 0 : SNIFF_ACTIVITY_MAXIMUM)) / 4);
+
+	if (!Idle)
+		ExitSniffMode();
+	else {
+		if (SniffInfo.IdlePeriods < 0xFF)
+			SniffInfo.IdlePeriods++;
+
+		if ((ApplicationSettings.SniffIdleTime)
+				&& (SniffInfo.IdlePeriods >= ApplicationSettings.SniffIdleTime)
+				&& (!SniffInfo.RequestPending)
+				&& (!(ApplicationStateInfo.Flags
+						& APPLICATION_STATE_INFO_SNIFF_MODE_ACTIVE)))
+			StartSniffMode();
+	}
+}
+
+/* The following function is a utility function which is used to ask */
+/* the controller to use the packet types of the specified level     */
+/* (LINK_PACKETS_XXX).  The time spent at the previous level is      */
+/* accounted.                                                        */
+static void SetLinkPacketLevel(Byte_t Level) {
+	Byte_t Status;
+	unsigned long CurrentTick;
+
+	CurrentTick = BTPS_GetTickCount();
+
+	LinkInfo.LevelTime[LinkInfo.Level] += CurrentTick - LinkInfo.LevelStartTick;
+	LinkInfo.LevelStartTick = CurrentTick;
+	LinkInfo.Level = Level;
+	LinkInfo.GoodChecks = 0;
+
+	if ((HCI_Change_Connection_Packet_Type(
+			ApplicationStateInfo.BluetoothStackID, SniffInfo.ConnectionHandle,
+			LinkPacketTypes[Level].PacketType, &Status)) || (Status))
+		Display(("Packet type change to %s failed.\r\n", LinkPacketTypes[Level].Name));
+}
+
+/* The following function is called when an SPP port has been opened */
+/* to start the packet type selection of the link with the EDR       */
+/* packets.                                                          */
+static void StartLinkPacketSelection(void) {
+	Byte_t Status;
+	Word_t ConnectionHandle;
+
+	BTPS_MemInitialize(&LinkInfo, 0, sizeof(LinkInfo));
+
+	LinkInfo.LevelStartTick = BTPS_GetTickCount();
+
+	HCI_Reset_Failed_Contact_Counter(ApplicationStateInfo.BluetoothStackID,
+			SniffInfo.ConnectionHandle, &Status, &ConnectionHandle);
+
+	SetLinkPacketLevel(LINK_PACKETS_EDR);
+}
+
+/* The following function is called every APPLICATION_TIMER_PERIOD   */
+/* while a BR/EDR device is connected to check the link quality every*/
+/* LINK_QUALITY_PERIOD and select the packet types from it.          */
+static void UpdateLinkQuality(void) {
+	Byte_t Status;
+	Word_t ConnectionHandle;
+	Word_t FailedContacts;
+	SByte_t RSSI;
+
+	if (++LinkInfo.Periods >= LINK_QUALITY_PERIOD) {
+		LinkInfo.Periods = 0;
+
+		/* Read the failed contacts since the last check.                 */
+		if ((HCI_Read_Failed_Contact_Counter(
+				ApplicationStateInfo.BluetoothStackID,
+				SniffInfo.ConnectionHandle, &Status, &ConnectionHandle,
+				&FailedContacts)) || (Status))
+			FailedContacts = 0;
+		else if (FailedContacts)
+			HCI_Reset_Failed_Contact_Counter(
+					ApplicationStateInfo.BluetoothStackID,
+					SniffInfo.ConnectionHandle, &Status, &ConnectionHandle);
+
+		if ((!HCI_Read_RSSI(ApplicationStateInfo.BluetoothStackID,
+				SniffInfo.ConnectionHandle, &Status, &ConnectionHandle, &RSSI))
+				&& (!Status))
+			LinkInfo.RSSI = RSSI;
+
+		LinkInfo.FailedContacts += FailedContacts;
+
+		if ((FailedContacts) || (LinkInfo.RSSI < LINK_QUALITY_RSSI_LOW)) {
+			LinkInfo.GoodChecks = 0;
+
+			if (LinkInfo.Level < LINK_PACKETS_ROBUST) {
+				LinkInfo.Downgrades++;
+
+				SetLinkPacketLevel(LinkInfo.Level + 1);
+			}
+		} else {
+			if (LinkInfo.RSSI >= LINK_QUALITY_RSSI_GOOD)
+				LinkInfo.GoodChecks++;
+			else
+				LinkInfo.GoodChecks = 0;
+
+			if ((LinkInfo.GoodChecks >= LINK_QUALITY_GOOD_CHECKS)
+					&& (LinkInfo.Level > LINK_PACKETS_EDR)) {
+				LinkInfo.Upgrades++;
+
+				SetLinkPacketLevel(LinkInfo.Level - 1);
+			}
+		}
+	}
+}
+
+/* The following function is a utility function which is used to add */
+/* a completed latency trace sample to the histograms.               */
+static void AddTraceSample(Word_t *Timestamps) {
+	unsigned int Stage;
+	unsigned int Bucket;
+	Word_t Delta;
+
+	for (Stage = 0; Stage < (HAL_TRACE_NUMBER_STAGES - 1); Stage++) {
+		/* The bucket is the number of significant bits in the time.      */
+		Delta = (Word_t) (Timestamps[Stage + 1] - Timestamps[Stage]);
+		for (Bucket = 0; (Delta) && (Bucket < (TRACE_HISTOGRAM_BUCKETS - 1));
+				Bucket++)
+			Delta >>= 1;
+
+		if (TraceInfo.Histogram[Stage][Bucket] != 0xFFFF)
+			TraceInfo.Histogram[Stage][Bucket]++;
+	}
+
+	TraceInfo.Samples++;
+}
+
+/* The following function is called every APPLICATION_TIMER_PERIOD   */
+/* to collect the last latency trace sample and to start a new one   */
+/* when it is due.                                                   */
+static void UpdateLatencyTrace(void) {
+	Word_t Timestamps[HAL_TRACE_NUMBER_STAGES];
+
+	if (HAL_TraceGetSample(Timestamps))
+		AddTraceSample(Timestamps);
+
+	if (++TraceInfo.Periods >= ApplicationSettings.TracePeriod) {
+		TraceInfo.Periods = 0;
+
+		/* A sample that has not finished by now was not bridged (for     */
+		/* example no device was connected).                              */
+		if (HAL_TraceArm())
+			TraceInfo.SamplesDiscarded++;
+	}
+}
+
+/* The following function is the application timer, which is run by  */
+/* the scheduler (from ApplicationMain()) every                      */
+/* APPLICATION_TIMER_PERIOD.                                         */
+static void BTPSAPI ApplicationTimerCallback(void *ScheduleParameter) {
+	if (ApplicationStateInfo.Flags & APPLICATION_STATE_INFO_FLAGS_LE_CONNECTED)
+		UpdateLEConnectionProfile();
+
+	if (ApplicationStateInfo.Flags & APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED) {
+		UpdateSniffMode();
+		UpdateLinkQuality();
+	}
+
+	if (SPPTestInfo.Mode)
+		ReportSPPTest();
+
+	if (ApplicationSettings.TracePeriod)
+		UpdateLatencyTrace();
+
+	if (ControlInfo.EscapeLength)
+		UpdateControlEscape();
+
+	if (BondStoreInfo.Pending)
+		UpdateBondStore();
+
+	if (ReconnectInfo.Phase < RECONNECT_PHASE_NORMAL)
+		UpdateReconnect();
+}
+
+/* The following function is called by the HAL (in interrupt context)*/
+/* when space is available in the UART transmit buffer.              */
+static void UARTWriteReadyCallback(void *CallbackParameter) {
+	PostApplicationMailbox(APPLICATION_MAILBOX_MESSAGE_ID_UART_WRITE_READY);
+}
+
+/* The following function is used to enable or disable the UART      */
+/* framing.  All framing state is reset and the credits return to    */
+/* their initial values.                                             */
+static void SetUARTFraming(Boolean_t Enable) {
+	unsigned int Index;
+
+	BTPS_MemInitialize(&UARTFramingInfo, 0, sizeof(UARTFramingInfo));
+
+	UARTFramingInfo.Enabled = Enable;
+
+	for (Index = 0; Index < UART_FRAMING_NUMBER_CHANNELS; Index++) {
+		UARTFramingInfo.TxCredits[Index] = UART_FRAMING_INITIAL_CREDITS;
+		UARTFramingInfo.RxCredits[Index] = UART_FRAMING_INITIAL_CREDITS;
+	}
+
+	/* Frames are processed as soon as the end of a frame is received,   */
+	/* raw data on the 0xFF end of block marker.                         */
+	HAL_ConsoleSetNotifyCharacter(
+			(unsigned char) (Enable ? UART_FRAMING_SLIP_END : 0xFF));
+
+	/* The wired host is flow controlled by credits when framed.         */
+	UpdateWiredFlowHold();
+}
+
+/* The following function is a utility function which is used to SLIP*/
+/* encode the specified bytes to the UART.  The caller is responsible*/
+/* for making sure that there is enough space in the UART.           */
+static void WriteFramedBytes(unsigned int Length, Byte_t *Data) {
+	Byte_t Buffer[16];
+	unsigned int Count;
+
+	Count = 0;
+	while (Length--) {
+		if ((*Data == UART_FRAMING_SLIP_END) || (*Data == UART_FRAMING_SLIP_ESC)) {
+			Buffer[Count++] = UART_FRAMING_SLIP_ESC;
+			Buffer[Count++] =
+					(Byte_t) ((*Data == UART_FRAMING_SLIP_END) ?
+							UART_FRAMING_SLIP_ESC_END : UART_FRAMING_SLIP_ESC_ESC);
+		} else
+			Buffer[Count++] = *Data;
+
+		Data++;
+
+		/* Flush the buffer when it can not hold another escaped byte.    */
+		if ((Count >= (sizeof(Buffer) - 1)) || (!Length)) {
+			HAL_ConsoleWriteNonBlocking(Count, (char *) Buffer);
+			Count = 0;
+		}
+	}
+}
+
+/* The following function is a utility function which is used to     */
+/* write a complete frame to the UART.  The caller is responsible for*/
+/* making sure that there is UART_FRAMING_ENCODED_SIZE(Length) space */
+/* in the UART.                                                      */
+static void WriteUARTFrame(Byte_t Header, unsigned int Length, Byte_t *Data) {
+	Byte_t End = UART_FRAMING_SLIP_END;
+
+	HAL_ConsoleWriteNonBlocking(1, (char *) &End);
+	WriteFramedBytes(1, &Header);
+
+	if (Length)
+		WriteFramedBytes(Length, Data);
+
+	HAL_ConsoleWriteNonBlocking(1, (char *) &End);
+
+	UARTFramingInfo.FramesSent++;
+}
+
+/* The following function is a utility function which is used to send*/
+/* channel data to the host in a single data frame.  This function   */
+/* returns the number of bytes that were sent, which is zero if the  */
+/* host has not granted a credit on the channel or the UART is full. */
+static unsigned int SendUARTFrameData(Byte_t Channel, unsigned int Length,
+		Byte_t *Data) {
+	unsigned int Space;
+
+	if ((!Length) || (!UARTFramingInfo.TxCredits[Channel]))
+		return (0);
+
+	/* Make sure there is room for at least a one byte frame, otherwise  */
+	/* ask to be told when there is.                                     */
+	Space = HAL_ConsoleWriteSpace();
+	if (Space < UART_FRAMING_ENCODED_SIZE(1)) {
+		HAL_ConsoleArmTxSpaceCallback();
+
+		return (0);
+	}
+
+	/* Send as much as will fit in the UART in the worst case, asking to */
+	/* be told when the rest can be sent.                                */
+	Space = (Space - UART_FRAMING_ENCODED_SIZE(0)) / 2;
+	if (Length > Space) {
+		Length = Space;
+
+		HAL_ConsoleArmTxSpaceCallback();
+	}
+
+	if (Length > UART_FRAMING_MAXIMUM_PAYLOAD)
+		Length = UART_FRAMING_MAXIMUM_PAYLOAD;
+
+	WriteUARTFrame((Byte_t) (UART_FRAMING_TYPE_DATA | Channel), Length, Data);
+
+	UARTFramingInfo.TxCredits[Channel]--;
+
+	return (Length);
+}
+
+/* The following function is a utility function which is used to     */
+/* grant the host more credits on the specified channel.  This       */
+/* function returns TRUE if the credit frame was sent.               */
+static Boolean_t SendUARTFrameCredits(Byte_t Channel, Byte_t Credits) {
+	Boolean_t ret_val;
+
+	if (HAL_ConsoleWriteSpace() >= UART_FRAMING_ENCODED_SIZE(1)) {
+		WriteUARTFrame((Byte_t) (UART_FRAMING_TYPE_CREDIT | Channel), 1,
+				&Credits);
+
+		UARTFramingInfo.RxCredits[Channel] += Credits;
+
+		ret_val = TRUE;
+	} else
+		ret_val = FALSE;
+
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to top */
+/* up the credits held by the host.  SPP and LE credits are only     */
+/* granted for frames that are guaranteed to fit in the SPP Buffer   */
+/* and the serial service buffer.                                    */
+static void UpdateUARTFrameCredits(void) {
+	unsigned int Index;
+	unsigned int Credits;
+	Byte_t Channel;
+
+	if (UARTFramingInfo.Enabled) {
+		/* Grant SPP credits while a BR/EDR device is connected.          */
+		if (ApplicationStateInfo.Flags
+				& APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED) {
+			Credits = (SPP_BUFFER_SIZE - ApplicationStateInfo.SPPBufferLength)
+					/ UART_FRAMING_MAXIMUM_PAYLOAD;
+
+			if (Credits > UARTFramingInfo.RxCredits[UART_FRAMING_CHANNEL_SPP])
+				SendUARTFrameCredits(UART_FRAMING_CHANNEL_SPP,
+						(Byte_t) (Credits
+								- UARTFramingInfo.RxCredits[UART_FRAMING_CHANNEL_SPP]));
+		}
+
+		/* Grant LE credits while the LE device has enabled notifications.*/
+		if (SerialServiceInfo.NotificationsEnabled) {
+			Credits = (SERIAL_SERVICE_BUFFER_SIZE - SerialServiceInfo.BufferLength)
+					/ UART_FRAMING_MAXIMUM_PAYLOAD;
+
+			if (Credits > UARTFramingInfo.RxCredits[UART_FRAMING_CHANNEL_LE])
+				SendUARTFrameCredits(UART_FRAMING_CHANNEL_LE,
+						(Byte_t) (Credits
+								- UARTFramingInfo.RxCredits[UART_FRAMING_CHANNEL_LE]));
+		}
+
+		/* Grant credits on the channel of each connected additional SPP  */
+		/* port for the space in its transmit ring.                       */
+		for (Index = 0; Index < SPP_MAXIMUM_ADDITIONAL_PORTS; Index++) {
+			if (!(SPPPortsInfo.Ports[Index].Flags
+					& SPP_PORT_INFO_FLAGS_CONNECTED))
+				continue;
+
+			Channel = (Byte_t) (UART_FRAMING_CHANNEL_SPP_PORT + Index);
+			Credits = (SPP_PORT_TRANSMIT_BUFFER_SIZE
+					- SPPPortsInfo.Ports[Index].TransmitLength)
+					/ UART_FRAMING_MAXIMUM_PAYLOAD;
+
+			if (Credits > UARTFramingInfo.RxCredits[Channel])
+				SendUARTFrameCredits(Channel,
+						(Byte_t) (Credits - UARTFramingInfo.RxCredits[Channel]));
+		}
+
+		/* Control frames are processed as they arrive so simply return   */
+		/* the credits that have been used.                               */
+		if (UARTFramingInfo.RxCredits[UART_FRAMING_CHANNEL_CONTROL]
+				< UART_FRAMING_INITIAL_CREDITS)
+			SendUARTFrameCredits(UART_FRAMING_CHANNEL_CONTROL,
+					(Byte_t) (UART_FRAMING_INITIAL_CREDITS
+							- UARTFramingInfo.RxCredits[UART_FRAMING_CHANNEL_CONTROL]));
+	}
+}
+
+/* The following function is a utility function which is used to     */
+/* dispatch a complete frame received from the host.                 */
+static void ProcessUARTFrame(void) {
+	Byte_t Header;
+	Byte_t Channel;
+	unsigned int Length;
+	Byte_t *Payload;
+
+	Header = UARTFramingInfo.RxFrame[0];
+	Channel = (Byte_t) (Header & UART_FRAMING_CHANNEL_MASK);
+	Length = UARTFramingInfo.RxFrameLength - 1;
+	Payload = &(UARTFramingInfo.RxFrame[1]);
+
+	UARTFramingInfo.FramesReceived++;
+
+	if (Channel >= UART_FRAMING_NUMBER_CHANNELS) {
+		UARTFramingInfo.FramesDropped++;
+		return;
+	}
+
+	switch (Header & UART_FRAMING_TYPE_MASK) {
+	case UART_FRAMING_TYPE_CREDIT:
+		/* The host has granted us more credits on the channel.           */
+		if ((Length == 1)
+				&& ((unsigned int) UARTFramingInfo.TxCredits[Channel] + Payload[0]
+						<= 0xFF)) {
+			UARTFramingInfo.TxCredits[Channel] += Payload[0];
+
+			/* Resume sending any SPP data that was waiting for a credit.*/
+			if ((Channel == UART_FRAMING_CHANNEL_SPP)
+					|| (Channel >= UART_FRAMING_CHANNEL_SPP_PORT))
+				PostApplicationMailbox(
+						APPLICATION_MAILBOX_MESSAGE_ID_UART_WRITE_READY);
+		} else
+			UARTFramingInfo.FramesDropped++;
+		break;
+	case UART_FRAMING_TYPE_DATA:
+		/* The host must hold a credit to send a data frame.              */
+		if (!UARTFramingInfo.RxCredits[Channel]) {
+			UARTFramingInfo.FramesDropped++;
+			break;
+		}
+
+		UARTFramingInfo.RxCredits[Channel]--;
+
+		switch (Channel) {
+		case UART_FRAMING_CHANNEL_SPP:
+			/* Queue the data to be sent to the SPP device.                */
+			if ((ApplicationStateInfo.Flags
+					& APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED)
+					&& (Length
+							<= (SPP_BUFFER_SIZE - ApplicationStateInfo.SPPBufferLength))) {
+				BTPS_MemCopy(
+						&(ApplicationStateInfo.SPPBuffer[ApplicationStateInfo.SPPBufferLength]),
+						Payload, Length);
+
+				ApplicationStateInfo.SPPBufferLength += Length;
+			} else
+				UARTFramingInfo.FramesDropped++;
+			break;
+		case UART_FRAMING_CHANNEL_LE:
+			/* Queue the data to be notified to the LE device.             */
+			if ((SerialServiceInfo.NotificationsEnabled)
+					&& (Length
+							<= (SERIAL_SERVICE_BUFFER_SIZE - SerialServiceInfo.BufferLength))) {
+				BTPS_MemCopy(
+						&(SerialServiceInfo.Buffer[SerialServiceInfo.BufferLength]),
+						Payload, Length);
+
+				SerialServiceInfo.BufferLength += Length;
+			} else
+				UARTFramingInfo.FramesDropped++;
+			break;
+		case UART_FRAMING_CHANNEL_CONTROL:
+			/* Each frame holds a single command, a trailing carriage      */
+			/* return is optional.                                         */
+			while ((Length)
+					&& ((Payload[Length - 1] == '\r')
+							|| (Payload[Length - 1] == '\n')))
+				Length--;
+
+			if (Length < CONTROL_COMMAND_BUFFER_SIZE) {
+				BTPS_MemCopy(ControlInfo.CommandBuffer, Payload, Length);
+
+				ControlInfo.CommandLength = Length;
+
+				ExecuteControlCommand();
+			} else
+				UARTFramingInfo.FramesDropped++;
+			break;
+		default:
+			/* Queue the data to be sent to an additional SPP port, no     */
+			/* handler exists for the other channels.                      */
+			if ((Channel < UART_FRAMING_CHANNEL_SPP_PORT)
+					|| (!QueueSPPPortData(
+							(unsigned int) (Channel - UART_FRAMING_CHANNEL_SPP_PORT),
+							Length, Payload)))
+				UARTFramingInfo.FramesDropped++;
+			break;
+		}
+		break;
+	default:
+		UARTFramingInfo.FramesDropped++;
+		break;
+	}
+}
+
+/* The following function is a utility function which is used to read*/
+/* and decode all of the frames that have been received on the UART. */
+static void ProcessUARTFrames(void) {
+	Byte_t Buffer[16];
+	Byte_t Character;
+	int Length;
+	int Index;
+
+	while ((Length = HAL_ConsoleRead(sizeof(Buffer), (char *) Buffer)) > 0) {
+		for (Index = 0; Index < Length; Index++) {
+			Character = Buffer[Index];
+
+			if (Character == UART_FRAMING_SLIP_END) {
+				/* Dispatch the frame unless it was empty or too long.      */
+				if ((UARTFramingInfo.RxFrameLength)
+						&& (!UARTFramingInfo.RxOverflow)
+						&& (!UARTFramingInfo.RxEscape))
+					ProcessUARTFrame();
+				else if (UARTFramingInfo.RxOverflow)
+					UARTFramingInfo.FramesDropped++;
+
+				UARTFramingInfo.RxFrameLength = 0;
+				UARTFramingInfo.RxOverflow = FALSE;
+				UARTFramingInfo.RxEscape = FALSE;
+			} else if (Character == UART_FRAMING_SLIP_ESC)
+				UARTFramingInfo.RxEscape = TRUE;
+			else {
+				if (UARTFramingInfo.RxEscape) {
+					if (Character == UART_FRAMING_SLIP_ESC_END)
+						Character = UART_FRAMING_SLIP_END;
+					else if (Character == UART_FRAMING_SLIP_ESC_ESC)
+						Character = UART_FRAMING_SLIP_ESC;
+					else
+						UARTFramingInfo.RxOverflow = TRUE;
+
+					UARTFramingInfo.RxEscape = FALSE;
+				}
+
+				if (UARTFramingInfo.RxFrameLength
+						< sizeof(UARTFramingInfo.RxFrame))
+					UARTFramingInfo.RxFrame[UARTFramingInfo.RxFrameLength++] =
+							Character;
+				else
+					UARTFramingInfo.RxOverflow = TRUE;
+			}
+		}
+	}
+
+	/* Return any credits that were used.                                */
+	UpdateUARTFrameCredits();
+}
+
+/* The following function is a utility function which is used to send*/
+/* the buffered log characters to the host in a log frame.  The log  */
+/* is discarded if the host has not granted a credit or the UART is  */
+/* full.                                                             */
+static void FlushFramedLog(void) {
+	if (UARTFramingInfo.LogLength) {
+		if ((!UARTFramingInfo.TxCredits[UART_FRAMING_CHANNEL_LOG])
+				|| (HAL_ConsoleWriteSpace()
+						< UART_FRAMING_ENCODED_SIZE(UARTFramingInfo.LogLength))
+				|| (SendUARTFrameData(UART_FRAMING_CHANNEL_LOG,
+						UARTFramingInfo.LogLength, UARTFramingInfo.LogBuffer)
+						!= UARTFramingInfo.LogLength))
+			UARTFramingInfo.LogBytesDropped += UARTFramingInfo.LogLength;
+
+		UARTFramingInfo.LogLength = 0;
+	}
+}
+
+/* The following function is a utility function which is used to     */
+/* calculate the checksum of the specified settings.                 */
+static Word_t CalculateSettingsChecksum(ApplicationSettings_t *Settings) {
+	Word_t ret_val;
+	Byte_t *Data;
+	unsigned int Index;
+
+	ret_val = 0;
+	Data = (Byte_t *) Settings;
+
+	for (Index = 0; Index < BTPS_STRUCTURE_OFFSET(ApplicationSettings_t, Checksum);
+			Index++)
+		ret_val = (Word_t) ((ret_val << 1) + (ret_val >> 15) + Data[Index]);
+
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to load*/
+/* the compiled in default settings.                                 */
+static void LoadDefaultSettings(void) {
+	BTPS_MemInitialize(&ApplicationSettings, 0, sizeof(ApplicationSettings));
+
+	ApplicationSettings.Signature = APPLICATION_SETTINGS_SIGNATURE;
+	ApplicationSettings.AdvertisingIntervalMin =
+			ADVERTISING_INTERVAL_MINIMUM_DEFAULT;
+	ApplicationSettings.AdvertisingIntervalMax =
+			ADVERTISING_INTERVAL_MAXIMUM_DEFAULT;
+	ApplicationSettings.SlowAdvertisingIntervalMin =
+			ADVERTISING_SLOW_INTERVAL_MINIMUM_DEFAULT;
+	ApplicationSettings.SlowAdvertisingIntervalMax =
+			ADVERTISING_SLOW_INTERVAL_MAXIMUM_DEFAULT;
+	ApplicationSettings.HCILLInactivityTimeout = HCILL_MODE_INACTIVITY_TIMEOUT;
+	ApplicationSettings.HCILLRetransmitTimeout = HCILL_MODE_RETRANSMIT_TIMEOUT;
+	ApplicationSettings.RealTimeDeadline = REALTIME_DEFAULT_DEADLINE;
+	ApplicationSettings.ConsoleBaudRate = BT_DEBUG_UART_BAUDRATE;
+	ApplicationSettings.SPPPortNumber = SPP_PORT_NUMBER;
+	ApplicationSettings.SPPAdditionalPorts = SPP_DEFAULT_ADDITIONAL_PORTS;
+	ApplicationSettings.UARTFraming = UART_FRAMING_DEFAULT_ENABLED;
+	ApplicationSettings.BridgePolicy = BRIDGE_POLICY_SPP_PRIMARY;
+	ApplicationSettings.LEProfile = LE_PROFILE_AUTOMATIC;
+	ApplicationSettings.SniffIdleTime = SNIFF_DEFAULT_IDLE_TIME;
+	ApplicationSettings.SPPProfile = SPP_PROFILE_BALANCED;
+	ApplicationSettings.TracePeriod = TRACE_DEFAULT_PERIOD;
+	ApplicationSettings.FastAdvertisingTime = ADVERTISING_FAST_TIME_DEFAULT;
+
+	BTPS_StringCopy(ApplicationSettings.DeviceName, LE_DEMO_DEVICE_NAME);
+}
+
+/* The following function is a utility function which is used to load*/
+/* the settings saved in flash, the default settings are used if no  */
+/* valid settings have been saved.                                   */
+static void LoadSettings(void) {
+	ApplicationSettings_t *SavedSettings;
+
+	SavedSettings = (ApplicationSettings_t *) APPLICATION_SETTINGS_SEGMENT;
+
+	if ((SavedSettings->Signature == APPLICATION_SETTINGS_SIGNATURE)
+			&& (SavedSettings->Checksum
+					== CalculateSettingsChecksum(SavedSettings))) {
+		BTPS_MemCopy(&ApplicationSettings, SavedSettings,
+				APPLICATION_SETTINGS_SIZE);
+
+		/* Make sure the name is terminated.                              */
+		ApplicationSettings.DeviceName[MAXIMUM_DEVICE_NAME_LENGTH] = '\0';
+	} else
+		LoadDefaultSettings();
+}
+
+/* The following function is a utility function which is used to save*/
+/* the current settings in flash.  This function returns zero if     */
+/* successful or a negative value if there was an error.             */
+/* * NOTE * The CPU is held while the flash is erased, so the        */
+/*          settings can only be saved while there are no Bluetooth  */
+/*          connections.                                             */
+static int SaveSettings(void) {
+	int ret_val;
+
+	if (!(ApplicationStateInfo.Flags
+			& (APPLICATION_STATE_INFO_FLAGS_LE_CONNECTED
+					| APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED))) {
+		ApplicationSettings.Checksum = CalculateSettingsChecksum(
+				&ApplicationSettings);
+
+		if ((!(ret_val = HAL_FlashEraseSegment(APPLICATION_SETTINGS_SEGMENT)))
+				&& (!(ret_val = HAL_FlashWrite(APPLICATION_SETTINGS_SEGMENT,
+						APPLICATION_SETTINGS_SIZE, &ApplicationSettings)))) {
+			/* Make sure the settings were written correctly.              */
+			if (BTPS_MemCompare(APPLICATION_SETTINGS_SEGMENT,
+					&ApplicationSettings, APPLICATION_SETTINGS_SIZE))
+				ret_val = FUNCTION_ERROR;
+		}
+	} else
+		ret_val = FUNCTION_ERROR;
+
+	return (ret_val);
+}
+
+/* The following function is a utility function which is used to     */
+/* apply a change of the device name.  Nothing is written to the     */
+/* controller if the name has not changed.                           */
+static void ApplyDeviceName(void) {
+	if ((ApplicationStateInfo.BluetoothStackID) && (BuildAdvertisingData())) {
+		if (ApplicationStateInfo.GAPSInstanceID)
+			GAPS_Set_Device_Name(ApplicationStateInfo.BluetoothStackID,
+					ApplicationStateInfo.GAPSInstanceID,
+					ApplicationSettings.DeviceName);
+
+		FormatEIRData(ApplicationStateInfo.BluetoothStackID);
+		FormatAdvertisingData(ApplicationStateInfo.BluetoothStackID,
+				!(ApplicationStateInfo.Flags
+						& APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED));
+	}
+}
+
+/* The following function is a utility function which is used to     */
+/* re-open the Serial Port Server on the configured port.  This      */
+/* function returns zero if successful or a negative value if there  */
+/* was an error.                                                     */
+static int ReopenSPPServer(void) {
+	int ret_val;
+
+	if ((ApplicationStateInfo.BluetoothStackID)
+			&& (!(ApplicationStateInfo.Flags
+					& APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED))) {
+		/* The additional ports follow the bridge port.                   */
+		SPPClosePorts();
+
+		if (ApplicationStateInfo.SPPServerPortID) {
+			SPP_Un_Register_SDP_Record(ApplicationStateInfo.BluetoothStackID,
+					ApplicationStateInfo.SPPServerPortID,
+					ApplicationStateInfo.SPPServerSDPHandle);
+
+			SPP_Close_Server_Port(ApplicationStateInfo.BluetoothStackID,
+					ApplicationStateInfo.SPPServerPortID);
+
+			ApplicationStateInfo.SPPServerPortID = 0;
+		}
+
+		ret_val = SPPOpenServer(ApplicationStateInfo.BluetoothStackID);
+	} else
+		ret_val = FUNCTION_ERROR;
+
+	return (ret_val);
+}
+
+/* The following function is used to enter or leave command mode on  */
+/* the raw UART.                                                     */
+static void SetCommandMode(Boolean_t Enable) {
+	ControlInfo.CommandMode = Enable;
+	ControlInfo.CommandLength = 0;
+	ControlInfo.EscapeLength = 0;
+
+	/* Commands are processed a line at a time.                          */
+	HAL_ConsoleSetNotifyCharacter((unsigned char) (Enable ? '\r' : 0xFF));
+
+	UpdateWiredFlowHold();
+
+	if (Enable) {
+		AddControlResponse("OK\r\n");
+		WriteControlResponse();
+	} else {
+		/* The test data would be mixed with the UART data so any test is */
+		/* stopped.                                                       */
+		SPPTestInfo.Mode = SPP_TEST_MODE_OFF;
+
+		/* Resume delivering any SPP data that was left queued.           */
+		PostApplicationMailbox(APPLICATION_MAILBOX_MESSAGE_ID_SPP_DATA);
+	}
+}
+
+/* The following function is a utility function which is used to     */
+/* parse the comma separated numeric values of a set command (of the */
+/* form =<value>[,<value>]).  This function returns TRUE if exactly  */
+/* NumberValues values were parsed.                                  */
+static Boolean_t ParseControlValues(char *Parameter, unsigned int NumberValues,
+		unsigned long *Values) {
+	char *End;
+	unsigned int Index;
+
+	if (*Parameter != '=')
+		return (FALSE);
+
+	for (Index = 0; Index < NumberValues; Index++) {
+		Parameter++;
+
+		Values[Index] = strtoul(Parameter, &End, 0);
+
+		/* Make sure a number was present and it is followed by the next  */
+		/* separator (or the end of the line for the last value).         */
+		if ((End == Parameter)
+				|| (*End != ((Index == (NumberValues - 1)) ? '\0' : ',')))
+			return (FALSE);
+
+		Parameter = End;
+	}
+
+	return (TRUE);
+}
+
+/* The following function is a utility function which is used to     */
+/* append text to the response to the current command.  Text that    */
+/* does not fit is discarded.                                        */
+static void AddControlResponse(char *Response) {
+	unsigned int Length;
+
+	Length = BTPS_StringLength(Response);
+
+	if (Length
+			> (CONTROL_RESPONSE_BUFFER_SIZE - ControlInfo.ResponseLength))
+		Length = CONTROL_RESPONSE_BUFFER_SIZE - ControlInfo.ResponseLength;
+
+	BTPS_MemCopy(&(ControlInfo.ResponseBuffer[ControlInfo.ResponseLength]),
+			Response, Length);
+
+	ControlInfo.ResponseLength += Length;
+}
+
+/* The following function is a utility function which is used to     */
+/* send the response to the current command, either on the control   */
+/* channel or directly to the UART.  This function waits for the     */
+/* UART to take the whole response so that multi-line responses are  */
+/* not lost, but for no longer than CONTROL_RESPONSE_TIMEOUT (and    */
+/* not at all while an earlier response is stalled).  Whatever does  */
+/* not fit is dropped.                                               */
+static void WriteControlResponse(void) {
+	unsigned int Index;
+	unsigned int Count;
+	unsigned long StartTick;
+
+	StartTick = BTPS_GetTickCount();
+
+	for (Index = 0; Index < ControlInfo.ResponseLength; Index += Count) {
+		Count = ControlInfo.ResponseLength - Index;
+
+		if (UARTFramingInfo.Enabled) {
+			if (Count > UART_FRAMING_MAXIMUM_PAYLOAD)
+				Count = UART_FRAMING_MAXIMUM_PAYLOAD;
+
+			/* Only whole frames are written.                              */
+			if (HAL_ConsoleWriteSpace() >= UART_FRAMING_ENCODED_SIZE(Count))
+				WriteUARTFrame(
+						(Byte_t) (UART_FRAMING_TYPE_DATA
+								| UART_FRAMING_CHANNEL_CONTROL), Count,
+						(Byte_t *) &(ControlInfo.ResponseBuffer[Index]));
+			else
+				Count = 0;
+		} else
+			Count = (unsigned int) HAL_ConsoleWriteNonBlocking(Count,
+					&(ControlInfo.ResponseBuffer[Index]));
+
+		/* Give up on the response if the host is not reading.            */
+		if ((!Count)
+				&& ((ControlInfo.ResponseStalled)
+						|| ((BTPS_GetTickCount() - StartTick)
+								>= CONTROL_RESPONSE_TIMEOUT))) {
+			ControlInfo.ResponseStalled = TRUE;
+			break;
+		}
+	}
+
+	if (Index >= ControlInfo.ResponseLength)
+		ControlInfo.ResponseStalled = FALSE;
+
+	ControlInfo.ResponseLength = 0;
+}
+
+/* The following function is used to execute the command held in the */
+/* command buffer and send the response.                             */
+static void ExecuteControlCommand(void) {
+	int Result;
+	char *Command;
+	unsigned int Index;
+	unsigned int Length;
+
+	ControlInfo.CommandBuffer[ControlInfo.CommandLength] = '\0';
+	ControlInfo.ResponseLength = 0;
+	ControlInfo.PendingActions = 0;
+
+	/* Ignore empty lines (for example the line feed of a CR/LF).        */
+	if (!ControlInfo.CommandLength)
+		return;
+
+	Command = ControlInfo.CommandBuffer;
+	Result = FUNCTION_ERROR;
+
+	if ((ControlInfo.CommandLength >= 2)
+			&& (!BTPS_MemCompareI(Command, "AT", 2))) {
+		Command += 2;
+
+		if (*Command) {
+			/* Search for the command, which must be followed by a query,  */
+			/* a set or the end of the line.                               */
+			for (Index = 0; Index < NUMBER_CONTROL_COMMANDS; Index++) {
+				Length = BTPS_StringLength(ControlCommandTable[Index].Name);
+
+				if ((!BTPS_MemCompareI(Command, ControlCommandTable[Index].Name,
+						Length))
+						&& ((Command[Length] == '\0') || (Command[Length] == '?')
+								|| (Command[Length] == '='))) {
+					Result = (*ControlCommandTable[Index].Function)(
+							&(Command[Length]));
+					break;
+				}
+			}
+		} else
+			Result = 0;
+	}
+
+	AddControlResponse((char *) ((Result < 0) ? "ERROR\r\n" : "OK\r\n"));
+	WriteControlResponse();
+
+	/* Now that the response has been queued perform any action that     */
+	/* would prevent it from being sent.                                 */
+	if (ControlInfo.PendingActions & CONTROL_PENDING_BAUD_RATE) {
+		if (HAL_ConsoleSetBaudRate(ApplicationSettings.ConsoleBaudRate))
+			ApplicationSettings.ConsoleBaudRate = HAL_ConsoleGetBaudRate();
+	}
+
+	if (ControlInfo.PendingActions & CONTROL_PENDING_FRAMING) {
+		if (ControlInfo.CommandMode)
+			SetCommandMode(FALSE);
+
+		SetUARTFraming((Boolean_t) ApplicationSettings.UARTFraming);
+	}
+
+	if (ControlInfo.PendingActions & CONTROL_PENDING_RESET) {
+		/* Give the response time to be sent.                             */
+		BTPS_Delay(CONTROL_RESET_DELAY);
+
+		HAL_Reset();
+	}
+}
+
+/* The following function is a utility function which is used to     */
+/* collect command mode input from the raw UART and execute each     */
+/* command once its carriage return is received.                     */
+static void ProcessControlInput(void) {
+	char Character;
+
+	while ((ControlInfo.CommandMode)
+			&& (HAL_ConsoleRead(1, &Character) == 1)) {
+		if ((Character == '\r') || (Character == '\n')) {
+			if (ControlInfo.CommandLength <= CONTROL_COMMAND_BUFFER_SIZE - 1)
+				ExecuteControlCommand();
+			else {
+				AddControlResponse("ERROR\r\n");
+				WriteControlResponse();
+			}
+
+			ControlInfo.CommandLength = 0;
+		} else {
+			/* Keep counting past the end of the buffer so that a command  */
+			/* that is too long is rejected.                               */
+			if (ControlInfo.CommandLength < CONTROL_COMMAND_BUFFER_SIZE - 1)
+				ControlInfo.CommandBuffer[ControlInfo.CommandLength] =
+						Character;
+
+			if (ControlInfo.CommandLength < CONTROL_COMMAND_BUFFER_SIZE)
+				ControlInfo.CommandLength++;
+		}
+	}
+}
+
+/* The following function implements the ATO command, which returns  */
+/* the raw UART to data mode.                                        */
+static int ControlDataMode(char *Parameter) {
+	if (*Parameter)
+		return (FUNCTION_ERROR);
+
+	if (ControlInfo.CommandMode)
+		SetCommandMode(FALSE);
+
+	return (0);
+}
+
+/* The following function implements the ATZ command.                */
+static int ControlReset(char *Parameter) {
+	if (*Parameter)
+		return (FUNCTION_ERROR);
+
+	ControlInfo.PendingActions |= CONTROL_PENDING_RESET;
+
+	return (0);
+}
+
+/* The following function implements the AT&W command.               */
+static int ControlSaveSettings(char *Parameter) {
+	if (*Parameter)
+		return (FUNCTION_ERROR);
+
+	return (SaveSettings());
+}
+
+/* The following function implements the AT&F command.  The defaults */
+/* are applied in the same way as if each setting had been changed.  */
+static int ControlFactoryDefaults(char *Parameter) {
+	ApplicationSettings_t PreviousSettings;
+
+	if (*Parameter)
+		return (FUNCTION_ERROR);
+
+	BTPS_MemCopy(&PreviousSettings, &ApplicationSettings,
+			sizeof(PreviousSettings));
+
+	LoadDefaultSettings();
+
+	ApplyDeviceName();
+
+	if (ApplicationStateInfo.BluetoothStackID)
+		HCILL_Configure(ApplicationStateInfo.BluetoothStackID,
+				ApplicationSettings.HCILLInactivityTimeout,
+				ApplicationSettings.HCILLRetransmitTimeout, TRUE);
+
+	/* The port can only be changed while SPP is not connected.          */
+	if (ApplicationSettings.SPPPortNumber != PreviousSettings.SPPPortNumber) {
+		if (ReopenSPPServer())
+			ApplicationSettings.SPPPortNumber = PreviousSettings.SPPPortNumber;
+	} else if ((ApplicationSettings.SPPAdditionalPorts
+			!= PreviousSettings.SPPAdditionalPorts)
+			&& (ApplicationStateInfo.SPPServerPortID)) {
+		SPPClosePorts();
+		SPPOpenPorts(ApplicationStateInfo.BluetoothStackID);
+	}
+
+	if (ApplicationSettings.ConsoleBaudRate != PreviousSettings.ConsoleBaudRate)
+		ControlInfo.PendingActions |= CONTROL_PENDING_BAUD_RATE;
+
+	if (ApplicationSettings.UARTFraming != PreviousSettings.UARTFraming)
+		ControlInfo.PendingActions |= CONTROL_PENDING_FRAMING;
+
+	return (0);
+}
+
+/* The following function implements the AT+PORT command.            */
+static int ControlPort(char *Parameter) {
+	int ret_val;
+	Byte_t PreviousPortNumber;
+	unsigned long Value;
+	char Response[16];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		BTPS_SprintF(Response, "+PORT:%u\r\n",
+				(unsigned int) ApplicationSettings.SPPPortNumber);
+		AddControlResponse(Response);
+
+		ret_val = 0;
+	} else {
+		if ((ParseControlValues(Parameter, 1, &Value))
+				&& (Value >= SPP_PORT_NUMBER_MINIMUM)
+				&& (Value <= SPP_PORT_NUMBER_MAXIMUM)) {
+			PreviousPortNumber = ApplicationSettings.SPPPortNumber;
+
+			ApplicationSettings.SPPPortNumber = (Byte_t) Value;
+
+			if ((ret_val = ReopenSPPServer()) != 0) {
+				ApplicationSettings.SPPPortNumber = PreviousPortNumber;
+
+				/* Make sure the previous server is still available.        */
+				if (!ApplicationStateInfo.SPPServerPortID)
+					ReopenSPPServer();
+			}
+		} else
+			ret_val = INVALID_PARAMETERS_ERROR;
+	}
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+NAME command.            */
+static int ControlName(char *Parameter) {
+	int ret_val;
+	unsigned int Length;
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		AddControlResponse("+NAME:");
+		AddControlResponse(ApplicationSettings.DeviceName);
+		AddControlResponse("\r\n");
+
+		ret_val = 0;
+	} else {
+		Length = BTPS_StringLength(Parameter);
+
+		if ((*Parameter == '=') && (Length > 1)
+				&& (Length <= (MAXIMUM_DEVICE_NAME_LENGTH + 1))) {
+			BTPS_StringCopy(ApplicationSettings.DeviceName, &(Parameter[1]));
+
+			ApplyDeviceName();
+
+			ret_val = 0;
+		} else
+			ret_val = INVALID_PARAMETERS_ERROR;
+	}
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+ADV command.             */
+static int ControlAdvertising(char *Parameter) {
+	int ret_val;
+	unsigned long Values[2];
+	char Response[24];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		BTPS_SprintF(Response, "+ADV:%u,%u\r\n",
+				ApplicationSettings.AdvertisingIntervalMin,
+				ApplicationSettings.AdvertisingIntervalMax);
+		AddControlResponse(Response);
+
+		ret_val = 0;
+	} else {
+		if ((ParseControlValues(Parameter, 2, Values))
+				&& (Values[0] >= ADVERTISING_INTERVAL_LOWER_LIMIT)
+				&& (Values[0] <= Values[1])
+				&& (Values[1] <= ADVERTISING_INTERVAL_UPPER_LIMIT)) {
+			ApplicationSettings.AdvertisingIntervalMin = (Word_t) Values[0];
+			ApplicationSettings.AdvertisingIntervalMax = (Word_t) Values[1];
+
+			ret_val = 0;
+		} else
+			ret_val = INVALID_PARAMETERS_ERROR;
+	}
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+ADVSLOW command.  The    */
+/* parameters are the slow advertising intervals and the number of   */
+/* seconds the fast intervals (AT+ADV) are used for, both are used   */
+/* the next time advertising starts.                                 */
+static int ControlSlowAdvertising(char *Parameter) {
+	int ret_val;
+	unsigned long Values[3];
+	char Response[32];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		BTPS_SprintF(Response, "+ADVSLOW:%u,%u,%u\r\n",
+				ApplicationSettings.SlowAdvertisingIntervalMin,
+				ApplicationSettings.SlowAdvertisingIntervalMax,
+				(unsigned int) ApplicationSettings.FastAdvertisingTime);
+		AddControlResponse(Response);
+
+		ret_val = 0;
+	} else {
+		if ((ParseControlValues(Parameter, 3, Values))
+				&& (Values[0] >= ADVERTISING_INTERVAL_LOWER_LIMIT)
+				&& (Values[0] <= Values[1])
+				&& (Values[1] <= ADVERTISING_INTERVAL_UPPER_LIMIT)
+				&& (Values[2] <= ADVERTISING_FAST_TIME_LIMIT)) {
+			ApplicationSettings.SlowAdvertisingIntervalMin = (Word_t) Values[0];
+			ApplicationSettings.SlowAdvertisingIntervalMax = (Word_t) Values[1];
+			ApplicationSettings.FastAdvertisingTime = (Byte_t) Values[2];
+
+			ret_val = 0;
+		} else
+			ret_val = INVALID_PARAMETERS_ERROR;
+	}
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+HCILL command.           */
+static int ControlHCILL(char *Parameter) {
+	int ret_val;
+	unsigned long Values[2];
+	char Response[24];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		BTPS_SprintF(Response, "+HCILL:%u,%u\r\n",
+				ApplicationSettings.HCILLInactivityTimeout,
+				ApplicationSettings.HCILLRetransmitTimeout);
+		AddControlResponse(Response);
+
+		ret_val = 0;
+	} else {
+		if ((ParseControlValues(Parameter, 2, Values)) && (Values[0])
+				&& (Values[0] <= 0xFFFF) && (Values[1])
+				&& (Values[1] <= 0xFFFF)) {
+			if ((ret_val = HCILL_Configure(ApplicationStateInfo.BluetoothStackID,
+					(Word_t) Values[0], (Word_t) Values[1], TRUE)) == 0) {
+				ApplicationSettings.HCILLInactivityTimeout = (Word_t) Values[0];
+				ApplicationSettings.HCILLRetransmitTimeout = (Word_t) Values[1];
+			}
+		} else
+			ret_val = INVALID_PARAMETERS_ERROR;
+	}
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+BAUD command.            */
+static int ControlBaudRate(char *Parameter) {
+	int ret_val;
+	unsigned long Value;
+	char Response[20];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		BTPS_SprintF(Response, "+BAUD:%lu\r\n",
+				ApplicationSettings.ConsoleBaudRate);
+		AddControlResponse(Response);
+
+		ret_val = 0;
+	} else {
+		/* The HAL validates the baud rate when it is applied, a rate     */
+		/* that can not be used leaves the current rate in place.         */
+		if ((ParseControlValues(Parameter, 1, &Value)) && (Value)) {
+			ApplicationSettings.ConsoleBaudRate = Value;
+
+			ControlInfo.PendingActions |= CONTROL_PENDING_BAUD_RATE;
+
+			ret_val = 0;
+		} else
+			ret_val = INVALID_PARAMETERS_ERROR;
+	}
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+FRAMING command.         */
+static int ControlFraming(char *Parameter) {
+	int ret_val;
+	unsigned long Value;
+	char Response[16];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		BTPS_SprintF(Response, "+FRAMING:%u\r\n",
+				(unsigned int) ApplicationSettings.UARTFraming);
+		AddControlResponse(Response);
+
+		ret_val = 0;
+	} else {
+		if ((ParseControlValues(Parameter, 1, &Value)) && (Value <= 1)) {
+			ApplicationSettings.UARTFraming = (Byte_t) Value;
+
+			if ((Boolean_t) Value != UARTFramingInfo.Enabled)
+				ControlInfo.PendingActions |= CONTROL_PENDING_FRAMING;
+
+			ret_val = 0;
+		} else
+			ret_val = INVALID_PARAMETERS_ERROR;
+	}
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+STAT command.  One line  */
+/* is sent for each group of counters so that the response buffer    */
+/* only ever needs to hold a single line.                            */
+static int ControlStatistics(char *Parameter) {
+	unsigned int Index;
+	unsigned int Length;
+	unsigned int Interval;
+	DWord_t LevelTime;
+	DWord_t AdvertisingTime;
+	DWord_t ConnectTime;
+	AdvertisingStatistics_t *Statistics;
+	char Response[CONTROL_RESPONSE_BUFFER_SIZE - 8];
+
+	if (BTPS_MemCompare(Parameter, "?", 2))
+		return (FUNCTION_ERROR);
+
+	BTPS_SprintF(Response, "+STAT:UART,%lu,%lu,%lu,%lu,%lu\r\n",
+			HAL_ConsoleGetDroppedBytes(), UARTFramingInfo.FramesReceived,
+			UARTFramingInfo.FramesSent, UARTFramingInfo.FramesDropped,
+			UARTFramingInfo.LogBytesDropped);
+	AddControlResponse(Response);
+	WriteControlResponse();
+
+	BTPS_SprintF(Response, "+STAT:LE,%u,%lu,%lu,%lu,%lu,%lu\r\n",
+			(unsigned int) SerialServiceInfo.PayloadSize,
+			SerialServiceInfo.NotificationsSent,
+			SerialServiceInfo.BytesReceived, SerialServiceInfo.BytesDropped,
+			LEProfileInfo.UpdatesRequested, LEProfileInfo.UpdatesRejected);
+	AddControlResponse(Response);
+	WriteControlResponse();
+
+	if (ApplicationStateInfo.Flags & APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED)
+		UpdateSniffTime();
+
+	BTPS_SprintF(Response, "+STAT:SPP,%lu,%lu,%lu\r\n",
+			SPPTestInfo.PartialWrites, SPPTestInfo.BufferFullStalls,
+			SPPTestInfo.PatternErrors);
+	AddControlResponse(Response);
+	WriteControlResponse();
+
+	BTPS_SprintF(Response, "+STAT:SNIFF,%lu,%lu,%lu\r\n",
+			SniffInfo.ActiveTime, SniffInfo.SniffTime, SniffInfo.SniffEntries);
+	AddControlResponse(Response);
+	WriteControlResponse();
+
+	BTPS_SprintF(Response, "+STAT:REALTIME,%lu,%lu\r\n",
+			RealTimeInfo.BytesDropped, RealTimeInfo.Drops);
+	AddControlResponse(Response);
+	WriteControlResponse();
+
+	/* Report the packet types of the BR/EDR link followed by the time   */
+	/* spent (in seconds) and the transmit goodput (in bytes per second) */
+	/* at each level.                                                    */
+	BTPS_SprintF(Response, "+STAT:LINK,%s,0x%04X,%d,%lu,%lu,%lu\r\n",
+			LinkPacketTypes[LinkInfo.Level].Name, LinkInfo.PacketType,
+			(int) LinkInfo.RSSI, LinkInfo.FailedContacts, LinkInfo.Downgrades,
+			LinkInfo.Upgrades);
+	AddControlResponse(Response);
+	WriteControlResponse();
+
+	for (Index = 0; Index < NUMBER_LINK_PACKET_LEVELS; Index++) {
+		LevelTime = LinkInfo.LevelTime[Index];
+		if ((Index == LinkInfo.Level)
+				&& (ApplicationStateInfo.Flags
+						& APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED))
+			LevelTime += BTPS_GetTickCount() - LinkInfo.LevelStartTick;
+
+		/* The goodput is taken over whole seconds, scaling the bytes by  */
+		/* 1000 would overflow after about 4MB.                           */
+		LevelTime /= 1000;
+
+		BTPS_SprintF(Response, "+STAT:PACKETS,%s,%lu,%lu\r\n",
+				LinkPacketTypes[Index].Name, LevelTime,
+				(LevelTime) ? (LinkInfo.TransmitBytes[Index] / LevelTime) : 0);
+		AddControlResponse(Response);
+		WriteControlResponse();
+	}
+
+	BTPS_SprintF(Response, "+STAT:BOND,%lu,%lu,%lu\r\n",
+			BondStoreInfo.RecordsWritten, BondStoreInfo.SegmentErases,
+			BondStoreInfo.WriteErrors);
+	AddControlResponse(Response);
+	WriteControlResponse();
+
+	/* Report the LTK requests answered from the cache and by            */
+	/* regenerating the key, with the average time (in milliseconds) to  */
+	/* set up the encryption for each.                                   */
+	BTPS_SprintF(Response, "+STAT:LTK,%lu,%lu,%lu,%lu\r\n",
+			LTKCacheInfo.Requests[LTK_SOURCE_CACHE],
+			LTKCacheInfo.Requests[LTK_SOURCE_REGENERATED],
+			(LTKCacheInfo.SetupCount[LTK_SOURCE_CACHE]) ?
+					(LTKCacheInfo.SetupTime[LTK_SOURCE_CACHE]
+							/ LTKCacheInfo.SetupCount[LTK_SOURCE_CACHE]) :
+					0,
+			(LTKCacheInfo.SetupCount[LTK_SOURCE_REGENERATED]) ?
+					(LTKCacheInfo.SetupTime[LTK_SOURCE_REGENERATED]
+							/ LTKCacheInfo.SetupCount[LTK_SOURCE_REGENERATED]) :
+					0);
+	AddControlResponse(Response);
+	WriteControlResponse();
+
+	/* Report the private addresses found in the RPA cache, resolved     */
+	/* with the IRKs, not resolved and that replaced a previous address  */
+	/* of the same device.                                               */
+	BTPS_SprintF(Response, "+STAT:RPA,%lu,%lu,%lu,%lu\r\n",
+			RPACacheInfo.Hits, RPACacheInfo.Resolved, RPACacheInfo.Unresolved,
+			RPACacheInfo.Rotations);
+	AddControlResponse(Response);
+	WriteControlResponse();
+
+	BTPS_SprintF(Response, "+STAT:RECONNECT,%u,%lu,%lu,%lu,%lu\r\n",
+			(unsigned int) ReconnectInfo.LastPhase, ReconnectInfo.LastTime,
+			ReconnectInfo.Connections[RECONNECT_PHASE_DIRECTED],
+			ReconnectInfo.Connections[RECONNECT_PHASE_WHITE_LIST],
+			ReconnectInfo.Connections[RECONNECT_PHASE_NORMAL]);
+	AddControlResponse(Response);
+	WriteControlResponse();
+
+	/* Report the time (in milliseconds) from the start of opening the   */
+	/* stack to the first advertising, followed by the time taken by the */
+	/* stack initialization and by each of the steps that follow it.     */
+	Length = BTPS_SprintF(Response, "+STAT:BOOT,%lu,%lu",
+			BootInfo.AdvertisingTime, BootInfo.InitializeTime);
+	for (Index = 0; Index < NUMBER_OPEN_STACK_STEPS; Index++)
+		Length += BTPS_SprintF(&(Response[Length]), ",%lu",
+				BootInfo.StepTime[Index]);
+
+	BTPS_SprintF(&(Response[Length]), "\r\n");
+	AddControlResponse(Response);
+	WriteControlResponse();
+
+	/* Report the boot timeline, in milliseconds from the start of the   */
+	/* system timer: the opening of the stack, the controller released   */
+	/* from reset, the controller ready, the stack initialized and the   */
+	/* first advertising.                                                */
+	BTPS_SprintF(Response, "+STAT:BOOTTIME,%lu,%lu,%lu,%lu,%lu\r\n",
+			BootInfo.StartTick,
+			HAL_GetBootStamp(HAL_BOOT_STAGE_CONTROLLER_RESET),
+			HAL_GetBootStamp(HAL_BOOT_STAGE_CONTROLLER_READY),
+			BootInfo.StartTick + BootInfo.InitializeTime,
+			(BootInfo.AdvertisingTime) ?
+					(BootInfo.StartTick + BootInfo.AdvertisingTime) : 0);
+	AddControlResponse(Response);
+	WriteControlResponse();
+
+	/* Report the time (in milliseconds) taken by the Patch RAM download */
+	/* followed by the time taken by each of its phases: setting the     */
+	/* download baud rate, the Base Patch, the LE Patch and restoring    */
+	/* the HCI baud rate.                                                */
+	/* A stage that was not reached is reported as zero.                 */
+	Length = BTPS_SprintF(Response, "+STAT:PATCH,%lu",
+			GetBootStageTime(HAL_BOOT_STAGE_PATCH_START,
+					HAL_BOOT_STAGE_PATCH_COMPLETE));
+	for (Index = HAL_BOOT_STAGE_PATCH_START;
+			Index < HAL_BOOT_STAGE_PATCH_COMPLETE; Index++)
+		Length += BTPS_SprintF(&(Response[Length]), ",%lu",
+				GetBootStageTime(Index, Index + 1));
+
+	BTPS_SprintF(&(Response[Length]), "\r\n");
+	AddControlResponse(Response);
+	WriteControlResponse();
+
+	/* Report each advertising configuration with the time spent in it   */
+	/* (in seconds), the average time to connect (in milliseconds) and   */
+	/* the estimated average current (in uA).  The estimate divides the  */
+	/* charge of an event (nC) by the mean of the intervals plus the     */
+	/* mean random advertising delay of 5ms (both in ms, so nC/ms = uA). */
+	for (Index = 0; Index < NUMBER_ADVERTISING_CONFIGS; Index++) {
+		Statistics = &(AdvertisingInfo.Statistics[Index]);
+
+		AdvertisingTime = Statistics->AdvertisingTime;
+		if ((AdvertisingInfo.Active) && (AdvertisingInfo.Config == Index))
+			AdvertisingTime += BTPS_GetTickCount()
+					- AdvertisingInfo.ConfigStartTick;
+
+		ConnectTime =
+				(Statistics->Connections) ?
+						(Statistics->ConnectTime / Statistics->Connections) : 0;
+
+		if (Index == ADVERTISING_CONFIG_SLOW)
+			Interval = (ApplicationSettings.SlowAdvertisingIntervalMin
+					+ ApplicationSettings.SlowAdvertisingIntervalMax) / 2;
+		else
+			Interval = (ApplicationSettings.AdvertisingIntervalMin
+					+ ApplicationSettings.AdvertisingIntervalMax) / 2;
+
+		BTPS_SprintF(Response, "+STAT:ADV,%s,%lu,%lu,%lu,%lu\r\n",
+				(Index == ADVERTISING_CONFIG_SLOW) ? "SLOW" : "FAST",
+				AdvertisingTime / 1000, Statistics->Connections, ConnectTime,
+				(unsigned long) ADVERTISING_EVENT_CHARGE
+						/ ((unsigned long) Interval + 5));
+		AddControlResponse(Response);
+		WriteControlResponse();
+	}
+
+	return (0);
+}
+
+/* The following function implements the AT+LEPROFILE command.  The  */
+/* profile is given by name, or AUTO to select it from the traffic.  */
+/* The query also reports the parameters of the current connection.  */
+static int ControlLEProfile(char *Parameter) {
+	int ret_val;
+	unsigned int Index;
+	char Response[64];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		BTPS_SprintF(Response, "+LEPROFILE:%s,%s,%u,%u,%u\r\n",
+				(ApplicationSettings.LEProfile == LE_PROFILE_AUTOMATIC) ?
+						"AUTO" :
+						LEConnectionProfiles[ApplicationSettings.LEProfile].Name,
+				(LEProfileInfo.Profile < NUMBER_LE_CONNECTION_PROFILES) ?
+						LEConnectionProfiles[LEProfileInfo.Profile].Name :
+						"NONE",
+				LEProfileInfo.CurrentParameters.Connection_Interval,
+				LEProfileInfo.CurrentParameters.Slave_Latency,
+				LEProfileInfo.CurrentParameters.Supervision_Timeout);
+		AddControlResponse(Response);
+
+		ret_val = 0;
+	} else if (*Parameter == '=') {
+		Parameter++;
+
+		ret_val = INVALID_PARAMETERS_ERROR;
+
+		if (!BTPS_MemCompareI(Parameter, "AUTO", 5)) {
+			ApplicationSettings.LEProfile = LE_PROFILE_AUTOMATIC;
+
+			ret_val = 0;
+		} else {
+			for (Index = 0; Index < NUMBER_LE_CONNECTION_PROFILES; Index++) {
+				if (!BTPS_MemCompareI(Parameter,
+						LEConnectionProfiles[Index].Name,
+						BTPS_StringLength(LEConnectionProfiles[Index].Name)
+								+ 1)) {
+					ApplicationSettings.LEProfile = (Byte_t) Index;
+
+					ret_val = 0;
+					break;
+				}
+			}
+		}
+	} else
+		ret_val = INVALID_PARAMETERS_ERROR;
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+SNIFF command.  The      */
+/* parameter is the idle time (in seconds) before the BR/EDR link is */
+/* put into sniff mode, zero disables sniff mode.  The query also    */
+/* reports the mode and sniff interval of the current link.          */
+static int ControlSniff(char *Parameter) {
+	int ret_val;
+	unsigned long Value;
+	char Response[32];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		BTPS_SprintF(Response, "+SNIFF:%u,%s,%u\r\n",
+				(unsigned int) ApplicationSettings.SniffIdleTime,
+				(ApplicationStateInfo.Flags
+						& APPLICATION_STATE_INFO_SNIFF_MODE_ACTIVE) ?
+						"SNIFF" : "ACTIVE", SniffInfo.Interval);
+		AddControlResponse(Response);
+
+		ret_val = 0;
+	} else {
+		if ((ParseControlValues(Parameter, 1, &Value)) && (Value <= 0xFF)) {
+			ApplicationSettings.SniffIdleTime = (Byte_t) Value;
+
+			/* Wake the link if sniff mode has been disabled.              */
+			if (!Value)
+				ExitSniffMode();
+
+			ret_val = 0;
+		} else
+			ret_val = INVALID_PARAMETERS_ERROR;
+	}
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+SPPPROFILE command.  The */
+/* profile is given by name and is used for the next connection, the */
+/* query also reports the profile used by the current connection and */
+/* the free heap.                                                    */
+static int ControlSPPProfile(char *Parameter) {
+	int ret_val;
+	unsigned int Index;
+	unsigned int Used;
+	unsigned int Free;
+	unsigned int MaxFree;
+	char Response[48];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		BTPS_QueryMemoryUsage(&Used, &Free, &MaxFree);
+
+		BTPS_SprintF(Response, "+SPPPROFILE:%s,%s,%u,%u\r\n",
+				SPPBufferProfiles[ApplicationSettings.SPPProfile].Name,
+				SPPBufferProfiles[ApplicationStateInfo.SPPBufferProfile].Name,
+				Free, MaxFree);
+		AddControlResponse(Response);
+
+		ret_val = 0;
+	} else {
+		ret_val = INVALID_PARAMETERS_ERROR;
+
+		if (*Parameter == '=') {
+			Parameter++;
+
+			for (Index = 0; Index < NUMBER_SPP_BUFFER_PROFILES; Index++) {
+				if (!BTPS_MemCompareI(Parameter, SPPBufferProfiles[Index].Name,
+						BTPS_StringLength(SPPBufferProfiles[Index].Name) + 1)) {
+					ApplicationSettings.SPPProfile = (Byte_t) Index;
+
+					/* RFCOMM takes the queuing parameters once no SPP    */
+					/* port is connected.                                 */
+					ApplicationStateInfo.Flags |=
+							APPLICATION_STATE_INFO_FLAGS_SPP_QUEUING_PENDING;
+					UpdateSPPQueuingParameters();
+
+					ret_val = 0;
+					break;
+				}
+			}
+		}
+	}
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+SPPTEST command.  The    */
+/* test mode is given by name (OFF stops the test).  The test runs   */
+/* while the UART stays in command mode and continues across SPP     */
+/* connections.                                                      */
+static int ControlSPPTest(char *Parameter) {
+	int ret_val;
+	unsigned int Index;
+	char Response[24];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		BTPS_SprintF(Response, "+SPPTEST:%s\r\n",
+				SPPTestModeNames[SPPTestInfo.Mode]);
+		AddControlResponse(Response);
+
+		ret_val = 0;
+	} else {
+		ret_val = INVALID_PARAMETERS_ERROR;
+
+		if (*Parameter == '=') {
+			Parameter++;
+
+			for (Index = 0; Index < NUMBER_SPP_TEST_MODES; Index++) {
+				if (!BTPS_MemCompareI(Parameter, SPPTestModeNames[Index],
+						BTPS_StringLength(SPPTestModeNames[Index]) + 1)) {
+					/* Start the new test with fresh patterns and period  */
+					/* counters, the totals are statistics (AT+STAT).     */
+					SPPTestInfo.Mode = (Byte_t) Index;
+					SPPTestInfo.TransmitPattern = 0;
+					SPPTestInfo.ReceivePattern = 0;
+					SPPTestInfo.ReportTick = BTPS_GetTickCount();
+					SPPTestInfo.PeriodTransmitBytes = 0;
+					SPPTestInfo.PeriodReceiveBytes = 0;
+					SPPTestInfo.PeriodGoodBytes = 0;
+					SPPTestInfo.PeriodPartialWrites = 0;
+					SPPTestInfo.PeriodBufferFullStalls = 0;
+
+					/* Start sending (and consuming any data that was     */
+					/* left queued).                                      */
+					PostApplicationMailbox(
+							APPLICATION_MAILBOX_MESSAGE_ID_SPP_BUFFER_EMPTY);
+					PostApplicationMailbox(
+							APPLICATION_MAILBOX_MESSAGE_ID_SPP_DATA);
+
+					ret_val = 0;
+					break;
+				}
+			}
+		}
+	}
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+TRACE command.  The      */
+/* parameter is the number of seconds between latency trace samples  */
+/* (zero turns tracing off), setting it clears the histograms.  The  */
+/* query reports the period and the number of samples taken and      */
+/* discarded, followed by one line per stage holding the histogram   */
+/* of the time (in ACLK periods) from that stage to the next.        */
+static int ControlTrace(char *Parameter) {
+	int ret_val;
+	unsigned int Stage;
+	unsigned int Bucket;
+	unsigned int Length;
+	unsigned long Value;
+	char Response[CONTROL_RESPONSE_BUFFER_SIZE - 8];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		BTPS_SprintF(Response, "+TRACE:%u,%lu,%lu\r\n",
+				(unsigned int) ApplicationSettings.TracePeriod,
+				TraceInfo.Samples, TraceInfo.SamplesDiscarded);
+		AddControlResponse(Response);
+		WriteControlResponse();
+
+		for (Stage = 0; Stage < (HAL_TRACE_NUMBER_STAGES - 1); Stage++) {
+			Length = BTPS_SprintF(Response, "+TRACE:%u", Stage);
+			for (Bucket = 0; Bucket < TRACE_HISTOGRAM_BUCKETS; Bucket++)
+				Length += BTPS_SprintF(&(Response[Length]), ",%u",
+						TraceInfo.Histogram[Stage][Bucket]);
+
+			BTPS_SprintF(&(Response[Length]), "\r\n");
+			AddControlResponse(Response);
+			WriteControlResponse();
+		}
+
+		ret_val = 0;
+	} else {
+		if ((ParseControlValues(Parameter, 1, &Value)) && (Value <= 0xFF)) {
+			ApplicationSettings.TracePeriod = (Byte_t) Value;
+
+			BTPS_MemInitialize(&TraceInfo, 0, sizeof(TraceInfo));
+
+			ret_val = 0;
+		} else
+			ret_val = INVALID_PARAMETERS_ERROR;
+	}
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+BONDS command.  The query*/
+/* sends one line for each bonded device, giving the type (BR or LE) */
+/* and the BD_ADDR.  The LE lines also give the encryption key size  */
+/* and whether the IRK is known.  AT+BONDS=CLEAR deletes all bonds.  */
+static int ControlBonds(char *Parameter) {
+	int ret_val;
+	unsigned int Index;
+	BoardStr_t BoardStr;
+	char Response[48];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		for (Index = 0; Index < MAX_SUPPORTED_LINK_KEYS; Index++) {
+			if (LinkKeyInfo[Index].Flags & BOND_ENTRY_FLAGS_VALID) {
+				BD_ADDRToStr(&(LinkKeyInfo[Index].BD_ADDR), BoardStr);
+
+				BTPS_SprintF(Response, "+BONDS:BR,%s\r\n", BoardStr);
+				AddControlResponse(Response);
+				WriteControlResponse();
+			}
+		}
+
+		for (Index = 0; Index < MAX_SUPPORTED_LE_BONDS; Index++) {
+			if (LEBondInfo[Index].Flags & BOND_ENTRY_FLAGS_VALID) {
+				BD_ADDRToStr(&(LEBondInfo[Index].BD_ADDR), BoardStr);
+
+				BTPS_SprintF(Response, "+BONDS:LE,%s,%u,%u\r\n", BoardStr,
+						(unsigned int) LEBondInfo[Index].EncryptionKeySize,
+						(LEBondInfo[Index].Flags & BOND_ENTRY_FLAGS_IRK_VALID) ?
+								1 : 0);
+				AddControlResponse(Response);
+				WriteControlResponse();
+			}
+		}
+
+		ret_val = 0;
+	} else {
+		if ((*Parameter == '=')
+				&& (!BTPS_MemCompareI(&(Parameter[1]), "CLEAR", 6))) {
+			DeleteBondEntry(BOND_TABLE_LINK_KEY, NULL);
+			DeleteBondEntry(BOND_TABLE_LE, NULL);
+
+			ret_val = 0;
+		} else
+			ret_val = INVALID_PARAMETERS_ERROR;
+	}
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+REALTIME command.  The   */
+/* parameter is the real-time deadline in milliseconds (zero turns   */
+/* the mode off), the query also reports the number of bytes dropped */
+/* and the number of times data was dropped.                         */
+static int ControlRealTime(char *Parameter) {
+	int ret_val;
+	unsigned long Value;
+	char Response[48];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		BTPS_SprintF(Response, "+REALTIME:%u,%lu,%lu\r\n",
+				ApplicationSettings.RealTimeDeadline, RealTimeInfo.BytesDropped,
+				RealTimeInfo.Drops);
+		AddControlResponse(Response);
+
+		ret_val = 0;
+	} else {
+		if ((ParseControlValues(Parameter, 1, &Value))
+				&& (Value <= REALTIME_DEADLINE_LIMIT)) {
+			ApplicationSettings.RealTimeDeadline = (Word_t) Value;
+
+			/* Start tracking the age from the data queued now.            */
+			RealTimeInfo.NumberSegments = 0;
+			RealTimeInfo.QueuedLength = 0;
+
+			ApplyRealTimeMode();
+			UpdateWiredFlowHold();
+
+			ret_val = 0;
+		} else
+			ret_val = INVALID_PARAMETERS_ERROR;
+	}
+
+	return (ret_val);
+}
+
+/* The following function implements the AT+SPPPORTS command.  The   */
+/* parameter is the number of additional SPP ports, changing it drops*/
+/* any connection to the additional ports.  The query reports the    */
+/* number of ports, the maximum number of ports, the RAM used by the */
+/* SPP buffers with that number of ports and the free heap, followed */
+/* by one line per open port holding its RFCOMM channel, its UART    */
+/* framing channel, whether it is connected and the bytes sent and   */
+/* received.                                                         */
+static int ControlSPPPorts(char *Parameter) {
+	int ret_val;
+	unsigned int Index;
+	unsigned int Used;
+	unsigned int Free;
+	unsigned int MaxFree;
+	unsigned long Value;
+	SPPPortInfo_t *Port;
+	char Response[CONTROL_RESPONSE_BUFFER_SIZE - 8];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		BTPS_QueryMemoryUsage(&Used, &Free, &MaxFree);
+
+		BTPS_SprintF(Response, "+SPPPORTS:%u,%u,%u,%u\r\n",
+				(unsigned int) ApplicationSettings.SPPAdditionalPorts,
+				SPP_MAXIMUM_ADDITIONAL_PORTS,
+				(unsigned int) SPP_PORTS_RAM_SIZE(ApplicationSettings.SPPAdditionalPorts),
+				Free);
+		AddControlResponse(Response);
+		WriteControlResponse();
+
+		for (Index = 0; Index < SPP_MAXIMUM_ADDITIONAL_PORTS; Index++) {
+			Port = &(SPPPortsInfo.Ports[Index]);
+			if (!Port->ServerPortID)
+				continue;
+
+			BTPS_SprintF(Response, "+SPPPORTS:%u,%u,%u,%lu,%lu\r\n",
+					ApplicationSettings.SPPPortNumber + Index + 1,
+					UART_FRAMING_CHANNEL_SPP_PORT + Index,
+					(unsigned int) (Port->Flags & SPP_PORT_INFO_FLAGS_CONNECTED),
+					Port->BytesSent, Port->BytesReceived);
+			AddControlResponse(Response);
+			WriteControlResponse();
+		}
+
+		ret_val = 0;
+	} else {
+		if ((ParseControlValues(Parameter, 1, &Value))
+				&& (Value <= SPP_MAXIMUM_ADDITIONAL_PORTS)) {
+			/* Reopening the ports would drop their connections, so an     */
+			/* unchanged number leaves them alone.  The ports are opened   */
+			/* with the bridge port if it is not open.                     */
+			if ((Value != ApplicationSettings.SPPAdditionalPorts)
+					&& (ApplicationStateInfo.SPPServerPortID)) {
+				ApplicationSettings.SPPAdditionalPorts = (Byte_t) Value;
+
+				SPPClosePorts();
+				SPPOpenPorts(ApplicationStateInfo.BluetoothStackID);
+
+				UpdateSPPConnectability();
+				UpdateSPPQueuingParameters();
+			} else
+				ApplicationSettings.SPPAdditionalPorts = (Byte_t) Value;
+
+			ret_val = 0;
+		} else
+			ret_val = INVALID_PARAMETERS_ERROR;
 	}
-}
 
-/* The following function is a utility function that is used to      */
-/* format a SPP Data Packet.  This function returns the number of    */
-/* bytes formatted into PacketBuffer.                                */
-static unsigned int FormatSPPDataPacket(unsigned int PacketBufferLength,
-		Byte_t *PacketBuffer) {
-	return HAL_ConsoleRead(PacketBufferLength, (char *)PacketBuffer);
+	return (ret_val);
 }
 
-/* The following function is a utility function which is used to     */
-/* packetize and send SPP Data to a connected device.                */
-static void ProcessSendSPPData(Boolean_t PacketizeCurrentData) {
-	int Result;
-
-	/* Only continue if we are current connected to a BR/EDR Device AND  */
-	/* the SPP Buffer is not Empty.                                      */
-	if ((ApplicationStateInfo.Flags
-			& (APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED
-					| APPLICATION_STATE_INFO_FLAGS_SPP_BUFFER_FULL))
-			== APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED) {
-		/* If requested packetize the current Button and Accelerometer    */
-		/* Data.                                                          */
-		if (PacketizeCurrentData) {
-			/* Packetize the current data to the end of the SPP Buffer and */
-			/* increment the length of the SPP Buffer.                     */
-			ApplicationStateInfo.SPPBufferLength +=
-					FormatSPPDataPacket(
-							SPP_BUFFER_SIZE
-									- ApplicationStateInfo.SPPBufferLength,
-							&(ApplicationStateInfo.SPPBuffer[ApplicationStateInfo.SPPBufferLength]));
+/* The following function implements the AT+BRIDGE command.  The     */
+/* policy is given by name (see BRIDGE_POLICY_XXX), CHANNEL turns the*/
+/* UART framing on and the other policies turn it off (both take     */
+/* effect as AT+FRAMING does).  Setting it clears the statistics.    */
+/* The query reports the policy in use and the seconds since the     */
+/* statistics were cleared, followed by one line per transport       */
+/* holding the bytes sent and received, the transmit and receive     */
+/* throughput (in bytes per second) and the current and largest      */
+/* transmit queue depth.                                             */
+static int ControlBridge(char *Parameter) {
+	int ret_val;
+	unsigned int Index;
+	unsigned long Elapsed;
+	BridgeStatistics_t *Statistics;
+	char Response[CONTROL_RESPONSE_BUFFER_SIZE - 8];
+
+	if (!BTPS_MemCompare(Parameter, "?", 2)) {
+		Elapsed = (BTPS_GetTickCount() - BridgeInfo.StartTick) / 1000;
+
+		BTPS_SprintF(Response, "+BRIDGE:%s,%lu\r\n",
+				BridgePolicyNames[
+						(UARTFramingInfo.Enabled) ?
+								BRIDGE_POLICY_CHANNEL :
+								ApplicationSettings.BridgePolicy], Elapsed);
+		AddControlResponse(Response);
+		WriteControlResponse();
+
+		if (!Elapsed)
+			Elapsed = 1;
+
+		for (Index = 0; Index < 2; Index++) {
+			Statistics = (Index) ? &(BridgeInfo.LE) : &(BridgeInfo.SPP);
+
+			BTPS_SprintF(Response, "+BRIDGE:%s,%lu,%lu,%lu,%lu,%u,%u\r\n",
+					(Index) ? "LE" : "SPP", Statistics->TransmitBytes,
+					Statistics->ReceiveBytes, Statistics->TransmitBytes / Elapsed,
+					Statistics->ReceiveBytes / Elapsed,
+					(Index) ? SerialServiceInfo.BufferLength :
+							ApplicationStateInfo.SPPBufferLength,
+					(unsigned int) Statistics->MaximumQueueDepth);
+			AddControlResponse(Response);
+			WriteControlResponse();
 		}
 
-		/* Send the packetized SPP data to the remote device.             */
-		Result = SPP_Data_Write(ApplicationStateInfo.BluetoothStackID,
-				ApplicationStateInfo.SPPServerPortID,
-				ApplicationStateInfo.SPPBufferLength,
-				(unsigned char *) ApplicationStateInfo.SPPBuffer);
+		ret_val = 0;
+	} else {
+		ret_val = INVALID_PARAMETERS_ERROR;
 
-		if (Result > 0) {
-			/* If we wrote less than the requested number of bytes move the*/
-			/* data forward in the buffer and flag that the SPP Buffer is  */
-			/* FULL.                                                       */
-			if ((unsigned int) Result < ApplicationStateInfo.SPPBufferLength) {
-				BTPS_MemMove(ApplicationStateInfo.SPPBuffer,
-						&(ApplicationStateInfo.SPPBuffer[(unsigned int) Result]),
-						(ApplicationStateInfo.SPPBufferLength - Result));
+		if (*Parameter == '=') {
+			Parameter++;
 
-				ApplicationStateInfo.Flags |=
-						APPLICATION_STATE_INFO_FLAGS_SPP_BUFFER_FULL;
-			}
+			for (Index = 0; Index < NUMBER_BRIDGE_POLICIES; Index++) {
+				if (!BTPS_MemCompareI(Parameter, BridgePolicyNames[Index],
+						BTPS_StringLength(BridgePolicyNames[Index]) + 1)) {
+					/* The raw policy is kept while the UART is framed.   */
+					if (Index == BRIDGE_POLICY_CHANNEL)
+						ApplicationSettings.UARTFraming = TRUE;
+					else {
+						ApplicationSettings.BridgePolicy = (Byte_t) Index;
+						ApplicationSettings.UARTFraming = FALSE;
+					}
 
-			ApplicationStateInfo.SPPBufferLength -= (unsigned int) Result;
-		} else
-			Display(("Error - SPP_Data_Write returned %d.\r\n", Result));
+					if ((Boolean_t) ApplicationSettings.UARTFraming
+							!= UARTFramingInfo.Enabled)
+						ControlInfo.PendingActions |= CONTROL_PENDING_FRAMING;
+
+					BTPS_MemInitialize(&BridgeInfo, 0, sizeof(BridgeInfo));
+					BridgeInfo.StartTick = BTPS_GetTickCount();
+
+					ret_val = 0;
+					break;
+				}
+			}
+		}
 	}
+
+	return (ret_val);
 }
 
 /* ***************************************************************** */
@@ -1358,8 +6667,10 @@ static void BTPSAPI GAP_LE_Event_Callback(unsigned int BluetoothStackID,
 	int Result;
 	BoardStr_t BoardStr;
 	DeviceInfo_t *DeviceInfo;
+	LEBondInfo_t *LEBond;
 	Long_Term_Key_t GeneratedLTK;
 	GAP_Encryption_Mode_t GAP_Encryption_Mode;
+	GAP_LE_Address_Type_t ConnectionAddressType;
 	GAP_LE_Authentication_Event_Data_t *Authentication_Event_Data;
 	GAP_LE_Authentication_Response_Information_t GAP_LE_Authentication_Response_Information;
 
@@ -1387,16 +6698,54 @@ static void BTPSAPI GAP_LE_Event_Callback(unsigned int BluetoothStackID,
 						== HCI_ERROR_CODE_NO_ERROR) {
 					/* Make sure that no entry already exists.            */
 					if ((DeviceInfo =
-							SearchDeviceInfoEntryByBD_ADDR(&DeviceInfoList,
+							SearchDeviceInfoEntryByBD_ADDR(
 									&GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Complete_Event_Data->Peer_Address))
 							== NULL) {
 						/* No entry exists so create one.                  */
-						if (!CreateNewDeviceInfoEntry(&DeviceInfoList,
+						if (!CreateNewDeviceInfoEntry(
 								&GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Complete_Event_Data->Peer_Address_Type,
 								&GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Complete_Event_Data->Peer_Address))
 							Display(
 									("Failed to add device to Device Info List.\r\n"));
 					}
+
+					/* Look up the bond now, so that a new resolvable     */
+					/* private address is resolved before the encryption  */
+					/* is started.                                        */
+					if ((LEBond =
+							SearchLEBondEntry(
+									GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Complete_Event_Data->Peer_Address_Type,
+									&GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Complete_Event_Data->Peer_Address,
+									FALSE)) != NULL) {
+						BD_ADDRToStr(&(LEBond->BD_ADDR), BoardStr);
+						Display(("   Bond:         %s.\r\n", BoardStr));
+					}
+
+					/* Start selecting the connection parameters for the  */
+					/* new connection.                                    */
+					StartLEConnectionProfile(
+							&(GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Complete_Event_Data->Current_Connection_Parameters));
+
+					/* Record how long the connection took.               */
+					if (ReconnectInfo.Phase < NUMBER_RECONNECT_PHASES) {
+						ReconnectInfo.LastPhase = ReconnectInfo.Phase;
+						ReconnectInfo.LastTime = BTPS_GetTickCount()
+								- ReconnectInfo.StartTick;
+						ReconnectInfo.Connections[ReconnectInfo.Phase]++;
+						ReconnectInfo.Phase = RECONNECT_PHASE_NONE;
+
+						StopAdvertisingSchedule();
+
+						Display(
+								("   Connected after %lu ms (phase %u).\r\n", ReconnectInfo.LastTime, (unsigned int)ReconnectInfo.LastPhase));
+					}
+				} else {
+					/* The directed advertising ended without a           */
+					/* connection, move on to the next phase.             */
+					if (GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Complete_Event_Data->Status
+							== HCI_ERROR_CODE_DIRECTED_ADVERTISING_TIMEOUT)
+						PostApplicationMailbox(
+								APPLICATION_MAILBOX_MESSAGE_ID_DIRECTED_TIMEOUT);
 				}
 			}
 			break;
@@ -1416,9 +6765,9 @@ static void BTPSAPI GAP_LE_Event_Callback(unsigned int BluetoothStackID,
 				Display(("   BD_ADDR: %s.\r\n", BoardStr));
 
 				/* Check to see if the device info is present in the     */
-				/* list.                                                 */
+				/* table.                                                */
 				if ((DeviceInfo =
-						SearchDeviceInfoEntryByBD_ADDR(&DeviceInfoList,
+						SearchDeviceInfoEntryByBD_ADDR(
 								&GAP_LE_Event_Data->Event_Data.GAP_LE_Disconnection_Complete_Event_Data->Peer_Address))
 						!= NULL) {
 					/* Check to see if the link is encrypted.  If it isn't*/
@@ -1430,11 +6779,8 @@ static void BTPSAPI GAP_LE_Event_Callback(unsigned int BluetoothStackID,
 					if ((Result) || (GAP_Encryption_Mode == emDisabled)) {
 						/* Connection is not encrypted so delete the device*/
 						/* structure.                                      */
-						DeviceInfo =
-								DeleteDeviceInfoEntry(&DeviceInfoList,
-										&GAP_LE_Event_Data->Event_Data.GAP_LE_Disconnection_Complete_Event_Data->Peer_Address);
-						if (DeviceInfo)
-							FreeDeviceInfoEntryMemory(DeviceInfo);
+						DeleteDeviceInfoEntry(
+								&GAP_LE_Event_Data->Event_Data.GAP_LE_Disconnection_Complete_Event_Data->Peer_Address);
 					}
 				}
 
@@ -1443,13 +6789,47 @@ static void BTPSAPI GAP_LE_Event_Callback(unsigned int BluetoothStackID,
 						APPLICATION_MAILBOX_MESSAGE_ID_LE_DISCONNECTED);
 			}
 			break;
+		case etLE_Connection_Parameter_Update_Response:
+			if (GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Parameter_Update_Response_Event_Data) {
+				Display(
+						("etLE_Connection_Parameter_Update_Response: %s.\r\n", (GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Parameter_Update_Response_Event_Data->Accepted)?"Accepted":"Rejected"));
+
+				if (LEProfileInfo.PendingProfile != LE_PROFILE_NONE) {
+					if (GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Parameter_Update_Response_Event_Data->Accepted) {
+						LEProfileInfo.Profile = LEProfileInfo.PendingProfile;
+						LEProfileInfo.Retries = 0;
+						LEProfileInfo.PendingProfile = LE_PROFILE_NONE;
+					} else
+						RejectLEConnectionProfile();
+				}
+			}
+			break;
+		case etLE_Connection_Parameter_Updated:
+			if (GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Parameter_Updated_Event_Data) {
+				Display(
+						("etLE_Connection_Parameter_Updated: Status 0x%02X, Interval %u ms, Latency %u.\r\n", GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Parameter_Updated_Event_Data->Status, GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Parameter_Updated_Event_Data->Current_Connection_Parameters.Connection_Interval, GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Parameter_Updated_Event_Data->Current_Connection_Parameters.Slave_Latency));
+
+				if (GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Parameter_Updated_Event_Data->Status
+						== HCI_ERROR_CODE_NO_ERROR)
+					LEProfileInfo.CurrentParameters =
+							GAP_LE_Event_Data->Event_Data.GAP_LE_Connection_Parameter_Updated_Event_Data->Current_Connection_Parameters;
+			}
+			break;
 		case etLE_Encryption_Change:
 			Display(
 					("etLE_Encryption_Change with size %d.\r\n",(int)GAP_LE_Event_Data->Event_Data_Size));
+
+			if (GAP_LE_Event_Data->Event_Data.GAP_LE_Encryption_Change_Event_Data)
+				UpdateLTKSetupTime(
+						GAP_LE_Event_Data->Event_Data.GAP_LE_Encryption_Change_Event_Data->Encryption_Change_Status);
 			break;
 		case etLE_Encryption_Refresh_Complete:
 			Display(
 					("etLE_Encryption_Refresh_Complete with size %d.\r\n", (int)GAP_LE_Event_Data->Event_Data_Size));
+
+			if (GAP_LE_Event_Data->Event_Data.GAP_LE_Encryption_Refresh_Complete_Event_Data)
+				UpdateLTKSetupTime(
+						GAP_LE_Event_Data->Event_Data.GAP_LE_Encryption_Refresh_Complete_Event_Data->Status);
 			break;
 		case etLE_Authentication:
 			Display(
@@ -1468,33 +6848,65 @@ static void BTPSAPI GAP_LE_Event_Callback(unsigned int BluetoothStackID,
 					Display(("      BD_ADDR: %s.\r\n", BoardStr));
 
 					/* The other side of a connection is requesting    */
-					/* that we start encryption. Thus we should        */
-					/* regenerate LTK for this connection and send it  */
-					/* to the chip.                                    */
-					Result =
-							GAP_LE_Regenerate_Long_Term_Key(BluetoothStackID,
-									(Encryption_Key_t *) (&DHK),
-									(Encryption_Key_t *) (&ER),
+					/* that we start encryption. Thus we should take   */
+					/* the LTK from the cache, or regenerate it for    */
+					/* this connection, and send it to the chip.       */
+					LTKCacheInfo.RequestTick = BTPS_GetTickCount();
+
+					if (SearchLTKCache(
+							Authentication_Event_Data->Authentication_Event_Data.Long_Term_Key_Request.EDIV,
+							&(Authentication_Event_Data->Authentication_Event_Data.Long_Term_Key_Request.Rand),
+							&GeneratedLTK)) {
+						LTKCacheInfo.RequestSource = LTK_SOURCE_CACHE;
+
+						Result = 0;
+					} else {
+						LTKCacheInfo.RequestSource = LTK_SOURCE_REGENERATED;
+
+						Result =
+								GAP_LE_Regenerate_Long_Term_Key(BluetoothStackID,
+										(Encryption_Key_t *) (&DHK),
+										(Encryption_Key_t *) (&ER),
+										Authentication_Event_Data->Authentication_Event_Data.Long_Term_Key_Request.EDIV,
+										&(Authentication_Event_Data->Authentication_Event_Data.Long_Term_Key_Request.Rand),
+										&GeneratedLTK);
+						if (!Result) {
+							Display(
+									("      GAP_LE_Regenerate_Long_Term_Key Success.\r\n"));
+
+							AddLTKCacheEntry(
 									Authentication_Event_Data->Authentication_Event_Data.Long_Term_Key_Request.EDIV,
 									&(Authentication_Event_Data->Authentication_Event_Data.Long_Term_Key_Request.Rand),
 									&GeneratedLTK);
+						}
+					}
+
+					LTKCacheInfo.Requests[LTKCacheInfo.RequestSource]++;
+
 					if (!Result) {
-						Display(
-								("      GAP_LE_Regenerate_Long_Term_Key Success.\r\n"));
+						/* Respond with the Long Term Key, using the key*/
+						/* size of the bond if it is known.             */
+						LEBond = SearchLEBondEntry(
+								GetConnectionAddressType(
+										&Authentication_Event_Data->BD_ADDR),
+								&Authentication_Event_Data->BD_ADDR, FALSE);
 
-						/* Respond with the Re-Generated Long Term Key. */
 						GAP_LE_Authentication_Response_Information.GAP_LE_Authentication_Type =
 								larLongTermKey;
 						GAP_LE_Authentication_Response_Information.Authentication_Data_Length =
 								GAP_LE_LONG_TERM_KEY_INFORMATION_DATA_SIZE;
 						GAP_LE_Authentication_Response_Information.Authentication_Data.Long_Term_Key_Information.Encryption_Key_Size =
-								GAP_LE_MAXIMUM_ENCRYPTION_KEY_SIZE;
+								(LEBond) ?
+										LEBond->EncryptionKeySize :
+										GAP_LE_MAXIMUM_ENCRYPTION_KEY_SIZE;
 						GAP_LE_Authentication_Response_Information.Authentication_Data.Long_Term_Key_Information.Long_Term_Key =
 								GeneratedLTK;
 					} else {
 						Display(
 								("      GAP_LE_Regenerate_Long_Term_Key returned %d.\r\n",Result));
 
+						LTKCacheInfo.RequestSource = LTK_SOURCE_NONE;
+
 						/* Since we failed to generate the requested key*/
 						/* we should respond with a negative response.  */
 						GAP_LE_Authentication_Response_Information.GAP_LE_Authentication_Type =
@@ -1585,9 +6997,11 @@ static void BTPSAPI GAP_LE_Event_Callback(unsigned int BluetoothStackID,
 					} else {
 						/* Failed to pair so delete the key entry for   */
 						/* this device and disconnect the link.         */
-						if ((DeviceInfo = DeleteDeviceInfoEntry(&DeviceInfoList,
-								&Authentication_Event_Data->BD_ADDR)) != NULL)
-							FreeDeviceInfoEntryMemory(DeviceInfo);
+						DeleteDeviceInfoEntry(
+								&Authentication_Event_Data->BD_ADDR);
+
+						DeleteBondEntry(BOND_TABLE_LE,
+								&Authentication_Event_Data->BD_ADDR);
 
 						/* Disconnect the Link.                         */
 						GAP_LE_Disconnect(BluetoothStackID,
@@ -1600,10 +7014,34 @@ static void BTPSAPI GAP_LE_Event_Callback(unsigned int BluetoothStackID,
 
 					/* Generate new LTK,EDIV and Rand and respond with */
 					/* them.                                           */
-					EncryptionInformationRequestResponse(BluetoothStackID,
+					if ((!EncryptionInformationRequestResponse(BluetoothStackID,
 							&Authentication_Event_Data->BD_ADDR,
 							Authentication_Event_Data->Authentication_Event_Data.Encryption_Request_Information.Encryption_Key_Size,
-							&GAP_LE_Authentication_Response_Information);
+							&GAP_LE_Authentication_Response_Information))
+							&& ((LEBond = SearchLEBondEntry(
+									GetConnectionAddressType(
+											&Authentication_Event_Data->BD_ADDR),
+									&Authentication_Event_Data->BD_ADDR, TRUE))
+									!= NULL)) {
+						/* Keep the EDIV, Rand and key size in the bond */
+						/* store, so that the bond survives a reset.    */
+						LEBond->EDIV =
+								GAP_LE_Authentication_Response_Information.Authentication_Data.Encryption_Information.EDIV;
+						LEBond->Rand =
+								GAP_LE_Authentication_Response_Information.Authentication_Data.Encryption_Information.Rand;
+						LEBond->EncryptionKeySize =
+								Authentication_Event_Data->Authentication_Event_Data.Encryption_Request_Information.Encryption_Key_Size;
+
+						/* A bond that is already keyed by the identity */
+						/* address keeps its address type.              */
+						if (((DeviceInfo = SearchDeviceInfoEntryByBD_ADDR(
+								&Authentication_Event_Data->BD_ADDR)) != NULL)
+								&& (!(LEBond->Flags & BOND_ENTRY_FLAGS_IRK_VALID)))
+							LEBond->AddressType =
+									(Byte_t) DeviceInfo->ConnectionAddressType;
+
+						StoreBondEntry(LEBond);
+					}
 					break;
 				case latEncryptionInformation:
 					/* Display the information from the event.         */
@@ -1612,6 +7050,38 @@ static void BTPSAPI GAP_LE_Event_Callback(unsigned int BluetoothStackID,
 					Display(
 							("                             Key Size: %d.\r\n", Authentication_Event_Data->Authentication_Event_Data.Encryption_Information.Encryption_Key_Size));
 					break;
+				case latIdentityInformation:
+					Display(
+							(" Identity Information from RemoteDevice: %s.\r\n", BoardStr));
+
+					/* Keep the IRK of the device in the bond store and*/
+					/* key the bond by the identity address, so that   */
+					/* the device is found whether it connects with its*/
+					/* identity address or with a private address.     */
+					ConnectionAddressType = GetConnectionAddressType(
+							&Authentication_Event_Data->BD_ADDR);
+
+					if ((LEBond = SearchLEBondEntry(ConnectionAddressType,
+							&Authentication_Event_Data->BD_ADDR, TRUE)) != NULL) {
+						LEBond->IRK =
+								Authentication_Event_Data->Authentication_Event_Data.Identity_Information.IRK;
+						LEBond->Flags |= BOND_ENTRY_FLAGS_IRK_VALID;
+
+						LEBond = MoveLEBondEntry(LEBond,
+								Authentication_Event_Data->Authentication_Event_Data.Identity_Information.Address_Type,
+								&(Authentication_Event_Data->Authentication_Event_Data.Identity_Information.Address));
+
+						StoreBondEntry(LEBond);
+
+						/* Map the private address of the connection to */
+						/* the identity address.                        */
+						if ((ConnectionAddressType == latRandom)
+								&& (!COMPARE_BD_ADDR(LEBond->BD_ADDR,
+										Authentication_Event_Data->BD_ADDR)))
+							AddRPACacheEntry(&Authentication_Event_Data->BD_ADDR,
+									&(LEBond->BD_ADDR));
+					}
+					break;
 				}
 			}
 			break;
@@ -1649,6 +7119,7 @@ static void BTPSAPI GATT_Connection_Event_Callback(
 		unsigned int BluetoothStackID,
 		GATT_Connection_Event_Data_t *GATT_Connection_Event_Data,
 		unsigned long CallbackParameter) {
+	int Result;
 	BoardStr_t BoardStr;
 
 	/* Verify that all parameters to this callback are Semi-Valid.       */
@@ -1676,12 +7147,38 @@ static void BTPSAPI GATT_Connection_Event_Callback(
 				ApplicationStateInfo.LEConnectionInfo.BD_ADDR =
 						GATT_Connection_Event_Data->Event_Data.GATT_Device_Connection_Data->RemoteDevice;
 
+				/* Start with the default MTU and ask for the largest MTU */
+				/* the stack supports so that notifications carry as much */
+				/* data as possible.                                      */
+				SetSerialServiceMTU(
+						GATT_Connection_Event_Data->Event_Data.GATT_Device_Connection_Data->MTU);
+
+				if (GATT_Connection_Event_Data->Event_Data.GATT_Device_Connection_Data->ConnectionType
+						== gctLE) {
+					Result = GATT_Exchange_MTU_Request(BluetoothStackID,
+							GATT_Connection_Event_Data->Event_Data.GATT_Device_Connection_Data->ConnectionID,
+							GATT_MAXIMUM_SUPPORTED_STACK_MTU,
+							GATT_Client_Event_Callback, 0);
+					if (Result < 0)
+						DisplayFunctionError("GATT_Exchange_MTU_Request", Result);
+				}
+
 				/* Notify the event handler of the connection.           */
 				PostApplicationMailbox(
 						APPLICATION_MAILBOX_MESSAGE_ID_LE_CONNECTED);
 			} else
 				Display(("Error - Null Connection Data.\r\n"));
 			break;
+		case etGATT_Connection_Device_Connection_MTU_Update:
+			if (GATT_Connection_Event_Data->Event_Data.GATT_Device_Connection_MTU_Update_Data) {
+				Display(
+						("etGATT_Connection_Device_Connection_MTU_Update: MTU %u.\r\n", (unsigned int)GATT_Connection_Event_Data->Event_Data.GATT_Device_Connection_MTU_Update_Data->MTU));
+
+				/* Notifications are sized to the negotiated MTU.        */
+				SetSerialServiceMTU(
+						GATT_Connection_Event_Data->Event_Data.GATT_Device_Connection_MTU_Update_Data->MTU);
+			}
+			break;
 		}
 	} else {
 		/* There was an error with one or more of the input parameters.   */
@@ -1691,6 +7188,233 @@ static void BTPSAPI GATT_Connection_Event_Callback(
 	}
 }
 
+/* The following function is for the GATT Server Event Callback of   */
+/* the serial service.  This function is called for every read or    */
+/* write of the serial service attributes that have no storage (the  */
+/* characteristic values and the Client Characteristic Configuration */
+/* Descriptor).  The caller is free to use the contents of the GATT  */
+/* Server Event Data ONLY in the context of this callback.           */
+/* * NOTE * This function MUST NOT Block and wait for Events that can*/
+/*          only be satisfied by Receiving a Bluetooth Event         */
+/*          Callback.  A Deadlock WILL occur because NO Bluetooth    */
+/*          Callbacks will be issued while this function is currently*/
+/*          outstanding.                                             */
+static void BTPSAPI GATT_Server_Event_Callback(unsigned int BluetoothStackID,
+		GATT_Server_Event_Data_t *GATT_Server_Event_Data,
+		unsigned long CallbackParameter) {
+	Byte_t Configuration[SERIAL_SERVICE_CCCD_LENGTH];
+	GATT_Read_Request_Data_t *ReadRequestData;
+	GATT_Write_Request_Data_t *WriteRequestData;
+
+	/* Verify that all parameters to this callback are Semi-Valid.       */
+	if ((BluetoothStackID) && (GATT_Server_Event_Data)) {
+		switch (GATT_Server_Event_Data->Event_Data_Type) {
+		case etGATT_Server_Read_Request:
+			ReadRequestData =
+					GATT_Server_Event_Data->Event_Data.GATT_Read_Request_Data;
+			if (ReadRequestData) {
+				/* Only the configuration descriptor may be read.           */
+				if (ReadRequestData->AttributeOffset
+						!= SERIAL_SERVICE_TX_CCCD_ATTRIBUTE_OFFSET)
+					GATT_Error_Response(BluetoothStackID,
+							ReadRequestData->TransactionID,
+							ReadRequestData->AttributeOffset,
+							ATT_PROTOCOL_ERROR_CODE_READ_NOT_PERMITTED);
+				else if (ReadRequestData->AttributeValueOffset)
+					GATT_Error_Response(BluetoothStackID,
+							ReadRequestData->TransactionID,
+							ReadRequestData->AttributeOffset,
+							ATT_PROTOCOL_ERROR_CODE_ATTRIBUTE_NOT_LONG);
+				else {
+					ASSIGN_HOST_WORD_TO_LITTLE_ENDIAN_UNALIGNED_WORD(
+							Configuration,
+							(Word_t) (SerialServiceInfo.NotificationsEnabled ? GATT_CLIENT_CONFIGURATION_CHARACTERISTIC_NOTIFY_ENABLE : 0));
+
+					GATT_Read_Response(BluetoothStackID,
+							ReadRequestData->TransactionID,
+							SERIAL_SERVICE_CCCD_LENGTH, Configuration);
+				}
+			}
+			break;
+		case etGATT_Server_Write_Request:
+			WriteRequestData =
+					GATT_Server_Event_Data->Event_Data.GATT_Write_Request_Data;
+			if (WriteRequestData) {
+				/* Prepared (long) writes are not supported.                */
+				if ((WriteRequestData->DelayWrite)
+						|| (WriteRequestData->AttributeValueOffset)) {
+					GATT_Error_Response(BluetoothStackID,
+							WriteRequestData->TransactionID,
+							WriteRequestData->AttributeOffset,
+							ATT_PROTOCOL_ERROR_CODE_ATTRIBUTE_NOT_LONG);
+					break;
+				}
+
+				switch (WriteRequestData->AttributeOffset) {
+				case SERIAL_SERVICE_TX_CCCD_ATTRIBUTE_OFFSET:
+					if (WriteRequestData->AttributeValueLength
+							== SERIAL_SERVICE_CCCD_LENGTH) {
+						SerialServiceInfo.NotificationsEnabled =
+								(Boolean_t) ((READ_UNALIGNED_WORD_LITTLE_ENDIAN(WriteRequestData->AttributeValue)
+										& GATT_CLIENT_CONFIGURATION_CHARACTERISTIC_NOTIFY_ENABLE) ?
+										TRUE : FALSE);
+
+						GATT_Write_Response(BluetoothStackID,
+								WriteRequestData->TransactionID);
+
+						/* Start moving UART data to the LE device.           */
+						PostLEWriteReady();
+					} else
+						GATT_Error_Response(BluetoothStackID,
+								WriteRequestData->TransactionID,
+								WriteRequestData->AttributeOffset,
+								ATT_PROTOCOL_ERROR_CODE_INVALID_ATTRIBUTE_VALUE_LENGTH);
+					break;
+				case SERIAL_SERVICE_RX_VALUE_ATTRIBUTE_OFFSET:
+					/* Move the data straight to the UART.                   */
+					ProcessReceiveLEData(WriteRequestData->AttributeValueLength,
+							WriteRequestData->AttributeValue);
+
+					GATT_Write_Response(BluetoothStackID,
+							WriteRequestData->TransactionID);
+					break;
+				default:
+					GATT_Error_Response(BluetoothStackID,
+							WriteRequestData->TransactionID,
+							WriteRequestData->AttributeOffset,
+							ATT_PROTOCOL_ERROR_CODE_WRITE_NOT_PERMITTED);
+					break;
+				}
+			}
+			break;
+		}
+	}
+}
+
+/* The following function is for the GATT Client Event Callback.     */
+/* This function is only used to receive the response to the MTU     */
+/* exchange started when an LE device connects.  The caller is free  */
+/* to use the contents of the GATT Client Event Data ONLY in the     */
+/* context of this callback.                                         */
+/* * NOTE * This function MUST NOT Block and wait for Events that can*/
+/*          only be satisfied by Receiving a Bluetooth Event         */
+/*          Callback.  A Deadlock WILL occur because NO Bluetooth    */
+/*          Callbacks will be issued while this function is currently*/
+/*          outstanding.                                             */
+static void BTPSAPI GATT_Client_Event_Callback(unsigned int BluetoothStackID,
+		GATT_Client_Event_Data_t *GATT_Client_Event_Data,
+		unsigned long CallbackParameter) {
+	/* Verify that all parameters to this callback are Semi-Valid.       */
+	if ((BluetoothStackID) && (GATT_Client_Event_Data)) {
+		switch (GATT_Client_Event_Data->Event_Data_Type) {
+		case etGATT_Client_Exchange_MTU_Response:
+			if (GATT_Client_Event_Data->Event_Data.GATT_Exchange_MTU_Response_Data) {
+				Display(
+						("etGATT_Client_Exchange_MTU_Response: Server MTU %u.\r\n", (unsigned int)GATT_Client_Event_Data->Event_Data.GATT_Exchange_MTU_Response_Data->ServerMTU));
+
+				/* The MTU in use is the smaller of the two.             */
+				SetSerialServiceMTU(
+						GATT_Client_Event_Data->Event_Data.GATT_Exchange_MTU_Response_Data->ServerMTU);
+			}
+			break;
+		case etGATT_Client_Error_Response:
+			Display(("MTU exchange failed, using the default MTU.\r\n"));
+			break;
+		}
+	}
+}
+
+/* The following function is for the HCI Event Callback.  This       */
+/* function is used to watch the controller's completed packets so   */
+/* that the serial service notifications may be paced by the buffers */
+/* available in the controller.                                      */
+/* * NOTE * Completed packets are also reported for other ATT traffic*/
+/*          on the LE link, which at worst lets a notification be    */
+/*          queued early, the stack refuses it if it has no buffer.  */
+static void BTPSAPI HCI_Event_Callback(unsigned int BluetoothStackID,
+		HCI_Event_Data_t *HCI_Event_Data, unsigned long CallbackParameter) {
+	unsigned int Index;
+	Word_t Completed;
+	HCI_Number_Of_Completed_Packets_Data_t *CompletedData;
+
+	/* Track the mode of the BR/EDR link.                                */
+	if ((BluetoothStackID) && (HCI_Event_Data)
+			&& (HCI_Event_Data->Event_Data_Type == etMode_Change_Event)
+			&& (HCI_Event_Data->Event_Data.HCI_Mode_Change_Event_Data)
+			&& (ApplicationStateInfo.Flags
+					& APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED)
+			&& (HCI_Event_Data->Event_Data.HCI_Mode_Change_Event_Data->Connection_Handle
+					== SniffInfo.ConnectionHandle)) {
+		SniffInfo.RequestPending = FALSE;
+
+		if (HCI_Event_Data->Event_Data.HCI_Mode_Change_Event_Data->Status
+				== HCI_ERROR_CODE_NO_ERROR) {
+			UpdateSniffTime();
+
+			if (HCI_Event_Data->Event_Data.HCI_Mode_Change_Event_Data->Current_Mode
+					== HCI_CURRENT_MODE_SNIFF_MODE) {
+				ApplicationStateInfo.Flags |=
+						APPLICATION_STATE_INFO_SNIFF_MODE_ACTIVE;
+
+				SniffInfo.Interval =
+						HCI_Event_Data->Event_Data.HCI_Mode_Change_Event_Data->Interval;
+				SniffInfo.SniffEntries++;
+
+				/* Data may have been queued while the request was       */
+				/* outstanding.                                          */
+				if (ApplicationStateInfo.SPPBufferLength)
+					PostApplicationMailbox(
+							APPLICATION_MAILBOX_MESSAGE_ID_SPP_BUFFER_EMPTY);
+			} else
+				ApplicationStateInfo.Flags &=
+						~APPLICATION_STATE_INFO_SNIFF_MODE_ACTIVE;
+		} else
+			SniffInfo.IdlePeriods = 0;
+	}
+
+	/* Track the packet types used on the BR/EDR link.                   */
+	if ((BluetoothStackID) && (HCI_Event_Data)
+			&& (HCI_Event_Data->Event_Data_Type
+					== etConnection_Packet_Type_Changed_Event)
+			&& (HCI_Event_Data->Event_Data.HCI_Connection_Packet_Type_Changed_Event_Data)
+			&& (HCI_Event_Data->Event_Data.HCI_Connection_Packet_Type_Changed_Event_Data->Status
+					== HCI_ERROR_CODE_NO_ERROR)
+			&& (HCI_Event_Data->Event_Data.HCI_Connection_Packet_Type_Changed_Event_Data->Connection_Handle
+					== SniffInfo.ConnectionHandle))
+		LinkInfo.PacketType =
+				HCI_Event_Data->Event_Data.HCI_Connection_Packet_Type_Changed_Event_Data->Packet_Type;
+
+	/* Verify that all parameters to this callback are Semi-Valid.       */
+	if ((BluetoothStackID) && (HCI_Event_Data)
+			&& (HCI_Event_Data->Event_Data_Type
+					== etNumber_Of_Completed_Packets_Event)
+			&& (HCI_Event_Data->Event_Data.HCI_Number_Of_Completed_Packets_Event_Data)
+			&& (ApplicationStateInfo.Flags
+					& APPLICATION_STATE_INFO_FLAGS_LE_CONNECTED)) {
+		for (Index = 0;
+				Index
+						< HCI_Event_Data->Event_Data.HCI_Number_Of_Completed_Packets_Event_Data->Number_of_Handles;
+				Index++) {
+			CompletedData =
+					&(HCI_Event_Data->Event_Data.HCI_Number_Of_Completed_Packets_Event_Data->HCI_Number_Of_Completed_Packets_Data[Index]);
+
+			if (CompletedData->Connection_Handle
+					== SerialServiceInfo.ConnectionHandle) {
+				Completed = CompletedData->HC_Num_Of_Completed_Packets;
+				if (Completed > SerialServiceInfo.PacketsOutstanding)
+					Completed = SerialServiceInfo.PacketsOutstanding;
+
+				SerialServiceInfo.PacketsOutstanding -= (Byte_t) Completed;
+
+				/* Send any data that is waiting for a buffer.           */
+				if ((SerialServiceInfo.NotificationsEnabled)
+						&& ((Completed) || (SerialServiceInfo.BufferLength)))
+					PostLEWriteReady();
+			}
+		}
+	}
+}
+
 /* The following function is for the GAP Event Receive Data Callback.*/
 /* This function will be called whenever a Callback has been         */
 /* registered for the specified GAP Action that is associated with   */
@@ -1719,12 +7443,11 @@ static void BTPSAPI GATT_Connection_Event_Callback(
 static void BTPSAPI GAP_Event_Callback(unsigned int BluetoothStackID,
 		GAP_Event_Data_t *GAP_Event_Data, unsigned long CallbackParameter) {
 	int Result;
-	int Index;
-	BD_ADDR_t NULL_BD_ADDR;
 	Boolean_t OOB_Data;
 	Boolean_t MITM;
 	PIN_Code_t PINCode;
 	BoardStr_t Callback_BoardStr;
+	LinkKeyInfo_t *LinkKey;
 	GAP_IO_Capability_t RemoteIOCapability;
 	GAP_Remote_Name_Event_Data_t *GAP_Remote_Name_Event_Data;
 	GAP_Authentication_Information_t GAP_Authentication_Information;
@@ -1754,19 +7477,16 @@ static void BTPSAPI GAP_Event_Callback(unsigned int BluetoothStackID,
 
 				/* See if we have stored a Link Key for the specified */
 				/* device.                                            */
-				for (Index = 0;
-						Index < (sizeof(LinkKeyInfo) / sizeof(LinkKeyInfo_t));
-						Index++) {
-					if (COMPARE_BD_ADDR(LinkKeyInfo[Index].BD_ADDR, GAP_Event_Data->Event_Data.GAP_Authentication_Event_Data->Remote_Device)) {
-						/* Link Key information stored, go ahead and    */
-						/* respond with the stored Link Key.            */
-						GAP_Authentication_Information.Authentication_Data_Length =
-								sizeof(Link_Key_t);
-						GAP_Authentication_Information.Authentication_Data.Link_Key =
-								LinkKeyInfo[Index].LinkKey;
-
-						break;
-					}
+				if ((LinkKey =
+						SearchBondEntry(BOND_TABLE_LINK_KEY,
+								&GAP_Event_Data->Event_Data.GAP_Authentication_Event_Data->Remote_Device,
+								FALSE)) != NULL) {
+					/* Link Key information stored, go ahead and       */
+					/* respond with the stored Link Key.               */
+					GAP_Authentication_Information.Authentication_Data_Length =
+							sizeof(Link_Key_t);
+					GAP_Authentication_Information.Authentication_Data.Link_Key =
+							LinkKey->LinkKey;
 				}
 
 				/* Submit the authentication response.                */
@@ -1856,34 +7576,15 @@ static void BTPSAPI GAP_Event_Callback(unsigned int BluetoothStackID,
 
 				/* Now store the link Key in either a free location OR*/
 				/* over the old key location.                         */
-				ASSIGN_BD_ADDR(NULL_BD_ADDR, 0x00, 0x00, 0x00, 0x00, 0x00,
-						0x00);
-
-				for (Index = 0, Result = -1;
-						Index < (sizeof(LinkKeyInfo) / sizeof(LinkKeyInfo_t));
-						Index++) {
-					if (COMPARE_BD_ADDR(LinkKeyInfo[Index].BD_ADDR, GAP_Event_Data->Event_Data.GAP_Authentication_Event_Data->Remote_Device))
-						break;
-					else {
-						if ((Result == (-1))
-								&& (COMPARE_BD_ADDR(LinkKeyInfo[Index].BD_ADDR, NULL_BD_ADDR)))
-							Result = Index;
-					}
-				}
-
-				/* If we didn't find a match, see if we found an empty*/
-				/* location.                                          */
-				if (Index == (sizeof(LinkKeyInfo) / sizeof(LinkKeyInfo_t)))
-					Index = Result;
-
-				/* Check to see if we found a location to store the   */
-				/* Link Key information into.                         */
-				if (Index != (-1)) {
-					LinkKeyInfo[Index].BD_ADDR =
-							GAP_Event_Data->Event_Data.GAP_Authentication_Event_Data->Remote_Device;
-					LinkKeyInfo[Index].LinkKey =
+				if ((LinkKey =
+						SearchBondEntry(BOND_TABLE_LINK_KEY,
+								&GAP_Event_Data->Event_Data.GAP_Authentication_Event_Data->Remote_Device,
+								TRUE)) != NULL) {
+					LinkKey->LinkKey =
 							GAP_Event_Data->Event_Data.GAP_Authentication_Event_Data->Authentication_Event_Data.Link_Key_Info.Link_Key;
 
+					StoreBondEntry(LinkKey);
+
 					Display(("Link Key Stored.\r\n"));
 				} else
 					Display(("Link Key array full.\r\n"));
@@ -2065,6 +7766,10 @@ static void BTPSAPI SPP_Event_Callback(unsigned int BluetoothStackID,
 			ApplicationStateInfo.CBConnectionInfo.BD_ADDR =
 					SPP_Event_Data->Event_Data.SPP_Open_Port_Indication_Data->BD_ADDR;
 
+			/* Size the SPP buffers before any data is queued.          */
+			ApplySPPBufferProfile(
+					SPP_Event_Data->Event_Data.SPP_Open_Port_Indication_Data->SerialPortID);
+
 			/* Notify the event handler of the connection.              */
 			PostApplicationMailbox(APPLICATION_MAILBOX_MESSAGE_ID_CB_CONNECTED);
 			break;
@@ -2079,17 +7784,42 @@ static void BTPSAPI SPP_Event_Callback(unsigned int BluetoothStackID,
 					APPLICATION_MAILBOX_MESSAGE_ID_CB_DISCONNECTED);
 			break;
 		case etPort_Status_Indication:
-			/* Display Information about the new Port Status.           */
-			Display(("\r\n"));
-			Display(
-					("SPP Port Status Indication: 0x%04X, Status: 0x%04X, Break Status: 0x%04X, Length: 0x%04X.\r\n", SPP_Event_Data->Event_Data.SPP_Port_Status_Indication_Data->SerialPortID, SPP_Event_Data->Event_Data.SPP_Port_Status_Indication_Data->PortStatus, SPP_Event_Data->Event_Data.SPP_Port_Status_Indication_Data->BreakStatus, SPP_Event_Data->Event_Data.SPP_Port_Status_Indication_Data->BreakTimeout));
+			/* Display Information about the new Port Status.  This     */
+			/* arrives while data is bridged, so it is only displayed   */
+			/* when the UART is framed and it goes on the log channel.  */
+			if (UARTFramingInfo.Enabled)
+				Display(
+						("SPP Port Status Indication: 0x%04X, Status: 0x%04X, Break Status: 0x%04X, Length: 0x%04X.\r\n", SPP_Event_Data->Event_Data.SPP_Port_Status_Indication_Data->SerialPortID, SPP_Event_Data->Event_Data.SPP_Port_Status_Indication_Data->PortStatus, SPP_Event_Data->Event_Data.SPP_Port_Status_Indication_Data->BreakStatus, SPP_Event_Data->Event_Data.SPP_Port_Status_Indication_Data->BreakTimeout));
+
+#if SPP_HONOR_REMOTE_FLOW_CONTROL
+			/* Track whether the remote is able to accept data.         */
+			if (SPP_Event_Data->Event_Data.SPP_Port_Status_Indication_Data->PortStatus
+					& SPP_PORT_STATUS_RTS_CTS_BIT) {
+				if (ApplicationStateInfo.Flags
+						& APPLICATION_STATE_INFO_FLAGS_REMOTE_FLOW_STOPPED) {
+					ApplicationStateInfo.Flags &=
+							~APPLICATION_STATE_INFO_FLAGS_REMOTE_FLOW_STOPPED;
+
+					/* Resume sending any queued data.                    */
+					PostApplicationMailbox(
+							APPLICATION_MAILBOX_MESSAGE_ID_SPP_BUFFER_EMPTY);
+				}
+			} else
+				ApplicationStateInfo.Flags |=
+						APPLICATION_STATE_INFO_FLAGS_REMOTE_FLOW_STOPPED;
 
+			/* Pass the remote's flow state on to the wired host.       */
+			UpdateWiredFlowHold();
+#endif
 			break;
 		case etPort_Data_Indication:
-			/* Simply inform the user that data has arrived.            */
-			Display(("\r\n"));
-			Display(
-					("SPP Data Indication, ID: 0x%04X, Length: 0x%04X.\r\n", SPP_Event_Data->Event_Data.SPP_Data_Indication_Data->SerialPortID, SPP_Event_Data->Event_Data.SPP_Data_Indication_Data->DataLength));
+			/* Flag that data is waiting and let the application move it*/
+			/* to the UART.  Nothing is displayed here as the data is   */
+			/* sent on the same port.                                   */
+			ApplicationStateInfo.Flags |=
+					APPLICATION_STATE_INFO_FLAGS_SPP_DATA_PENDING;
+
+			PostApplicationMailbox(APPLICATION_MAILBOX_MESSAGE_ID_SPP_DATA);
 			break;
 		case etPort_Send_Port_Information_Indication:
 			/* Simply Respond with the information that was sent to us. */
@@ -2103,6 +7833,8 @@ static void BTPSAPI SPP_Event_Callback(unsigned int BluetoothStackID,
 			ApplicationStateInfo.Flags &=
 					~APPLICATION_STATE_INFO_FLAGS_SPP_BUFFER_FULL;
 
+			UpdateWiredFlowHold();
+
 			/* Post the message to the application handler.             */
 			PostApplicationMailbox(
 					APPLICATION_MAILBOX_MESSAGE_ID_SPP_BUFFER_EMPTY);
@@ -2127,6 +7859,55 @@ static void BTPSAPI SPP_Event_Callback(unsigned int BluetoothStackID,
 	}
 }
 
+/* The following function is the callback for the additional SPP     */
+/* server ports, the CallbackParameter is the index of the port.  The*/
+/* events are noted in the flags of the port and the ports are       */
+/* serviced from the application mailbox.                            */
+static void BTPSAPI SPP_Port_Event_Callback(unsigned int BluetoothStackID,
+		SPP_Event_Data_t *SPP_Event_Data, unsigned long CallbackParameter) {
+	SPPPortInfo_t *Port;
+
+	if ((SPP_Event_Data) && (BluetoothStackID)
+			&& (CallbackParameter < SPP_MAXIMUM_ADDITIONAL_PORTS)) {
+		Port = &(SPPPortsInfo.Ports[CallbackParameter]);
+
+		switch (SPP_Event_Data->Event_Data_Type) {
+		case etPort_Open_Indication:
+			Display(
+					("SPP Port %u Open Indication, ID: 0x%04X.\r\n", (unsigned int) CallbackParameter + 1, Port->ServerPortID));
+
+			Port->BD_ADDR =
+					SPP_Event_Data->Event_Data.SPP_Open_Port_Indication_Data->BD_ADDR;
+			Port->Flags = SPP_PORT_INFO_FLAGS_CONNECTED;
+			break;
+		case etPort_Close_Port_Indication:
+			Display(
+					("SPP Port %u Close Port.\r\n", (unsigned int) CallbackParameter + 1));
+
+			/* Discard any data that was queued for the device.         */
+			Port->Flags = 0;
+			Port->TransmitLength = 0;
+			Port->ReceiveLength = 0;
+			break;
+		case etPort_Data_Indication:
+			Port->Flags |= SPP_PORT_INFO_FLAGS_DATA_PENDING;
+			break;
+		case etPort_Send_Port_Information_Indication:
+			SPP_Respond_Port_Information(BluetoothStackID,
+					SPP_Event_Data->Event_Data.SPP_Send_Port_Information_Indication_Data->SerialPortID,
+					&SPP_Event_Data->Event_Data.SPP_Send_Port_Information_Indication_Data->SPPPortInformation);
+			break;
+		case etPort_Transmit_Buffer_Empty_Indication:
+			Port->Flags &= ~SPP_PORT_INFO_FLAGS_BUFFER_FULL;
+			break;
+		default:
+			break;
+		}
+
+		PostApplicationMailbox(APPLICATION_MAILBOX_MESSAGE_ID_SPP_PORT_EVENT);
+	}
+}
+
 /* ***************************************************************** */
 /*                    End of Event Callbacks.                        */
 /* ***************************************************************** */
@@ -2146,6 +7927,26 @@ int InitializeApplication(HCI_DriverInformation_t *HCI_DriverInformation,
 	/* Next, makes sure that the Driver Information passed appears to be */
 	/* semi-valid.                                                       */
 	if ((HCI_DriverInformation) && (BTPS_Initialization)) {
+		/* Load the saved settings and apply the ones that affect the     */
+		/* UART.                                                          */
+		LoadSettings();
+
+		/* Load the bonds saved in flash.                                 */
+		LoadBondStore();
+
+		/* Nothing is advertising until the stack has been opened.        */
+		ReconnectInfo.Phase = RECONNECT_PHASE_NONE;
+		ReconnectInfo.LastPhase = RECONNECT_PHASE_NONE;
+
+		LTKCacheInfo.RequestSource = LTK_SOURCE_NONE;
+
+		if (ApplicationSettings.ConsoleBaudRate != HAL_ConsoleGetBaudRate()) {
+			if (HAL_ConsoleSetBaudRate(ApplicationSettings.ConsoleBaudRate))
+				ApplicationSettings.ConsoleBaudRate = HAL_ConsoleGetBaudRate();
+		}
+
+		SetUARTFraming((Boolean_t) ApplicationSettings.UARTFraming);
+
 		/* Try to Open the stack and check if it was successful.          */
 		if (!OpenStack(HCI_DriverInformation, BTPS_Initialization)) {
 			/* Now that the device is discoverable attempt to make it      */
@@ -2155,6 +7956,16 @@ int InitializeApplication(HCI_DriverInformation_t *HCI_DriverInformation,
 				/* Create the Application Mailbox.                          */
 				if ((ApplicationStateInfo.Mailbox = BTPS_CreateMailbox(
 						APPLICATION_MAILBOX_DEPTH, APPLICATION_MAILBOX_SIZE)) != NULL) {
+					/* Ask the HAL to tell us when the UART can accept more  */
+					/* SPP data.                                             */
+					HAL_RegisterTxSpaceCallback(UARTWriteReadyCallback, NULL,
+							SPP_RECEIVE_BUFFER_SIZE);
+
+					/* Start the application timer.                          */
+					if (!BTPS_AddFunctionToScheduler(ApplicationTimerCallback,
+							NULL, APPLICATION_TIMER_PERIOD))
+						Display(("Failed to start the application timer.\r\n"));
+
 					/* Post some messages to the application to kick start   */
 					/* the application.                                      */
 					PostApplicationMailbox(
@@ -2188,9 +7999,38 @@ int InitializeApplication(HCI_DriverInformation_t *HCI_DriverInformation,
 }
 
 void DataSendCallback(void* param) {
+	HAL_TraceStamp(HAL_TRACE_STAGE_MAILBOX_POST);
+
 	PostApplicationMailbox(APPLICATION_MAILBOX_MESSAGE_ID_UART_READ);
 }
 
+/* The following function is used to retrieve the HCILL timeouts (in  */
+/* milliseconds) that should be used when HCILL is configured.       */
+void GetHCILLTimeouts(Word_t *InactivityTimeout, Word_t *RetransmitTimeout) {
+	if (InactivityTimeout)
+		*InactivityTimeout = ApplicationSettings.HCILLInactivityTimeout;
+
+	if (RetransmitTimeout)
+		*RetransmitTimeout = ApplicationSettings.HCILLRetransmitTimeout;
+}
+
+/* The following function is used to write a character of the debug  */
+/* output.  The character is written directly to the UART when the   */
+/* UART is not framed, otherwise it is collected into lines that are */
+/* sent on the log channel.  Output never blocks, characters that do */
+/* not fit are dropped.                                              */
+void DisplayCharacter(char Character) {
+	if (UARTFramingInfo.Enabled) {
+		UARTFramingInfo.LogBuffer[UARTFramingInfo.LogLength++] =
+				(Byte_t) Character;
+
+		if ((Character == '\n')
+				|| (UARTFramingInfo.LogLength >= UART_FRAMING_LOG_BUFFER_SIZE))
+			FlushFramedLog();
+	} else
+		HAL_ConsoleWriteNonBlocking(1, &Character);
+}
+
 /* The following function is the main application state machine which*/
 /* is used to process all application events.                        */
 void ApplicationMain(void) {
@@ -2208,10 +8048,35 @@ void ApplicationMain(void) {
 				switch (MessageID) {
 				case APPLICATION_MAILBOX_MESSAGE_ID_SPP_BUFFER_EMPTY:
 					/* Since the SPP Buffer is empty go ahead and send all*/
-					/* of the queued data.                                */
-					ProcessSendSPPData(FALSE);
+					/* of the queued data.  If the host is still stopped  */
+					/* also drain the UART so that it may resume.         */
+					if ((!UARTFramingInfo.Enabled)
+							&& (HAL_ConsoleRxFlowStopped()))
+						ProcessBridgeData();
+					else
+						ProcessSendSPPData(FALSE);
+
+					/* Loop back any data that was waiting for space.     */
+					if (SPPTestInfo.Mode == SPP_TEST_MODE_LOOPBACK)
+						ProcessReceiveSPPData();
+
+					/* Grant the host credits for the space that is now   */
+					/* free.                                              */
+					UpdateUARTFrameCredits();
 					break;
 				case APPLICATION_MAILBOX_MESSAGE_ID_LE_CONNECTED:
+					/* Advertising has stopped, the slow intervals are no */
+					/* longer needed.                                     */
+					BTPS_DeleteFunctionFromScheduler(AdvertisingTimerCallback,
+							NULL);
+
+					/* Find the HCI handle of the link so that the serial */
+					/* service notifications can be paced.                */
+					GAP_LE_Query_Connection_Handle(
+							ApplicationStateInfo.BluetoothStackID,
+							ApplicationStateInfo.LEConnectionInfo.BD_ADDR,
+							&(SerialServiceInfo.ConnectionHandle));
+
 					/* Set the LE Connection Flag.                        */
 					ApplicationStateInfo.Flags |=
 							APPLICATION_STATE_INFO_FLAGS_LE_CONNECTED;
@@ -2220,8 +8085,10 @@ void ApplicationMain(void) {
 					HAL_SetLED(1, 1);
 					break;
 				case APPLICATION_MAILBOX_MESSAGE_ID_LE_DISCONNECTED:
-					/* Start an advertising process.                      */
-					StartAdvertising(ApplicationStateInfo.BluetoothStackID);
+					/* Start an advertising process, reconnecting to the  */
+					/* device that was connected first if it is bonded.   */
+					StartReconnect(
+							&(ApplicationStateInfo.LEConnectionInfo.BD_ADDR));
 
 					/* Clear the LE Connection Information.               */
 					BTPS_MemInitialize(&(ApplicationStateInfo.LEConnectionInfo),
@@ -2231,9 +8098,27 @@ void ApplicationMain(void) {
 					ApplicationStateInfo.Flags &=
 							~APPLICATION_STATE_INFO_FLAGS_LE_CONNECTED;
 
+					/* Discard any data that was queued for the LE device */
+					/* (the counters are kept).                           */
+					SerialServiceInfo.NotificationsEnabled = FALSE;
+					SerialServiceInfo.PacketsOutstanding = 0;
+					SerialServiceInfo.BufferLength = 0;
+
+					/* Move any SPP data that was held while LE was the   */
+					/* bridge.                                            */
+					PostApplicationMailbox(
+							APPLICATION_MAILBOX_MESSAGE_ID_SPP_DATA);
+
 					/* Clear the LE LED.                                  */
 					HAL_SetLED(1, 0);
 					break;
+				case APPLICATION_MAILBOX_MESSAGE_ID_DIRECTED_TIMEOUT:
+					if (ReconnectInfo.Phase == RECONNECT_PHASE_DIRECTED)
+						NextReconnectPhase();
+					break;
+				case APPLICATION_MAILBOX_MESSAGE_ID_ADVERTISING_TIMER:
+					StartSlowAdvertising();
+					break;
 				case APPLICATION_MAILBOX_MESSAGE_ID_CB_CONNECTED:
 					/* Format the Advertising Data to say that LE is not  */
 					/* supported so that the MSP430 Exp Data Collector    */
@@ -2241,19 +8126,51 @@ void ApplicationMain(void) {
 					FormatAdvertisingData(ApplicationStateInfo.BluetoothStackID,
 							FALSE);
 
-					/* Set stack to be non-discoverable/non-connectable as*/
-					/* we do only allow 1 BR/EDR Connection.              */
-					GAP_Set_Discoverability_Mode(
-							ApplicationStateInfo.BluetoothStackID,
-							dmNonDiscoverableMode, 0);
-					GAP_Set_Connectability_Mode(
+					/* Find the HCI handle of the link and start the sniff*/
+					/* mode accounting for it.                            */
+					BTPS_MemInitialize(&SniffInfo, 0, sizeof(SniffInfo));
+
+					GAP_Query_Connection_Handle(
 							ApplicationStateInfo.BluetoothStackID,
-							cmNonConnectableMode);
+							ApplicationStateInfo.CBConnectionInfo.BD_ADDR,
+							&(SniffInfo.ConnectionHandle));
+
+					SniffInfo.ModeStartTick = BTPS_GetTickCount();
+
+					/* Use the fastest packet types the link allows.      */
+					StartLinkPacketSelection();
 
 					/* Set the BR/EDR Connection Flag.                    */
 					ApplicationStateInfo.Flags |=
 							APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED;
 
+					/* Limit the retransmissions in real-time mode (this  */
+					/* needs the connection flag set).                    */
+					if (ApplicationSettings.RealTimeDeadline)
+						ApplyRealTimeMode();
+
+					/* Stop being discoverable/connectable unless an      */
+					/* additional SPP port is still free.                 */
+					UpdateSPPConnectability();
+
+					/* Tell the remote the state of the wired port.       */
+					ApplicationStateInfo.SPPLocalPortStatus = 0;
+					UpdateLocalPortStatus();
+
+					/* Allow the host to send SPP data frames.            */
+					UpdateUARTFrameCredits();
+
+					/* Read the UART data that was left waiting for a     */
+					/* device to connect.                                 */
+					if (!UARTFramingInfo.Enabled)
+						PostApplicationMailbox(
+								APPLICATION_MAILBOX_MESSAGE_ID_UART_READ);
+
+					/* Start the generator if a test is running.          */
+					if (SPPTestInfo.Mode == SPP_TEST_MODE_GENERATE)
+						PostApplicationMailbox(
+								APPLICATION_MAILBOX_MESSAGE_ID_SPP_BUFFER_EMPTY);
+
 					/* Set the BR/EDR LED.                                */
 					HAL_SetLED(0, 1);
 					break;
@@ -2265,13 +8182,16 @@ void ApplicationMain(void) {
 					FormatAdvertisingData(ApplicationStateInfo.BluetoothStackID,
 							TRUE);
 
-					/* Set the stack to be connectable and discoverable.  */
-					GAP_Set_Discoverability_Mode(
-							ApplicationStateInfo.BluetoothStackID,
-							dmGeneralDiscoverableMode, 0);
-					GAP_Set_Connectability_Mode(
-							ApplicationStateInfo.BluetoothStackID,
-							cmConnectableMode);
+					/* Report the time the link spent in each mode.       */
+					UpdateSniffTime();
+
+					Display(
+							("BR/EDR link active %lu ms, sniff %lu ms.\r\n", SniffInfo.ActiveTime, SniffInfo.SniffTime));
+
+					if (ApplicationStateInfo.Flags
+							& APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED)
+						LinkInfo.LevelTime[LinkInfo.Level] += BTPS_GetTickCount()
+								- LinkInfo.LevelStartTick;
 
 					/* Clear the BR/EDR Connection Information.           */
 					BTPS_MemInitialize(&(ApplicationStateInfo.CBConnectionInfo),
@@ -2281,18 +8201,75 @@ void ApplicationMain(void) {
 					/* Full Flag.                                         */
 					ApplicationStateInfo.Flags &=
 							~(APPLICATION_STATE_INFO_FLAGS_CB_CONNECTED
-									| APPLICATION_STATE_INFO_FLAGS_SPP_BUFFER_FULL);
+									| APPLICATION_STATE_INFO_FLAGS_SPP_BUFFER_FULL
+									| APPLICATION_STATE_INFO_FLAGS_REMOTE_FLOW_STOPPED
+									| APPLICATION_STATE_INFO_FLAGS_SPP_DATA_PENDING
+									| APPLICATION_STATE_INFO_SNIFF_MODE_ACTIVE);
+
+					/* Set the stack to be connectable and discoverable.  */
+					UpdateSPPConnectability();
 
 					/* Since we are disconnected we will discard any SPP  */
 					/* data that was queued for transmission to the       */
 					/* device.                                            */
 					ApplicationStateInfo.SPPBufferLength = 0;
+					ApplicationStateInfo.SPPReceiveBufferLength = 0;
+
+					/* Pick up a change of the buffer profile if no other */
+					/* SPP port is connected.                             */
+					UpdateSPPQueuingParameters();
+
+					/* Release any hold placed on the wired host.         */
+					UpdateWiredFlowHold();
 
 					/* Clear the BR/EDR LED.                              */
 					HAL_SetLED(0, 0);
 					break;
 				case APPLICATION_MAILBOX_MESSAGE_ID_UART_READ:
-					ProcessSendSPPData(TRUE);
+					/* When framed all received frames are decoded first  */
+					/* (SPP and LE data is queued in the SPP Buffer and   */
+					/* the serial service buffer), otherwise the raw data */
+					/* is sent as the bridge policy selects.              */
+					if (UARTFramingInfo.Enabled) {
+						ProcessUARTFrames();
+						ProcessSendSPPData(FALSE);
+						ProcessSPPPorts();
+						ProcessSendLEData(FALSE);
+					} else {
+						if (ControlInfo.CommandMode)
+							ProcessControlInput();
+						else
+							ProcessBridgeData();
+					}
+					break;
+				case APPLICATION_MAILBOX_MESSAGE_ID_LE_WRITE_READY:
+					/* Send any UART data that is waiting for the LE      */
+					/* device and grant the host credits for the space    */
+					/* that is now free.                                  */
+					SerialServiceInfo.WriteReadyPending = FALSE;
+
+					if (UARTFramingInfo.Enabled)
+						ProcessSendLEData(FALSE);
+					else
+						ProcessBridgeData();
+
+					UpdateUARTFrameCredits();
+					break;
+				case APPLICATION_MAILBOX_MESSAGE_ID_SPP_DATA:
+				case APPLICATION_MAILBOX_MESSAGE_ID_UART_WRITE_READY:
+					/* Move any received SPP data to the UART.            */
+					ProcessReceiveSPPData();
+
+					if (UARTFramingInfo.Enabled)
+						ProcessSPPPorts();
+					break;
+				case APPLICATION_MAILBOX_MESSAGE_ID_SPP_PORT_EVENT:
+					/* An additional SPP port has connected, disconnected */
+					/* or has data or space, stay connectable while a     */
+					/* port is free and move the data of all the ports.   */
+					UpdateSPPConnectability();
+					UpdateSPPQueuingParameters();
+					ProcessSPPPorts();
 					break;
 				}
 			} else {